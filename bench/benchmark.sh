@@ -0,0 +1,89 @@
+#!/bin/sh
+
+# Validates a synthetic repository offline, and reports the throughput, memory
+# usage and per-phase timing of the validation.
+#
+#   $ ./benchmark.sh GENERATOR FORT DIR [GENERATOR_ARGS...]
+#
+# GENERATOR is the path to the repo_generator binary, FORT is the path to the
+# fort binary, and DIR is the directory where the repository will be created.
+# GENERATOR_ARGS are handed to the generator (eg. "--cas=1000 --roas=20").
+#
+# Generating the keys is slow, so the repository is reused by later runs that
+# request the same GENERATOR_ARGS.
+
+if [ $# -lt 3 ]; then
+  echo "Usage: $0 GENERATOR FORT DIR [GENERATOR_ARGS...]" >&2
+  exit 1
+fi
+
+GENERATOR="$1"
+FORT="$2"
+DIR="$3"
+shift 3
+
+if ! [ -f "$DIR/args" ] || [ "$(cat "$DIR/args")" != "$*" ]; then
+  rm -rf "$DIR"
+  mkdir -p "$DIR" || exit 1
+  echo "Generating repository..."
+  "$GENERATOR" "$@" "$DIR" || exit 1
+  echo "$*" > "$DIR/args"
+  echo
+fi
+
+echo "Validating..."
+"$FORT" --mode=standalone \
+  --work-offline \
+  --tal="$DIR/tal" \
+  --local-repository="$DIR/repo" \
+  --output.roa="$DIR/vrps.csv" \
+  --output.profile="$DIR/profile.json" \
+  --log.level=error \
+  || exit 1
+echo
+
+# The report has one member per line at the top level; the phases are
+# { "name": { "seconds": S, "count": C }, ... }
+awk '
+/^  "duration": / {
+  gsub(/[^0-9.]/, "", $2); duration = $2;
+}
+/^  "max-rss": / {
+  gsub(/[^0-9]/, "", $2); rss = $2;
+}
+/^  "phases": / {
+  line = $0;
+  sub(/^  "phases": \{ */, "", line);
+  n = split(line, entries, /\}, */);
+  for (i = 1; i <= n; i++) {
+    if (!match(entries[i], /"[a-z-]+"/))
+      continue;
+    name = substr(entries[i], RSTART + 1, RLENGTH - 2);
+    split(entries[i], fields, /[:,] */);
+    seconds = fields[3] + 0;
+    count = fields[5] + 0;
+    phase_names[++phases] = name;
+    phase_seconds[name] = seconds;
+    phase_count[name] = count;
+    if (name ~ /^(certificate|manifest|crl|roa|ghostbusters)$/)
+      objects += count;
+  }
+}
+END {
+  printf("Validation time: %.3f seconds\n", duration);
+  printf("Objects validated: %d\n", objects);
+  if (duration > 0)
+    printf("Objects/second: %.1f\n", objects / duration);
+  printf("Peak RSS: %.1f MiB\n", rss / 1024);
+  printf("\n%-20s %13s %10s\n", "Phase", "Seconds", "Count");
+  for (i = 1; i <= phases; i++) {
+    name = phase_names[i];
+    printf("%-20s %13.6f %10d\n", name, phase_seconds[name],
+        phase_count[name]);
+  }
+}
+' "$DIR/profile.json"
+
+echo
+echo "VRPs: $(($(wc -l < "$DIR/vrps.csv") - 1))"
+echo "Full report: $DIR/profile.json"
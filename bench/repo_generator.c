@@ -0,0 +1,1451 @@
+/*
+ * Synthetic RPKI repository generator.
+ *
+ * Creates a tree of real (signed) RPKI objects: a TA, the requested amount of
+ * CAs (spread across the requested depth), and a CRL, a manifest and some ROAs
+ * per CA. The files are stored with the layout of Fort's local repository, so
+ * that they can be validated offline (--work-offline), and a TAL pointing to
+ * the TA is created as well.
+ *
+ * Only meant for benchmarking; the keys aren't stored anywhere.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <openssl/asn1t.h>
+#include <openssl/cms.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/objects.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+
+#define OID_CP_IPADDR_ASNUMBER	"1.3.6.1.5.5.7.14.2"
+#define OID_CT_MANIFEST		"1.2.840.113549.1.9.16.1.26"
+#define OID_CT_ROA		"1.2.840.113549.1.9.16.1.24"
+#define OID_AD_CA_REPOSITORY	"1.3.6.1.5.5.7.48.5"
+#define OID_AD_RPKI_MANIFEST	"1.3.6.1.5.5.7.48.10"
+#define OID_AD_SIGNED_OBJECT	"1.3.6.1.5.5.7.48.11"
+
+#define RSA_BITS		2048
+/* Validity of the certificates */
+#define CERT_DAYS		365
+/* Validity of the CRLs, manifests and their EE certificates */
+#define LIST_DAYS		7
+/* Serials of the revoked certificates (never issued) start here */
+#define REVOKED_SERIAL_BASE	1000000000L
+#define FIRST_ASN		64496
+
+/* RFC 6486 */
+typedef struct {
+	ASN1_IA5STRING *file;
+	ASN1_BIT_STRING *hash;
+} FileAndHash;
+
+DEFINE_STACK_OF(FileAndHash)
+
+typedef struct {
+	ASN1_INTEGER *manifestNumber;
+	ASN1_GENERALIZEDTIME *thisUpdate;
+	ASN1_GENERALIZEDTIME *nextUpdate;
+	ASN1_OBJECT *fileHashAlg;
+	STACK_OF(FileAndHash) *fileList;
+} Manifest;
+
+DECLARE_ASN1_FUNCTIONS(FileAndHash)
+DECLARE_ASN1_FUNCTIONS(Manifest)
+
+ASN1_SEQUENCE(FileAndHash) = {
+	ASN1_SIMPLE(FileAndHash, file, ASN1_IA5STRING),
+	ASN1_SIMPLE(FileAndHash, hash, ASN1_BIT_STRING),
+} ASN1_SEQUENCE_END(FileAndHash)
+
+ASN1_SEQUENCE(Manifest) = {
+	ASN1_SIMPLE(Manifest, manifestNumber, ASN1_INTEGER),
+	ASN1_SIMPLE(Manifest, thisUpdate, ASN1_GENERALIZEDTIME),
+	ASN1_SIMPLE(Manifest, nextUpdate, ASN1_GENERALIZEDTIME),
+	ASN1_SIMPLE(Manifest, fileHashAlg, ASN1_OBJECT),
+	ASN1_SEQUENCE_OF(Manifest, fileList, FileAndHash),
+} ASN1_SEQUENCE_END(Manifest)
+
+IMPLEMENT_ASN1_FUNCTIONS(FileAndHash)
+IMPLEMENT_ASN1_FUNCTIONS(Manifest)
+
+/* RFC 6482 */
+typedef struct {
+	ASN1_BIT_STRING *address;
+	ASN1_INTEGER *maxLength;
+} ROAIPAddress;
+
+DEFINE_STACK_OF(ROAIPAddress)
+
+typedef struct {
+	ASN1_OCTET_STRING *addressFamily;
+	STACK_OF(ROAIPAddress) *addresses;
+} ROAIPAddressFamily;
+
+DEFINE_STACK_OF(ROAIPAddressFamily)
+
+typedef struct {
+	ASN1_INTEGER *asID;
+	STACK_OF(ROAIPAddressFamily) *ipAddrBlocks;
+} RouteOriginAttestation;
+
+DECLARE_ASN1_FUNCTIONS(ROAIPAddress)
+DECLARE_ASN1_FUNCTIONS(ROAIPAddressFamily)
+DECLARE_ASN1_FUNCTIONS(RouteOriginAttestation)
+
+ASN1_SEQUENCE(ROAIPAddress) = {
+	ASN1_SIMPLE(ROAIPAddress, address, ASN1_BIT_STRING),
+	ASN1_OPT(ROAIPAddress, maxLength, ASN1_INTEGER),
+} ASN1_SEQUENCE_END(ROAIPAddress)
+
+ASN1_SEQUENCE(ROAIPAddressFamily) = {
+	ASN1_SIMPLE(ROAIPAddressFamily, addressFamily, ASN1_OCTET_STRING),
+	ASN1_SEQUENCE_OF(ROAIPAddressFamily, addresses, ROAIPAddress),
+} ASN1_SEQUENCE_END(ROAIPAddressFamily)
+
+ASN1_SEQUENCE(RouteOriginAttestation) = {
+	ASN1_SIMPLE(RouteOriginAttestation, asID, ASN1_INTEGER),
+	ASN1_SEQUENCE_OF(RouteOriginAttestation, ipAddrBlocks,
+	    ROAIPAddressFamily),
+} ASN1_SEQUENCE_END(RouteOriginAttestation)
+
+IMPLEMENT_ASN1_FUNCTIONS(ROAIPAddress)
+IMPLEMENT_ASN1_FUNCTIONS(ROAIPAddressFamily)
+IMPLEMENT_ASN1_FUNCTIONS(RouteOriginAttestation)
+
+struct args {
+	unsigned int cas;
+	unsigned int depth;
+	unsigned int roas;
+	unsigned int crl_entries;
+	unsigned int ee_keys;
+	char const *host;
+	char const *output;
+};
+
+/* An IP prefix; a @len of -1 means "none" (the address space ran out) */
+struct prefix {
+	unsigned char addr[16];
+	int len;
+};
+
+/* A file of a publication point, as listed by its manifest */
+struct mft_entry {
+	char *name;
+	unsigned char hash[32];
+};
+
+struct ca {
+	unsigned int id;
+	char *name;
+	EVP_PKEY *key;
+	X509 *cert;
+	/* Serial number of the next certificate this CA issues */
+	long next_serial;
+
+	struct prefix v4;
+	struct prefix v6;
+
+	char *cert_uri;
+	char *repo_uri;
+	char *crl_uri;
+	char *mft_uri;
+
+	struct mft_entry *files;
+	unsigned int file_count;
+	unsigned int file_capacity;
+};
+
+static struct args args = {
+	.cas = 100,
+	.depth = 2,
+	.roas = 10,
+	.crl_entries = 0,
+	.ee_keys = 16,
+	.host = "rpki.bench.invalid",
+	.output = NULL,
+};
+
+static time_t now;
+static EVP_PKEY **ee_keys;
+static unsigned int ee_key_next;
+
+/* Statistics */
+static unsigned long total_files;
+static unsigned long total_roas;
+static unsigned long total_vrps;
+static unsigned long total_keys;
+
+static void
+print_usage(char const *program)
+{
+	fprintf(stderr, "Usage: %s [options] <output directory>\n", program);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "  --cas=<n>          CAs below the TA (default %u)\n",
+	    args.cas);
+	fprintf(stderr, "  --depth=<n>        Levels of CAs below the TA (default %u)\n",
+	    args.depth);
+	fprintf(stderr, "  --roas=<n>         ROAs per CA (default %u)\n",
+	    args.roas);
+	fprintf(stderr, "  --crl-entries=<n>  Revoked serials per CRL (default %u)\n",
+	    args.crl_entries);
+	fprintf(stderr, "  --ee-keys=<n>      Key pairs shared by the EE certificates, 0 for one per\n");
+	fprintf(stderr, "                     certificate (default %u)\n",
+	    args.ee_keys);
+	fprintf(stderr, "  --host=<name>      Host of the rsync URIs (default %s)\n",
+	    args.host);
+}
+
+static int
+parse_uint(char const *name, char const *str, unsigned int *result)
+{
+	unsigned long value;
+	char *end;
+
+	errno = 0;
+	value = strtoul(str, &end, 10);
+	if (errno || *end != '\0' || end == str || value > UINT_MAX) {
+		fprintf(stderr, "Invalid --%s: '%s'\n", name, str);
+		return -EINVAL;
+	}
+
+	*result = value;
+	return 0;
+}
+
+static int
+parse_args(int argc, char **argv)
+{
+	static struct option const options[] = {
+		{ "cas", required_argument, NULL, 'c' },
+		{ "depth", required_argument, NULL, 'd' },
+		{ "roas", required_argument, NULL, 'r' },
+		{ "crl-entries", required_argument, NULL, 'l' },
+		{ "ee-keys", required_argument, NULL, 'k' },
+		{ "host", required_argument, NULL, 'H' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	int opt;
+	int error;
+
+	while ((opt = getopt_long(argc, argv, "h", options, NULL)) != -1) {
+		switch (opt) {
+		case 'c':
+			error = parse_uint("cas", optarg, &args.cas);
+			break;
+		case 'd':
+			error = parse_uint("depth", optarg, &args.depth);
+			break;
+		case 'r':
+			error = parse_uint("roas", optarg, &args.roas);
+			break;
+		case 'l':
+			error = parse_uint("crl-entries", optarg,
+			    &args.crl_entries);
+			break;
+		case 'k':
+			error = parse_uint("ee-keys", optarg, &args.ee_keys);
+			break;
+		case 'H':
+			args.host = optarg;
+			error = 0;
+			break;
+		default:
+			print_usage(argv[0]);
+			return -EINVAL;
+		}
+		if (error)
+			return error;
+	}
+
+	if (optind != argc - 1) {
+		print_usage(argv[0]);
+		return -EINVAL;
+	}
+	args.output = argv[optind];
+
+	if (args.depth == 0 && args.cas > 0) {
+		fprintf(stderr, "--depth must be positive if there are CAs.\n");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void
+print_openssl_error(char const *what)
+{
+	fprintf(stderr, "%s failed:\n", what);
+	ERR_print_errors_fp(stderr);
+}
+
+static char *
+str_printf(char const *format, ...)
+{
+	va_list ap;
+	char *result;
+	int len;
+
+	va_start(ap, format);
+	len = vasprintf(&result, format, ap);
+	va_end(ap);
+
+	if (len < 0) {
+		fprintf(stderr, "Out of memory.\n");
+		return NULL;
+	}
+	return result;
+}
+
+/* Returns the local path where the object at rsync @uri has to be stored. */
+static char *
+uri2path(char const *uri)
+{
+	return str_printf("%s/repo/%s", args.output, uri + strlen("rsync://"));
+}
+
+/* Creates the missing parent directories of @path. */
+static int
+mkdir_parents(char const *path)
+{
+	char *copy, *slash;
+	int error;
+
+	copy = strdup(path);
+	if (copy == NULL)
+		return -ENOMEM;
+
+	error = 0;
+	for (slash = strchr(copy + 1, '/'); slash != NULL;
+	    slash = strchr(slash + 1, '/')) {
+		*slash = '\0';
+		if (mkdir(copy, 0755) != 0 && errno != EEXIST) {
+			error = -errno;
+			fprintf(stderr, "Cannot create directory '%s': %s\n",
+			    copy, strerror(errno));
+			break;
+		}
+		*slash = '/';
+	}
+
+	free(copy);
+	return error;
+}
+
+static int
+write_file(char const *path, unsigned char const *content, size_t size)
+{
+	FILE *file;
+	int error;
+
+	error = mkdir_parents(path);
+	if (error)
+		return error;
+
+	file = fopen(path, "wb");
+	if (file == NULL) {
+		error = -errno;
+		fprintf(stderr, "Cannot open '%s': %s\n", path, strerror(errno));
+		return error;
+	}
+
+	if (fwrite(content, 1, size, file) != size) {
+		error = -EIO;
+		fprintf(stderr, "Cannot write '%s'.\n", path);
+	}
+
+	fclose(file);
+	total_files++;
+	return error;
+}
+
+/*
+ * Stores @content (the DER encoding of an object published at rsync @uri)
+ * and, if @ca isn't NULL, lists it at the @ca's manifest.
+ */
+static int
+publish(struct ca *ca, char const *uri, unsigned char const *content,
+    size_t size)
+{
+	struct mft_entry *entry;
+	char *path;
+	int error;
+
+	path = uri2path(uri);
+	if (path == NULL)
+		return -ENOMEM;
+	error = write_file(path, content, size);
+	free(path);
+	if (error || ca == NULL)
+		return error;
+
+	if (ca->file_count == ca->file_capacity) {
+		ca->file_capacity = (ca->file_capacity == 0)
+		    ? 16
+		    : (2 * ca->file_capacity);
+		entry = realloc(ca->files,
+		    ca->file_capacity * sizeof(struct mft_entry));
+		if (entry == NULL)
+			return -ENOMEM;
+		ca->files = entry;
+	}
+
+	entry = &ca->files[ca->file_count];
+	entry->name = strdup(strrchr(uri, '/') + 1);
+	if (entry->name == NULL)
+		return -ENOMEM;
+	if (!EVP_Digest(content, size, entry->hash, NULL, EVP_sha256(),
+	    NULL)) {
+		free(entry->name);
+		print_openssl_error("EVP_Digest()");
+		return -EINVAL;
+	}
+
+	ca->file_count++;
+	return 0;
+}
+
+static EVP_PKEY *
+generate_key(void)
+{
+	EVP_PKEY_CTX *ctx;
+	EVP_PKEY *key;
+
+	key = NULL;
+	ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+	if (ctx == NULL)
+		goto fail;
+	if (EVP_PKEY_keygen_init(ctx) <= 0)
+		goto fail;
+	if (EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, RSA_BITS) <= 0)
+		goto fail;
+	if (EVP_PKEY_keygen(ctx, &key) <= 0)
+		goto fail;
+
+	EVP_PKEY_CTX_free(ctx);
+	total_keys++;
+	return key;
+
+fail:
+	print_openssl_error("RSA key generation");
+	EVP_PKEY_CTX_free(ctx);
+	return NULL;
+}
+
+/* Returns a key for an EE certificate; release it with ee_key_put(). */
+static EVP_PKEY *
+ee_key_get(void)
+{
+	EVP_PKEY **slot;
+
+	if (args.ee_keys == 0)
+		return generate_key();
+
+	slot = &ee_keys[ee_key_next];
+	ee_key_next = (ee_key_next + 1) % args.ee_keys;
+	if (*slot == NULL)
+		*slot = generate_key();
+	return *slot;
+}
+
+static void
+ee_key_put(EVP_PKEY *key)
+{
+	if (args.ee_keys == 0)
+		EVP_PKEY_free(key);
+}
+
+static int
+add_ext(X509 *cert, X509V3_CTX *ctx, int nid, char const *value)
+{
+	X509_EXTENSION *ext;
+
+	ext = X509V3_EXT_conf_nid(NULL, ctx, nid, (char *) value);
+	if (ext == NULL) {
+		fprintf(stderr, "Cannot create extension %s = '%s'.\n",
+		    OBJ_nid2sn(nid), value);
+		ERR_print_errors_fp(stderr);
+		return -EINVAL;
+	}
+
+	if (!X509_add_ext(cert, ext, -1)) {
+		X509_EXTENSION_free(ext);
+		print_openssl_error("X509_add_ext()");
+		return -EINVAL;
+	}
+
+	X509_EXTENSION_free(ext);
+	return 0;
+}
+
+/*
+ * X509V3_EXT_conf_nid() needs a configuration database to build policies, so
+ * this one is built by hand.
+ */
+static int
+add_policy(X509 *cert)
+{
+	CERTIFICATEPOLICIES *policies;
+	POLICYINFO *policy;
+	int error;
+
+	policies = sk_POLICYINFO_new_null();
+	if (policies == NULL)
+		return -ENOMEM;
+
+	error = -ENOMEM;
+	policy = POLICYINFO_new();
+	if (policy == NULL)
+		goto end;
+	ASN1_OBJECT_free(policy->policyid);
+	policy->policyid = OBJ_txt2obj(OID_CP_IPADDR_ASNUMBER, 1);
+	if (policy->policyid == NULL || !sk_POLICYINFO_push(policies, policy)) {
+		POLICYINFO_free(policy);
+		goto end;
+	}
+
+	error = 0;
+	if (!X509_add1_ext_i2d(cert, NID_certificate_policies, policies, 1,
+	    X509V3_ADD_APPEND)) {
+		print_openssl_error("X509_add1_ext_i2d()");
+		error = -EINVAL;
+	}
+
+end:
+	CERTIFICATEPOLICIES_free(policies);
+	return error;
+}
+
+static int
+prefix2str(int family, struct prefix const *prefix, char *buf, size_t size)
+{
+	char addr[INET6_ADDRSTRLEN];
+
+	if (inet_ntop(family, prefix->addr, addr, sizeof(addr)) == NULL)
+		return -errno;
+	snprintf(buf, size, "%s/%d", addr, prefix->len);
+	return 0;
+}
+
+/*
+ * Returns the OpenSSL configuration value of the IP resources extension
+ * listing @v4 and @v6. Both of them can be missing, but not at the same time.
+ */
+static char *
+ip_resources(struct prefix const *v4, struct prefix const *v6)
+{
+	char buf4[INET6_ADDRSTRLEN + 4];
+	char buf6[INET6_ADDRSTRLEN + 4];
+
+	if (v4->len >= 0 && prefix2str(AF_INET, v4, buf4, sizeof(buf4)))
+		return NULL;
+	if (v6->len >= 0 && prefix2str(AF_INET6, v6, buf6, sizeof(buf6)))
+		return NULL;
+
+	if (v4->len < 0)
+		return str_printf("critical,IPv6:%s", buf6);
+	if (v6->len < 0)
+		return str_printf("critical,IPv4:%s", buf4);
+	return str_printf("critical,IPv4:%s,IPv6:%s", buf4, buf6);
+}
+
+struct cert_args {
+	/* NULL if self-signed */
+	struct ca *issuer;
+	EVP_PKEY *key;
+	char const *subject;
+	time_t not_after;
+	/* CA certificates only */
+	struct ca *ca;
+	/* EE certificates only */
+	char const *signed_object;
+	/* Value of the IP resources extension (NULL means inherit) */
+	char const *ip;
+	/* Value of the AS resources extension (NULL means none) */
+	char const *as;
+};
+
+static X509 *
+create_cert(struct cert_args const *cargs)
+{
+	X509 *cert;
+	X509_NAME *name;
+	X509 *issuer_cert;
+	EVP_PKEY *issuer_key;
+	X509V3_CTX ctx;
+	time_t not_after;
+	char *value;
+	int error;
+
+	cert = X509_new();
+	if (cert == NULL)
+		goto enomem;
+
+	name = X509_NAME_new();
+	if (name == NULL)
+		goto enomem_cert;
+	if (!X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+	    (unsigned char const *) cargs->subject, -1, -1, 0)) {
+		X509_NAME_free(name);
+		goto openssl_fail;
+	}
+
+	if (cargs->issuer != NULL) {
+		issuer_cert = cargs->issuer->cert;
+		issuer_key = cargs->issuer->key;
+		if (!X509_set_issuer_name(cert,
+		    X509_get_subject_name(issuer_cert))) {
+			X509_NAME_free(name);
+			goto openssl_fail;
+		}
+	} else {
+		issuer_cert = cert;
+		issuer_key = cargs->key;
+		if (!X509_set_issuer_name(cert, name)) {
+			X509_NAME_free(name);
+			goto openssl_fail;
+		}
+	}
+
+	if (!X509_set_subject_name(cert, name)) {
+		X509_NAME_free(name);
+		goto openssl_fail;
+	}
+	X509_NAME_free(name);
+
+	if (!X509_set_version(cert, 2))
+		goto openssl_fail;
+	if (!ASN1_INTEGER_set(X509_get_serialNumber(cert),
+	    (cargs->issuer != NULL) ? cargs->issuer->next_serial++ : 1))
+		goto openssl_fail;
+	if (!X509_time_adj_ex(X509_getm_notBefore(cert), 0, -3600, &now))
+		goto openssl_fail;
+	not_after = cargs->not_after;
+	if (!X509_time_adj_ex(X509_getm_notAfter(cert), 0, 0, &not_after))
+		goto openssl_fail;
+	if (!X509_set_pubkey(cert, cargs->key))
+		goto openssl_fail;
+
+	X509V3_set_ctx(&ctx, issuer_cert, cert, NULL, NULL, 0);
+
+	if (cargs->ca != NULL) {
+		if (add_ext(cert, &ctx, NID_basic_constraints, "critical,CA:TRUE"))
+			goto fail;
+	}
+	if (add_ext(cert, &ctx, NID_subject_key_identifier, "hash"))
+		goto fail;
+	if (cargs->issuer != NULL) {
+		if (add_ext(cert, &ctx, NID_authority_key_identifier,
+		    "keyid:always"))
+			goto fail;
+	}
+	if (add_ext(cert, &ctx, NID_key_usage, (cargs->ca != NULL)
+	    ? "critical,keyCertSign,cRLSign"
+	    : "critical,digitalSignature"))
+		goto fail;
+
+	if (cargs->issuer != NULL) {
+		value = str_printf("URI:%s", cargs->issuer->crl_uri);
+		if (value == NULL)
+			goto enomem_cert;
+		error = add_ext(cert, &ctx, NID_crl_distribution_points,
+		    value);
+		free(value);
+		if (error)
+			goto fail;
+
+		value = str_printf("caIssuers;URI:%s",
+		    cargs->issuer->cert_uri);
+		if (value == NULL)
+			goto enomem_cert;
+		error = add_ext(cert, &ctx, NID_info_access, value);
+		free(value);
+		if (error)
+			goto fail;
+	}
+
+	value = (cargs->ca != NULL)
+	    ? str_printf(OID_AD_CA_REPOSITORY ";URI:%s,"
+	        OID_AD_RPKI_MANIFEST ";URI:%s",
+	        cargs->ca->repo_uri, cargs->ca->mft_uri)
+	    : str_printf(OID_AD_SIGNED_OBJECT ";URI:%s",
+	        cargs->signed_object);
+	if (value == NULL)
+		goto enomem_cert;
+	error = add_ext(cert, &ctx, NID_sinfo_access, value);
+	free(value);
+	if (error)
+		goto fail;
+
+	if (add_policy(cert))
+		goto fail;
+	if (add_ext(cert, &ctx, NID_sbgp_ipAddrBlock, (cargs->ip != NULL)
+	    ? cargs->ip
+	    : "critical,IPv4:inherit,IPv6:inherit"))
+		goto fail;
+	if (cargs->as != NULL &&
+	    add_ext(cert, &ctx, NID_sbgp_autonomousSysNum, cargs->as))
+		goto fail;
+
+	if (!X509_sign(cert, issuer_key, EVP_sha256()))
+		goto openssl_fail;
+
+	return cert;
+
+openssl_fail:
+	print_openssl_error("Certificate creation");
+fail:
+	X509_free(cert);
+	return NULL;
+enomem_cert:
+	X509_free(cert);
+enomem:
+	fprintf(stderr, "Out of memory.\n");
+	return NULL;
+}
+
+static int
+publish_cert(struct ca *issuer, char const *uri, X509 *cert)
+{
+	unsigned char *der;
+	int len;
+	int error;
+
+	der = NULL;
+	len = i2d_X509(cert, &der);
+	if (len <= 0) {
+		print_openssl_error("i2d_X509()");
+		return -EINVAL;
+	}
+
+	error = publish(issuer, uri, der, len);
+	OPENSSL_free(der);
+	return error;
+}
+
+/* Sets the @len most significant bits of @addr after the first @offset bits */
+static void
+set_bits(unsigned char *addr, int offset, int len, unsigned long value)
+{
+	int i, bit;
+
+	for (i = 0; i < len; i++) {
+		bit = offset + i;
+		if ((value >> (len - 1 - i)) & 1)
+			addr[bit / 8] |= 0x80 >> (bit % 8);
+		else
+			addr[bit / 8] &= ~(0x80 >> (bit % 8));
+	}
+}
+
+/*
+ * Computes the @index'th subprefix (out of 2^@bits) of @parent. The result is
+ * "none" if it doesn't fit in @max_len bits.
+ */
+static void
+subprefix(struct prefix const *parent, unsigned int index, int bits,
+    int max_len, struct prefix *result)
+{
+	*result = *parent;
+	if (parent->len < 0 || parent->len + bits > max_len) {
+		result->len = -1;
+		return;
+	}
+
+	set_bits(result->addr, parent->len, bits, index);
+	result->len = parent->len + bits;
+}
+
+/* Bits needed to enumerate @n different values */
+static int
+bits_for(unsigned int n)
+{
+	int bits;
+
+	for (bits = 0; n > (1u << bits); bits++)
+		;
+	return bits;
+}
+
+static struct ca *
+ca_create(unsigned int id, struct ca *parent)
+{
+	struct ca *ca;
+
+	ca = calloc(1, sizeof(struct ca));
+	if (ca == NULL)
+		goto enomem;
+
+	ca->id = id;
+	ca->next_serial = 1;
+	ca->name = (parent == NULL) ? strdup("ta") : str_printf("ca%u", id);
+	if (ca->name == NULL)
+		goto enomem_ca;
+
+	ca->cert_uri = (parent == NULL)
+	    ? str_printf("rsync://%s/ta/ta.cer", args.host)
+	    : str_printf("%s%s.cer", parent->repo_uri, ca->name);
+	ca->repo_uri = str_printf("rsync://%s/repo/%s/", args.host, ca->name);
+	ca->crl_uri = str_printf("%s%s.crl", ca->repo_uri, ca->name);
+	ca->mft_uri = str_printf("%s%s.mft", ca->repo_uri, ca->name);
+	if (ca->cert_uri == NULL || ca->repo_uri == NULL ||
+	    ca->crl_uri == NULL || ca->mft_uri == NULL)
+		goto enomem_ca;
+
+	ca->key = generate_key();
+	if (ca->key == NULL)
+		goto fail;
+
+	return ca;
+
+enomem_ca:
+	fprintf(stderr, "Out of memory.\n");
+fail:
+	free(ca->name);
+	free(ca->cert_uri);
+	free(ca->repo_uri);
+	free(ca->crl_uri);
+	free(ca->mft_uri);
+	free(ca);
+	return NULL;
+enomem:
+	fprintf(stderr, "Out of memory.\n");
+	return NULL;
+}
+
+static void
+ca_destroy(struct ca *ca)
+{
+	unsigned int i;
+
+	for (i = 0; i < ca->file_count; i++)
+		free(ca->files[i].name);
+	free(ca->files);
+	free(ca->name);
+	free(ca->cert_uri);
+	free(ca->repo_uri);
+	free(ca->crl_uri);
+	free(ca->mft_uri);
+	X509_free(ca->cert);
+	EVP_PKEY_free(ca->key);
+	free(ca);
+}
+
+/* Issues and publishes the certificate of @ca, signed by @issuer. */
+static int
+ca_certify(struct ca *ca, struct ca *issuer)
+{
+	struct cert_args cargs;
+	char *ip;
+	char subject[32];
+
+	ip = ip_resources(&ca->v4, &ca->v6);
+	if (ip == NULL)
+		return -ENOMEM;
+
+	snprintf(subject, sizeof(subject), "bench-%s", ca->name);
+	memset(&cargs, 0, sizeof(cargs));
+	cargs.issuer = issuer;
+	cargs.key = ca->key;
+	cargs.subject = subject;
+	cargs.not_after = now + CERT_DAYS * 24 * 3600;
+	cargs.ca = ca;
+	cargs.ip = ip;
+	cargs.as = (issuer == NULL)
+	    ? "critical,AS:0-4294967295"
+	    : "critical,AS:inherit";
+
+	ca->cert = create_cert(&cargs);
+	free(ip);
+	if (ca->cert == NULL)
+		return -EINVAL;
+
+	return publish_cert(issuer, ca->cert_uri, ca->cert);
+}
+
+/*
+ * Wraps @econtent (of type @oid) in a CMS SignedData, signed by a new EE
+ * certificate issued by @ca, and publishes it at @uri. @listed tells whether
+ * the object belongs to the @ca's manifest.
+ */
+static int
+publish_signed_object(struct ca *ca, bool listed, char const *uri,
+    char const *oid, unsigned char *econtent, int econtent_len,
+    char const *ip)
+{
+	static unsigned long ee_count;
+	struct cert_args cargs;
+	char subject[32];
+	EVP_PKEY *key;
+	X509 *ee;
+	ASN1_OBJECT *type;
+	CMS_ContentInfo *cms;
+	BIO *bio;
+	unsigned char *der;
+	int der_len;
+	int error;
+	unsigned int flags;
+
+	key = ee_key_get();
+	if (key == NULL)
+		return -EINVAL;
+
+	snprintf(subject, sizeof(subject), "bench-ee%lu", ++ee_count);
+	memset(&cargs, 0, sizeof(cargs));
+	cargs.issuer = ca;
+	cargs.key = key;
+	cargs.subject = subject;
+	cargs.not_after = now + LIST_DAYS * 24 * 3600;
+	cargs.signed_object = uri;
+	cargs.ip = ip;
+	cargs.as = (ip == NULL) ? "critical,AS:inherit" : NULL;
+
+	error = -EINVAL;
+	ee = create_cert(&cargs);
+	if (ee == NULL)
+		goto release_key;
+
+	flags = CMS_BINARY | CMS_NOSMIMECAP | CMS_USE_KEYID | CMS_PARTIAL;
+	cms = CMS_sign(NULL, NULL, NULL, NULL, flags);
+	if (cms == NULL)
+		goto openssl_fail;
+	type = OBJ_txt2obj(oid, 1);
+	if (type == NULL || !CMS_set1_eContentType(cms, type)) {
+		ASN1_OBJECT_free(type);
+		goto openssl_fail_cms;
+	}
+	ASN1_OBJECT_free(type);
+	if (CMS_add1_signer(cms, ee, key, EVP_sha256(), flags) == NULL)
+		goto openssl_fail_cms;
+
+	bio = BIO_new_mem_buf(econtent, econtent_len);
+	if (bio == NULL)
+		goto openssl_fail_cms;
+	if (!CMS_final(cms, bio, NULL, CMS_BINARY)) {
+		BIO_free(bio);
+		goto openssl_fail_cms;
+	}
+	BIO_free(bio);
+
+	der = NULL;
+	der_len = i2d_CMS_ContentInfo(cms, &der);
+	if (der_len <= 0)
+		goto openssl_fail_cms;
+
+	error = publish(listed ? ca : NULL, uri, der, der_len);
+	OPENSSL_free(der);
+	CMS_ContentInfo_free(cms);
+	X509_free(ee);
+	ee_key_put(key);
+	return error;
+
+openssl_fail_cms:
+	CMS_ContentInfo_free(cms);
+openssl_fail:
+	print_openssl_error("Signed object creation");
+	X509_free(ee);
+release_key:
+	ee_key_put(key);
+	return error;
+}
+
+static ASN1_BIT_STRING *
+prefix2bitstr(struct prefix const *prefix)
+{
+	ASN1_BIT_STRING *bitstr;
+	int bytes;
+
+	bitstr = ASN1_BIT_STRING_new();
+	if (bitstr == NULL)
+		return NULL;
+
+	bytes = (prefix->len + 7) / 8;
+	if (!ASN1_BIT_STRING_set(bitstr, (unsigned char *) prefix->addr,
+	    bytes)) {
+		ASN1_BIT_STRING_free(bitstr);
+		return NULL;
+	}
+	bitstr->flags &= ~0x07;
+	bitstr->flags |= ASN1_STRING_FLAG_BITS_LEFT | (8 * bytes - prefix->len);
+
+	return bitstr;
+}
+
+static int
+roa_add_family(RouteOriginAttestation *roa, unsigned char afi,
+    struct prefix const *prefix)
+{
+	unsigned char family[2] = { 0, afi };
+	ROAIPAddressFamily *block;
+	ROAIPAddress *address;
+
+	block = ROAIPAddressFamily_new();
+	if (block == NULL)
+		return -ENOMEM;
+	if (!ASN1_OCTET_STRING_set(block->addressFamily, family, 2))
+		goto enomem_block;
+
+	address = ROAIPAddress_new();
+	if (address == NULL)
+		goto enomem_block;
+	ASN1_BIT_STRING_free(address->address);
+	address->address = prefix2bitstr(prefix);
+	if (address->address == NULL)
+		goto enomem_address;
+	if (!sk_ROAIPAddress_push(block->addresses, address))
+		goto enomem_address;
+
+	if (!sk_ROAIPAddressFamily_push(roa->ipAddrBlocks, block))
+		goto enomem_block;
+
+	total_vrps++;
+	return 0;
+
+enomem_address:
+	ROAIPAddress_free(address);
+enomem_block:
+	ROAIPAddressFamily_free(block);
+	return -ENOMEM;
+}
+
+/* Issues the @index'th ROA of @ca. */
+static int
+publish_roa(struct ca *ca, unsigned int index)
+{
+	RouteOriginAttestation *roa;
+	struct prefix v4, v6;
+	unsigned char *der;
+	char *uri, *ip;
+	int bits, der_len;
+	int error;
+
+	bits = bits_for(args.roas);
+	subprefix(&ca->v4, index, bits, 32, &v4);
+	subprefix(&ca->v6, index, bits, 128, &v6);
+	if (v4.len < 0 && v6.len < 0)
+		return 0; /* Out of address space */
+
+	roa = RouteOriginAttestation_new();
+	if (roa == NULL)
+		return -ENOMEM;
+
+	error = -ENOMEM;
+	if (!ASN1_INTEGER_set(roa->asID, FIRST_ASN + total_roas % 1000))
+		goto end;
+	if (v4.len >= 0 && roa_add_family(roa, 1, &v4))
+		goto end;
+	if (v6.len >= 0 && roa_add_family(roa, 2, &v6))
+		goto end;
+
+	der = NULL;
+	der_len = i2d_RouteOriginAttestation(roa, &der);
+	if (der_len <= 0) {
+		print_openssl_error("i2d_RouteOriginAttestation()");
+		error = -EINVAL;
+		goto end;
+	}
+
+	uri = str_printf("%sroa%u.roa", ca->repo_uri, index);
+	ip = ip_resources(&v4, &v6);
+	if (uri != NULL && ip != NULL)
+		error = publish_signed_object(ca, true, uri, OID_CT_ROA, der,
+		    der_len, ip);
+	free(uri);
+	free(ip);
+	OPENSSL_free(der);
+	total_roas++;
+
+end:
+	RouteOriginAttestation_free(roa);
+	return error;
+}
+
+static int
+publish_crl(struct ca *ca)
+{
+	X509_CRL *crl;
+	X509_REVOKED *revoked;
+	ASN1_INTEGER *number;
+	ASN1_TIME *time;
+	X509V3_CTX ctx;
+	X509_EXTENSION *ext;
+	unsigned char *der;
+	unsigned int i;
+	time_t next;
+	int der_len;
+	int error;
+
+	crl = X509_CRL_new();
+	if (crl == NULL)
+		return -ENOMEM;
+
+	number = NULL;
+	time = ASN1_TIME_new();
+	if (time == NULL)
+		goto openssl_fail;
+
+	next = now + LIST_DAYS * 24 * 3600;
+	if (!X509_CRL_set_version(crl, 1))
+		goto openssl_fail;
+	if (!X509_CRL_set_issuer_name(crl, X509_get_subject_name(ca->cert)))
+		goto openssl_fail;
+	if (!X509_time_adj_ex(time, 0, -3600, &now) ||
+	    !X509_CRL_set1_lastUpdate(crl, time))
+		goto openssl_fail;
+	if (!X509_time_adj_ex(time, 0, 0, &next) ||
+	    !X509_CRL_set1_nextUpdate(crl, time))
+		goto openssl_fail;
+
+	number = ASN1_INTEGER_new();
+	if (number == NULL)
+		goto openssl_fail;
+
+	for (i = 0; i < args.crl_entries; i++) {
+		revoked = X509_REVOKED_new();
+		if (revoked == NULL)
+			goto openssl_fail;
+		if (!ASN1_INTEGER_set(number, REVOKED_SERIAL_BASE + i) ||
+		    !X509_REVOKED_set_serialNumber(revoked, number) ||
+		    !X509_time_adj_ex(time, 0, -7200, &now) ||
+		    !X509_REVOKED_set_revocationDate(revoked, time) ||
+		    !X509_CRL_add0_revoked(crl, revoked)) {
+			X509_REVOKED_free(revoked);
+			goto openssl_fail;
+		}
+	}
+
+	X509V3_set_ctx(&ctx, ca->cert, NULL, NULL, crl, 0);
+	ext = X509V3_EXT_conf_nid(NULL, &ctx, NID_authority_key_identifier,
+	    "keyid:always");
+	if (ext == NULL)
+		goto openssl_fail;
+	if (!X509_CRL_add_ext(crl, ext, -1)) {
+		X509_EXTENSION_free(ext);
+		goto openssl_fail;
+	}
+	X509_EXTENSION_free(ext);
+
+	if (!ASN1_INTEGER_set(number, 1) ||
+	    !X509_CRL_add1_ext_i2d(crl, NID_crl_number, number, 0, 0))
+		goto openssl_fail;
+
+	if (!X509_CRL_sort(crl) || !X509_CRL_sign(crl, ca->key, EVP_sha256()))
+		goto openssl_fail;
+
+	der = NULL;
+	der_len = i2d_X509_CRL(crl, &der);
+	if (der_len <= 0)
+		goto openssl_fail;
+
+	error = publish(ca, ca->crl_uri, der, der_len);
+	OPENSSL_free(der);
+	ASN1_INTEGER_free(number);
+	ASN1_TIME_free(time);
+	X509_CRL_free(crl);
+	return error;
+
+openssl_fail:
+	print_openssl_error("CRL creation");
+	ASN1_INTEGER_free(number);
+	ASN1_TIME_free(time);
+	X509_CRL_free(crl);
+	return -EINVAL;
+}
+
+static int
+publish_manifest(struct ca *ca)
+{
+	Manifest *mft;
+	FileAndHash *fah;
+	struct mft_entry *entry;
+	unsigned char *der;
+	unsigned int i;
+	int der_len;
+	int error;
+
+	mft = Manifest_new();
+	if (mft == NULL)
+		return -ENOMEM;
+
+	error = -ENOMEM;
+	if (!ASN1_INTEGER_set(mft->manifestNumber, 1))
+		goto end;
+	if (ASN1_GENERALIZEDTIME_adj(mft->thisUpdate, now, 0, -3600) == NULL)
+		goto end;
+	if (ASN1_GENERALIZEDTIME_adj(mft->nextUpdate, now, LIST_DAYS, 0)
+	    == NULL)
+		goto end;
+	ASN1_OBJECT_free(mft->fileHashAlg);
+	mft->fileHashAlg = OBJ_nid2obj(NID_sha256);
+
+	for (i = 0; i < ca->file_count; i++) {
+		entry = &ca->files[i];
+		fah = FileAndHash_new();
+		if (fah == NULL)
+			goto end;
+		if (!ASN1_STRING_set(fah->file, entry->name, -1) ||
+		    !ASN1_BIT_STRING_set(fah->hash, entry->hash,
+		    sizeof(entry->hash)) ||
+		    !sk_FileAndHash_push(mft->fileList, fah)) {
+			FileAndHash_free(fah);
+			goto end;
+		}
+		fah->hash->flags &= ~0x07;
+		fah->hash->flags |= ASN1_STRING_FLAG_BITS_LEFT;
+	}
+
+	der = NULL;
+	der_len = i2d_Manifest(mft, &der);
+	if (der_len <= 0) {
+		print_openssl_error("i2d_Manifest()");
+		error = -EINVAL;
+		goto end;
+	}
+
+	/* The manifest doesn't list itself */
+	error = publish_signed_object(ca, false, ca->mft_uri, OID_CT_MANIFEST,
+	    der, der_len, NULL);
+	OPENSSL_free(der);
+
+end:
+	Manifest_free(mft);
+	return error;
+}
+
+static int
+write_tal(struct ca *ta)
+{
+	unsigned char *der;
+	char *b64, *path;
+	FILE *file;
+	int der_len, b64_len, i;
+	int error;
+
+	der = NULL;
+	der_len = i2d_PUBKEY(ta->key, &der);
+	if (der_len <= 0) {
+		print_openssl_error("i2d_PUBKEY()");
+		return -EINVAL;
+	}
+
+	b64 = malloc(4 * ((der_len + 2) / 3) + 1);
+	if (b64 == NULL) {
+		OPENSSL_free(der);
+		return -ENOMEM;
+	}
+	b64_len = EVP_EncodeBlock((unsigned char *) b64, der, der_len);
+	OPENSSL_free(der);
+
+	path = str_printf("%s/tal/bench.tal", args.output);
+	if (path == NULL) {
+		free(b64);
+		return -ENOMEM;
+	}
+
+	error = mkdir_parents(path);
+	if (error)
+		goto end;
+
+	file = fopen(path, "w");
+	if (file == NULL) {
+		error = -errno;
+		fprintf(stderr, "Cannot open '%s': %s\n", path, strerror(errno));
+		goto end;
+	}
+
+	/* URI, empty line, and the Base64 of the key (64 columns) */
+	fprintf(file, "%s\n\n", ta->cert_uri);
+	for (i = 0; i < b64_len; i += 64)
+		fprintf(file, "%.64s\n", b64 + i);
+	if (fclose(file) != 0) {
+		error = -errno;
+		fprintf(stderr, "Cannot write '%s': %s\n", path,
+		    strerror(errno));
+	}
+
+end:
+	free(path);
+	free(b64);
+	return error;
+}
+
+/* Children per CA so that @cas fit in @depth levels */
+static unsigned int
+compute_fanout(void)
+{
+	unsigned long long total, level;
+	unsigned int fanout, d;
+
+	if (args.cas == 0)
+		return 0;
+
+	for (fanout = 1; fanout < args.cas; fanout++) {
+		total = 0;
+		level = 1;
+		for (d = 0; d < args.depth && total < args.cas; d++) {
+			level *= fanout;
+			total += level;
+		}
+		if (total >= args.cas)
+			break;
+	}
+
+	return fanout;
+}
+
+/*
+ * Creates the tree breadth-first: CA number i (the TA is 0) is the child of CA
+ * number (i - 1) / fanout.
+ */
+static int
+generate(void)
+{
+	struct ca **cas;
+	struct ca *ca, *child;
+	unsigned int fanout, bits;
+	unsigned int i, c, r, first, last;
+	int error;
+
+	fanout = compute_fanout();
+	bits = bits_for(fanout);
+
+	cas = calloc(args.cas + 1, sizeof(struct ca *));
+	if (cas == NULL)
+		return -ENOMEM;
+
+	error = -EINVAL;
+	cas[0] = ca_create(0, NULL);
+	if (cas[0] == NULL)
+		goto end;
+	/* 10.0.0.0/8 and 2001:db8::/32 */
+	cas[0]->v4.addr[0] = 10;
+	cas[0]->v4.len = 8;
+	cas[0]->v6.addr[0] = 0x20;
+	cas[0]->v6.addr[1] = 0x01;
+	cas[0]->v6.addr[2] = 0x0d;
+	cas[0]->v6.addr[3] = 0xb8;
+	cas[0]->v6.len = 32;
+	error = ca_certify(cas[0], NULL);
+	if (error)
+		goto end;
+	error = write_tal(cas[0]);
+	if (error)
+		goto end;
+
+	for (i = 0; i <= args.cas; i++) {
+		ca = cas[i];
+
+		first = i * fanout + 1;
+		last = first + fanout; /* Exclusive */
+		if (first > args.cas)
+			first = last = 0;
+		else if (last > args.cas + 1)
+			last = args.cas + 1;
+
+		for (c = first; c < last; c++) {
+			child = ca_create(c, ca);
+			if (child == NULL) {
+				error = -EINVAL;
+				goto end;
+			}
+			cas[c] = child;
+			subprefix(&ca->v4, c - first, bits, 32, &child->v4);
+			subprefix(&ca->v6, c - first, bits, 128, &child->v6);
+			if (child->v4.len < 0 && child->v6.len < 0) {
+				fprintf(stderr, "The address space ran out; try a smaller depth.\n");
+				error = -EINVAL;
+				goto end;
+			}
+			error = ca_certify(child, ca);
+			if (error)
+				goto end;
+		}
+
+		if (i != 0) {
+			for (r = 0; r < args.roas; r++) {
+				error = publish_roa(ca, r);
+				if (error)
+					goto end;
+			}
+		}
+
+		error = publish_crl(ca);
+		if (error)
+			goto end;
+		error = publish_manifest(ca);
+		if (error)
+			goto end;
+
+		/* Its children no longer need it */
+		ca_destroy(ca);
+		cas[i] = NULL;
+	}
+
+end:
+	for (i = 0; i <= args.cas; i++)
+		if (cas[i] != NULL)
+			ca_destroy(cas[i]);
+	free(cas);
+	return error;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct timespec start, end;
+	unsigned int i;
+	int error;
+
+	error = parse_args(argc, argv);
+	if (error)
+		return -error;
+
+	if (args.ee_keys > 0) {
+		ee_keys = calloc(args.ee_keys, sizeof(EVP_PKEY *));
+		if (ee_keys == NULL) {
+			fprintf(stderr, "Out of memory.\n");
+			return ENOMEM;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	now = time(NULL);
+	error = generate();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	for (i = 0; i < args.ee_keys; i++)
+		EVP_PKEY_free(ee_keys[i]);
+	free(ee_keys);
+
+	if (error)
+		return -error;
+
+	printf("Repository: %s/repo\n", args.output);
+	printf("TAL: %s/tal/bench.tal\n", args.output);
+	printf("CAs: %u (plus the TA)\n", args.cas);
+	printf("ROAs: %lu\n", total_roas);
+	printf("VRPs: %lu\n", total_vrps);
+	printf("Files: %lu\n", total_files);
+	printf("Keys generated: %lu\n", total_keys);
+	printf("Generation time: %.3f seconds\n",
+	    (end.tv_sec - start.tv_sec) +
+	    (end.tv_nsec - start.tv_nsec) / 1000000000.0);
+	return 0;
+}
@@ -0,0 +1,70 @@
+#!/bin/sh
+
+# Starts Fort's RTR server on top of a synthetic repository, loads it with
+# concurrent RTR sessions, and reports the time-to-full-table, Serial Query
+# latency, throughput and server CPU usage.
+#
+#   $ ./rtr_benchmark.sh GENERATOR LOADGEN FORT DIR [LOADGEN_ARGS...]
+#
+# GENERATOR, LOADGEN and FORT are the paths to the repo_generator, rtr_loadgen
+# and fort binaries. DIR is the directory where the repository will be created
+# (or reused, if it already exists). The size of the repository can be tuned
+# through the GENERATOR_ARGS environment variable (eg. "--cas=1000 --roas=20").
+# LOADGEN_ARGS are handed to the load generator (eg. "--clients=400
+# --version=1").
+#
+# The server listens on 127.0.0.1, port $PORT (default 8323).
+
+if [ $# -lt 4 ]; then
+  echo "Usage: $0 GENERATOR LOADGEN FORT DIR [LOADGEN_ARGS...]" >&2
+  exit 1
+fi
+
+GENERATOR="$1"
+LOADGEN="$2"
+FORT="$3"
+DIR="$4"
+shift 4
+PORT="${PORT:-8323}"
+
+if ! [ -f "$DIR/args" ] || [ "$(cat "$DIR/args")" != "$GENERATOR_ARGS" ]; then
+  rm -rf "$DIR"
+  mkdir -p "$DIR" || exit 1
+  echo "Generating repository..."
+  # Word splitting is intended
+  "$GENERATOR" $GENERATOR_ARGS "$DIR" || exit 1
+  echo "$GENERATOR_ARGS" > "$DIR/args"
+  echo
+fi
+
+echo "Starting the server..."
+"$FORT" --mode=server \
+  --work-offline \
+  --tal="$DIR/tal" \
+  --local-repository="$DIR/repo" \
+  --server.address=127.0.0.1 \
+  --server.port="$PORT" \
+  --thread-pool.server.max=500 \
+  --log.level=error \
+  > "$DIR/server.log" 2>&1 &
+SERVER=$!
+trap 'kill $SERVER 2>/dev/null' EXIT INT TERM
+
+# Wait until the first validation cycle is over and the table can be served
+TRIES=0
+until "$LOADGEN" --port="$PORT" --clients=1 --queries=0 > /dev/null 2>&1; do
+  if ! kill -0 $SERVER 2>/dev/null; then
+    echo "The server died; see $DIR/server.log." >&2
+    exit 1
+  fi
+  TRIES=$((TRIES + 1))
+  if [ $TRIES -gt 600 ]; then
+    echo "The server didn't become ready in time." >&2
+    exit 1
+  fi
+  sleep 1
+done
+
+echo "Running the load..."
+echo
+"$LOADGEN" --port="$PORT" --pid=$SERVER "$@"
@@ -0,0 +1,719 @@
+/*
+ * RTR load generator.
+ *
+ * Opens the requested amount of concurrent RTR sessions against a running
+ * server (typically, Fort in server mode). Every session requests the full
+ * table (Reset Query) and then polls for updates (Serial Query) a number of
+ * times. At the end, prints the time-to-full-table and Serial Query latency
+ * distributions, the throughput, and (if the server's PID is known) the CPU
+ * time the server spent serving them.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/* RFC 6810 and RFC 8210 */
+#define PDU_SERIAL_NOTIFY	0
+#define PDU_SERIAL_QUERY	1
+#define PDU_RESET_QUERY		2
+#define PDU_CACHE_RESPONSE	3
+#define PDU_IPV4_PREFIX		4
+#define PDU_IPV6_PREFIX		6
+#define PDU_END_OF_DATA		7
+#define PDU_CACHE_RESET		8
+#define PDU_ROUTER_KEY		9
+#define PDU_ERROR_REPORT	10
+
+#define PDU_HEADER_LEN		8
+/* Error Reports can be long; anything bigger than this is nonsense */
+#define PDU_MAX_LEN		65536
+#define READ_BUFFER_SIZE	65536
+
+struct args {
+	char const *host;
+	char const *port;
+	unsigned int clients;
+	/* 0, 1, or -1 (alternate between both) */
+	int version;
+	unsigned int queries;
+	/* Milliseconds between Serial Queries */
+	unsigned int interval;
+	/* Server PID, or 0 (unknown) */
+	long pid;
+};
+
+struct read_buffer {
+	int fd;
+	unsigned char data[READ_BUFFER_SIZE];
+	size_t offset;
+	size_t len;
+	/* Content of the last PDU */
+	unsigned char pdu[PDU_MAX_LEN];
+};
+
+struct client {
+	pthread_t thread;
+	uint8_t version;
+	int fd;
+
+	uint16_t session;
+	uint32_t serial;
+
+	/* Seconds it took to receive the full table */
+	double reset_latency;
+	/* Seconds each Serial Query took */
+	double *query_latencies;
+	unsigned int queries_done;
+
+	unsigned long prefixes;
+	unsigned long router_keys;
+	unsigned long pdus;
+	unsigned long long bytes;
+	unsigned int cache_resets;
+
+	/* Nonzero if the session died */
+	int error;
+	char const *error_msg;
+	/* Text of the server's Error Report, if that's what killed it */
+	char error_text[256];
+};
+
+static struct args args = {
+	.host = "127.0.0.1",
+	.port = "323",
+	.clients = 100,
+	.version = -1,
+	.queries = 10,
+	.interval = 0,
+	.pid = 0,
+};
+
+static pthread_barrier_t start_barrier;
+
+static void
+print_usage(char const *program)
+{
+	fprintf(stderr, "Usage: %s [options]\n", program);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "  --host=<addr>      Server address (default %s)\n",
+	    args.host);
+	fprintf(stderr, "  --port=<port>      Server port (default %s)\n",
+	    args.port);
+	fprintf(stderr, "  --clients=<n>      Concurrent sessions (default %u)\n",
+	    args.clients);
+	fprintf(stderr, "  --version=<v>      RTR version: 0, 1 or mixed (default mixed)\n");
+	fprintf(stderr, "  --queries=<n>      Serial Queries per session (default %u)\n",
+	    args.queries);
+	fprintf(stderr, "  --interval=<ms>    Pause between Serial Queries (default %u)\n",
+	    args.interval);
+	fprintf(stderr, "  --pid=<pid>        Server PID, to measure its CPU usage\n");
+}
+
+static int
+parse_uint(char const *name, char const *str, unsigned int *result)
+{
+	unsigned long value;
+	char *end;
+
+	errno = 0;
+	value = strtoul(str, &end, 10);
+	if (errno || *end != '\0' || end == str || value > UINT_MAX) {
+		fprintf(stderr, "Invalid --%s: '%s'\n", name, str);
+		return -EINVAL;
+	}
+
+	*result = value;
+	return 0;
+}
+
+static int
+parse_args(int argc, char **argv)
+{
+	static struct option const options[] = {
+		{ "host", required_argument, NULL, 'H' },
+		{ "port", required_argument, NULL, 'p' },
+		{ "clients", required_argument, NULL, 'c' },
+		{ "version", required_argument, NULL, 'v' },
+		{ "queries", required_argument, NULL, 'q' },
+		{ "interval", required_argument, NULL, 'i' },
+		{ "pid", required_argument, NULL, 'P' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	unsigned int pid;
+	int opt;
+	int error;
+
+	while ((opt = getopt_long(argc, argv, "h", options, NULL)) != -1) {
+		error = 0;
+		switch (opt) {
+		case 'H':
+			args.host = optarg;
+			break;
+		case 'p':
+			args.port = optarg;
+			break;
+		case 'c':
+			error = parse_uint("clients", optarg, &args.clients);
+			break;
+		case 'v':
+			if (strcmp(optarg, "0") == 0)
+				args.version = 0;
+			else if (strcmp(optarg, "1") == 0)
+				args.version = 1;
+			else if (strcmp(optarg, "mixed") == 0)
+				args.version = -1;
+			else {
+				fprintf(stderr, "Invalid --version: '%s'\n",
+				    optarg);
+				error = -EINVAL;
+			}
+			break;
+		case 'q':
+			error = parse_uint("queries", optarg, &args.queries);
+			break;
+		case 'i':
+			error = parse_uint("interval", optarg, &args.interval);
+			break;
+		case 'P':
+			error = parse_uint("pid", optarg, &pid);
+			args.pid = pid;
+			break;
+		default:
+			print_usage(argv[0]);
+			return -EINVAL;
+		}
+		if (error)
+			return error;
+	}
+
+	if (optind != argc) {
+		print_usage(argv[0]);
+		return -EINVAL;
+	}
+	if (args.clients == 0) {
+		fprintf(stderr, "There has to be at least one client.\n");
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static int
+client_connect(struct client *client)
+{
+	struct addrinfo hints, *result, *ai;
+	int fd;
+	int error;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	error = getaddrinfo(args.host, args.port, &hints, &result);
+	if (error) {
+		client->error_msg = gai_strerror(error);
+		return -EINVAL;
+	}
+
+	fd = -1;
+	for (ai = result; ai != NULL; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	error = errno;
+	freeaddrinfo(result);
+
+	if (fd < 0) {
+		client->error_msg = strerror(error);
+		return -error;
+	}
+
+	client->fd = fd;
+	return 0;
+}
+
+static void
+put16(unsigned char *buf, uint16_t value)
+{
+	buf[0] = value >> 8;
+	buf[1] = value;
+}
+
+static void
+put32(unsigned char *buf, uint32_t value)
+{
+	buf[0] = value >> 24;
+	buf[1] = value >> 16;
+	buf[2] = value >> 8;
+	buf[3] = value;
+}
+
+static uint16_t
+get16(unsigned char const *buf)
+{
+	return (buf[0] << 8) | buf[1];
+}
+
+static uint32_t
+get32(unsigned char const *buf)
+{
+	return ((uint32_t) buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8)
+	    | buf[3];
+}
+
+static int
+send_pdu(struct client *client, unsigned char *pdu, size_t len)
+{
+	ssize_t written;
+	size_t offset;
+
+	for (offset = 0; offset < len; offset += written) {
+		written = write(client->fd, pdu + offset, len - offset);
+		if (written < 0) {
+			if (errno == EINTR) {
+				written = 0;
+				continue;
+			}
+			client->error_msg = strerror(errno);
+			return -errno;
+		}
+	}
+
+	return 0;
+}
+
+static int
+send_reset_query(struct client *client)
+{
+	unsigned char pdu[8];
+
+	pdu[0] = client->version;
+	pdu[1] = PDU_RESET_QUERY;
+	put16(pdu + 2, 0);
+	put32(pdu + 4, sizeof(pdu));
+	return send_pdu(client, pdu, sizeof(pdu));
+}
+
+static int
+send_serial_query(struct client *client)
+{
+	unsigned char pdu[12];
+
+	pdu[0] = client->version;
+	pdu[1] = PDU_SERIAL_QUERY;
+	put16(pdu + 2, client->session);
+	put32(pdu + 4, sizeof(pdu));
+	put32(pdu + 8, client->serial);
+	return send_pdu(client, pdu, sizeof(pdu));
+}
+
+static int
+read_bytes(struct client *client, struct read_buffer *buffer,
+    unsigned char *result, size_t len)
+{
+	ssize_t bytes;
+	size_t chunk;
+
+	while (len > 0) {
+		if (buffer->offset == buffer->len) {
+			bytes = read(buffer->fd, buffer->data,
+			    sizeof(buffer->data));
+			if (bytes < 0) {
+				if (errno == EINTR)
+					continue;
+				client->error_msg = strerror(errno);
+				return -errno;
+			}
+			if (bytes == 0) {
+				client->error_msg = "The server closed the connection.";
+				return -EPIPE;
+			}
+			buffer->offset = 0;
+			buffer->len = bytes;
+			client->bytes += bytes;
+		}
+
+		chunk = buffer->len - buffer->offset;
+		if (chunk > len)
+			chunk = len;
+		memcpy(result, buffer->data + buffer->offset, chunk);
+		buffer->offset += chunk;
+		result += chunk;
+		len -= chunk;
+	}
+
+	return 0;
+}
+
+static void
+error_report_text(struct client *client, uint8_t code, unsigned char *pdu,
+    size_t len)
+{
+	uint32_t pdu_len, text_len;
+
+	snprintf(client->error_text, sizeof(client->error_text),
+	    "The server sent an Error Report (code %u).", code);
+	client->error_msg = client->error_text;
+
+	/* Length of the encapsulated PDU, and length of the text */
+	if (len < 8)
+		return;
+	pdu_len = get32(pdu);
+	if ((size_t) pdu_len + 8 > len)
+		return;
+	text_len = get32(pdu + 4 + pdu_len);
+	if (text_len == 0 || text_len > len - 8 - pdu_len)
+		return;
+
+	snprintf(client->error_text, sizeof(client->error_text),
+	    "The server sent an Error Report (code %u): %.*s", code,
+	    (int) text_len, pdu + 8 + pdu_len);
+}
+
+/*
+ * Reads PDUs until the end of the response (End of Data or Cache Reset).
+ * Returns the type of the last PDU.
+ */
+static int
+read_response(struct client *client, struct read_buffer *buffer)
+{
+	unsigned char *pdu = buffer->pdu;
+	unsigned char header[PDU_HEADER_LEN];
+	uint32_t len;
+	int error;
+
+	do {
+		error = read_bytes(client, buffer, header, sizeof(header));
+		if (error)
+			return error;
+
+		len = get32(header + 4);
+		if (len < PDU_HEADER_LEN || len > PDU_MAX_LEN) {
+			client->error_msg = "The server sent a PDU with a bogus length.";
+			return -EINVAL;
+		}
+		error = read_bytes(client, buffer, pdu, len - PDU_HEADER_LEN);
+		if (error)
+			return error;
+		client->pdus++;
+
+		switch (header[1]) {
+		case PDU_IPV4_PREFIX:
+		case PDU_IPV6_PREFIX:
+			client->prefixes++;
+			break;
+		case PDU_ROUTER_KEY:
+			client->router_keys++;
+			break;
+		case PDU_END_OF_DATA:
+			if (len < 12) {
+				client->error_msg = "The server sent a truncated End of Data.";
+				return -EINVAL;
+			}
+			client->session = get16(header + 2);
+			client->serial = get32(pdu);
+			return PDU_END_OF_DATA;
+		case PDU_CACHE_RESET:
+			client->cache_resets++;
+			return PDU_CACHE_RESET;
+		case PDU_ERROR_REPORT:
+			error_report_text(client, header[3], pdu,
+			    len - PDU_HEADER_LEN);
+			return -EPROTO;
+		}
+		/* Cache Response, and Serial Notifies can arrive any time */
+	} while (true);
+}
+
+static void *
+client_run(void *arg)
+{
+	struct client *client = arg;
+	struct read_buffer *buffer;
+	double start;
+	unsigned int q;
+	int result;
+
+	buffer = malloc(sizeof(struct read_buffer));
+	if (buffer == NULL) {
+		client->error = -ENOMEM;
+		client->error_msg = "Out of memory.";
+		pthread_barrier_wait(&start_barrier);
+		return NULL;
+	}
+
+	client->error = client_connect(client);
+	/* Everyone starts requesting at the same time */
+	pthread_barrier_wait(&start_barrier);
+	if (client->error)
+		goto end;
+
+	buffer->fd = client->fd;
+	buffer->offset = 0;
+	buffer->len = 0;
+
+reset:
+	start = now();
+	result = send_reset_query(client);
+	if (result)
+		goto fail;
+	result = read_response(client, buffer);
+	if (result < 0)
+		goto fail;
+	if (result != PDU_END_OF_DATA) {
+		client->error_msg = "The server answered a Reset Query with a Cache Reset.";
+		result = -EPROTO;
+		goto fail;
+	}
+	client->reset_latency = now() - start;
+
+	for (q = client->queries_done; q < args.queries; q++) {
+		if (args.interval > 0)
+			usleep(args.interval * 1000);
+
+		start = now();
+		result = send_serial_query(client);
+		if (result)
+			goto fail;
+		result = read_response(client, buffer);
+		if (result < 0)
+			goto fail;
+		client->query_latencies[client->queries_done++] = now() - start;
+		if (result == PDU_CACHE_RESET)
+			goto reset;
+	}
+
+	goto end;
+
+fail:
+	client->error = result;
+end:
+	if (client->fd >= 0)
+		close(client->fd);
+	free(buffer);
+	return NULL;
+}
+
+static int
+compare_doubles(void const *a, void const *b)
+{
+	double x = *((double const *) a);
+	double y = *((double const *) b);
+
+	return (x > y) - (x < y);
+}
+
+/* @values has to be sorted */
+static double
+percentile(double *values, size_t count, unsigned int pct)
+{
+	size_t index;
+
+	if (count == 0)
+		return 0;
+
+	index = (count * pct + 99) / 100;
+	if (index > 0)
+		index--;
+	return values[index];
+}
+
+static void
+print_distribution(char const *name, double *values, size_t count)
+{
+	qsort(values, count, sizeof(double), compare_doubles);
+	printf("%s (%zu samples, ms): min %.3f, p50 %.3f, p99 %.3f, max %.3f\n",
+	    name, count,
+	    1000 * percentile(values, count, 0),
+	    1000 * percentile(values, count, 50),
+	    1000 * percentile(values, count, 99),
+	    1000 * percentile(values, count, 100));
+}
+
+/* Returns the CPU seconds (user + system) spent by process @pid so far. */
+static int
+get_cpu_time(long pid, double *result)
+{
+	char path[64];
+	char line[1024];
+	char *fields;
+	unsigned long utime, stime;
+	FILE *file;
+	int matched;
+
+	snprintf(path, sizeof(path), "/proc/%ld/stat", pid);
+	file = fopen(path, "r");
+	if (file == NULL)
+		return -errno;
+	fields = fgets(line, sizeof(line), file);
+	fclose(file);
+	if (fields == NULL)
+		return -EIO;
+
+	/* The command name can contain anything; skip it */
+	fields = strrchr(line, ')');
+	if (fields == NULL)
+		return -EINVAL;
+	matched = sscanf(fields + 2,
+	    "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+	    &utime, &stime);
+	if (matched != 2)
+		return -EINVAL;
+
+	*result = (double) (utime + stime) / sysconf(_SC_CLK_TCK);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct client *clients, *client;
+	double *reset_latencies, *query_latencies;
+	size_t resets, queries;
+	unsigned long long bytes;
+	unsigned long pdus, min_prefixes, max_prefixes;
+	unsigned int failed, cache_resets;
+	double start, elapsed;
+	double cpu_start, cpu_end;
+	bool cpu_known;
+	unsigned int i, q;
+	int error;
+
+	error = parse_args(argc, argv);
+	if (error)
+		return -error;
+
+	clients = calloc(args.clients, sizeof(struct client));
+	reset_latencies = calloc(args.clients, sizeof(double));
+	query_latencies = calloc((size_t) args.clients * args.queries + 1,
+	    sizeof(double));
+	if (clients == NULL || reset_latencies == NULL ||
+	    query_latencies == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		return ENOMEM;
+	}
+
+	error = pthread_barrier_init(&start_barrier, NULL, args.clients + 1);
+	if (error) {
+		fprintf(stderr, "pthread_barrier_init() failed: %s\n",
+		    strerror(error));
+		return error;
+	}
+
+	cpu_known = args.pid != 0 && get_cpu_time(args.pid, &cpu_start) == 0;
+	if (args.pid != 0 && !cpu_known)
+		fprintf(stderr, "Cannot read the CPU time of process %ld; it won't be reported.\n",
+		    args.pid);
+
+	for (i = 0; i < args.clients; i++) {
+		client = &clients[i];
+		client->fd = -1;
+		client->version = (args.version >= 0)
+		    ? (unsigned int) args.version
+		    : (i % 2);
+		client->query_latencies = query_latencies +
+		    (size_t) i * args.queries;
+		error = pthread_create(&client->thread, NULL, client_run,
+		    client);
+		if (error) {
+			fprintf(stderr, "pthread_create() failed: %s\n",
+			    strerror(error));
+			return error;
+		}
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	start = now();
+	for (i = 0; i < args.clients; i++)
+		pthread_join(clients[i].thread, NULL);
+	elapsed = now() - start;
+
+	if (cpu_known && get_cpu_time(args.pid, &cpu_end) != 0)
+		cpu_known = false;
+
+	resets = 0;
+	queries = 0;
+	bytes = 0;
+	pdus = 0;
+	failed = 0;
+	cache_resets = 0;
+	min_prefixes = ULONG_MAX;
+	max_prefixes = 0;
+	for (i = 0; i < args.clients; i++) {
+		client = &clients[i];
+		bytes += client->bytes;
+		pdus += client->pdus;
+		cache_resets += client->cache_resets;
+		if (client->error) {
+			if (failed == 0)
+				fprintf(stderr, "Client %u failed: %s\n", i,
+				    client->error_msg);
+			failed++;
+		}
+		if (client->reset_latency > 0) {
+			reset_latencies[resets++] = client->reset_latency;
+			/* Each full table is counted once */
+			if (client->prefixes < min_prefixes)
+				min_prefixes = client->prefixes;
+			if (client->prefixes > max_prefixes)
+				max_prefixes = client->prefixes;
+		}
+		/* Compact the latencies of the finished queries */
+		for (q = 0; q < client->queries_done; q++)
+			query_latencies[queries++] =
+			    client->query_latencies[q];
+	}
+
+	printf("Sessions: %u (%u failed)\n", args.clients, failed);
+	if (resets > 0)
+		printf("Full table: %lu to %lu prefixes per session\n",
+		    min_prefixes, max_prefixes);
+	printf("Cache Resets received: %u\n", cache_resets);
+	print_distribution("Time to full table", reset_latencies, resets);
+	print_distribution("Serial Query latency", query_latencies, queries);
+	printf("Elapsed: %.3f seconds\n", elapsed);
+	if (elapsed > 0) {
+		printf("Throughput: %.1f queries/s, %.1f PDUs/s, %.2f MiB/s\n",
+		    (resets + queries) / elapsed, pdus / elapsed,
+		    bytes / elapsed / (1024 * 1024));
+	}
+	if (cpu_known) {
+		printf("Server CPU: %.2f seconds (%.1f%% of one core)\n",
+		    cpu_end - cpu_start,
+		    (elapsed > 0) ? (100 * (cpu_end - cpu_start) / elapsed) : 0);
+	}
+
+	pthread_barrier_destroy(&start_barrier);
+	free(query_latencies);
+	free(reset_latencies);
+	free(clients);
+	return (failed > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -51,11 +51,17 @@ decode(struct file_contents *fc, struct ContentInfo **result)
 
 int
 content_info_load(struct rpki_uri *uri, struct ContentInfo **result)
+{
+	return content_info_load_file(uri_get_local(uri), result);
+}
+
+int
+content_info_load_file(char const *path, struct ContentInfo **result)
 {
 	struct file_contents fc;
 	int error;
 
-	error = file_load(uri_get_local(uri), &fc);
+	error = file_load(path, &fc);
 	if (error)
 		return error;
 
@@ -6,6 +6,7 @@
 #include "str_token.h"
 #include "thread_var.h"
 #include "data_structure/array_list.h"
+#include "data_structure/uthash_nonfatal.h"
 #include "object/name.h"
 
 enum defer_node_type {
@@ -29,19 +30,30 @@ struct defer_node {
 SLIST_HEAD(defer_stack, defer_node);
 
 struct serial_number {
-	BIGNUM *number;
+	/* Sign byte (1 if negative), followed by the magnitude (big endian) */
+	unsigned char *key;
+	size_t key_len;
 	char *file; /* File where this serial number was found. */
+	UT_hash_handle hh;
 };
 
-STATIC_ARRAY_LIST(serial_numbers, struct serial_number)
+STATIC_ARRAY_LIST(subject_files, char *)
 
 struct subject_name {
-	struct rfc5280_name *name;
-	char *file; /* File where this subject name was found. */
+	/*
+	 * commonName, NULL chara, and then serialNumber and another NULL chara
+	 * (the latter two only if the name has a serialNumber).
+	 */
+	char *key;
+	size_t key_len;
+	/*
+	 * Files where this subject name was found. (There can be several,
+	 * because certificates that also share the public key are allowed.)
+	 */
+	struct subject_files files;
+	UT_hash_handle hh;
 };
 
-STATIC_ARRAY_LIST(subjects, struct subject_name)
-
 /**
  * Cached certificate data.
  */
@@ -49,12 +61,12 @@ struct metadata_node {
 	struct rpki_uri *uri;
 	struct resources *resources;
 	/*
-	 * Serial numbers of the children.
-	 * This is an unsorted array list for two reasons: Certificates usually
-	 * don't have many children, and I'm running out of time.
+	 * Serial numbers and subject names of the children.
+	 * They are hash tables because some CAs have tens of thousands of
+	 * children.
 	 */
-	struct serial_numbers serials;
-	struct subjects subjects;
+	struct serial_number *serials;
+	struct subject_name *subjects;
 
 	/** Used by certstack. Points to the next stacked certificate. */
 	SLIST_ENTRY(metadata_node) next;
@@ -156,17 +168,35 @@ defer_destroy(struct defer_node *defer)
 }
 
 static void
-serial_cleanup(struct serial_number *serial)
+serials_cleanup(struct metadata_node *meta)
 {
-	BN_free(serial->number);
-	free(serial->file);
+	struct serial_number *serial, *tmp;
+
+	HASH_ITER(hh, meta->serials, serial, tmp) {
+		HASH_DEL(meta->serials, serial);
+		free(serial->key);
+		free(serial->file);
+		free(serial);
+	}
+}
+
+static void
+subject_file_cleanup(char **file)
+{
+	free(*file);
 }
 
 static void
-subject_cleanup(struct subject_name *subject)
+subjects_cleanup(struct metadata_node *meta)
 {
-	x509_name_put(subject->name);
-	free(subject->file);
+	struct subject_name *subject, *tmp;
+
+	HASH_ITER(hh, meta->subjects, subject, tmp) {
+		HASH_DEL(meta->subjects, subject);
+		free(subject->key);
+		subject_files_cleanup(&subject->files, subject_file_cleanup);
+		free(subject);
+	}
 }
 
 static void
@@ -174,8 +204,8 @@ meta_destroy(struct metadata_node *meta)
 {
 	uri_refput(meta->uri);
 	resources_destroy(meta->resources);
-	serial_numbers_cleanup(&meta->serials, serial_cleanup);
-	subjects_cleanup(&meta->subjects, subject_cleanup);
+	serials_cleanup(meta);
+	subjects_cleanup(meta);
 	free(meta);
 }
 
@@ -329,8 +359,8 @@ x509stack_push(struct cert_stack *stack, struct rpki_uri *uri, X509 *x509,
 
 	meta->uri = uri;
 	uri_refget(uri);
-	serial_numbers_init(&meta->serials);
-	subjects_init(&meta->subjects);
+	meta->serials = NULL;
+	meta->subjects = NULL;
 
 	meta->resources = resources_create(false);
 	if (meta->resources == NULL) {
@@ -374,9 +404,7 @@ x509stack_push(struct cert_stack *stack, struct rpki_uri *uri, X509 *x509,
 	return 0;
 
 end5:	resources_destroy(meta->resources);
-end4:	subjects_cleanup(&meta->subjects, subject_cleanup);
-	serial_numbers_cleanup(&meta->serials, serial_cleanup);
-	uri_refput(meta->uri);
+end4:	uri_refput(meta->uri);
 	free(meta);
 end3:	free(repo);
 	return error;
@@ -437,6 +465,9 @@ get_current_file_name(char **_result)
 	char const *tmp;
 	char *result;
 
+	/* Callers can call free() whether this function fails or not. */
+	*_result = NULL;
+
 	tmp = fnstack_peek();
 	if (tmp == NULL)
 		pr_crit("The file name stack is empty.");
@@ -449,6 +480,25 @@ get_current_file_name(char **_result)
 	return 0;
 }
 
+/* Returns NULL on memory allocation failure. */
+static unsigned char *
+serial_key(BIGNUM *number, size_t *key_len)
+{
+	unsigned char *result;
+	int len;
+
+	len = BN_num_bytes(number);
+	result = malloc(len + 1);
+	if (result == NULL)
+		return NULL;
+
+	result[0] = BN_is_negative(number) ? 1 : 0;
+	BN_bn2bin(number, result + 1);
+
+	*key_len = len + 1;
+	return result;
+}
+
 /**
  * Intended to validate serial number uniqueness.
  * "Stores" the serial number in the current relevant certificate metadata,
@@ -460,13 +510,13 @@ int
 x509stack_store_serial(struct cert_stack *stack, BIGNUM *number)
 {
 	struct metadata_node *meta;
-	struct serial_number *cursor;
-	array_index i;
-	struct serial_number duplicate;
+	struct serial_number *serial;
+	unsigned char *key;
+	size_t key_len;
 	char *string;
 	int error;
 
-	/* Remember to free @number if you return 0 but don't store it. */
+	/* Remember to free @number if you return 0. */
 
 	meta = SLIST_FIRST(&stack->metas);
 	if (meta == NULL) {
@@ -474,6 +524,10 @@ x509stack_store_serial(struct cert_stack *stack, BIGNUM *number)
 		return 0; /* The TA lacks siblings, so serial is unique. */
 	}
 
+	key = serial_key(number, &key_len);
+	if (key == NULL)
+		return pr_enomem();
+
 	/*
 	 * Note: This is is reported as a warning, even though duplicate serial
 	 * numbers are clearly a violation of the RFC and common sense.
@@ -495,29 +549,94 @@ x509stack_store_serial(struct cert_stack *stack, BIGNUM *number)
 	 *
 	 * TODO I haven't seen this warning in a while. Review.
 	 */
-	ARRAYLIST_FOREACH(&meta->serials, cursor, i) {
-		if (BN_cmp(cursor->number, number) == 0) {
-			BN2string(number, &string);
-			pr_val_warn("Serial number '%s' is not unique. (Also found in '%s'.)",
-			    string, cursor->file);
-			BN_free(number);
-			free(string);
-			return 0;
-		}
+	HASH_FIND(hh, meta->serials, key, key_len, serial);
+	if (serial != NULL) {
+		BN2string(number, &string);
+		pr_val_warn("Serial number '%s' is not unique. (Also found in '%s'.)",
+		    string, serial->file);
+		BN_free(number);
+		free(string);
+		free(key);
+		return 0;
+	}
+
+	serial = malloc(sizeof(struct serial_number));
+	if (serial == NULL) {
+		error = pr_enomem();
+		goto revert_key;
+	}
+	serial->key = key;
+	serial->key_len = key_len;
+
+	error = get_current_file_name(&serial->file);
+	if (error)
+		goto revert_serial;
+
+	errno = 0;
+	HASH_ADD_KEYPTR(hh, meta->serials, serial->key, serial->key_len,
+	    serial);
+	if (errno) {
+		error = pr_enomem();
+		goto revert_file;
 	}
 
-	duplicate.number = number;
-	error = get_current_file_name(&duplicate.file);
+	BN_free(number);
+	return 0;
+
+revert_file:
+	free(serial->file);
+revert_serial:
+	free(serial);
+revert_key:
+	free(key);
+	return error;
+}
+
+static int
+add_subject_file(struct subject_name *subject)
+{
+	char *file;
+	int error;
+
+	error = get_current_file_name(&file);
 	if (error)
 		return error;
 
-	error = serial_numbers_add(&meta->serials, &duplicate);
+	error = subject_files_add(&subject->files, &file);
 	if (error)
-		free(duplicate.file);
+		free(file);
 
 	return error;
 }
 
+/* Returns NULL on memory allocation failure. */
+static char *
+subject_key(struct rfc5280_name *name, size_t *key_len)
+{
+	char const *common_name;
+	char const *serial;
+	size_t cn_len;
+	size_t serial_len;
+	char *result;
+
+	common_name = x509_name_commonName(name);
+	serial = x509_name_serialNumber(name);
+
+	cn_len = strlen(common_name) + 1;
+	serial_len = (serial != NULL) ? (strlen(serial) + 1) : 0;
+
+	result = malloc(cn_len + serial_len);
+	if (result == NULL)
+		return NULL;
+
+	memcpy(result, common_name, cn_len);
+	if (serial != NULL)
+		memcpy(result + cn_len, serial, serial_len);
+
+	*key_len = cn_len + serial_len;
+	return result;
+}
+
 /**
  * Intended to validate subject uniqueness.
  * "Stores" the subject in the current relevant certificate metadata, and
@@ -530,9 +649,11 @@ x509stack_store_subject(struct cert_stack *stack, struct rfc5280_name *subject,
     subject_pk_check_cb cb, void *arg)
 {
 	struct metadata_node *meta;
-	struct subject_name *cursor;
+	struct subject_name *node;
+	char *key;
+	size_t key_len;
+	char **cursor;
 	array_index i;
-	struct subject_name duplicate;
 	bool duplicated;
 	int error;
 
@@ -579,11 +700,18 @@ x509stack_store_subject(struct cert_stack *stack, struct rfc5280_name *subject,
 	if (meta == NULL)
 		return 0; /* The TA lacks siblings, so subject is unique. */
 
+	key = subject_key(subject, &key_len);
+	if (key == NULL)
+		return pr_enomem();
+
 	/* See the large comment in certstack_x509_store_serial(). */
-	duplicated = false;
-	ARRAYLIST_FOREACH(&meta->subjects, cursor, i) {
-		if (x509_name_equals(cursor->name, subject)) {
-			error = cb(&duplicated, cursor->file, arg);
+	HASH_FIND(hh, meta->subjects, key, key_len, node);
+	if (node != NULL) {
+		free(key);
+
+		duplicated = false;
+		ARRAYLIST_FOREACH(&node->files, cursor, i) {
+			error = cb(&duplicated, *cursor, arg);
 			if (error)
 				return error;
 
@@ -595,28 +723,40 @@ x509stack_store_subject(struct cert_stack *stack, struct rfc5280_name *subject,
 			    x509_name_commonName(subject),
 			    (serial != NULL) ? "/" : "",
 			    (serial != NULL) ? serial : "",
-			    cursor->file);
+			    *cursor);
 			return 0;
 		}
+
+		return add_subject_file(node);
 	}
 
-	duplicate.name = subject;
-	x509_name_get(subject);
+	node = malloc(sizeof(struct subject_name));
+	if (node == NULL) {
+		free(key);
+		return pr_enomem();
+	}
+	node->key = key;
+	node->key_len = key_len;
+	subject_files_init(&node->files);
 
-	error = get_current_file_name(&duplicate.file);
+	error = add_subject_file(node);
 	if (error)
-		goto revert_name;
+		goto revert_node;
 
-	error = subjects_add(&meta->subjects, &duplicate);
-	if (error)
-		goto revert_file;
+	errno = 0;
+	HASH_ADD_KEYPTR(hh, meta->subjects, node->key, node->key_len, node);
+	if (errno) {
+		error = pr_enomem();
+		goto revert_files;
+	}
 
 	return 0;
 
-revert_file:
-	free(duplicate.file);
-revert_name:
-	x509_name_put(subject);
+revert_files:
+	subject_files_cleanup(&node->files, subject_file_cleanup);
+revert_node:
+	free(node->key);
+	free(node);
 	return error;
 }
 
@@ -18,6 +18,13 @@ static struct clients_table {
 /** Read/write lock, which protects @table and its inhabitants. */
 static pthread_rwlock_t lock;
 
+/*
+ * Traffic counters of the client attended by the current thread (see
+ * clients_add()). They're reached without the lock, since they're sent to on
+ * every PDU.
+ */
+static pthread_key_t traffic_key;
+
 int
 clients_db_init(void)
 {
@@ -28,11 +35,19 @@ clients_db_init(void)
 	error = pthread_rwlock_init(&lock, NULL);
 	if (error)
 		return pr_op_errno(error, "pthread_rwlock_init() errored");
+
+	error = pthread_key_create(&traffic_key, NULL);
+	if (error) {
+		pthread_rwlock_destroy(&lock);
+		return pr_op_errno(error, "pthread_key_create() errored");
+	}
+
 	return 0;
 }
 
 static struct hashable_client *
-create_client(int fd, struct sockaddr_storage addr)
+create_client(int fd, struct sockaddr_storage addr, int notify_fd,
+    struct client_traffic *traffic)
 {
 	struct hashable_client *client;
 
@@ -46,20 +61,33 @@ create_client(int fd, struct sockaddr_storage addr)
 	client->meat.serial_number_set = false;
 	client->meat.rtr_version_set = false;
 	client->meat.addr = addr;
+	client->meat.notify_fd = notify_fd;
+	client->meat.traffic = traffic;
 
 	return client;
 }
 
 /*
  * If the client whose file descriptor is @fd isn't already stored, store it.
+ * @notify_fd is where notify_clients() will queue its Serial Notifies.
+ *
+ * @traffic (can be NULL) must be owned by the calling thread, and outlive the
+ * client's entry (until clients_forget()). The PDUs this thread sends will be
+ * accounted there.
  */
 int
-clients_add(int fd, struct sockaddr_storage addr)
+clients_add(int fd, struct sockaddr_storage addr, int notify_fd,
+    struct client_traffic *traffic)
 {
 	struct hashable_client *new_client;
 	struct hashable_client *old_client;
 
-	new_client = create_client(fd, addr);
+	if (traffic != NULL) {
+		atomic_init(&traffic->pdus_sent, 0);
+		atomic_init(&traffic->bytes_sent, 0);
+	}
+
+	new_client = create_client(fd, addr, notify_fd, traffic);
 	if (new_client == NULL)
 		return pr_enomem();
 
@@ -78,6 +106,7 @@ clients_add(int fd, struct sockaddr_storage addr)
 
 	rwlock_unlock(&lock);
 
+	pthread_setspecific(traffic_key, traffic);
 	return 0;
 }
 
@@ -98,6 +127,25 @@ unlock:
 	rwlock_unlock(&lock);
 }
 
+/*
+ * Accounts a PDU of @bytes length sent by the current thread to its client.
+ * (Nothing is done if the thread isn't attending a client.)
+ */
+void
+clients_add_sent(size_t bytes)
+{
+	struct client_traffic *traffic;
+
+	traffic = pthread_getspecific(traffic_key);
+	if (traffic == NULL)
+		return;
+
+	atomic_fetch_add_explicit(&traffic->pdus_sent, 1,
+	    memory_order_relaxed);
+	atomic_fetch_add_explicit(&traffic->bytes_sent, bytes,
+	    memory_order_relaxed);
+}
+
 int
 clients_get_min_serial(serial_t *result)
 {
@@ -175,6 +223,8 @@ clients_get_rtr_version_set(int fd, bool *is_set, uint8_t *rtr_version)
 /*
  * Remove the client with ID @fd from the DB. If a @cb is set, it will be
  * called before deleting the client from the DB.
+ *
+ * Must be called by the client's thread, which stops accounting its traffic.
  */
 void
 clients_forget(int fd, clients_foreach_cb cb, void *arg)
@@ -193,6 +243,8 @@ clients_forget(int fd, clients_foreach_cb cb, void *arg)
 	}
 
 	rwlock_unlock(&lock);
+
+	pthread_setspecific(traffic_key, NULL);
 }
 
 int
@@ -256,5 +308,6 @@ clients_db_destroy(void)
 		free(node);
 	}
 
+	pthread_key_delete(traffic_key);
 	pthread_rwlock_destroy(&lock); /* Nothing to do with error code */
 }
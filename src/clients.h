@@ -1,26 +1,42 @@
 #ifndef SRC_CLIENTS_H_
 #define SRC_CLIENTS_H_
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <netinet/in.h>
 #include "rtr/pdu.h"
 #include "rtr/db/vrp.h"
 
+/*
+ * Traffic sent to a client (for the metrics). Only the client's thread writes
+ * it; the metrics scrapes read it.
+ */
+struct client_traffic {
+	atomic_ullong pdus_sent;
+	atomic_ullong bytes_sent;
+};
+
 struct client {
 	int fd;
 	struct sockaddr_storage addr;
+	/* Write end of the client thread's notify pipe; -1 if none */
+	int notify_fd;
 
 	serial_t serial_number;
 	bool serial_number_set;
 
 	uint8_t rtr_version;
 	bool rtr_version_set;
+
+	/* Owned by the client's thread; NULL if none */
+	struct client_traffic *traffic;
 };
 
 int clients_db_init(void);
 
-int clients_add(int, struct sockaddr_storage);
+int clients_add(int, struct sockaddr_storage, int, struct client_traffic *);
 void clients_update_serial(int, serial_t);
+void clients_add_sent(size_t);
 
 typedef int (*clients_foreach_cb)(struct client *, void *);
 void clients_forget(int, clients_foreach_cb, void *);
@@ -81,6 +81,12 @@ struct rpki_config {
 			unsigned int retry;
 			unsigned int expire;
 		} interval;
+		/** Retention of the delta history */
+		struct {
+			unsigned int max_count;
+			unsigned int max_age;
+			unsigned int max_memory;
+		} deltas;
 	} server;
 
 	struct {
@@ -194,6 +200,12 @@ struct rpki_config {
 		char *bgpsec;
 		/** Format for the output */
 		enum output_format format;
+		/** Compression of the output files */
+		enum output_compression compression;
+		/** Directory where the delta of each serial will be stored */
+		char *deltas;
+		/** File where the validation cycles' profiling will be stored */
+		char *profile;
 	} output;
 
 	/* ASN1 decoder max stack size allowed */
@@ -218,7 +230,28 @@ struct rpki_config {
 		struct {
 			unsigned int max;
 		} validation;
+		/* Threads that prefetch RRDP repositories (per TAL) */
+		struct {
+			unsigned int max;
+		} rrdp_prefetch;
+		/* Threads that parse the deltas of an RRDP repository */
+		struct {
+			unsigned int max;
+		} rrdp_deltas;
+		/* Threads that format the output files */
+		struct {
+			unsigned int max;
+		} output;
 	} thread_pool;
+
+	struct {
+		/* Serve the performance metrics over HTTP? */
+		bool enabled;
+		/* Address the metrics listener binds to (NULL means any) */
+		char *address;
+		/* Port the metrics listener binds to */
+		char *port;
+	} metrics;
 };
 
 static void print_usage(FILE *, bool);
@@ -435,6 +468,33 @@ static const struct option_field options[] = {
 		 */
 		.min = 600,
 		.max = 172800,
+	}, {
+		.id = 5007,
+		.name = "server.deltas.max-count",
+		.type = &gt_uint,
+		.offset = offsetof(struct rpki_config,
+		    server.deltas.max_count),
+		.doc = "Maximum number of serials whose deltas are kept (0 = no limit)",
+		.min = 0,
+		.max = UINT_MAX,
+	}, {
+		.id = 5008,
+		.name = "server.deltas.max-age",
+		.type = &gt_uint,
+		.offset = offsetof(struct rpki_config,
+		    server.deltas.max_age),
+		.doc = "Seconds after which deltas are forgotten (0 = no limit)",
+		.min = 0,
+		.max = UINT_MAX,
+	}, {
+		.id = 5009,
+		.name = "server.deltas.max-memory",
+		.type = &gt_uint,
+		.offset = offsetof(struct rpki_config,
+		    server.deltas.max_memory),
+		.doc = "Maximum MiB occupied by the kept deltas (0 = no limit)",
+		.min = 0,
+		.max = 1048576,
 	},
 
 	/* RSYNC fields */
@@ -735,6 +795,26 @@ static const struct option_field options[] = {
 		.type = &gt_output_format,
 		.offset = offsetof(struct rpki_config, output.format),
 		.doc = "Format to print ROAs and BGPsec Router Keys",
+	}, {
+		.id = 6004,
+		.name = "output.compression",
+		.type = &gt_output_compression,
+		.offset = offsetof(struct rpki_config, output.compression),
+		.doc = "Compression of the output files",
+	}, {
+		.id = 6005,
+		.name = "output.deltas",
+		.type = &gt_string,
+		.offset = offsetof(struct rpki_config, output.deltas),
+		.doc = "Directory where the changes of each new serial will be stored (in binary format)",
+		.arg_doc = "<directory>",
+	}, {
+		.id = 6003,
+		.name = "output.profile",
+		.type = &gt_string,
+		.offset = offsetof(struct rpki_config, output.profile),
+		.doc = "File where the time spent at each validation phase will be reported (as JSON), use '-' to print at console",
+		.arg_doc = "<file>",
 	},
 
 	{
@@ -793,6 +873,55 @@ static const struct option_field options[] = {
 		.min = 1,
 		.max = 100,
 	},
+	{
+		.id = 12002,
+		.name = "thread-pool.rrdp-prefetch.max",
+		.type = &gt_uint,
+		.offset = offsetof(struct rpki_config,
+		    thread_pool.rrdp_prefetch.max),
+		.doc = "Maximum number of threads (per TAL) that download known RRDP repositories before the tree traversal; 0 disables the prefetch",
+		.min = 0,
+		.max = 100,
+	},
+	{
+		.id = 12003,
+		.name = "thread-pool.rrdp-deltas.max",
+		.type = &gt_uint,
+		.offset = offsetof(struct rpki_config,
+		    thread_pool.rrdp_deltas.max),
+		.doc = "Maximum number of threads that parse the deltas of an RRDP repository simultaneously",
+		.min = 1,
+		.max = 100,
+	},
+	{
+		.id = 12004,
+		.name = "thread-pool.output.max",
+		.type = &gt_uint,
+		.offset = offsetof(struct rpki_config, thread_pool.output.max),
+		.doc = "Maximum number of threads that format the ROAs and Router Keys of the output files simultaneously",
+		.min = 1,
+		.max = 100,
+	},
+
+	{
+		.id = 13000,
+		.name = "metrics.enabled",
+		.type = &gt_bool,
+		.offset = offsetof(struct rpki_config, metrics.enabled),
+		.doc = "Serve performance metrics (in the Prometheus text format) over HTTP",
+	}, {
+		.id = 13001,
+		.name = "metrics.address",
+		.type = &gt_string,
+		.offset = offsetof(struct rpki_config, metrics.address),
+		.doc = "Address to which the metrics listener will bind itself to. Can be a name, in which case an address will be resolved.",
+	}, {
+		.id = 13002,
+		.name = "metrics.port",
+		.type = &gt_string,
+		.offset = offsetof(struct rpki_config, metrics.port),
+		.doc = "Port to which the metrics listener will bind itself to. Can be a string, in which case a number will be resolved.",
+	},
 
 	{ 0 },
 };
@@ -977,6 +1106,9 @@ set_default_values(void)
 	rpki_config.server.interval.refresh = 3600;
 	rpki_config.server.interval.retry = 600;
 	rpki_config.server.interval.expire = 7200;
+	rpki_config.server.deltas.max_count = 100;
+	rpki_config.server.deltas.max_age = 86400;
+	rpki_config.server.deltas.max_memory = 256;
 
 	rpki_config.tal = NULL;
 	rpki_config.slurm = NULL;
@@ -1067,6 +1199,9 @@ set_default_values(void)
 	rpki_config.output.roa = NULL;
 	rpki_config.output.bgpsec = NULL;
 	rpki_config.output.format = OFM_CSV;
+	rpki_config.output.compression = OCM_NONE;
+	rpki_config.output.deltas = NULL;
+	rpki_config.output.profile = NULL;
 
 	rpki_config.asn1_decode_max_stack = 4096; /* 4kB */
 	rpki_config.stale_repository_period = 43200; /* 12 hours */
@@ -1082,8 +1217,22 @@ set_default_values(void)
 	rpki_config.thread_pool.server.max = 20;
 	/* Usually 5 TALs, let a few more available */
 	rpki_config.thread_pool.validation.max = 5;
+	/* Enough to overlap the slowest RRDP servers */
+	rpki_config.thread_pool.rrdp_prefetch.max = 8;
+	rpki_config.thread_pool.rrdp_deltas.max = 4;
+	rpki_config.thread_pool.output.max = 4;
+
+	rpki_config.metrics.enabled = false;
+	rpki_config.metrics.address = NULL;
+	rpki_config.metrics.port = strdup("9323");
+	if (rpki_config.metrics.port == NULL) {
+		error = pr_enomem();
+		goto revert_init_locations_list;
+	}
 
 	return 0;
+revert_init_locations_list:
+	init_locations_cleanup(&rpki_config.init_tal_locations);
 revert_init_locations:
 	free(rpki_config.validation_log.tag);
 revert_validation_log_tag:
@@ -1138,6 +1287,20 @@ validate_config(void)
 	    !valid_output_file(rpki_config.output.bgpsec))
 		return pr_op_err("Invalid output.bgpsec file.");
 
+	if (rpki_config.output.profile != NULL &&
+	    !valid_output_file(rpki_config.output.profile))
+		return pr_op_err("Invalid output.profile file.");
+
+#ifndef HAVE_ZLIB
+	if (rpki_config.output.compression == OCM_GZIP)
+		return pr_op_err("Fort was built without zlib, so the output can't be compressed.");
+#endif
+
+	if (rpki_config.output.deltas != NULL &&
+	    !valid_file_or_dir(rpki_config.output.deltas, false, true,
+	    pr_op_errno))
+		return pr_op_err("Invalid output.deltas directory.");
+
 	if (rpki_config.slurm != NULL &&
 	    !valid_file_or_dir(rpki_config.slurm, true, true, pr_op_errno))
 		return pr_op_err("Invalid slurm location.");
@@ -1338,6 +1501,24 @@ config_get_interval_expire(void)
 	return rpki_config.server.interval.expire;
 }
 
+unsigned int
+config_get_deltas_max_count(void)
+{
+	return rpki_config.server.deltas.max_count;
+}
+
+unsigned int
+config_get_deltas_max_age(void)
+{
+	return rpki_config.server.deltas.max_age;
+}
+
+unsigned int
+config_get_deltas_max_memory(void)
+{
+	return rpki_config.server.deltas.max_memory;
+}
+
 char const *
 config_get_slurm(void)
 {
@@ -1573,12 +1754,30 @@ config_get_output_bgpsec(void)
 	return rpki_config.output.bgpsec;
 }
 
+char const *
+config_get_output_profile(void)
+{
+	return rpki_config.output.profile;
+}
+
 enum output_format
 config_get_output_format(void)
 {
 	return rpki_config.output.format;
 }
 
+enum output_compression
+config_get_output_compression(void)
+{
+	return rpki_config.output.compression;
+}
+
+char const *
+config_get_output_deltas(void)
+{
+	return rpki_config.output.deltas;
+}
+
 unsigned int
 config_get_asn1_decode_max_stack(void)
 {
@@ -1603,6 +1802,42 @@ config_get_thread_pool_validation_max(void)
 	return rpki_config.thread_pool.validation.max;
 }
 
+unsigned int
+config_get_thread_pool_rrdp_prefetch_max(void)
+{
+	return rpki_config.thread_pool.rrdp_prefetch.max;
+}
+
+unsigned int
+config_get_thread_pool_rrdp_deltas_max(void)
+{
+	return rpki_config.thread_pool.rrdp_deltas.max;
+}
+
+unsigned int
+config_get_thread_pool_output_max(void)
+{
+	return rpki_config.thread_pool.output.max;
+}
+
+bool
+config_get_metrics_enabled(void)
+{
+	return rpki_config.metrics.enabled;
+}
+
+char const *
+config_get_metrics_address(void)
+{
+	return rpki_config.metrics.address;
+}
+
+char const *
+config_get_metrics_port(void)
+{
+	return rpki_config.metrics.port;
+}
+
 void
 config_set_rsync_enabled(bool value)
 {
@@ -7,6 +7,7 @@
 #include "config/filename_format.h"
 #include "config/log_conf.h"
 #include "config/mode.h"
+#include "config/output_compression.h"
 #include "config/output_format.h"
 #include "config/rsync_strategy.h"
 #include "config/string_array.h"
@@ -24,6 +25,9 @@ unsigned int config_get_validation_interval(void);
 unsigned int config_get_interval_refresh(void);
 unsigned int config_get_interval_retry(void);
 unsigned int config_get_interval_expire(void);
+unsigned int config_get_deltas_max_count(void);
+unsigned int config_get_deltas_max_age(void);
+unsigned int config_get_deltas_max_memory(void);
 char const *config_get_slurm(void);
 
 char const *config_get_tal(void);
@@ -50,11 +54,20 @@ unsigned int config_get_http_retry_count(void);
 unsigned int config_get_http_retry_interval(void);
 char const *config_get_output_roa(void);
 char const *config_get_output_bgpsec(void);
+char const *config_get_output_profile(void);
 enum output_format config_get_output_format(void);
+enum output_compression config_get_output_compression(void);
+char const *config_get_output_deltas(void);
 unsigned int config_get_asn1_decode_max_stack(void);
 unsigned int config_get_stale_repository_period(void);
 unsigned int config_get_thread_pool_server_max(void);
 unsigned int config_get_thread_pool_validation_max(void);
+unsigned int config_get_thread_pool_rrdp_prefetch_max(void);
+unsigned int config_get_thread_pool_rrdp_deltas_max(void);
+unsigned int config_get_thread_pool_output_max(void);
+bool config_get_metrics_enabled(void);
+char const *config_get_metrics_address(void);
+char const *config_get_metrics_port(void);
 
 /* Logging getters */
 bool config_get_op_log_enabled(void);
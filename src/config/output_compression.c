@@ -0,0 +1,66 @@
+#include "config/output_compression.h"
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "config/str.h"
+
+#define OCM_VALUE_NONE "none"
+#define OCM_VALUE_GZIP "gzip"
+
+#define DEREFERENCE(void_value) (*((enum output_compression *) void_value))
+
+static void
+print_output_compression(struct option_field const *field, void *value)
+{
+	char const *str = "<unknown>";
+
+	switch (DEREFERENCE(value)) {
+	case OCM_NONE:
+		str = OCM_VALUE_NONE;
+		break;
+	case OCM_GZIP:
+		str = OCM_VALUE_GZIP;
+		break;
+	}
+
+	pr_op_info("%s: %s", field->name, str);
+}
+
+static int
+parse_argv_output_compression(struct option_field const *field,
+    char const *str, void *result)
+{
+	if (strcmp(str, OCM_VALUE_NONE) == 0)
+		DEREFERENCE(result) = OCM_NONE;
+	else if (strcmp(str, OCM_VALUE_GZIP) == 0)
+		DEREFERENCE(result) = OCM_GZIP;
+	else
+		return pr_op_err("Unknown output compression %s: '%s'",
+		    field->name, str);
+
+	return 0;
+}
+
+static int
+parse_json_output_compression(struct option_field const *opt, json_t *json,
+    void *result)
+{
+	char const *string;
+	int error;
+
+	error = parse_json_string(json, opt->name, &string);
+	return error ? error : parse_argv_output_compression(opt, string,
+	    result);
+}
+
+const struct global_type gt_output_compression = {
+	.has_arg = required_argument,
+	.size = sizeof(enum output_compression),
+	.print = print_output_compression,
+	.parse.argv = parse_argv_output_compression,
+	.parse.json = parse_json_output_compression,
+	.arg_doc = OCM_VALUE_NONE "|" OCM_VALUE_GZIP,
+};
@@ -0,0 +1,15 @@
+#ifndef SRC_CONFIG_OUTPUT_COMPRESSION_H_
+#define SRC_CONFIG_OUTPUT_COMPRESSION_H_
+
+#include "config/types.h"
+
+enum output_compression {
+	/* Plain files */
+	OCM_NONE,
+	/* gzip (zlib) */
+	OCM_GZIP,
+};
+
+extern const struct global_type gt_output_compression;
+
+#endif /* SRC_CONFIG_OUTPUT_COMPRESSION_H_ */
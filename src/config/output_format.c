@@ -9,6 +9,7 @@
 
 #define OFM_VALUE_CSV  "csv"
 #define OFM_VALUE_JSON "json"
+#define OFM_VALUE_BINARY "binary"
 
 #define DEREFERENCE(void_value) (*((enum output_format *) void_value))
 
@@ -24,6 +25,9 @@ print_output_format(struct option_field const *field, void *value)
 	case OFM_JSON:
 		str = OFM_VALUE_JSON;
 		break;
+	case OFM_BINARY:
+		str = OFM_VALUE_BINARY;
+		break;
 	}
 
 	pr_op_info("%s: %s", field->name, str);
@@ -37,6 +41,8 @@ parse_argv_output_format(struct option_field const *field, char const *str,
 		DEREFERENCE(result) = OFM_CSV;
 	else if (strcmp(str, OFM_VALUE_JSON) == 0)
 		DEREFERENCE(result) = OFM_JSON;
+	else if (strcmp(str, OFM_VALUE_BINARY) == 0)
+		DEREFERENCE(result) = OFM_BINARY;
 	else
 		return pr_op_err("Unknown output format %s: '%s'",
 		    field->name, str);
@@ -61,5 +67,5 @@ const struct global_type gt_output_format = {
 	.print = print_output_format,
 	.parse.argv = parse_argv_output_format,
 	.parse.json = parse_json_output_format,
-	.arg_doc = OFM_VALUE_CSV "|" OFM_VALUE_JSON,
+	.arg_doc = OFM_VALUE_CSV "|" OFM_VALUE_JSON "|" OFM_VALUE_BINARY,
 };
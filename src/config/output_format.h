@@ -8,6 +8,8 @@ enum output_format {
 	OFM_CSV,
 	/* JSON format */
 	OFM_JSON,
+	/* Fixed-width records, sorted (see output_printer.c) */
+	OFM_BINARY,
 };
 
 extern const struct global_type gt_output_format;
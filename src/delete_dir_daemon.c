@@ -1,19 +1,29 @@
-#define _XOPEN_SOURCE 500
+#define _GNU_SOURCE
 
 #include "delete_dir_daemon.h"
 
+#include <sys/queue.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
 #include <errno.h>
-#include <ftw.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include "common.h"
 #include "internal_pool.h"
 #include "log.h"
 #include "random.h"
 
-#define MAX_FD_ALLOWED 20
+/* Number of tasks that will work on the deletion of the same set of roots */
+#define DELETE_WORKERS 3
+/* Files a worker deletes before pausing, and the pause (in milliseconds) */
+#define DELETE_BATCH 128
+#define DELETE_PAUSE_MS 5
 
 struct rem_dirs {
 	char **arr;
@@ -21,88 +31,478 @@ struct rem_dirs {
 	size_t arr_set;
 };
 
+/*
+ * A directory whose content must be deleted. Its subdirectories are queued as
+ * separate jobs, so several workers can empty the same tree.
+ */
+struct dir_job {
+	/* Full path; only used by the messages */
+	char *path;
+	/* Relative to @parent's directory, or @path if this is a root */
+	char const *name;
+	/* NULL if this is one of the (renamed) roots */
+	struct dir_job *parent;
+	/*
+	 * Open from the moment the directory is read until it's removed, so the
+	 * subdirectories are opened and removed relative to it. -1 if it
+	 * couldn't be opened (or is in another file system).
+	 */
+	int fd;
+	/* File system of the root; the deletion doesn't leave it */
+	dev_t dev;
+	/*
+	 * Queued or unfinished subdirectories, plus one while the directory
+	 * itself is being read. The directory is removed once it reaches zero.
+	 * Protected by the queue's lock.
+	 */
+	unsigned int pending;
+	STAILQ_ENTRY(dir_job) next;
+};
+
+STAILQ_HEAD(dir_jobs, dir_job);
+
+/*
+ * State shared by the workers deleting a set of roots.
+ *
+ * The workers are tasks of the internal pool, which also serves the RTR
+ * server and the metrics, so they never wait: a worker returns as soon as the
+ * queue is empty, and the one that queues subdirectories starts more workers
+ * (up to DELETE_WORKERS) if needed.
+ */
+struct delete_queue {
+	struct dir_jobs jobs;
+	/* Workers that haven't returned yet; the last one frees the queue */
+	unsigned int workers;
+
+	pthread_mutex_t lock;
+};
+
+static void *delete_worker(void *);
+
+static struct dir_job *
+dir_job_create(char *path, char const *name, struct dir_job *parent)
+{
+	struct dir_job *job;
+
+	job = malloc(sizeof(struct dir_job));
+	if (job == NULL)
+		return NULL;
+
+	job->path = path;
+	job->name = name;
+	job->parent = parent;
+	job->fd = -1;
+	job->dev = (parent != NULL) ? parent->dev : 0;
+	job->pending = 1;
+	return job;
+}
+
+static void
+dir_job_destroy(struct dir_job *job)
+{
+	free(job->path);
+	free(job);
+}
+
+/* Starts another worker, if there's room for it. Call with the lock held. */
+static void
+queue_spawn_worker(struct delete_queue *queue)
+{
+	if (queue->workers >= DELETE_WORKERS)
+		return;
+	if (internal_pool_push_prio(TASK_PRIORITY_LOW, delete_worker, queue))
+		return; /* The running workers will take care of it */
+	queue->workers++;
+}
+
+/*
+ * Subdirectories are queued at the head, so the tree is mostly deleted depth
+ * first, and the number of open directories stays close to its depth.
+ */
+static void
+queue_push(struct delete_queue *queue, struct dir_job *job)
+{
+	pthread_mutex_lock(&queue->lock);
+	job->parent->pending++;
+	STAILQ_INSERT_HEAD(&queue->jobs, job, next);
+	queue_spawn_worker(queue);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+/*
+ * Returns the next job, or NULL if the queue is empty. In the latter case the
+ * calling worker is done; @last tells whether it was the last one.
+ */
+static struct dir_job *
+queue_pop(struct delete_queue *queue, bool *last)
+{
+	struct dir_job *job;
+
+	pthread_mutex_lock(&queue->lock);
+	job = STAILQ_FIRST(&queue->jobs);
+	if (job != NULL) {
+		STAILQ_REMOVE_HEAD(&queue->jobs, next);
+	} else {
+		queue->workers--;
+		*last = (queue->workers == 0);
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return job;
+}
+
+static void
+queue_destroy(struct delete_queue *queue)
+{
+	struct dir_job *job;
+
+	while (!STAILQ_EMPTY(&queue->jobs)) {
+		job = STAILQ_FIRST(&queue->jobs);
+		STAILQ_REMOVE_HEAD(&queue->jobs, next);
+		dir_job_destroy(job);
+	}
+	pthread_mutex_destroy(&queue->lock);
+	free(queue);
+}
+
 static int
-remove_file(char const *location)
+parent_fd(struct dir_job *job)
 {
-	pr_op_debug("Trying to remove file '%s'.", location);
-	if (remove(location))
-		return pr_op_errno(errno, "Couldn't delete file '%s'", location);
-	return 0;
+	return (job->parent != NULL) ? job->parent->fd : AT_FDCWD;
+}
+
+/*
+ * Opens @job's directory, unless it's a symbolic link or it belongs to another
+ * file system (ie. it's a mount point). Returns false if it shouldn't be
+ * touched.
+ */
+static bool
+dir_job_open(struct dir_job *job)
+{
+	struct stat attr;
+
+	job->fd = openat(parent_fd(job), job->name,
+	    O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+	if (job->fd < 0) {
+		pr_op_debug("Couldn't open directory '%s', please delete it manually: %s",
+		    job->path, strerror(errno));
+		return false;
+	}
+
+	if (fstat(job->fd, &attr)) {
+		pr_op_debug("Can't get information of '%s': %s", job->path,
+		    strerror(errno));
+		goto fail;
+	}
+
+	if (job->parent == NULL) {
+		job->dev = attr.st_dev;
+	} else if (attr.st_dev != job->dev) {
+		pr_op_debug("'%s' is in another file system; it won't be deleted.",
+		    job->path);
+		goto fail;
+	}
+
+	return true;
+fail:
+	close(job->fd);
+	job->fd = -1;
+	return false;
+}
+
+/*
+ * Drops the reference @job holds (by itself or by a subdirectory). The
+ * directory is removed when all its subdirectories are gone, which might in
+ * turn release its parent.
+ */
+static void
+dir_job_release(struct delete_queue *queue, struct dir_job *job)
+{
+	struct dir_job *parent;
+	bool done;
+
+	while (job != NULL) {
+		pthread_mutex_lock(&queue->lock);
+		done = (--job->pending == 0);
+		pthread_mutex_unlock(&queue->lock);
+		if (!done)
+			return;
+
+		/* Not opened means it wasn't emptied either */
+		if (job->fd >= 0) {
+			close(job->fd);
+			pr_op_debug("Trying to remove dir '%s'.", job->path);
+			if (unlinkat(parent_fd(job), job->name, AT_REMOVEDIR))
+				pr_op_debug("Couldn't delete directory '%s', please delete it manually: %s",
+				    job->path, strerror(errno));
+		}
+
+		parent = job->parent;
+		dir_job_destroy(job);
+		job = parent;
+	}
+}
+
+/*
+ * Pauses the worker after every DELETE_BATCH deleted files, so a big tree
+ * doesn't monopolize the disk.
+ */
+static void
+throttle(unsigned int *deleted)
+{
+	struct timespec pause;
+
+	if (++(*deleted) < DELETE_BATCH)
+		return;
+
+	*deleted = 0;
+	pause.tv_sec = 0;
+	pause.tv_nsec = DELETE_PAUSE_MS * 1000000L;
+	nanosleep(&pause, NULL);
 }
 
 static int
-remove_dir(char const *location)
+queue_subdir(struct delete_queue *queue, struct dir_job *job, char const *name)
 {
-	pr_op_debug("Trying to remove dir '%s'.", location);
-	if (rmdir(location))
-		return pr_op_errno(errno, "Couldn't delete directory '%s'",
-		    location);
+	struct dir_job *child;
+	char *path;
+	size_t parent_len;
+	size_t path_len;
+
+	parent_len = strlen(job->path);
+	path_len = parent_len + 1 + strlen(name) + 1;
+	path = malloc(path_len);
+	if (path == NULL)
+		return pr_enomem();
+	snprintf(path, path_len, "%s/%s", job->path, name);
+
+	child = dir_job_create(path, path + parent_len + 1, job);
+	if (child == NULL) {
+		free(path);
+		return pr_enomem();
+	}
+
+	queue_push(queue, child);
 	return 0;
 }
 
-static int
-traverse(char const *path, struct stat const *sb, int flag, struct FTW *ftwbuf)
+/*
+ * Deletes the files of @job's (already open) directory, relative to its fd,
+ * and queues its subdirectories.
+ */
+static void
+empty_dir(struct delete_queue *queue, struct dir_job *job,
+    unsigned int *deleted)
 {
-	/*
-	 * FTW_SLN:
-	 *   Will never be present since FTW_PHYS flag is utilized
-	 */
-	switch (flag) {
-	case FTW_DP:
-		return remove_dir(path);
-	case FTW_F:
-		return remove_file(path);
-	case FTW_DNR:
-		return pr_op_err("Can't access '%s', stop deletion.", path);
-	case FTW_NS:
-		return pr_op_err("Can't get information of '%s', stop deletion.",
-		    path);
-	case FTW_SL:
-		return pr_op_err("Can't delete '%s' since is a symbolic link, stop deletion.",
-		    path);
-	case FTW_D:
-		return pr_op_err("Can't delete '%s' dir before deleting its content.",
-		    path);
-	default:
-		return pr_op_warn("Unknown path flag %d, doing nothing to '%s'.",
-		    flag, path);
+	DIR *dir;
+	struct dirent *entry;
+	struct stat attr;
+	bool is_dir;
+	int fd;
+
+	/* The directory stream closes its fd; @job's must outlive it */
+	fd = dup(job->fd);
+	if (fd < 0) {
+		pr_op_debug("Couldn't read directory '%s', please delete it manually: %s",
+		    job->path, strerror(errno));
+		return;
+	}
+
+	dir = fdopendir(fd);
+	if (dir == NULL) {
+		pr_op_debug("Couldn't read directory '%s', please delete it manually: %s",
+		    job->path, strerror(errno));
+		close(fd);
+		return;
+	}
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 ||
+		    strcmp(entry->d_name, "..") == 0)
+			continue;
+
+		if (entry->d_type != DT_UNKNOWN) {
+			is_dir = (entry->d_type == DT_DIR);
+			if (entry->d_type == DT_LNK)
+				goto symlink;
+		} else {
+			if (fstatat(job->fd, entry->d_name, &attr,
+			    AT_SYMLINK_NOFOLLOW)) {
+				pr_op_debug("Can't get information of '%s/%s': %s",
+				    job->path, entry->d_name, strerror(errno));
+				continue;
+			}
+			is_dir = S_ISDIR(attr.st_mode);
+			if (S_ISLNK(attr.st_mode))
+				goto symlink;
+		}
+
+		if (is_dir) {
+			queue_subdir(queue, job, entry->d_name);
+			continue;
+		}
+
+		pr_op_debug("Trying to remove file '%s/%s'.", job->path,
+		    entry->d_name);
+		if (unlinkat(job->fd, entry->d_name, 0))
+			pr_op_debug("Couldn't delete file '%s/%s': %s",
+			    job->path, entry->d_name, strerror(errno));
+		throttle(deleted);
+		continue;
+
+symlink:
+		pr_op_debug("Can't delete '%s/%s' since is a symbolic link.",
+		    job->path, entry->d_name);
 	}
+
+	closedir(dir);
 }
 
+#ifdef __linux__
+/* See ioprio_set(2); glibc doesn't provide wrappers nor constants. */
+#define IOPRIO_CLASS_SHIFT	13
+#define IOPRIO_CLASS_IDLE	3
+#define IOPRIO_WHO_PROCESS	1
+
+/*
+ * Moves the calling thread to the idle I/O scheduling class, so the disk
+ * serves validation reads first. Returns the previous priority, or -1 if it
+ * couldn't be changed.
+ */
+static int
+io_priority_lower(void)
+{
+	int prev;
+
+	prev = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+	if (prev < 0)
+		return -1;
+	if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+	    IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) < 0)
+		return -1;
+
+	return prev;
+}
+
+/* The thread belongs to a pool, so give it back as it was found. */
+static void
+io_priority_restore(int prev)
+{
+	if (prev >= 0)
+		syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, prev);
+}
+#else
+static int
+io_priority_lower(void)
+{
+	return -1;
+}
+
+static void
+io_priority_restore(int prev)
+{
+	/* No-op */
+}
+#endif
+
 static void *
-remove_from_root(void *arg)
+delete_worker(void *arg)
 {
-	struct rem_dirs *root_arg = arg;
-	char **dirs_arr;
-	size_t len, i;
-	int error;
+	struct delete_queue *queue = arg;
+	struct dir_job *job;
+	unsigned int deleted;
+	int prio;
+	bool last;
+
+	prio = io_priority_lower();
+	deleted = 0;
+
+	while ((job = queue_pop(queue, &last)) != NULL) {
+		if (dir_job_open(job))
+			empty_dir(queue, job, &deleted);
+		dir_job_release(queue, job);
+	}
 
-	dirs_arr = root_arg->arr;
-	len = root_arg->arr_set;
-
-	/* Release received arg */
-	free(root_arg);
-
-	for (i = 0; i < len; i++) {
-		error = nftw(dirs_arr[i], traverse, MAX_FD_ALLOWED,
-		    FTW_DEPTH|FTW_MOUNT|FTW_PHYS);
-		if (error) {
-			if (errno)
-				pr_op_debug("Error deleting directory '%s', please delete it manually: %s",
-				    dirs_arr[i], strerror(errno));
-			else
-				pr_op_debug("Couldn't delete directory '%s', please delete it manually",
-				    dirs_arr[i]);
-		}
-		/* Release at once, won't be needed anymore */
-		free(dirs_arr[i]);
+	io_priority_restore(prio);
+
+	if (last) {
+		pr_op_debug("Done removing dirs.");
+		queue_destroy(queue);
 	}
 
-	pr_op_debug("Done removing dirs.");
-	free(dirs_arr);
 	return NULL;
 }
 
+static int
+queue_create(struct delete_queue **result)
+{
+	struct delete_queue *tmp;
+	int error;
+
+	tmp = malloc(sizeof(struct delete_queue));
+	if (tmp == NULL)
+		return pr_enomem();
+
+	STAILQ_INIT(&tmp->jobs);
+	tmp->workers = 0;
+
+	error = pthread_mutex_init(&tmp->lock, NULL);
+	if (error) {
+		error = pr_op_errno(error, "Calling pthread_mutex_init()");
+		free(tmp);
+		return error;
+	}
+
+	*result = tmp;
+	return 0;
+}
+
+/*
+ * Moves the renamed roots from @rem_dirs to @queue. Returns the number of
+ * roots moved.
+ */
+static size_t
+queue_roots(struct delete_queue *queue, struct rem_dirs *rem_dirs)
+{
+	struct dir_job *job;
+	size_t roots;
+	char *path;
+
+	roots = 0;
+	for (; rem_dirs->arr_set > 0; rem_dirs->arr_set--) {
+		path = rem_dirs->arr[rem_dirs->arr_set - 1];
+		job = dir_job_create(path, path, NULL);
+		if (job == NULL)
+			break;
+		STAILQ_INSERT_HEAD(&queue->jobs, job, next);
+		roots++;
+	}
+
+	return roots;
+}
+
+/*
+ * Starts the workers that will delete the @roots roots at @queue; the rest
+ * will be started as subdirectories are found. Returns error only if none of
+ * them could be started (in which case @queue is still owned by the caller).
+ */
+static int
+start_workers(struct delete_queue *queue, size_t roots)
+{
+	size_t i;
+	int error;
+
+	pthread_mutex_lock(&queue->lock);
+	for (i = 0; i < roots; i++)
+		queue_spawn_worker(queue);
+	error = (queue->workers > 0)
+	    ? 0
+	    : pr_op_err("Couldn't start the directory deletion workers.");
+	pthread_mutex_unlock(&queue->lock);
+
+	return error;
+}
+
 /*
  * Soft/hard error logic utilized, beware to prepare caller:
  * - '> 0' is a soft error
@@ -271,30 +671,55 @@ rem_dirs_destroy(struct rem_dirs *rem_dirs)
  * asynchronously. Also, it works on the best possible effort; some errors are
  * treated as "soft" errors, since the directory deletion still doesn't
  * considers the relations (parent-child) at dirs.
+ *
+ * The roots are renamed here; their content is deleted by up to
+ * DELETE_WORKERS low priority tasks of the internal pool, which share a queue
+ * of directories. The workers throttle themselves and (on Linux) utilize the
+ * idle I/O class, so the deletion of a big tree doesn't slow down the
+ * validation. As nftw(FTW_MOUNT) used to, they don't follow symbolic links nor
+ * leave the file system of each root.
  */
 int
 delete_dir_daemon_start(char **roots, size_t roots_len, char const *workspace)
 {
 	struct rem_dirs *arg;
+	struct delete_queue *queue;
+	size_t queued;
 	int error;
 
 	arg = NULL;
+	queue = NULL;
 	error = rem_dirs_create(roots_len, &arg);
 	if (error)
 		return error;
 
 	error = rename_all_roots(arg, roots, workspace);
-	if (error) {
-		rem_dirs_destroy(arg);
-		return error;
-	}
+	if (error)
+		goto release_dirs;
 
-	/* Thread arg is released at thread */
-	error = internal_pool_push(remove_from_root, (void *) arg);
-	if (error) {
-		rem_dirs_destroy(arg);
-		return error;
+	if (arg->arr_set == 0)
+		goto release_dirs;
+
+	error = queue_create(&queue);
+	if (error)
+		goto release_dirs;
+
+	queued = queue_roots(queue, arg);
+	if (queued == 0) {
+		error = pr_enomem();
+		goto release_queue;
 	}
 
+	/* The queue is released by the last worker */
+	error = start_workers(queue, queued);
+	if (error)
+		goto release_queue;
+
+	rem_dirs_destroy(arg);
 	return 0;
+release_queue:
+	queue_destroy(queue);
+release_dirs:
+	rem_dirs_destroy(arg);
+	return error;
 }
@@ -1,7 +1,9 @@
 #include "http.h"
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <curl/curl.h>
 #include <sys/stat.h>
@@ -9,6 +11,8 @@
 #include "config.h"
 #include "file.h"
 #include "log.h"
+#include "metrics.h"
+#include "profile.h"
 
 /* HTTP Response Code 200 (OK) */
 #define HTTP_OK			200
@@ -17,40 +21,168 @@
 /* HTTP Response Code 400 (Bad Request) */
 #define HTTP_BAD_REQUEST	400
 
+/* Max number of simultaneous transfers at http_download_files() */
+#define HTTP_MULTI_MAX_TRANSFERS	16
+/* Max number of connections per host at http_download_files() */
+#define HTTP_MULTI_MAX_HOST_CONNS	4
+
 typedef size_t (http_write_cb)(unsigned char *, size_t, size_t, void *);
 
 struct http_handler {
 	CURL *curl;
+	/* Does @curl belong to the thread's cache? (see http_easy_init()) */
+	bool cached;
 	char errbuf[CURL_ERROR_SIZE];
 };
 
+/*
+ * DNS cache and TLS sessions shared among all the threads, so that the
+ * handshakes against the same server can be abbreviated.
+ *
+ * (Connections aren't shared here, libcurl doesn't support sharing them
+ * between concurrent threads. Each thread keeps its own easy handle instead,
+ * see @easy_key.)
+ */
+static CURLSH *share;
+static pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+
+/*
+ * Each thread reuses a single easy handle, so that its live connections are
+ * kept between requests (eg. notification, snapshot and deltas of the same
+ * RRDP server).
+ */
+static pthread_key_t easy_key;
+static bool easy_key_initialized;
+
+static void
+share_lock(CURL *handle, curl_lock_data data, curl_lock_access access,
+    void *arg)
+{
+	pthread_mutex_lock(&share_locks[data]);
+}
+
+static void
+share_unlock(CURL *handle, curl_lock_data data, void *arg)
+{
+	pthread_mutex_unlock(&share_locks[data]);
+}
+
+static int
+share_init(void)
+{
+	CURLSHcode res;
+	int i;
+
+	share = curl_share_init();
+	if (share == NULL)
+		return pr_enomem();
+
+	for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		pthread_mutex_init(&share_locks[i], NULL);
+
+	res = curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock);
+	if (res == CURLSHE_OK)
+		res = curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC,
+		    share_unlock);
+	if (res == CURLSHE_OK)
+		res = curl_share_setopt(share, CURLSHOPT_SHARE,
+		    CURL_LOCK_DATA_DNS);
+	if (res != CURLSHE_OK) {
+		pr_op_err("Error initializing curl share (%s)",
+		    curl_share_strerror(res));
+		goto fail;
+	}
+
+	/* Not fatal, the library could be built without TLS sessions support */
+	res = curl_share_setopt(share, CURLSHOPT_SHARE,
+	    CURL_LOCK_DATA_SSL_SESSION);
+	if (res != CURLSHE_OK)
+		pr_op_warn("TLS sessions won't be shared between HTTP requests (%s).",
+		    curl_share_strerror(res));
+
+	return 0;
+fail:
+	curl_share_cleanup(share);
+	share = NULL;
+	for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		pthread_mutex_destroy(&share_locks[i]);
+	return -EINVAL;
+}
+
+static void
+share_cleanup(void)
+{
+	int i;
+
+	if (share == NULL)
+		return;
+
+	curl_share_cleanup(share);
+	share = NULL;
+	for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		pthread_mutex_destroy(&share_locks[i]);
+}
+
+/* Called when a thread (other than the main one) ends */
+static void
+easy_destroy(void *arg)
+{
+	curl_easy_cleanup(arg);
+}
+
 int
 http_init(void)
 {
 	CURLcode res;
+	int error;
+
 	res = curl_global_init(CURL_GLOBAL_SSL);
 	if (res != CURLE_OK)
 		return pr_op_err("Error initializing global curl (%s)",
 		    curl_easy_strerror(res));
 
+	error = share_init();
+	if (error)
+		goto global_cleanup;
+
+	error = pthread_key_create(&easy_key, easy_destroy);
+	if (error) {
+		error = -pr_op_errno(error,
+		    "Calling pthread_key_create() for HTTP");
+		goto share_cleanup;
+	}
+	easy_key_initialized = true;
+
 	return 0;
+share_cleanup:
+	share_cleanup();
+global_cleanup:
+	curl_global_cleanup();
+	return error;
 }
 
 void
 http_cleanup(void)
 {
+	CURL *curl;
+
+	if (easy_key_initialized) {
+		/* Destructors aren't called for the main thread */
+		curl = pthread_getspecific(easy_key);
+		if (curl != NULL) {
+			curl_easy_cleanup(curl);
+			pthread_setspecific(easy_key, NULL);
+		}
+		pthread_key_delete(easy_key);
+		easy_key_initialized = false;
+	}
+	share_cleanup();
 	curl_global_cleanup();
 }
 
-static int
-http_easy_init(struct http_handler *handler)
+static void
+http_easy_setopts(CURL *tmp, struct http_handler *handler)
 {
-	CURL *tmp;
-
-	tmp = curl_easy_init();
-	if (tmp == NULL)
-		return pr_enomem();
-
 	/* Use header always */
 	if (config_get_http_user_agent() != NULL)
 		curl_easy_setopt(tmp, CURLOPT_USERAGENT,
@@ -98,7 +230,65 @@ http_easy_init(struct http_handler *handler)
 	/* Prepare for multithreading, avoid signals */
 	curl_easy_setopt(tmp, CURLOPT_NOSIGNAL, 1L);
 
+	/* Use HTTP/2 if the server supports it (ALPN) */
+	curl_easy_setopt(tmp, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+
+	if (share != NULL)
+		curl_easy_setopt(tmp, CURLOPT_SHARE, share);
+}
+
+/* Creates an easy handle owned by @handler */
+static int
+http_easy_create(struct http_handler *handler)
+{
+	CURL *tmp;
+
+	tmp = curl_easy_init();
+	if (tmp == NULL)
+		return pr_enomem();
+
+	http_easy_setopts(tmp, handler);
 	handler->curl = tmp;
+	handler->cached = false;
+
+	return 0;
+}
+
+/*
+ * Prepares @handler to do a request, using the calling thread's easy handle
+ * (if there's one, otherwise it's created). All of its options are reset,
+ * the only state that survives between requests are the live connections
+ * and caches.
+ */
+static int
+http_easy_init(struct http_handler *handler)
+{
+	CURL *tmp;
+	int error;
+
+	if (!easy_key_initialized)
+		return http_easy_create(handler);
+
+	tmp = pthread_getspecific(easy_key);
+	if (tmp != NULL) {
+		curl_easy_reset(tmp);
+		http_easy_setopts(tmp, handler);
+		handler->curl = tmp;
+		handler->cached = true;
+		return 0;
+	}
+
+	error = http_easy_create(handler);
+	if (error)
+		return error;
+
+	error = pthread_setspecific(easy_key, handler->curl);
+	if (error) {
+		/* Not a big deal, just won't reuse the handle */
+		pr_op_errno(error, "Calling pthread_setspecific() for HTTP");
+		return 0;
+	}
+	handler->cached = true;
 
 	return 0;
 }
@@ -110,23 +300,24 @@ curl_err_string(struct http_handler *handler, CURLcode res)
 	    handler->errbuf : curl_easy_strerror(res);
 }
 
-/*
- * Fetch data from @uri and write result using @cb (which will receive @arg).
- */
-static int
-http_fetch(struct http_handler *handler, char const *uri, long *response_code,
-    long *cond_met, bool log_operation, http_write_cb cb, void *arg)
+static void
+http_fetch_setup(struct http_handler *handler, char const *uri,
+    http_write_cb cb, void *arg)
 {
-	CURLcode res;
-	long unmet = 0;
-
 	handler->errbuf[0] = 0;
 	curl_easy_setopt(handler->curl, CURLOPT_URL, uri);
-	curl_easy_setopt(handler->curl, CURLOPT_WRITEFUNCTION, cb);
+	curl_easy_setopt(handler->curl, CURLOPT_WRITEFUNCTION,
+	    (curl_write_callback) cb);
 	curl_easy_setopt(handler->curl, CURLOPT_WRITEDATA, arg);
+}
+
+/* Handle the result @res of the transfer of @uri. */
+static int
+http_fetch_result(struct http_handler *handler, char const *uri, CURLcode res,
+    long *response_code, long *cond_met, bool log_operation)
+{
+	long unmet = 0;
 
-	pr_val_debug("Doing HTTP GET to '%s'.", uri);
-	res = curl_easy_perform(handler->curl);
 	curl_easy_getinfo(handler->curl, CURLINFO_RESPONSE_CODE, response_code);
 	if (res == CURLE_OK) {
 		if (*response_code != HTTP_OK)
@@ -160,10 +351,32 @@ http_fetch(struct http_handler *handler, char const *uri, long *response_code,
 	return EREQFAILED;
 }
 
+/*
+ * Fetch data from @uri and write result using @cb (which will receive @arg).
+ */
+static int
+http_fetch(struct http_handler *handler, char const *uri, long *response_code,
+    long *cond_met, bool log_operation, http_write_cb cb, void *arg)
+{
+	CURLcode res;
+
+	http_fetch_setup(handler, uri, cb, arg);
+
+	pr_val_debug("Doing HTTP GET to '%s'.", uri);
+	profile_start(PP_FETCH_HTTP, NULL);
+	res = curl_easy_perform(handler->curl);
+	profile_end();
+
+	return http_fetch_result(handler, uri, res, response_code, cond_met,
+	    log_operation);
+}
+
 static void
 http_easy_cleanup(struct http_handler *handler)
 {
-	curl_easy_cleanup(handler->curl);
+	/* The thread's handle is kept, so its connections can be reused */
+	if (!handler->cached)
+		curl_easy_cleanup(handler->curl);
 }
 
 static size_t
@@ -177,30 +390,22 @@ write_cb(unsigned char *content, size_t size, size_t nmemb, void *arg)
 	if (written != nmemb)
 		return -EINVAL;
 
+	metrics_fetch_add_bytes(read);
 	return read;
 }
 
+/*
+ * Create (and open for writing at @out) the temporal file where the content
+ * of @original_file will be downloaded. Its path is set at @result.
+ */
 static int
-__http_download_file(struct rpki_uri *uri, long *response_code, long ims_value,
-    long *cond_met, bool log_operation)
+tmp_file_create(char const *original_file, char **result, FILE **out)
 {
 	char const *tmp_suffix = "_tmp";
-	struct http_handler handler;
 	struct stat stat;
-	FILE *out;
-	unsigned int retries;
-	char const *original_file;
 	char *tmp_file, *tmp;
 	int error;
 
-	retries = 0;
-	*cond_met = 1;
-	if (!config_get_http_enabled()) {
-		*response_code = 0; /* Not 200 code, but also not an error */
-		return 0;
-	}
-
-	original_file = uri_get_local(uri);
 	tmp_file = strdup(original_file);
 	if (tmp_file == NULL)
 		return pr_enomem();
@@ -218,10 +423,68 @@ __http_download_file(struct rpki_uri *uri, long *response_code, long ims_value,
 	if (error)
 		goto release_tmp;
 
-	error = file_write(tmp_file, &out, &stat);
+	error = file_write(tmp_file, out, &stat);
 	if (error)
 		goto delete_dir;
 
+	*result = tmp_file;
+	return 0;
+delete_dir:
+	delete_dir_recursive_bottom_up(tmp_file);
+release_tmp:
+	free(tmp_file);
+	return ENSURE_NEGATIVE(error);
+}
+
+/* Overwrite @original_file with @tmp_file. @tmp_file is released. */
+static int
+tmp_file_commit(char *tmp_file, char const *original_file)
+{
+	int error;
+
+	error = rename(tmp_file, original_file);
+	if (error) {
+		error = errno;
+		pr_val_errno(error, "Renaming temporal file from '%s' to '%s'",
+		    tmp_file, original_file);
+		delete_dir_recursive_bottom_up(tmp_file);
+		free(tmp_file);
+		return ENSURE_NEGATIVE(error);
+	}
+
+	free(tmp_file);
+	return 0;
+}
+
+/* Get rid of @tmp_file (and its empty parent dirs). @tmp_file is released. */
+static void
+tmp_file_discard(char *tmp_file)
+{
+	delete_dir_recursive_bottom_up(tmp_file);
+	free(tmp_file);
+}
+
+static int
+__http_download_file(struct rpki_uri *uri, long *response_code, long ims_value,
+    long *cond_met, bool log_operation)
+{
+	struct http_handler handler;
+	FILE *out;
+	unsigned int retries;
+	char *tmp_file;
+	int error;
+
+	retries = 0;
+	*cond_met = 1;
+	if (!config_get_http_enabled()) {
+		*response_code = 0; /* Not 200 code, but also not an error */
+		return 0;
+	}
+
+	error = tmp_file_create(uri_get_local(uri), &tmp_file, &out);
+	if (error)
+		return error;
+
 	do {
 		error = http_easy_init(&handler);
 		if (error)
@@ -255,26 +518,15 @@ __http_download_file(struct rpki_uri *uri, long *response_code, long ims_value,
 	http_easy_cleanup(&handler);
 	file_close(out);
 
-	if (error)
-		goto delete_dir;
-
-	/* Overwrite the original file */
-	error = rename(tmp_file, original_file);
 	if (error) {
-		error = errno;
-		pr_val_errno(error, "Renaming temporal file from '%s' to '%s'",
-		    tmp_file, original_file);
-		goto delete_dir;
+		tmp_file_discard(tmp_file);
+		return ENSURE_NEGATIVE(error);
 	}
 
-	free(tmp_file);
-	return 0;
+	return tmp_file_commit(tmp_file, uri_get_local(uri));
 close_file:
 	file_close(out);
-delete_dir:
-	delete_dir_recursive_bottom_up(tmp_file);
-release_tmp:
-	free(tmp_file);
+	tmp_file_discard(tmp_file);
 	return ENSURE_NEGATIVE(error);
 }
 
@@ -340,6 +592,231 @@ http_download_file_with_ims(struct rpki_uri *uri, long value,
 
 }
 
+/* An ongoing transfer from http_download_files() */
+struct multi_transfer {
+	struct http_transfer *req;
+	struct http_handler handler;
+	char *tmp_file;
+	FILE *out;
+};
+
+static int
+multi_transfer_start(CURLM *multi, struct multi_transfer *transfer,
+    struct http_transfer *req)
+{
+	CURLMcode res;
+	int error;
+
+	error = tmp_file_create(uri_get_local(req->uri), &transfer->tmp_file,
+	    &transfer->out);
+	if (error)
+		return error;
+
+	error = http_easy_create(&transfer->handler);
+	if (error)
+		goto discard;
+
+	http_fetch_setup(&transfer->handler, uri_get_global(req->uri),
+	    write_cb, transfer->out);
+	/* Wait for a connection to multiplex on, rather than opening another */
+	curl_easy_setopt(transfer->handler.curl, CURLOPT_PIPEWAIT, 1L);
+	curl_easy_setopt(transfer->handler.curl, CURLOPT_PRIVATE, transfer);
+
+	res = curl_multi_add_handle(multi, transfer->handler.curl);
+	if (res != CURLM_OK) {
+		error = pr_val_err("Error adding HTTP transfer '%s': %s",
+		    uri_get_global(req->uri), curl_multi_strerror(res));
+		goto cleanup;
+	}
+
+	pr_val_debug("Doing HTTP GET to '%s'.", uri_get_global(req->uri));
+	transfer->req = req;
+	return 0;
+cleanup:
+	http_easy_cleanup(&transfer->handler);
+discard:
+	file_close(transfer->out);
+	tmp_file_discard(transfer->tmp_file);
+	return error;
+}
+
+static void
+multi_transfer_end(CURLM *multi, struct multi_transfer *transfer,
+    CURLcode res, bool log_operation)
+{
+	struct http_transfer *req = transfer->req;
+	long response_code;
+	long cond_met;
+	int error;
+
+	response_code = 0;
+	cond_met = 1;
+	error = http_fetch_result(&transfer->handler, uri_get_global(req->uri),
+	    res, &response_code, &cond_met, log_operation);
+
+	curl_multi_remove_handle(multi, transfer->handler.curl);
+	http_easy_cleanup(&transfer->handler);
+	file_close(transfer->out);
+
+	if (error) {
+		tmp_file_discard(transfer->tmp_file);
+		req->result = error;
+	} else {
+		req->result = tmp_file_commit(transfer->tmp_file,
+		    uri_get_local(req->uri));
+	}
+	transfer->req = NULL;
+}
+
+/*
+ * Download every @reqs[i] whose result is EREQFAILED, updating its result.
+ * At most HTTP_MULTI_MAX_TRANSFERS transfers are active at the same time.
+ */
+static int
+multi_download_round(CURLM *multi, struct http_transfer *reqs,
+    unsigned int count, bool log_operation)
+{
+	struct multi_transfer transfers[HTTP_MULTI_MAX_TRANSFERS];
+	struct multi_transfer *transfer;
+	CURLMsg *msg;
+	CURLMcode res;
+	unsigned int next, active, t;
+	int running, left;
+	int error;
+
+	for (t = 0; t < HTTP_MULTI_MAX_TRANSFERS; t++)
+		transfers[t].req = NULL;
+
+	next = 0;
+	active = 0;
+	error = 0;
+	do {
+		/* Fill the free slots */
+		for (t = 0; t < HTTP_MULTI_MAX_TRANSFERS && next < count; t++) {
+			if (transfers[t].req != NULL)
+				continue;
+			while (next < count && reqs[next].result != EREQFAILED)
+				next++;
+			if (next == count)
+				break;
+
+			reqs[next].result = multi_transfer_start(multi,
+			    &transfers[t], &reqs[next]);
+			if (reqs[next].result == 0)
+				active++;
+			next++;
+		}
+
+		if (active == 0)
+			break;
+
+		res = curl_multi_perform(multi, &running);
+		if (res == CURLM_OK && running > 0)
+			res = curl_multi_wait(multi, NULL, 0, 1000, NULL);
+		if (res != CURLM_OK) {
+			error = pr_val_err("Error performing HTTP transfers: %s",
+			    curl_multi_strerror(res));
+			break;
+		}
+
+		while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE,
+			    &transfer);
+			multi_transfer_end(multi, transfer, msg->data.result,
+			    log_operation);
+			active--;
+		}
+	} while (true);
+
+	/* Only on error: abort whatever is still running */
+	for (t = 0; t < HTTP_MULTI_MAX_TRANSFERS; t++) {
+		transfer = &transfers[t];
+		if (transfer->req == NULL)
+			continue;
+		curl_multi_remove_handle(multi, transfer->handler.curl);
+		http_easy_cleanup(&transfer->handler);
+		file_close(transfer->out);
+		tmp_file_discard(transfer->tmp_file);
+		transfer->req->result = error;
+	}
+
+	return error;
+}
+
+/*
+ * Download simultaneously (from a single thread) the global URIs of the
+ * @count @reqs into their local paths.
+ *
+ * Transfers to the same server reuse connections (keep-alive), and are
+ * multiplexed over a single connection if the server speaks HTTP/2. Failed
+ * requests are retried according to the http.retry.* configuration.
+ *
+ * The result of each request is stored at @reqs[i].result, with the same
+ * meaning as the result of http_download_file(). Returns nonzero only if
+ * the transfers couldn't be performed at all; even then, the requests that
+ * were completed (and whose files are therefore at their local paths) have
+ * a zero result.
+ */
+int
+http_download_files(struct http_transfer *reqs, unsigned int count,
+    bool log_operation)
+{
+	CURLM *multi;
+	unsigned int retries, failed, i;
+	int error;
+
+	if (!config_get_http_enabled()) {
+		for (i = 0; i < count; i++)
+			reqs[i].result = 0;
+		return 0;
+	}
+
+	/* Mark all as pending */
+	for (i = 0; i < count; i++)
+		reqs[i].result = EREQFAILED;
+
+	multi = curl_multi_init();
+	if (multi == NULL)
+		return pr_enomem();
+
+	curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+	curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+	    (long) HTTP_MULTI_MAX_HOST_CONNS);
+
+	retries = 0;
+	do {
+		profile_start(PP_FETCH_HTTP, NULL);
+		error = multi_download_round(multi, reqs, count,
+		    log_operation);
+		profile_end();
+		if (error)
+			break;
+
+		failed = 0;
+		for (i = 0; i < count; i++)
+			if (reqs[i].result == EREQFAILED)
+				failed++;
+		if (failed == 0)
+			break;
+
+		if (retries == config_get_http_retry_count()) {
+			pr_val_warn("Max HTTP retries (%u) reached on %u of %u requests, won't retry again.",
+			    retries, failed, count);
+			break;
+		}
+		pr_val_warn("Retrying %u HTTP requests in %u seconds, %u attempts remaining.",
+		    failed, config_get_http_retry_interval(),
+		    config_get_http_retry_count() - retries);
+		retries++;
+		sleep(config_get_http_retry_interval());
+	} while (true);
+
+	curl_multi_cleanup(multi);
+	return error;
+}
+
 /*
  * Downloads @remote to the absolute path @dest (no workspace nor directory
  * structure is created).
@@ -12,6 +12,16 @@ void http_cleanup(void);
 int http_download_file(struct rpki_uri *, bool);
 int http_download_file_with_ims(struct rpki_uri *, long, bool);
 
+/* A request of http_download_files() */
+struct http_transfer {
+	/* Global URI is downloaded into the local URI */
+	struct rpki_uri *uri;
+	/* Same as the result of http_download_file() */
+	int result;
+};
+
+int http_download_files(struct http_transfer *, unsigned int, bool);
+
 int http_direct_download(char const *, char const *);
 
 #endif /* SRC_HTTP_HTTP_H_ */
@@ -33,6 +33,13 @@ internal_pool_push(thread_pool_task_cb cb, void *arg)
 	return thread_pool_push(pool, cb, arg);
 }
 
+int
+internal_pool_push_prio(enum task_priority prio, thread_pool_task_cb cb,
+    void *arg)
+{
+	return thread_pool_push_prio(pool, prio, cb, arg);
+}
+
 void
 internal_pool_cleanup(void)
 {
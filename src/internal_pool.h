@@ -5,6 +5,7 @@
 
 int internal_pool_init(void);
 int internal_pool_push(thread_pool_task_cb, void *);
+int internal_pool_push_prio(enum task_priority, thread_pool_task_cb, void *);
 void internal_pool_cleanup(void);
 
 #endif /* SRC_INTERNAL_POOL_H_ */
@@ -2,8 +2,13 @@
 
 #include <openssl/bio.h>
 #include <openssl/err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <syslog.h>
 #include <time.h>
+#include <sys/queue.h>
 
 #include "config.h"
 #include "debug.h"
@@ -32,6 +37,34 @@ static bool val_syslog_enabled;
 static bool op_global_log_enabled;
 static bool val_global_log_enabled;
 
+#define MSG_LEN 512
+
+/*
+ * Once the configuration has been loaded, the messages are not printed by the
+ * threads that produce them. Each thread formats its messages into its own
+ * ring buffer (so it never waits for anyone else), and a writer thread drains
+ * all the rings in batches.
+ *
+ * If a ring fills up, its new messages are dropped (and counted) rather than
+ * stalling the validation.
+ */
+#define LOG_RING_SIZE		(256 * 1024) /* Must be a power of two */
+#define LOG_RECORD_MAX		(LOG_RING_SIZE / 4)
+#define LOG_BATCH_MAX		(64 * 1024)
+/* Writer thread's sleep between drains, in milliseconds */
+#define LOG_WRITER_PERIOD	100
+
+static void log_async_start(void);
+static void log_async_stop(void);
+static void log_async_drain(void);
+static void log_ring_discard(void *);
+static void log_atfork_prepare(void);
+static void log_atfork_parent(void);
+static void log_atfork_child(void);
+
+static pthread_key_t ring_key;
+static bool ring_key_created;
+
 void
 log_setup(void)
 {
@@ -51,6 +84,12 @@ log_setup(void)
 
 	op_global_log_enabled = true;
 	val_global_log_enabled = true;
+
+	/* If these fail, the messages will simply be printed synchronously */
+	ring_key_created = pthread_key_create(&ring_key, log_ring_discard) == 0;
+	if (ring_key_created)
+		pthread_atfork(log_atfork_prepare, log_atfork_parent,
+		    log_atfork_child);
 }
 
 static void
@@ -126,11 +165,14 @@ log_start(void)
 		else
 			op_syslog_enabled = false;
 	}
+
+	log_async_start();
 }
 
 void
 log_teardown(void)
 {
+	log_async_stop();
 	log_disable_op_std();
 	log_disable_val_std();
 	log_disable_syslog();
@@ -139,6 +181,7 @@ log_teardown(void)
 void
 log_flush(void)
 {
+	log_async_drain();
 	if (op_fprintf_enabled || val_fprintf_enabled) {
 		fflush(stdout);
 		fflush(stderr);
@@ -164,61 +207,172 @@ level2struct(int level)
 	return &UNK;
 }
 
+/*
+ * A line that is being printed into a standard stream. It's built in a single
+ * buffer, so that it can be written at once (one call to the stream, and no
+ * interleaving between threads).
+ */
+struct log_line {
+	char *buf;
+	size_t len;
+	size_t capacity;
+	char stack_buf[1024];
+};
+
+static void
+log_line_init(struct log_line *line)
+{
+	line->buf = line->stack_buf;
+	line->len = 0;
+	line->capacity = sizeof(line->stack_buf);
+	line->buf[0] = '\0';
+}
+
 static void
-__fprintf(int level, char const *prefix, bool color_output,
-    char const *format, ...)
+log_line_cleanup(struct log_line *line)
+{
+	if (line->buf != line->stack_buf)
+		free(line->buf);
+}
+
+/* Grow @line (into the heap) so it can hold @needed more characters */
+static bool
+log_line_reserve(struct log_line *line, size_t needed)
+{
+	char *tmp;
+	size_t capacity;
+
+	/* Room for the terminating characters too */
+	capacity = line->len + needed + 16;
+	if (line->buf == line->stack_buf) {
+		tmp = malloc(capacity);
+		if (tmp == NULL)
+			return false;
+		memcpy(tmp, line->buf, line->len + 1);
+	} else {
+		tmp = realloc(line->buf, capacity);
+		if (tmp == NULL)
+			return false;
+	}
+
+	line->buf = tmp;
+	line->capacity = capacity;
+	return true;
+}
+
+/* If memory runs out, the message is truncated */
+static void
+log_line_vappend(struct log_line *line, char const *format, va_list args)
+{
+	va_list copy;
+	int written;
+
+	va_copy(copy, args);
+	written = vsnprintf(line->buf + line->len, line->capacity - line->len,
+	    format, copy);
+	va_end(copy);
+	if (written < 0)
+		return;
+
+	if (line->len + written >= line->capacity) {
+		/* It didn't fit; try again */
+		if (!log_line_reserve(line, written)) {
+			line->len = line->capacity - 1;
+			return;
+		}
+		vsnprintf(line->buf + line->len, line->capacity - line->len,
+		    format, args);
+	}
+
+	line->len += written;
+}
+
+static void
+log_line_append(struct log_line *line, char const *format, ...)
 {
-	struct level const *lvl;
 	va_list args;
+
+	va_start(args, format);
+	log_line_vappend(line, format, args);
+	va_end(args);
+}
+
+static void
+log_line_reset(struct log_line *line)
+{
+	line->len = 0;
+	line->buf[0] = '\0';
+}
+
+/*
+ * Appends the line "[color]<time> <label>[ [@prefix]]: [@file_name: ]<message>
+ * [color reset]\n" to @line.
+ */
+static void
+stream_line_vbuild(struct log_line *line, int level, char const *prefix,
+    char const *file_name, bool color_output, time_t now, const char *format,
+    va_list args)
+{
+	struct level const *lvl;
 	char time_buff[20];
-	time_t now;
 	struct tm stm_buff;
 
 	lvl = level2struct(level);
 
 	if (color_output)
-		fprintf(lvl->stream, "%s", lvl->color);
+		log_line_append(line, "%s", lvl->color);
 
-	now = time(0);
 	if (now != ((time_t) -1)) {
 		localtime_r(&now, &stm_buff);
 		strftime(time_buff, sizeof(time_buff), "%b %e %T", &stm_buff);
-		fprintf(lvl->stream, "%s ", time_buff);
+		log_line_append(line, "%s ", time_buff);
 	}
 
-	fprintf(lvl->stream, "%s", lvl->label);
+	log_line_append(line, "%s", lvl->label);
 	if (prefix)
-		fprintf(lvl->stream, " [%s]", prefix);
-	fprintf(lvl->stream, ": ");
+		log_line_append(line, " [%s]", prefix);
+	log_line_append(line, ": ");
 
-	va_start(args, format);
-	vfprintf(lvl->stream, format, args);
-	va_end(args);
+	if (file_name != NULL)
+		log_line_append(line, "%s: ", file_name);
+	log_line_vappend(line, format, args);
 
 	if (color_output)
-		fprintf(lvl->stream, COLOR_RESET);
+		log_line_append(line, "%s", COLOR_RESET);
+	log_line_append(line, "\n");
+}
 
-	fprintf(lvl->stream, "\n");
-	/* Force flush */
-	if (lvl->stream == stdout)
-		fflush(lvl->stream);
+static void
+stream_line_build(struct log_line *line, int level, char const *prefix,
+    char const *file_name, bool color_output, time_t now, const char *format,
+    ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	stream_line_vbuild(line, level, prefix, file_name, color_output, now,
+	    format, args);
+	va_end(args);
 }
 
-#define MSG_LEN 512
+static void
+stream_write(FILE *stream, struct log_line *line)
+{
+	fwrite(line->buf, 1, line->len, stream);
+	/* Force flush */
+	if (stream == stdout)
+		fflush(stream);
+}
 
 static void
-pr_syslog(int level, char const *prefix, const char *format, int facility,
-    va_list args)
+syslog_write(int level, int facility, char const *prefix,
+    char const *file_name, char const *msg)
 {
-	char const *file_name;
 	struct level const *lvl;
-	char msg[MSG_LEN];
 
-	file_name = fnstack_peek();
 	lvl = level2struct(level);
 
 	/* Can't use vsyslog(); it's not portable. */
-	vsnprintf(msg, MSG_LEN, format, args);
 	if (file_name != NULL) {
 		if (prefix != NULL)
 			syslog(level | facility, "%s [%s]: %s: %s", lvl->label,
@@ -236,44 +390,622 @@ pr_syslog(int level, char const *prefix, const char *format, int facility,
 }
 
 static void
-pr_stream(int level, char const *prefix, const char *format, bool color_output,
-    va_list args)
+syslog_write_simple(int facility, char const *prefix, char const *msg)
 {
-	char const *file_name;
-	char time_buff[20];
 	struct level const *lvl;
-	time_t now;
-	struct tm stm_buff;
 
-	file_name = fnstack_peek();
-	lvl = level2struct(level);
+	lvl = level2struct(LOG_ERR);
+	if (prefix != NULL)
+		syslog(LOG_ERR | facility, "%s [%s]: - %s", lvl->label, prefix,
+		    msg);
+	else
+		syslog(LOG_ERR | facility, "%s: - %s", lvl->label, msg);
+}
 
-	if (color_output)
-		fprintf(lvl->stream, "%s", lvl->color);
+enum log_record_type {
+	/* Nothing to print; the rest of the ring is unused */
+	LRT_PADDING,
+	/* A pr_stream() line */
+	LRT_STREAM,
+	/* A pr_syslog() message */
+	LRT_SYSLOG,
+	/* A pr_simple_syslog() message */
+	LRT_SYSLOG_SIMPLE,
+};
 
-	now = time(0);
-	if (now != ((time_t) -1)) {
-		localtime_r(&now, &stm_buff);
-		strftime(time_buff, sizeof(time_buff), "%b %e %T", &stm_buff);
-		fprintf(lvl->stream, "%s ", time_buff);
+/* A message, waiting in a ring to be printed by the writer thread */
+struct log_record {
+	/* Length of the whole record (header included), always aligned */
+	size_t size;
+	enum log_record_type type;
+	int level;
+	int facility;
+	bool color;
+	bool has_prefix;
+	bool has_file_name;
+	time_t time;
+	/* "[prefix\0][file_name\0]message\0" */
+	char text[];
+};
+
+#define RECORD_ALIGN(len) (((len) + 7) & ~((size_t) 7))
+
+/*
+ * Single producer (the owner thread), single consumer (whoever holds
+ * drain_lock) circular buffer of log records.
+ */
+struct log_ring {
+	char *buf;
+	/* Written by the producer only */
+	atomic_size_t head;
+	/* Written by the consumer only */
+	atomic_size_t tail;
+	/* The owner thread died; free the ring once it's empty */
+	atomic_bool orphan;
+	SLIST_ENTRY(log_ring) next;
+};
+
+SLIST_HEAD(log_rings, log_ring);
+
+/* Threads whose ring is this one print synchronously (eg. the writer) */
+static struct log_ring sync_ring;
+
+static struct log_rings rings = SLIST_HEAD_INITIALIZER(rings);
+/* Protects @rings */
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Only one drainer at a time */
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The writer thread is supposed to be running */
+static atomic_bool async_wanted;
+/* The writer thread is actually running (in this process) */
+static atomic_bool async_enabled;
+/* Messages dropped because their ring was full */
+static atomic_uint dropped;
+
+static pthread_t writer;
+/* Protects @writer_stop, and the creation and destruction of @writer */
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static bool writer_stop;
+/* A ring is getting full; the writer shouldn't wait for its next period */
+static atomic_bool writer_kicked;
+
+static void *log_writer(void *);
+
+static bool
+log_async_resume(void)
+{
+	bool enabled;
+
+	if (!atomic_load(&async_wanted))
+		return false;
+
+	pthread_mutex_lock(&writer_lock);
+	if (!atomic_load(&async_enabled)) {
+		writer_stop = false;
+		if (pthread_create(&writer, NULL, log_writer, NULL) == 0)
+			atomic_store(&async_enabled, true);
+		else /* Don't try again; print synchronously */
+			atomic_store(&async_wanted, false);
 	}
+	enabled = atomic_load(&async_enabled);
+	pthread_mutex_unlock(&writer_lock);
 
-	fprintf(lvl->stream, "%s", lvl->label);
-	if (prefix)
-		fprintf(lvl->stream, " [%s]", prefix);
-	fprintf(lvl->stream, ": ");
+	return enabled;
+}
 
-	if (file_name != NULL)
-		fprintf(lvl->stream, "%s: ", file_name);
-	vfprintf(lvl->stream, format, args);
+static void
+log_async_start(void)
+{
+	static bool atexit_registered = false;
 
-	if (color_output)
-		fprintf(lvl->stream, "%s", COLOR_RESET);
+	if (!ring_key_created)
+		return;
 
-	fprintf(lvl->stream, "\n");
-	/* Force flush */
-	if (lvl->stream == stdout)
-		fflush(lvl->stream);
+	/* Print whatever is left when somebody calls exit() */
+	if (!atexit_registered)
+		atexit_registered = (atexit(log_flush) == 0);
+
+	atomic_store(&async_wanted, true);
+	log_async_resume();
+}
+
+static void
+log_async_stop(void)
+{
+	atomic_store(&async_wanted, false);
+
+	pthread_mutex_lock(&writer_lock);
+	if (!atomic_load(&async_enabled)) {
+		pthread_mutex_unlock(&writer_lock);
+		return;
+	}
+	writer_stop = true;
+	pthread_cond_signal(&writer_cond);
+	pthread_mutex_unlock(&writer_lock);
+
+	pthread_join(writer, NULL);
+	atomic_store(&async_enabled, false);
+
+	log_async_drain();
+}
+
+static void
+log_writer_kick(void)
+{
+	if (atomic_exchange(&writer_kicked, true))
+		return;
+
+	pthread_mutex_lock(&writer_lock);
+	pthread_cond_signal(&writer_cond);
+	pthread_mutex_unlock(&writer_lock);
+}
+
+/* Returns NULL if the calling thread should print synchronously. */
+static struct log_ring *
+log_ring_get(void)
+{
+	struct log_ring *ring;
+
+	if (!atomic_load(&async_enabled) && !log_async_resume())
+		return NULL;
+
+	ring = pthread_getspecific(ring_key);
+	if (ring == &sync_ring)
+		return NULL;
+	if (ring != NULL)
+		return ring;
+
+	ring = malloc(sizeof(struct log_ring));
+	if (ring == NULL)
+		return NULL;
+	ring->buf = malloc(LOG_RING_SIZE);
+	if (ring->buf == NULL)
+		goto free_ring;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	atomic_init(&ring->orphan, false);
+
+	if (pthread_setspecific(ring_key, ring) != 0)
+		goto free_buf;
+
+	pthread_mutex_lock(&rings_lock);
+	SLIST_INSERT_HEAD(&rings, ring, next);
+	pthread_mutex_unlock(&rings_lock);
+
+	return ring;
+
+free_buf:
+	free(ring->buf);
+free_ring:
+	free(ring);
+	return NULL;
+}
+
+/* Thread-specific data destructor */
+static void
+log_ring_discard(void *arg)
+{
+	struct log_ring *ring = arg;
+
+	/* The drainer will release it */
+	if (ring != &sync_ring)
+		atomic_store(&ring->orphan, true);
+}
+
+static size_t
+text_len(char const *str)
+{
+	return (str != NULL) ? (strlen(str) + 1) : 0;
+}
+
+/*
+ * Formats the message into the calling thread's ring.
+ *
+ * Returns false if the message should be printed synchronously instead, in
+ * which case @args is left untouched.
+ */
+static bool
+log_async_push(enum log_record_type type, int level, int facility,
+    bool color, char const *prefix, char const *file_name,
+    char const *format, va_list args)
+{
+	struct log_ring *ring;
+	struct log_record *record;
+	struct log_line msg;
+	size_t prefix_len, file_name_len, msg_len;
+	size_t size, head, tail, offset, skip;
+	char *text;
+
+	ring = log_ring_get();
+	if (ring == NULL)
+		return false;
+
+	log_line_init(&msg);
+	log_line_vappend(&msg, format, args);
+
+	prefix_len = text_len(prefix);
+	file_name_len = text_len(file_name);
+	size = sizeof(struct log_record) + prefix_len + file_name_len;
+	if (size >= LOG_RECORD_MAX) {
+		atomic_fetch_add(&dropped, 1);
+		goto end;
+	}
+	/* Truncate huge messages */
+	msg_len = msg.len;
+	if (size + msg_len + 1 > LOG_RECORD_MAX)
+		msg_len = LOG_RECORD_MAX - size - 1;
+	size = RECORD_ALIGN(size + msg_len + 1);
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	offset = head & (LOG_RING_SIZE - 1);
+
+	/* Records are never split; skip the end of the ring if needed */
+	skip = LOG_RING_SIZE - offset;
+	if (skip >= size)
+		skip = 0;
+
+	if (LOG_RING_SIZE - (head - tail) < skip + size) {
+		atomic_fetch_add(&dropped, 1);
+		log_writer_kick();
+		goto end;
+	}
+
+	if (skip > 0) {
+		if (skip >= sizeof(struct log_record)) {
+			record = (struct log_record *) (ring->buf + offset);
+			record->size = skip;
+			record->type = LRT_PADDING;
+		}
+		head += skip;
+		offset = 0;
+	}
+
+	record = (struct log_record *) (ring->buf + offset);
+	record->size = size;
+	record->type = type;
+	record->level = level;
+	record->facility = facility;
+	record->color = color;
+	record->has_prefix = (prefix != NULL);
+	record->has_file_name = (file_name != NULL);
+	record->time = time(0);
+
+	text = record->text;
+	if (prefix != NULL) {
+		memcpy(text, prefix, prefix_len);
+		text += prefix_len;
+	}
+	if (file_name != NULL) {
+		memcpy(text, file_name, file_name_len);
+		text += file_name_len;
+	}
+	memcpy(text, msg.buf, msg_len);
+	text[msg_len] = '\0';
+
+	head += size;
+	atomic_store_explicit(&ring->head, head, memory_order_release);
+
+	if (head - tail >= LOG_RING_SIZE / 2)
+		log_writer_kick();
+
+end:
+	log_line_cleanup(&msg);
+	return true;
+}
+
+static bool
+log_async_pushf(enum log_record_type type, int level, int facility,
+    char const *prefix, char const *format, ...)
+{
+	va_list args;
+	bool pushed;
+
+	va_start(args, format);
+	pushed = log_async_push(type, level, facility, false, prefix, NULL,
+	    format, args);
+	va_end(args);
+
+	return pushed;
+}
+
+/* The writer's output, accumulated so each stream is written at once */
+struct log_batch {
+	struct log_line out;
+	struct log_line err;
+};
+
+static void
+log_batch_flush(struct log_batch *batch)
+{
+	if (batch->out.len > 0) {
+		stream_write(stdout, &batch->out);
+		log_line_reset(&batch->out);
+	}
+	if (batch->err.len > 0) {
+		stream_write(stderr, &batch->err);
+		log_line_reset(&batch->err);
+	}
+}
+
+static void
+log_record_print(struct log_record *record, struct log_batch *batch)
+{
+	char const *prefix;
+	char const *file_name;
+	char const *msg;
+	struct log_line *line;
+	struct log_line *other;
+	FILE *other_stream;
+
+	msg = record->text;
+	prefix = NULL;
+	if (record->has_prefix) {
+		prefix = msg;
+		msg += strlen(msg) + 1;
+	}
+	file_name = NULL;
+	if (record->has_file_name) {
+		file_name = msg;
+		msg += strlen(msg) + 1;
+	}
+
+	switch (record->type) {
+	case LRT_STREAM:
+		/* Don't reorder the lines when the streams are merged */
+		if (level2struct(record->level)->stream == stdout) {
+			line = &batch->out;
+			other = &batch->err;
+			other_stream = stderr;
+		} else {
+			line = &batch->err;
+			other = &batch->out;
+			other_stream = stdout;
+		}
+		if (other->len > 0) {
+			stream_write(other_stream, other);
+			log_line_reset(other);
+		}
+		stream_line_build(line, record->level, prefix, file_name,
+		    record->color, record->time, "%s", msg);
+		if (line->len >= LOG_BATCH_MAX)
+			log_batch_flush(batch);
+		break;
+	case LRT_SYSLOG:
+		syslog_write(record->level, record->facility, prefix,
+		    file_name, msg);
+		break;
+	case LRT_SYSLOG_SIMPLE:
+		syslog_write_simple(record->facility, prefix, msg);
+		break;
+	case LRT_PADDING:
+		break;
+	}
+}
+
+static void
+log_ring_drain(struct log_ring *ring, struct log_batch *batch)
+{
+	struct log_record *record;
+	size_t head, tail, offset;
+
+	tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+	while (tail != head) {
+		offset = tail & (LOG_RING_SIZE - 1);
+		if (LOG_RING_SIZE - offset < sizeof(struct log_record)) {
+			/* Too small for a padding record */
+			tail += LOG_RING_SIZE - offset;
+			continue;
+		}
+
+		record = (struct log_record *) (ring->buf + offset);
+		log_record_print(record, batch);
+		tail += record->size;
+	}
+
+	atomic_store_explicit(&ring->tail, tail, memory_order_release);
+}
+
+/* Printed directly, since queueing it could get it dropped as well */
+static void
+log_dropped_report(unsigned int count)
+{
+	struct log_line line;
+	char msg[MSG_LEN];
+
+	if (!op_global_log_enabled)
+		return;
+
+	snprintf(msg, MSG_LEN,
+	    "%u log messages were dropped (the log buffers were full).",
+	    count);
+
+	if (op_syslog_enabled)
+		syslog_write(LOG_ERR, config_get_op_log_facility(),
+		    config_get_op_log_tag(), NULL, msg);
+	if (op_fprintf_enabled) {
+		log_line_init(&line);
+		stream_line_build(&line, LOG_ERR, config_get_op_log_tag(), NULL,
+		    config_get_op_log_color_output(), time(0), "%s", msg);
+		stream_write(level2struct(LOG_ERR)->stream, &line);
+		log_line_cleanup(&line);
+	}
+}
+
+/* Prints all the queued messages. Requires drain_lock. */
+static void
+__log_async_drain(void)
+{
+	struct log_batch batch;
+	struct log_ring *ring, *prev, *tmp;
+	unsigned int count;
+	bool orphan;
+
+	log_line_init(&batch.out);
+	log_line_init(&batch.err);
+
+	pthread_mutex_lock(&rings_lock);
+	prev = NULL;
+	ring = SLIST_FIRST(&rings);
+	while (ring != NULL) {
+		orphan = atomic_load(&ring->orphan);
+		log_ring_drain(ring, &batch);
+		tmp = ring;
+		ring = SLIST_NEXT(ring, next);
+
+		if (!orphan) {
+			prev = tmp;
+			continue;
+		}
+
+		if (prev == NULL)
+			SLIST_REMOVE_HEAD(&rings, next);
+		else
+			SLIST_NEXT(prev, next) = ring;
+		free(tmp->buf);
+		free(tmp);
+	}
+	pthread_mutex_unlock(&rings_lock);
+
+	log_batch_flush(&batch);
+	log_line_cleanup(&batch.out);
+	log_line_cleanup(&batch.err);
+
+	count = atomic_exchange(&dropped, 0);
+	if (count > 0)
+		log_dropped_report(count);
+}
+
+static void
+log_async_drain(void)
+{
+	pthread_mutex_lock(&drain_lock);
+	__log_async_drain();
+	pthread_mutex_unlock(&drain_lock);
+}
+
+static void *
+log_writer(void *arg)
+{
+	struct timespec deadline;
+
+	/* Don't let the writer queue its own messages */
+	pthread_setspecific(ring_key, &sync_ring);
+
+	pthread_mutex_lock(&writer_lock);
+	while (!writer_stop) {
+		if (!atomic_load(&writer_kicked)) {
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_nsec += LOG_WRITER_PERIOD * 1000000L;
+			if (deadline.tv_nsec >= 1000000000L) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&writer_cond, &writer_lock,
+			    &deadline);
+			if (writer_stop)
+				break;
+		}
+		atomic_store(&writer_kicked, false);
+		pthread_mutex_unlock(&writer_lock);
+
+		log_async_drain();
+
+		pthread_mutex_lock(&writer_lock);
+	}
+	pthread_mutex_unlock(&writer_lock);
+
+	return NULL;
+}
+
+/*
+ * Print everything before forking, so the child doesn't inherit (and print
+ * again) the parent's messages. Also, make sure the child doesn't inherit the
+ * locks in a locked state.
+ */
+static void
+log_atfork_prepare(void)
+{
+	pthread_mutex_lock(&drain_lock);
+	__log_async_drain();
+	pthread_mutex_lock(&rings_lock);
+	pthread_mutex_lock(&writer_lock);
+}
+
+static void
+log_atfork_parent(void)
+{
+	pthread_mutex_unlock(&writer_lock);
+	pthread_mutex_unlock(&rings_lock);
+	pthread_mutex_unlock(&drain_lock);
+}
+
+static void
+log_atfork_child(void)
+{
+	struct log_ring *ring;
+
+	/* Whatever made it to the rings after the drain belongs to the parent */
+	SLIST_FOREACH(ring, &rings, next)
+		atomic_store(&ring->tail, atomic_load(&ring->head));
+
+	/* The writer didn't survive; the next message will spawn another one */
+	atomic_store(&async_enabled, false);
+	atomic_store(&writer_kicked, false);
+	pthread_cond_init(&writer_cond, NULL);
+
+	pthread_mutex_unlock(&writer_lock);
+	pthread_mutex_unlock(&rings_lock);
+	pthread_mutex_unlock(&drain_lock);
+}
+
+static void
+pr_stream(int level, char const *prefix, char const *file_name,
+    bool color_output, const char *format, va_list args)
+{
+	struct log_line line;
+
+	if (log_async_push(LRT_STREAM, level, 0, color_output, prefix,
+	    file_name, format, args))
+		return;
+
+	log_line_init(&line);
+	stream_line_vbuild(&line, level, prefix, file_name, color_output,
+	    time(0), format, args);
+	stream_write(level2struct(level)->stream, &line);
+	log_line_cleanup(&line);
+}
+
+static void
+__fprintf(int level, char const *prefix, bool color_output,
+    char const *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	pr_stream(level, prefix, NULL, color_output, format, args);
+	va_end(args);
+}
+
+static void
+pr_syslog(int level, char const *prefix, const char *format, int facility,
+    va_list args)
+{
+	char const *file_name;
+	char msg[MSG_LEN];
+
+	file_name = fnstack_peek();
+
+	if (log_async_push(LRT_SYSLOG, level, facility, false, prefix,
+	    file_name, format, args))
+		return;
+
+	vsnprintf(msg, MSG_LEN, format, args);
+	syslog_write(level, facility, prefix, file_name, msg);
 }
 
 #define PR_OP_SIMPLE(level)						\
@@ -298,7 +1030,8 @@ pr_stream(int level, char const *prefix, const char *format, bool color_output,
 									\
 		if (op_fprintf_enabled) {				\
 			va_start(args, format);				\
-			pr_stream(level, prefix, format, color, args);	\
+			pr_stream(level, prefix, fnstack_peek(), color,	\
+			    format, args);				\
 			va_end(args);					\
 		}							\
 	} while (0)
@@ -326,7 +1059,8 @@ pr_stream(int level, char const *prefix, const char *format, bool color_output,
 									\
 		if (val_fprintf_enabled) {				\
 			va_start(args, format);				\
-			pr_stream(level, prefix, format, color, args);	\
+			pr_stream(level, prefix, fnstack_peek(), color,	\
+			    format, args);				\
 			va_end(args);					\
 		}							\
 	} while (0)
@@ -334,29 +1068,49 @@ pr_stream(int level, char const *prefix, const char *format, bool color_output,
 bool
 log_val_debug_enabled(void)
 {
-	return config_get_val_log_level() >= LOG_DEBUG;
+#ifdef DISABLE_DEBUG_LOG
+	return false;
+#else
+	return val_global_log_enabled &&
+	    config_get_val_log_level() >= LOG_DEBUG;
+#endif
+}
+
+bool
+log_val_info_enabled(void)
+{
+	return val_global_log_enabled &&
+	    config_get_val_log_level() >= LOG_INFO;
 }
 
 bool
 log_op_debug_enabled(void)
 {
-	return config_get_op_log_level() >= LOG_DEBUG;
+#ifdef DISABLE_DEBUG_LOG
+	return false;
+#else
+	return op_global_log_enabled &&
+	    config_get_op_log_level() >= LOG_DEBUG;
+#endif
 }
 
 bool
 log_op_info_enabled(void)
 {
-	return config_get_op_log_level() >= LOG_INFO;
+	return op_global_log_enabled &&
+	    config_get_op_log_level() >= LOG_INFO;
 }
 
+/* Don't call directly; use pr_op_debug() */
 void
-pr_op_debug(const char *format, ...)
+__pr_op_debug(const char *format, ...)
 {
 	PR_OP_SIMPLE(LOG_DEBUG);
 }
 
+/* Don't call directly; use pr_op_info() */
 void
-pr_op_info(const char *format, ...)
+__pr_op_info(const char *format, ...)
 {
 	PR_OP_SIMPLE(LOG_INFO);
 }
@@ -382,14 +1136,16 @@ pr_op_err(const char *format, ...)
 	return -EINVAL;
 }
 
+/* Don't call directly; use pr_val_debug() */
 void
-pr_val_debug(const char *format, ...)
+__pr_val_debug(const char *format, ...)
 {
 	PR_VAL_SIMPLE(LOG_DEBUG);
 }
 
+/* Don't call directly; use pr_val_info() */
 void
-pr_val_info(const char *format, ...)
+__pr_val_info(const char *format, ...)
 {
 	PR_VAL_SIMPLE(LOG_INFO);
 }
@@ -418,14 +1174,11 @@ pr_val_err(const char *format, ...)
 static void
 pr_simple_syslog(int level, int facility, char const *prefix, const char *msg)
 {
-	struct level const *lvl;
+	if (log_async_pushf(LRT_SYSLOG_SIMPLE, level, facility, prefix, "%s",
+	    msg))
+		return;
 
-	lvl = level2struct(LOG_ERR);
-	if (prefix != NULL)
-		syslog(LOG_ERR | facility, "%s [%s]: - %s", lvl->label, prefix,
-		    msg);
-	else
-		syslog(LOG_ERR | facility, "%s: - %s", lvl->label, msg);
+	syslog_write_simple(facility, prefix, msg);
 }
 
 /**
@@ -598,6 +1351,7 @@ pr_enomem(void)
 		__fprintf(LOG_ERR, config_get_op_log_tag(),
 		    config_get_op_log_color_output(),
 		    "Out of memory.\n");
+	log_flush();
 	print_stack_trace();
 	exit(ENOMEM);
 }
@@ -609,6 +1363,7 @@ __dead void
 pr_crit(const char *format, ...)
 {
 	PR_OP_SIMPLE(LOG_CRIT);
+	log_flush();
 	print_stack_trace();
 	exit(-1);
 }
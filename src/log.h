@@ -42,7 +42,7 @@ void log_setup(void);
 void log_start(void);
 void log_teardown(void);
 
-/* Call to flush the stdout/stderr streams */
+/* Prints the queued messages, then flushes the stdout/stderr streams */
 void log_flush(void);
 
 /*
@@ -54,13 +54,43 @@ void log_flush(void);
  * Check if debug or info are enabled, useful to avoid boilerplate code
  */
 bool log_val_debug_enabled(void);
+bool log_val_info_enabled(void);
 bool log_op_debug_enabled(void);
 bool log_op_info_enabled(void);
 
+/*
+ * The debug and info printers are macros, so that the level is checked before
+ * the arguments are evaluated (printable URIs, addresses, etc. can be costly,
+ * and these messages are mostly disabled).
+ *
+ * Compile with -DDISABLE_DEBUG_LOG (eg. `make FORT_FLAGS='-DDISABLE_DEBUG_LOG'`)
+ * to remove the debug messages from the binary altogether. The format is still
+ * checked by the compiler, though.
+ */
+#define PR_IF_ENABLED(enabled, printer, ...)				\
+	do {								\
+		if (enabled())						\
+			printer(__VA_ARGS__);				\
+	} while (0)
+
+#ifdef DISABLE_DEBUG_LOG
+#define PR_DEBUG_IF_ENABLED(enabled, printer, ...)			\
+	do {								\
+		if (0)							\
+			printer(__VA_ARGS__);				\
+	} while (0)
+#else
+#define PR_DEBUG_IF_ENABLED PR_IF_ENABLED
+#endif
+
 /* Debug messages, useful for devs or to track a specific problem */
-void pr_op_debug(const char *, ...) CHECK_FORMAT(1, 2);
+#define pr_op_debug(...)						\
+	PR_DEBUG_IF_ENABLED(log_op_debug_enabled, __pr_op_debug, __VA_ARGS__)
+void __pr_op_debug(const char *, ...) CHECK_FORMAT(1, 2);
 /* Non-errors deemed useful to the user. */
-void pr_op_info(const char *, ...) CHECK_FORMAT(1, 2);
+#define pr_op_info(...)							\
+	PR_IF_ENABLED(log_op_info_enabled, __pr_op_info, __VA_ARGS__)
+void __pr_op_info(const char *, ...) CHECK_FORMAT(1, 2);
 /* Issues that did not trigger RPKI object rejection. */
 int pr_op_warn(const char *, ...) CHECK_FORMAT(1, 2);
 /* Errors that trigger RPKI object rejection. */
@@ -69,9 +99,13 @@ int pr_op_errno(int, const char *, ...) CHECK_FORMAT(2, 3);
 int op_crypto_err(const char *, ...) CHECK_FORMAT(1, 2);
 
 /* Debug messages, useful for devs or to track a specific problem */
-void pr_val_debug(const char *, ...) CHECK_FORMAT(1, 2);
+#define pr_val_debug(...)						\
+	PR_DEBUG_IF_ENABLED(log_val_debug_enabled, __pr_val_debug, __VA_ARGS__)
+void __pr_val_debug(const char *, ...) CHECK_FORMAT(1, 2);
 /* Non-errors deemed useful to the user. */
-void pr_val_info(const char *, ...) CHECK_FORMAT(1, 2);
+#define pr_val_info(...)						\
+	PR_IF_ENABLED(log_val_info_enabled, __pr_val_info, __VA_ARGS__)
+void __pr_val_info(const char *, ...) CHECK_FORMAT(1, 2);
 /* Issues that did not trigger RPKI object rejection. */
 int pr_val_warn(const char *, ...) CHECK_FORMAT(1, 2);
 /* Errors that trigger RPKI object rejection. */
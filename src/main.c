@@ -4,6 +4,8 @@
 #include "extension.h"
 #include "internal_pool.h"
 #include "nid.h"
+#include "output_printer.h"
+#include "profile.h"
 #include "reqs_errors.h"
 #include "thread_var.h"
 #include "http/http.h"
@@ -21,10 +23,15 @@ start_rtr_server(void)
 	if (error)
 		goto just_quit;
 
-	error = db_rrdp_init();
+	error = output_printer_init();
 	if (error)
 		goto vrps_cleanup;
 
+	error = db_rrdp_init();
+	if (error)
+		goto output_cleanup;
+	db_rrdp_load();
+
 	error = reqs_errors_init();
 	if (error)
 		goto db_rrdp_cleanup;
@@ -34,6 +41,8 @@ start_rtr_server(void)
 	reqs_errors_cleanup();
 db_rrdp_cleanup:
 	db_rrdp_cleanup();
+output_cleanup:
+	output_printer_cleanup();
 vrps_cleanup:
 	vrps_destroy();
 just_quit:
@@ -77,8 +86,14 @@ __main(int argc, char **argv)
 	if (error)
 		goto revert_pool;
 
+	error = profile_init();
+	if (error)
+		goto revert_relax_ng;
+
 	error = start_rtr_server();
 
+	profile_cleanup();
+revert_relax_ng:
 	relax_ng_cleanup();
 revert_pool:
 	internal_pool_cleanup();
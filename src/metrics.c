@@ -0,0 +1,931 @@
+#include "metrics.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+#include "clients.h"
+#include "common.h"
+#include "config.h"
+#include "internal_pool.h"
+#include "log.h"
+#include "data_structure/uthash_nonfatal.h"
+
+#define METRICS_REQUEST_MAX	4096
+/* Seconds a scraper is waited for (while sending its request or reading) */
+#define METRICS_REQUEST_TIMEOUT	2
+/* Scrapers attended at the same time; the rest are rejected */
+#define METRICS_SCRAPERS_MAX	4
+
+#define MOT_COUNT (MOT_GHOSTBUSTERS + 1)
+
+/* Outcome of the latest validation of a TAL */
+struct tal_metrics {
+	char *tal;
+	double duration;
+	int error;
+	UT_hash_handle hh;
+};
+
+/* Accumulated fetches of a repository */
+struct repo_metrics {
+	/* "<protocol> <repository>" */
+	char *key;
+	enum metrics_protocol protocol;
+	char const *repository;
+
+	double duration; /* Latest */
+	size_t bytes; /* Latest */
+	int error; /* Latest */
+	unsigned long long fetches;
+	unsigned long long failures;
+	/* Value of db.runs during the latest fetch */
+	unsigned long long run;
+	UT_hash_handle hh;
+};
+
+struct lock_wait {
+	atomic_ullong acquisitions;
+	atomic_ullong nanoseconds;
+};
+
+/* Rarely updated metrics; protected by @lock */
+static struct {
+	struct tal_metrics *tals;
+	struct repo_metrics *repos;
+
+	unsigned long long runs;
+	unsigned long long failed_runs;
+	double run_duration;
+
+	unsigned int vrps;
+	unsigned int router_keys;
+	unsigned int serial;
+	unsigned int delta_announced;
+	unsigned int delta_withdrawn;
+} db;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Frequently updated metrics; lockless */
+static atomic_ullong objects[MOT_COUNT][2];
+static struct lock_wait state_lock_read;
+static struct lock_wait state_lock_write;
+
+/* The current thread's ongoing struct metrics_fetch */
+static pthread_key_t fetch_key;
+static bool fetch_key_created;
+
+static pthread_t listener;
+static bool listener_running;
+static atomic_bool listener_stop;
+static int listener_fd;
+
+/*
+ * Scrapers being attended by internal pool tasks, so a slow one doesn't stall
+ * the rest.
+ */
+static unsigned int scrapers;
+static pthread_mutex_t scrapers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scrapers_cond = PTHREAD_COND_INITIALIZER;
+
+static char const *const object_names[MOT_COUNT] = {
+	[MOT_CERTIFICATE] = "certificate",
+	[MOT_CRL] = "crl",
+	[MOT_MANIFEST] = "manifest",
+	[MOT_ROA] = "roa",
+	[MOT_GHOSTBUSTERS] = "ghostbusters",
+};
+
+static char const *
+protocol2str(enum metrics_protocol protocol)
+{
+	switch (protocol) {
+	case MP_RSYNC:
+		return "rsync";
+	case MP_RRDP:
+		return "rrdp";
+	}
+
+	return "unknown";
+}
+
+void
+metrics_timer_start(struct metrics_timer *timer)
+{
+	clock_gettime(CLOCK_MONOTONIC, &timer->start);
+}
+
+double
+metrics_timer_elapsed(struct metrics_timer *timer)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - timer->start.tv_sec)
+	    + (now.tv_nsec - timer->start.tv_nsec) / 1000000000.0;
+}
+
+static void
+repo_metrics_destroy(struct repo_metrics *repo)
+{
+	free(repo->key);
+	free(repo);
+}
+
+/*
+ * Drops the repositories that weren't fetched during the cycle that just
+ * ended (db.runs - 1), so the ones that aren't referenced anymore don't pile
+ * up.
+ */
+static void
+repo_metrics_prune(void)
+{
+	struct repo_metrics *repo, *tmp;
+
+	HASH_ITER(hh, db.repos, repo, tmp) {
+		if (repo->run + 1 < db.runs) {
+			HASH_DEL(db.repos, repo);
+			repo_metrics_destroy(repo);
+		}
+	}
+}
+
+void
+metrics_validation_run(double duration, int error)
+{
+	pthread_mutex_lock(&lock);
+	db.runs++;
+	if (error)
+		db.failed_runs++;
+	db.run_duration = duration;
+	repo_metrics_prune();
+	pthread_mutex_unlock(&lock);
+}
+
+void
+metrics_tal_validated(char const *tal, double duration, int error)
+{
+	struct tal_metrics *node;
+
+	pthread_mutex_lock(&lock);
+
+	HASH_FIND_STR(db.tals, tal, node);
+	if (node == NULL) {
+		node = malloc(sizeof(struct tal_metrics));
+		if (node == NULL)
+			goto enomem;
+		node->tal = strdup(tal);
+		if (node->tal == NULL) {
+			free(node);
+			goto enomem;
+		}
+
+		errno = 0;
+		HASH_ADD_KEYPTR(hh, db.tals, node->tal, strlen(node->tal),
+		    node);
+		if (errno) {
+			free(node->tal);
+			free(node);
+			goto enomem;
+		}
+	}
+
+	node->duration = duration;
+	node->error = error;
+
+	pthread_mutex_unlock(&lock);
+	return;
+enomem:
+	pthread_mutex_unlock(&lock);
+	pr_enomem();
+}
+
+void
+metrics_object_validated(enum metrics_object_type type, int error)
+{
+	atomic_fetch_add(&objects[type][error ? 1 : 0], 1);
+}
+
+void
+metrics_fetch_start(struct metrics_fetch *fetch, enum metrics_protocol protocol)
+{
+	fetch->protocol = protocol;
+	fetch->bytes = 0;
+	fetch->parent = NULL;
+	metrics_timer_start(&fetch->timer);
+
+	if (fetch_key_created) {
+		fetch->parent = pthread_getspecific(fetch_key);
+		pthread_setspecific(fetch_key, fetch);
+	}
+}
+
+/* Attributes @bytes to the calling thread's ongoing fetch, if any. */
+void
+metrics_fetch_add_bytes(size_t bytes)
+{
+	struct metrics_fetch *fetch;
+
+	if (!fetch_key_created)
+		return;
+
+	fetch = pthread_getspecific(fetch_key);
+	if (fetch != NULL)
+		fetch->bytes += bytes;
+}
+
+static struct repo_metrics *
+repo_metrics_get(enum metrics_protocol protocol, char const *repository)
+{
+	struct repo_metrics *node;
+	char const *proto_str;
+	size_t proto_len;
+	char *key;
+
+	proto_str = protocol2str(protocol);
+	proto_len = strlen(proto_str);
+	key = malloc(proto_len + strlen(repository) + 2);
+	if (key == NULL)
+		return NULL;
+	sprintf(key, "%s %s", proto_str, repository);
+
+	HASH_FIND_STR(db.repos, key, node);
+	if (node != NULL) {
+		free(key);
+		return node;
+	}
+
+	node = malloc(sizeof(struct repo_metrics));
+	if (node == NULL) {
+		free(key);
+		return NULL;
+	}
+	node->key = key;
+	node->protocol = protocol;
+	node->repository = key + proto_len + 1;
+	node->fetches = 0;
+	node->failures = 0;
+
+	errno = 0;
+	HASH_ADD_KEYPTR(hh, db.repos, node->key, strlen(node->key), node);
+	if (errno) {
+		free(key);
+		free(node);
+		return NULL;
+	}
+
+	return node;
+}
+
+void
+metrics_fetch_end(struct metrics_fetch *fetch, char const *repository,
+    int error)
+{
+	struct repo_metrics *node;
+	double duration;
+
+	duration = metrics_timer_elapsed(&fetch->timer);
+	if (fetch_key_created)
+		pthread_setspecific(fetch_key, fetch->parent);
+
+	pthread_mutex_lock(&lock);
+	node = repo_metrics_get(fetch->protocol, repository);
+	if (node == NULL) {
+		pthread_mutex_unlock(&lock);
+		pr_enomem();
+	}
+
+	node->duration = duration;
+	node->bytes = fetch->bytes;
+	node->error = error;
+	node->fetches++;
+	if (error)
+		node->failures++;
+	node->run = db.runs;
+	pthread_mutex_unlock(&lock);
+}
+
+void
+metrics_vrps_set(unsigned int vrps, unsigned int router_keys,
+    unsigned int serial)
+{
+	pthread_mutex_lock(&lock);
+	db.vrps = vrps;
+	db.router_keys = router_keys;
+	db.serial = serial;
+	pthread_mutex_unlock(&lock);
+}
+
+void
+metrics_delta_set(unsigned int announced, unsigned int withdrawn)
+{
+	pthread_mutex_lock(&lock);
+	db.delta_announced = announced;
+	db.delta_withdrawn = withdrawn;
+	pthread_mutex_unlock(&lock);
+}
+
+void
+metrics_state_lock_waited(bool write, double seconds)
+{
+	struct lock_wait *wait;
+
+	wait = write ? &state_lock_write : &state_lock_read;
+	atomic_fetch_add(&wait->acquisitions, 1);
+	atomic_fetch_add(&wait->nanoseconds,
+	    (unsigned long long) (seconds * 1000000000.0));
+}
+
+/* Exposition */
+
+struct metrics_buffer {
+	char *data;
+	size_t len;
+	size_t capacity;
+};
+
+static void
+mbuf_printf(struct metrics_buffer *buf, char const *format, ...)
+{
+	va_list args;
+	size_t capacity;
+	char *tmp;
+	int written;
+
+	do {
+		va_start(args, format);
+		written = vsnprintf(buf->data + buf->len,
+		    buf->capacity - buf->len, format, args);
+		va_end(args);
+		if (written < 0)
+			return;
+		if (buf->len + written < buf->capacity)
+			break;
+
+		capacity = 2 * buf->capacity + written;
+		tmp = realloc(buf->data, capacity);
+		if (tmp == NULL)
+			pr_enomem();
+		buf->data = tmp;
+		buf->capacity = capacity;
+	} while (true);
+
+	buf->len += written;
+}
+
+/* Prints @value as a label value (ie. escapes backslashes, quotes and EOLs) */
+static void
+mbuf_label(struct metrics_buffer *buf, char const *value)
+{
+	char const *chr;
+
+	for (chr = value; *chr != '\0'; chr++) {
+		switch (*chr) {
+		case '\\':
+			mbuf_printf(buf, "\\\\");
+			break;
+		case '"':
+			mbuf_printf(buf, "\\\"");
+			break;
+		case '\n':
+			mbuf_printf(buf, "\\n");
+			break;
+		default:
+			mbuf_printf(buf, "%c", *chr);
+		}
+	}
+}
+
+static void
+mbuf_header(struct metrics_buffer *buf, char const *name, char const *type,
+    char const *help)
+{
+	mbuf_printf(buf, "# HELP %s %s\n# TYPE %s %s\n", name, help, name,
+	    type);
+}
+
+static void
+print_validation(struct metrics_buffer *buf)
+{
+	struct tal_metrics *tal, *tmp;
+
+	mbuf_header(buf, "fort_validation_runs_total", "counter",
+	    "Validation cycles performed.");
+	mbuf_printf(buf, "fort_validation_runs_total{result=\"success\"} %llu\n",
+	    db.runs - db.failed_runs);
+	mbuf_printf(buf, "fort_validation_runs_total{result=\"failure\"} %llu\n",
+	    db.failed_runs);
+
+	mbuf_header(buf, "fort_validation_duration_seconds", "gauge",
+	    "Duration of the latest validation cycle.");
+	mbuf_printf(buf, "fort_validation_duration_seconds %.6f\n",
+	    db.run_duration);
+
+	mbuf_header(buf, "fort_tal_validation_duration_seconds", "gauge",
+	    "Duration of the latest validation of each TAL.");
+	HASH_ITER(hh, db.tals, tal, tmp) {
+		mbuf_printf(buf, "fort_tal_validation_duration_seconds{tal=\"");
+		mbuf_label(buf, tal->tal);
+		mbuf_printf(buf, "\"} %.6f\n", tal->duration);
+	}
+
+	mbuf_header(buf, "fort_tal_validation_success", "gauge",
+	    "Whether the latest validation of each TAL succeeded.");
+	HASH_ITER(hh, db.tals, tal, tmp) {
+		mbuf_printf(buf, "fort_tal_validation_success{tal=\"");
+		mbuf_label(buf, tal->tal);
+		mbuf_printf(buf, "\"} %d\n", tal->error ? 0 : 1);
+	}
+}
+
+static void
+print_objects(struct metrics_buffer *buf)
+{
+	unsigned int i;
+
+	mbuf_header(buf, "fort_objects_validated_total", "counter",
+	    "RPKI objects validated, by type and outcome.");
+	for (i = 0; i < MOT_COUNT; i++) {
+		mbuf_printf(buf,
+		    "fort_objects_validated_total{type=\"%s\",result=\"valid\"} %llu\n",
+		    object_names[i], atomic_load(&objects[i][0]));
+		mbuf_printf(buf,
+		    "fort_objects_validated_total{type=\"%s\",result=\"invalid\"} %llu\n",
+		    object_names[i], atomic_load(&objects[i][1]));
+	}
+}
+
+static void
+print_repo_labels(struct metrics_buffer *buf, char const *name,
+    struct repo_metrics *repo)
+{
+	mbuf_printf(buf, "%s{protocol=\"%s\",repository=\"", name,
+	    protocol2str(repo->protocol));
+	mbuf_label(buf, repo->repository);
+	mbuf_printf(buf, "\"} ");
+}
+
+static void
+print_repos(struct metrics_buffer *buf)
+{
+	struct repo_metrics *repo, *tmp;
+
+	mbuf_header(buf, "fort_fetch_duration_seconds", "gauge",
+	    "Duration of the latest fetch of each repository.");
+	HASH_ITER(hh, db.repos, repo, tmp) {
+		print_repo_labels(buf, "fort_fetch_duration_seconds", repo);
+		mbuf_printf(buf, "%.6f\n", repo->duration);
+	}
+
+	mbuf_header(buf, "fort_fetch_bytes", "gauge",
+	    "Bytes downloaded by the latest fetch of each RRDP repository.");
+	HASH_ITER(hh, db.repos, repo, tmp) {
+		/* rsync runs in a subprocess; its traffic isn't measured */
+		if (repo->protocol != MP_RRDP)
+			continue;
+		print_repo_labels(buf, "fort_fetch_bytes", repo);
+		mbuf_printf(buf, "%zu\n", repo->bytes);
+	}
+
+	mbuf_header(buf, "fort_fetch_success", "gauge",
+	    "Whether the latest fetch of each repository succeeded.");
+	HASH_ITER(hh, db.repos, repo, tmp) {
+		print_repo_labels(buf, "fort_fetch_success", repo);
+		mbuf_printf(buf, "%d\n", repo->error ? 0 : 1);
+	}
+
+	mbuf_header(buf, "fort_fetches_total", "counter",
+	    "Fetches of each repository.");
+	HASH_ITER(hh, db.repos, repo, tmp) {
+		print_repo_labels(buf, "fort_fetches_total", repo);
+		mbuf_printf(buf, "%llu\n", repo->fetches);
+	}
+
+	mbuf_header(buf, "fort_fetch_failures_total", "counter",
+	    "Failed fetches of each repository.");
+	HASH_ITER(hh, db.repos, repo, tmp) {
+		print_repo_labels(buf, "fort_fetch_failures_total", repo);
+		mbuf_printf(buf, "%llu\n", repo->failures);
+	}
+}
+
+static void
+print_vrps(struct metrics_buffer *buf)
+{
+	mbuf_header(buf, "fort_vrps", "gauge",
+	    "Validated ROA payloads currently served.");
+	mbuf_printf(buf, "fort_vrps %u\n", db.vrps);
+
+	mbuf_header(buf, "fort_router_keys", "gauge",
+	    "BGPsec router keys currently served.");
+	mbuf_printf(buf, "fort_router_keys %u\n", db.router_keys);
+
+	mbuf_header(buf, "fort_rtr_serial", "gauge",
+	    "Current RTR serial number.");
+	mbuf_printf(buf, "fort_rtr_serial %u\n", db.serial);
+
+	mbuf_header(buf, "fort_delta_entries", "gauge",
+	    "Entries of the latest delta, by operation.");
+	mbuf_printf(buf, "fort_delta_entries{operation=\"announce\"} %u\n",
+	    db.delta_announced);
+	mbuf_printf(buf, "fort_delta_entries{operation=\"withdraw\"} %u\n",
+	    db.delta_withdrawn);
+}
+
+static void
+print_lock_wait(struct metrics_buffer *buf)
+{
+	mbuf_header(buf, "fort_state_lock_wait_seconds_total", "counter",
+	    "Time spent waiting for the VRP database's state lock.");
+	mbuf_printf(buf,
+	    "fort_state_lock_wait_seconds_total{mode=\"read\"} %.9f\n",
+	    atomic_load(&state_lock_read.nanoseconds) / 1000000000.0);
+	mbuf_printf(buf,
+	    "fort_state_lock_wait_seconds_total{mode=\"write\"} %.9f\n",
+	    atomic_load(&state_lock_write.nanoseconds) / 1000000000.0);
+
+	mbuf_header(buf, "fort_state_lock_acquisitions_total", "counter",
+	    "Acquisitions of the VRP database's state lock.");
+	mbuf_printf(buf,
+	    "fort_state_lock_acquisitions_total{mode=\"read\"} %llu\n",
+	    atomic_load(&state_lock_read.acquisitions));
+	mbuf_printf(buf,
+	    "fort_state_lock_acquisitions_total{mode=\"write\"} %llu\n",
+	    atomic_load(&state_lock_write.acquisitions));
+}
+
+struct client_print_args {
+	struct metrics_buffer *buf;
+	char const *name;
+	bool bytes;
+};
+
+static int
+count_client(struct client *client, void *arg)
+{
+	unsigned int *count = arg;
+	(*count)++;
+	return 0;
+}
+
+static int
+print_client(struct client *client, void *arg)
+{
+	struct client_print_args *args = arg;
+	char addr[INET6_ADDRSTRLEN];
+	void *sin_addr;
+
+	switch (client->addr.ss_family) {
+	case AF_INET:
+		sin_addr = &((struct sockaddr_in *) &client->addr)->sin_addr;
+		break;
+	case AF_INET6:
+		sin_addr = &((struct sockaddr_in6 *) &client->addr)->sin6_addr;
+		break;
+	default:
+		sin_addr = NULL;
+	}
+	if (sin_addr == NULL || inet_ntop(client->addr.ss_family, sin_addr,
+	    addr, sizeof(addr)) == NULL)
+		strcpy(addr, "unknown");
+
+	if (client->traffic == NULL)
+		return 0;
+
+	mbuf_printf(args->buf, "%s{client=\"%s\",id=\"%d\"} %llu\n",
+	    args->name, addr, client->fd, args->bytes
+	    ? atomic_load(&client->traffic->bytes_sent)
+	    : atomic_load(&client->traffic->pdus_sent));
+	return 0;
+}
+
+static void
+print_clients(struct metrics_buffer *buf)
+{
+	struct client_print_args args;
+	unsigned int count;
+
+	count = 0;
+	clients_foreach(count_client, &count);
+	mbuf_header(buf, "fort_rtr_clients", "gauge",
+	    "RTR clients currently connected.");
+	mbuf_printf(buf, "fort_rtr_clients %u\n", count);
+
+	args.buf = buf;
+	args.name = "fort_rtr_client_pdus_sent_total";
+	args.bytes = false;
+	mbuf_header(buf, args.name, "counter", "PDUs sent to each RTR client.");
+	clients_foreach(print_client, &args);
+
+	args.name = "fort_rtr_client_bytes_sent_total";
+	args.bytes = true;
+	mbuf_header(buf, args.name, "counter",
+	    "Bytes sent to each RTR client.");
+	clients_foreach(print_client, &args);
+}
+
+static void
+metrics_print(struct metrics_buffer *buf)
+{
+	pthread_mutex_lock(&lock);
+	print_validation(buf);
+	print_repos(buf);
+	print_vrps(buf);
+	pthread_mutex_unlock(&lock);
+
+	print_objects(buf);
+	print_lock_wait(buf);
+	print_clients(buf);
+}
+
+/* HTTP listener */
+
+static int
+send_all(int fd, char const *data, size_t len)
+{
+	ssize_t sent;
+
+	while (len > 0) {
+		sent = send(fd, data, len, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		data += sent;
+		len -= sent;
+	}
+
+	return 0;
+}
+
+/* Reads the request line of the scraper; returns its path in @path. */
+static bool
+read_request(int fd, char *request, size_t size, char **path)
+{
+	size_t len;
+	ssize_t got;
+	char *end;
+
+	len = 0;
+	do {
+		got = recv(fd, request + len, size - len - 1, 0);
+		if (got <= 0)
+			return false;
+		len += got;
+		request[len] = '\0';
+	} while (strstr(request, "\r\n") == NULL && len < size - 1);
+
+	if (strncmp(request, "GET ", 4) != 0)
+		return false;
+
+	*path = request + 4;
+	end = strpbrk(*path, " ?\r\n");
+	if (end == NULL)
+		return false;
+	*end = '\0';
+	return true;
+}
+
+static void
+attend_scraper(int fd)
+{
+	static char const *NOT_FOUND = "HTTP/1.1 404 Not Found\r\n"
+	    "Content-Length: 0\r\nConnection: close\r\n\r\n";
+	struct metrics_buffer body;
+	struct timeval timeout;
+	char request[METRICS_REQUEST_MAX];
+	char header[256];
+	char *path;
+	int len;
+
+	timeout.tv_sec = METRICS_REQUEST_TIMEOUT;
+	timeout.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	if (!read_request(fd, request, sizeof(request), &path))
+		return;
+	if (strcmp(path, "/metrics") != 0) {
+		send_all(fd, NOT_FOUND, strlen(NOT_FOUND));
+		return;
+	}
+
+	body.capacity = 16 * 1024;
+	body.len = 0;
+	body.data = malloc(body.capacity);
+	if (body.data == NULL)
+		pr_enomem();
+	metrics_print(&body);
+
+	len = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\n"
+	    "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+	    "Content-Length: %zu\r\n"
+	    "Connection: close\r\n\r\n", body.len);
+	if (send_all(fd, header, len) == 0)
+		send_all(fd, body.data, body.len);
+
+	free(body.data);
+}
+
+static void
+scraper_done(void)
+{
+	pthread_mutex_lock(&scrapers_lock);
+	scrapers--;
+	pthread_cond_broadcast(&scrapers_cond);
+	pthread_mutex_unlock(&scrapers_lock);
+}
+
+static void *
+scraper_task(void *arg)
+{
+	int fd = *((int *) arg);
+
+	free(arg);
+	attend_scraper(fd);
+	close(fd);
+	scraper_done();
+	return NULL;
+}
+
+/* Hands the scraper connected at @fd to an internal pool task */
+static void
+dispatch_scraper(int fd)
+{
+	int *arg;
+
+	pthread_mutex_lock(&scrapers_lock);
+	if (scrapers >= METRICS_SCRAPERS_MAX) {
+		pthread_mutex_unlock(&scrapers_lock);
+		pr_op_debug("Too many metrics scrapers; rejecting one.");
+		close(fd);
+		return;
+	}
+	scrapers++;
+	pthread_mutex_unlock(&scrapers_lock);
+
+	arg = malloc(sizeof(int));
+	if (arg == NULL)
+		goto fail;
+	*arg = fd;
+
+	if (internal_pool_push(scraper_task, arg) != 0) {
+		free(arg);
+		goto fail;
+	}
+	return;
+
+fail:
+	close(fd);
+	scraper_done();
+}
+
+static void *
+listen_scrapers(void *arg)
+{
+	struct timeval select_time;
+	fd_set readfds;
+	int fd;
+
+	while (!atomic_load(&listener_stop)) {
+		/* Check the stop flag every .2 seconds */
+		select_time.tv_sec = 0;
+		select_time.tv_usec = 200000;
+
+		FD_ZERO(&readfds);
+		FD_SET(listener_fd, &readfds);
+		if (select(listener_fd + 1, &readfds, NULL, NULL,
+		    &select_time) <= 0)
+			continue;
+
+		fd = accept(listener_fd, NULL, NULL);
+		if (fd < 0)
+			continue;
+
+		dispatch_scraper(fd);
+	}
+
+	return NULL;
+}
+
+static int
+create_listener_socket(char const *address, char const *port)
+{
+	struct addrinfo hints;
+	struct addrinfo *addrs, *addr;
+	int reuse;
+	int fd;
+	int error;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	error = getaddrinfo(address, port, &hints, &addrs);
+	if (error)
+		return pr_op_err("Could not infer a bindable address out of metrics address '%s' and port '%s': %s",
+		    (address != NULL) ? address : "any", port,
+		    gai_strerror(error));
+
+	reuse = 1;
+	for (addr = addrs; addr != NULL; addr = addr->ai_next) {
+		fd = socket(addr->ai_family, addr->ai_socktype,
+		    addr->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse,
+		    sizeof(reuse)) < 0 ||
+		    bind(fd, addr->ai_addr, addr->ai_addrlen) < 0 ||
+		    listen(fd, SOMAXCONN) < 0) {
+			close(fd);
+			continue;
+		}
+
+		freeaddrinfo(addrs);
+		listener_fd = fd;
+		pr_op_info("Metrics are being served at address '%s', port '%s'.",
+		    (address != NULL) ? address : "any", port);
+		return 0;
+	}
+
+	freeaddrinfo(addrs);
+	return pr_op_errno(errno, "Couldn't bind the metrics listener to address '%s', port '%s'",
+	    (address != NULL) ? address : "any", port);
+}
+
+int
+metrics_init(void)
+{
+	int error;
+
+	db.tals = NULL;
+	db.repos = NULL;
+
+	fetch_key_created = (pthread_key_create(&fetch_key, NULL) == 0);
+
+	listener_running = false;
+	scrapers = 0;
+	if (!config_get_metrics_enabled())
+		return 0;
+
+	error = create_listener_socket(config_get_metrics_address(),
+	    config_get_metrics_port());
+	if (error)
+		return error;
+
+	atomic_init(&listener_stop, false);
+	error = pthread_create(&listener, NULL, listen_scrapers, NULL);
+	if (error) {
+		close(listener_fd);
+		return pr_op_errno(error,
+		    "Could not spawn the metrics listener thread");
+	}
+
+	listener_running = true;
+	return 0;
+}
+
+void
+metrics_cleanup(void)
+{
+	struct tal_metrics *tal, *tal_tmp;
+	struct repo_metrics *repo, *repo_tmp;
+
+	if (listener_running) {
+		atomic_store(&listener_stop, true);
+		pthread_join(listener, NULL);
+		close(listener_fd);
+		listener_running = false;
+	}
+
+	/* The scrapers' tasks read the metrics */
+	pthread_mutex_lock(&scrapers_lock);
+	while (scrapers > 0)
+		pthread_cond_wait(&scrapers_cond, &scrapers_lock);
+	pthread_mutex_unlock(&scrapers_lock);
+
+	HASH_ITER(hh, db.tals, tal, tal_tmp) {
+		HASH_DEL(db.tals, tal);
+		free(tal->tal);
+		free(tal);
+	}
+	HASH_ITER(hh, db.repos, repo, repo_tmp) {
+		HASH_DEL(db.repos, repo);
+		repo_metrics_destroy(repo);
+	}
+
+	if (fetch_key_created)
+		pthread_key_delete(fetch_key);
+}
@@ -0,0 +1,62 @@
+#ifndef SRC_METRICS_H_
+#define SRC_METRICS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+/*
+ * Performance counters. They're always collected (they're cheap), and exposed
+ * in the Prometheus text format by an HTTP listener if --metrics.enabled.
+ */
+
+int metrics_init(void);
+void metrics_cleanup(void);
+
+/* Monotonic stopwatch */
+struct metrics_timer {
+	struct timespec start;
+};
+
+void metrics_timer_start(struct metrics_timer *);
+double metrics_timer_elapsed(struct metrics_timer *);
+
+/* Validation cycles */
+void metrics_validation_run(double, int);
+void metrics_tal_validated(char const *, double, int);
+
+enum metrics_object_type {
+	MOT_CERTIFICATE,
+	MOT_CRL,
+	MOT_MANIFEST,
+	MOT_ROA,
+	MOT_GHOSTBUSTERS,
+};
+
+void metrics_object_validated(enum metrics_object_type, int);
+
+/* Repository fetches */
+enum metrics_protocol {
+	MP_RSYNC,
+	MP_RRDP,
+};
+
+struct metrics_fetch {
+	enum metrics_protocol protocol;
+	struct metrics_timer timer;
+	/* Downloaded by the current thread since metrics_fetch_start() */
+	size_t bytes;
+	/* Enclosing fetch (of the same thread), if any */
+	struct metrics_fetch *parent;
+};
+
+void metrics_fetch_start(struct metrics_fetch *, enum metrics_protocol);
+void metrics_fetch_add_bytes(size_t);
+void metrics_fetch_end(struct metrics_fetch *, char const *, int);
+
+/* VRP database */
+void metrics_vrps_set(unsigned int, unsigned int, unsigned int);
+void metrics_delta_set(unsigned int, unsigned int);
+void metrics_state_lock_waited(bool, double);
+
+#endif /* SRC_METRICS_H_ */
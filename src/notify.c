@@ -1,34 +1,119 @@
 #include "notify.h"
 
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stddef.h>
+#include <string.h>
+#include <unistd.h>
 #include "clients.h"
 #include "log.h"
 #include "rtr/pdu_sender.h"
 #include "rtr/db/vrps.h"
 
+/*
+ * The validation thread doesn't send the Serial Notifies itself; one router
+ * with a full socket buffer would stall the notification of everyone else,
+ * as well as the next validation cycle.
+ *
+ * Instead, every client thread owns a non-blocking pipe. notify_clients()
+ * only writes a byte to each pipe, and the client thread sends the PDU itself
+ * (notify_send_pending()) the next time it's waiting for its router. If the
+ * pipe is already full, a notification is already pending; the newer ones
+ * collapse into it, since the PDU always carries the latest serial anyway.
+ */
+
 static int
-send_notify(struct client *client, void *arg)
+queue_notify(struct client *client, void *arg)
 {
-	serial_t *serial = arg;
+	static unsigned char const byte = 0;
+
+	if (client->notify_fd < 0)
+		return 0;
 
-	/* Send Serial Notify PDU */
-	send_serial_notify_pdu(client->fd, client->rtr_version,
-	    *serial);
+	if (write(client->notify_fd, &byte, sizeof(byte)) == -1 &&
+	    errno != EAGAIN && errno != EWOULDBLOCK)
+		pr_op_warn("Couldn't queue a Serial Notify to client %d: %s",
+		    client->fd, strerror(errno));
 
-	/* Errors already logged, do not interrupt notify to other clients */
+	/* Do not interrupt notify to other clients */
 	return 0;
 }
 
 int
 notify_clients(void)
 {
-	serial_t serial;
+	return clients_foreach(queue_notify, NULL);
+}
+
+static int
+set_pipe_flags(int fd)
+{
+	int flags;
+
+	flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		return -pr_op_errno(errno,
+		    "Couldn't make the notify pipe non-blocking");
+	if (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
+		return -pr_op_errno(errno,
+		    "Couldn't set FD_CLOEXEC on the notify pipe");
+
+	return 0;
+}
+
+/*
+ * Creates the notification pipe of a client thread. @fds[0] is the end the
+ * client thread waits on, @fds[1] is the one notify_clients() writes to.
+ */
+int
+notify_pipe_open(int fds[2])
+{
 	int error;
 
-	error = get_last_serial_number(&serial);
+	if (pipe(fds) == -1)
+		return -pr_op_errno(errno, "Couldn't create the notify pipe");
+
+	error = set_pipe_flags(fds[0]);
+	if (error)
+		goto fail;
+	error = set_pipe_flags(fds[1]);
 	if (error)
-		return error;
+		goto fail;
+
+	return 0;
+fail:
+	notify_pipe_close(fds);
+	return error;
+}
+
+void
+notify_pipe_close(int fds[2])
+{
+	close(fds[0]);
+	close(fds[1]);
+}
+
+/*
+ * Called by the thread of the client whose socket is @fd, when the read end of
+ * its notify pipe (@notify_fd) becomes readable. Sends the Serial Notify.
+ */
+void
+notify_send_pending(int fd, int notify_fd)
+{
+	unsigned char buffer[64];
+	serial_t serial;
+	uint8_t version;
+	bool version_set;
+
+	while (read(notify_fd, buffer, sizeof(buffer)) > 0)
+		; /* Drain; the notifications collapse into one */
+
+	if (get_last_serial_number(&serial) != 0)
+		return;
+	if (clients_get_rtr_version_set(fd, &version_set, &version) != 0)
+		return;
 
-	return clients_foreach(send_notify, &serial);
+	/* Errors already logged */
+	send_serial_notify_pdu(fd, version, serial);
 }
@@ -3,4 +3,8 @@
 
 int notify_clients(void);
 
+int notify_pipe_open(int [2]);
+void notify_pipe_close(int [2]);
+void notify_send_pending(int, int);
+
 #endif /* SRC_NOTIFY_H_ */
@@ -10,6 +10,8 @@
 #include "config.h"
 #include "extension.h"
 #include "log.h"
+#include "metrics.h"
+#include "profile.h"
 #include "nid.h"
 #include "reqs_errors.h"
 #include "str_token.h"
@@ -1148,6 +1150,7 @@ __certificate_get_resources(X509 *cert, struct resources *resources,
 	if (!ip_ext_found && !asn_ext_found)
 		return pr_val_err("Certificate lacks both IP and AS extension.");
 
+	resources_share_parent(resources);
 	return 0;
 }
 
@@ -2435,6 +2438,7 @@ certificate_traverse(struct rpp *rpp_parent, struct rpki_uri *cert_uri)
 		    uri_val_get_printable(cert_uri));
 
 	fnstack_push_uri(cert_uri);
+	profile_start(PP_CERTIFICATE, uri_get_global(cert_uri));
 	memset(&refs, 0, sizeof(refs));
 
 	error = rpp_crl(rpp_parent, &rpp_parent_crl);
@@ -2445,7 +2449,9 @@ certificate_traverse(struct rpp *rpp_parent, struct rpki_uri *cert_uri)
 	error = certificate_load(cert_uri, &cert);
 	if (error)
 		goto revert_fnstack_and_debug;
+	profile_start(PP_CHAIN, NULL);
 	error = certificate_validate_chain(cert, rpp_parent_crl);
+	profile_end();
 	if (error)
 		goto revert_cert;
 
@@ -2585,6 +2591,8 @@ revert_cert:
 	if (cert != NULL)
 		X509_free(cert);
 revert_fnstack_and_debug:
+	metrics_object_validated(MOT_CERTIFICATE, error);
+	profile_end();
 	fnstack_pop();
 	pr_val_debug("}");
 	return error;
@@ -4,6 +4,8 @@
 #include "algorithm.h"
 #include "extension.h"
 #include "log.h"
+#include "metrics.h"
+#include "profile.h"
 #include "thread_var.h"
 #include "object/name.h"
 
@@ -153,11 +155,14 @@ crl_load(struct rpki_uri *uri, X509_CRL **result)
 {
 	int error;
 	pr_val_debug("CRL '%s' {", uri_val_get_printable(uri));
+	profile_start(PP_CRL, uri_get_global(uri));
 
 	error = __crl_load(uri, result);
 	if (!error)
 		error = crl_validate(*result);
 
+	metrics_object_validated(MOT_CRL, error);
+	profile_end();
 	pr_val_debug("}");
 	return error;
 }
@@ -1,6 +1,8 @@
 #include "object/ghostbusters.h"
 
 #include "log.h"
+#include "metrics.h"
+#include "profile.h"
 #include "thread_var.h"
 #include "asn1/oid.h"
 #include "object/signed_object.h"
@@ -27,6 +29,7 @@ ghostbusters_traverse(struct rpki_uri *uri, struct rpp *pp)
 	/* Prepare */
 	pr_val_debug("Ghostbusters '%s' {", uri_val_get_printable(uri));
 	fnstack_push_uri(uri);
+	profile_start(PP_GHOSTBUSTERS, uri_get_global(uri));
 
 	/* Decode */
 	error = signed_object_decode(&sobj, uri);
@@ -55,6 +58,8 @@ revert_args:
 revert_sobj:
 	signed_object_cleanup(&sobj);
 revert_log:
+	metrics_object_validated(MOT_GHOSTBUSTERS, error);
+	profile_end();
 	pr_val_debug("}");
 	fnstack_pop();
 	return error;
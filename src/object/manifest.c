@@ -1,11 +1,17 @@
 #include "manifest.h"
 
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "algorithm.h"
 #include "common.h"
+#include "file.h"
 #include "log.h"
+#include "metrics.h"
+#include "profile.h"
 #include "thread_var.h"
+#include "asn1/content_info.h"
 #include "asn1/decode.h"
 #include "asn1/oid.h"
 #include "asn1/asn1c/GeneralizedTime.h"
@@ -243,6 +249,7 @@ handle_manifest(struct rpki_uri *uri, bool rrdp_workspace, struct rpp **pp)
 	/* Prepare */
 	pr_val_debug("Manifest '%s' {", uri_val_get_printable(uri));
 	fnstack_push_uri(uri);
+	profile_start(PP_MANIFEST, uri_get_global(uri));
 
 	/* Decode */
 	error = signed_object_decode(&sobj, uri);
@@ -289,7 +296,79 @@ revert_manifest:
 revert_sobj:
 	signed_object_cleanup(&sobj);
 revert_log:
+	metrics_object_validated(MOT_MANIFEST, error);
+	profile_end();
 	pr_val_debug("}");
 	fnstack_pop();
 	return error;
 }
+
+/*
+ * Finds the first file listed by the manifest at local path @path that's not
+ * next to it. On success, @missing is NULL if every file is present, or the
+ * local path of the missing one (or @path, if the manifest couldn't be
+ * decoded); the caller must free it.
+ *
+ * Nothing is validated; this only tells whether the files downloaded by a
+ * previous run are still complete (see db_rrdp_load()).
+ */
+int
+manifest_find_missing(char const *path, char **missing)
+{
+	struct signed_object sobj;
+	struct Manifest *mft;
+	struct FileAndHash *fah;
+	char *file;
+	char const *slash_pos;
+	size_t dir_len;
+	int i;
+	int error;
+
+	*missing = NULL;
+
+	error = content_info_load_file(path, &sobj.cinfo);
+	if (error)
+		goto undecodable;
+	error = signed_data_decode(&sobj.sdata, &sobj.cinfo->content);
+	if (error) {
+		content_info_free(sobj.cinfo);
+		goto undecodable;
+	}
+	error = decode_manifest(&sobj, &mft);
+	if (error) {
+		signed_object_cleanup(&sobj);
+		goto undecodable;
+	}
+
+	slash_pos = strrchr(path, '/');
+	dir_len = (slash_pos != NULL) ? ((slash_pos + 1) - path) : 0;
+
+	error = 0;
+	for (i = 0; i < mft->fileList.list.count; i++) {
+		fah = mft->fileList.list.array[i];
+
+		file = malloc(dir_len + fah->file.size + 1);
+		if (file == NULL) {
+			error = pr_enomem();
+			break;
+		}
+		memcpy(file, path, dir_len);
+		memcpy(file + dir_len, fah->file.buf, fah->file.size);
+		file[dir_len + fah->file.size] = '\0';
+
+		if (strlen(file) != dir_len + fah->file.size ||
+		    !valid_file_or_dir(file, true, false, NULL)) {
+			*missing = file;
+			break;
+		}
+		free(file);
+	}
+
+	ASN_STRUCT_FREE(asn_DEF_Manifest, mft);
+	signed_object_cleanup(&sobj);
+	return error;
+
+undecodable:
+	*missing = strdup(path);
+	return (*missing != NULL) ? 0 : pr_enomem();
+}
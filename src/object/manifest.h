@@ -6,5 +6,6 @@
 #include "rpp.h"
 
 int handle_manifest(struct rpki_uri *, bool, struct rpp **);
+int manifest_find_missing(char const *, char **);
 
 #endif /* SRC_OBJECT_MANIFEST_H_ */
@@ -6,6 +6,8 @@
 
 #include "config.h"
 #include "log.h"
+#include "metrics.h"
+#include "profile.h"
 #include "thread_var.h"
 #include "asn1/decode.h"
 #include "asn1/oid.h"
@@ -257,6 +259,7 @@ roa_traverse(struct rpki_uri *uri, struct rpp *pp)
 	/* Prepare */
 	pr_val_debug("ROA '%s' {", uri_val_get_printable(uri));
 	fnstack_push_uri(uri);
+	profile_start(PP_ROA, uri_get_global(uri));
 
 	/* Decode */
 	error = signed_object_decode(&sobj, uri);
@@ -290,6 +293,8 @@ revert_roa:
 revert_sobj:
 	signed_object_cleanup(&sobj);
 revert_log:
+	metrics_object_validated(MOT_ROA, error);
+	profile_end();
 	fnstack_pop();
 	pr_val_debug("}");
 	return error;
@@ -17,6 +17,8 @@
 #include "config.h"
 #include "line_file.h"
 #include "log.h"
+#include "metrics.h"
+#include "profile.h"
 #include "random.h"
 #include "reqs_errors.h"
 #include "state.h"
@@ -28,6 +30,7 @@
 #include "rsync/rsync.h"
 #include "rtr/db/vrps.h"
 #include "rrdp/db/db_rrdp.h"
+#include "rrdp/rrdp_loader.h"
 
 #define TAL_FILE_EXTENSION	".tal"
 typedef int (*foreach_uri_cb)(struct tal *, struct rpki_uri *, void *);
@@ -591,6 +594,9 @@ handle_tal_uri(struct tal *tal, struct rpki_uri *uri, void *arg)
 	if (error)
 		goto end;
 
+	/* Don't wait for the known RRDP repositories one at a time */
+	rrdp_prefetch();
+
 	/* Handle root certificate. */
 	error = certificate_traverse(NULL, uri);
 	if (error) {
@@ -666,15 +672,21 @@ static void *
 do_file_validation(void *thread_arg)
 {
 	struct validation_thread *thread = thread_arg;
+	struct metrics_timer timer;
 	struct tal *tal;
+	double duration;
 	int error;
 
+	metrics_timer_start(&timer);
+	profile_tal_start(thread->tal_file);
 	fnstack_init();
 	fnstack_push(thread->tal_file);
 
 	working_repo_init();
 
+	profile_start(PP_TAL_LOAD, NULL);
 	error = tal_load(thread->tal_file, &tal);
+	profile_end();
 	if (error)
 		goto end;
 
@@ -710,6 +722,9 @@ destroy_tal:
 end:
 	working_repo_cleanup();
 	fnstack_cleanup();
+	duration = metrics_timer_elapsed(&timer);
+	metrics_tal_validated(thread->tal_file, duration, error);
+	profile_tal_end(duration);
 	thread->exit_status = error;
 	return NULL;
 }
@@ -823,11 +838,15 @@ perform_standalone_validation(struct thread_pool *pool, struct db_table *table)
 	reqs_errors_log_summary();
 
 	/* One thread has errors, validation can't keep the resulting table */
-	if (t_error)
+	if (t_error) {
+		db_rrdp_store();
 		return t_error;
+	}
 
 	/* Remove non-visited rrdps URIS by tal */
 	db_rrdp_rem_nonvisited_tals();
+	/* Remember the RRDP state, in case we're restarted */
+	db_rrdp_store();
 
 	return error;
 }
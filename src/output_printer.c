@@ -1,249 +1,1122 @@
 #include "output_printer.h"
 
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <arpa/inet.h>
 #include "common.h"
 #include "config.h"
+#include "configure_ac.h"
 #include "file.h"
 #include "log.h"
-#include "crypto/base64.h"
+#include "data_structure/array_list.h"
+#include "rtr/pdu.h"
 #include "rtr/db/vrp.h"
+#include "rtr/db/vrps.h"
+#include "thread/thread_pool.h"
 
-static char addr_buf[INET6_ADDRSTRLEN];
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
-typedef struct json_out {
-	FILE *file;
+/*
+ * Binary format (--output.format=binary, and the --output.deltas files).
+ *
+ * A file is made of sections. Every section is a header followed by a sorted
+ * array of fixed-width records. All the integers are big endian.
+ *
+ * Header (32 bytes):
+ *
+ *	 0	"FORT"
+ *	 4	Format version (1)
+ *	 5	Content: 1 = ROAs, 2 = Router Keys
+ *	 6	Flags: 1 = the section is a delta (from "previous serial")
+ *	 7	Zero
+ *	 8	Session ID (RTR version 1) (16 bits)
+ *	10	Zero (16 bits)
+ *	12	Serial (32 bits)
+ *	16	Previous serial (32 bits); equals the serial if not a delta
+ *	20	Number of records (32 bits)
+ *	24	Time the file was written, in seconds since the epoch (64 bits)
+ *
+ * ROA record (24 bytes), sorted by family, prefix, prefix length, max length
+ * and ASN:
+ *
+ *	 0	ASN (32 bits)
+ *	 4	Prefix (16 bytes; IPv4 prefixes only use the first 4)
+ *	20	Prefix length
+ *	21	Max length
+ *	22	Family: 4 or 6
+ *	23	1 = announcement, 0 = withdrawal (always 1 if not a delta)
+ *
+ * Router Key record (116 bytes), sorted by ASN, SKI and SPKI:
+ *
+ *	 0	ASN (32 bits)
+ *	 4	Subject Key Identifier (20 bytes)
+ *	24	Subject Public Key Info (91 bytes)
+ *	115	1 = announcement, 0 = withdrawal (always 1 if not a delta)
+ *
+ * Full files (--output.roa, --output.bgpsec) have one section. Delta files
+ * have two: ROAs, then Router Keys.
+ */
+#define BIN_MAGIC		"FORT"
+#define BIN_VERSION		1
+#define BIN_CONTENT_ROAS	1
+#define BIN_CONTENT_ROUTER_KEYS	2
+#define BIN_FLAG_DELTA		1
+#define BIN_HEADER_LEN		32
+#define BIN_ROA_LEN		24
+#define BIN_ROUTER_KEY_LEN	(4 + RK_SKI_LEN + RK_SPKI_LEN + 1)
+
+/* Amount of delta files kept at --output.deltas */
+#define DELTA_FILES_KEPT	100
+
+/*
+ * The table is formatted in chunks of this many elements. If there are enough
+ * chunks, they're formatted in parallel (up to --thread-pool.output.max at a
+ * time) and then written in order.
+ */
+#define CHUNK_LEN		8192
+
+/*
+ * Longest possible formatted element, JSON comma included. (The longest ROA
+ * is about 110 characters, the longest Router Key about 210.)
+ */
+#define ROA_MAX_LEN		128
+#define ROUTER_KEY_MAX_LEN	256
+
+/* Prints @elem at @buf, returns the end of the printed string. */
+typedef char *(*format_cb)(char *, void const *, bool);
+
+struct format_chunk {
+	void const **elems;
+	unsigned int count;
+	/* Is elems[0] the first element of the whole file? */
 	bool first;
-} JSON_OUT;
+	format_cb format;
 
-static int
-load_output_file(char const *output, FILE **result, bool *fopen)
+	/* Result */
+	char *buf;
+	size_t len;
+};
+
+/* Elements of the table, in the order they'll be printed */
+struct elem_array {
+	void const **array;
+	unsigned int len;
+};
+
+/* A file being written */
+struct output_file {
+	/* Final location; NULL if it's the standard output */
+	char const *path;
+	/* Location while it's incomplete */
+	char *tmp_path;
+	/* One of these is the actual stream */
+	FILE *file;
+#ifdef HAVE_ZLIB
+	gzFile gz;
+#endif
+};
+
+STATIC_ARRAY_LIST(output_delta_vrps, struct delta_vrp)
+STATIC_ARRAY_LIST(output_delta_keys, struct delta_router_key)
+
+/* Changes of a serial, in the order they'll be printed */
+struct output_deltas {
+	struct output_delta_vrps vrps;
+	struct output_delta_keys router_keys;
+};
+
+/*
+ * Formats the chunks of the output files. It's kept between cycles, so the
+ * threads aren't spawned on every print. NULL if the chunks are formatted by
+ * the printing thread itself.
+ */
+static struct thread_pool *output_pool;
+
+static char const hex_digits[] = "0123456789abcdef";
+static char const base64url_digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+#define PUT_LITERAL(buf, literal) \
+	(memcpy(buf, literal, sizeof(literal) - 1), buf + sizeof(literal) - 1)
+
+static char *
+put_uint(char *buf, uint32_t value)
 {
-	FILE *tmp;
-	struct stat stat;
-	int error;
+	char tmp[10];
+	unsigned int i;
 
-	if (output == NULL) {
-		*result = NULL;
-		return 0;
-	}
+	i = 0;
+	do {
+		tmp[i++] = '0' + value % 10;
+		value /= 10;
+	} while (value != 0);
 
-	*fopen = false;
-	if (strcmp(output, "-") == 0) {
-		*result = stdout;
-		return 0;
+	while (i > 0)
+		*buf++ = tmp[--i];
+	return buf;
+}
+
+static char *
+put_ipv4(char *buf, unsigned char const *addr)
+{
+	buf = put_uint(buf, addr[0]);
+	*buf++ = '.';
+	buf = put_uint(buf, addr[1]);
+	*buf++ = '.';
+	buf = put_uint(buf, addr[2]);
+	*buf++ = '.';
+	return put_uint(buf, addr[3]);
+}
+
+static char *
+put_hex16(char *buf, uint16_t value)
+{
+	if (value >= 0x1000)
+		*buf++ = hex_digits[value >> 12];
+	if (value >= 0x100)
+		*buf++ = hex_digits[(value >> 8) & 0xF];
+	if (value >= 0x10)
+		*buf++ = hex_digits[(value >> 4) & 0xF];
+	*buf++ = hex_digits[value & 0xF];
+	return buf;
+}
+
+/*
+ * Same result as inet_ntop(AF_INET6): the longest run (the first one, if tied)
+ * of two or more zero words is compressed, and IPv4-mapped and IPv4-compatible
+ * addresses end in dotted decimal.
+ */
+static char *
+put_ipv6(char *buf, struct in6_addr const *addr)
+{
+	unsigned char const *bytes = addr->s6_addr;
+	uint16_t words[8];
+	int best_base, best_len;
+	int cur_base, cur_len;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		words[i] = (bytes[2 * i] << 8) | bytes[2 * i + 1];
+
+	best_base = cur_base = -1;
+	best_len = cur_len = 0;
+	for (i = 0; i < 8; i++) {
+		if (words[i] == 0) {
+			if (cur_base == -1) {
+				cur_base = i;
+				cur_len = 1;
+			} else {
+				cur_len++;
+			}
+		} else if (cur_base != -1) {
+			if (best_base == -1 || cur_len > best_len) {
+				best_base = cur_base;
+				best_len = cur_len;
+			}
+			cur_base = -1;
+		}
+	}
+	if (cur_base != -1 && (best_base == -1 || cur_len > best_len)) {
+		best_base = cur_base;
+		best_len = cur_len;
 	}
+	if (best_base != -1 && best_len < 2)
+		best_base = -1;
 
-	error = file_write(output, &tmp, &stat);
-	if (error) {
-		*result = NULL;
-		return error;
+	for (i = 0; i < 8; i++) {
+		if (best_base != -1 && best_base <= i &&
+		    i < best_base + best_len) {
+			if (i == best_base)
+				*buf++ = ':';
+			continue;
+		}
+		if (i != 0)
+			*buf++ = ':';
+		if (i == 6 && best_base == 0 && (best_len == 6 ||
+		    (best_len == 5 && words[5] == 0xffff)))
+			return put_ipv4(buf, bytes + 12);
+		buf = put_hex16(buf, words[i]);
 	}
+	if (best_base != -1 && best_base + best_len == 8)
+		*buf++ = ':';
 
-	*fopen = true;
-	*result = tmp;
-	return 0;
+	return buf;
 }
 
-static int
-print_roa_csv(struct vrp const *vrp, void *arg)
+/* base64url, without trailing pad */
+static char *
+put_base64url(char *buf, unsigned char const *in, size_t len)
 {
-	FILE *out = arg;
+	uint32_t triplet;
+
+	for (; len >= 3; in += 3, len -= 3) {
+		triplet = (in[0] << 16) | (in[1] << 8) | in[2];
+		*buf++ = base64url_digits[triplet >> 18];
+		*buf++ = base64url_digits[(triplet >> 12) & 0x3F];
+		*buf++ = base64url_digits[(triplet >> 6) & 0x3F];
+		*buf++ = base64url_digits[triplet & 0x3F];
+	}
+
+	if (len == 1) {
+		*buf++ = base64url_digits[in[0] >> 2];
+		*buf++ = base64url_digits[(in[0] & 0x3) << 4];
+	} else if (len == 2) {
+		*buf++ = base64url_digits[in[0] >> 2];
+		*buf++ = base64url_digits[((in[0] & 0x3) << 4) | (in[1] >> 4)];
+		*buf++ = base64url_digits[(in[1] & 0xF) << 2];
+	}
 
+	return buf;
+}
+
+static char *
+put_prefix(char *buf, struct vrp const *vrp)
+{
 	switch (vrp->addr_fam) {
 	case AF_INET:
-		fprintf(out, "AS%u,%s/%u,%u\n", vrp->asn,
-		    addr2str4(&vrp->prefix.v4, addr_buf), vrp->prefix_length,
-		    vrp->max_prefix_length);
+		buf = put_ipv4(buf,
+		    (unsigned char const *) &vrp->prefix.v4.s_addr);
 		break;
 	case AF_INET6:
-		fprintf(out, "AS%u,%s/%u,%u\n", vrp->asn,
-		    addr2str6(&vrp->prefix.v6, addr_buf), vrp->prefix_length,
-		    vrp->max_prefix_length);
+		buf = put_ipv6(buf, &vrp->prefix.v6);
 		break;
 	default:
 		pr_crit("Unknown family type");
 	}
 
-	return 0;
+	*buf++ = '/';
+	return put_uint(buf, vrp->prefix_length);
 }
 
-static int
-print_roa_json(struct vrp const *vrp, void *arg)
+static char *
+format_roa_csv(char *buf, void const *elem, bool first)
+{
+	struct vrp const *vrp = elem;
+
+	buf = PUT_LITERAL(buf, "AS");
+	buf = put_uint(buf, vrp->asn);
+	*buf++ = ',';
+	buf = put_prefix(buf, vrp);
+	*buf++ = ',';
+	buf = put_uint(buf, vrp->max_prefix_length);
+	*buf++ = '\n';
+	return buf;
+}
+
+static char *
+format_roa_json(char *buf, void const *elem, bool first)
+{
+	struct vrp const *vrp = elem;
+
+	if (!first)
+		*buf++ = ',';
+	buf = PUT_LITERAL(buf, "\n  { \"asn\" : \"AS");
+	buf = put_uint(buf, vrp->asn);
+	buf = PUT_LITERAL(buf, "\", \"prefix\" : \"");
+	buf = put_prefix(buf, vrp);
+	buf = PUT_LITERAL(buf, "\", \"maxLength\" : ");
+	buf = put_uint(buf, vrp->max_prefix_length);
+	buf = PUT_LITERAL(buf, " }");
+	return buf;
+}
+
+static char *
+format_router_key_csv(char *buf, void const *elem, bool first)
+{
+	struct router_key const *key = elem;
+
+	buf = PUT_LITERAL(buf, "AS");
+	buf = put_uint(buf, key->as);
+	*buf++ = ',';
+	buf = put_base64url(buf, key->ski, RK_SKI_LEN);
+	*buf++ = ',';
+	buf = put_base64url(buf, key->spk, RK_SPKI_LEN);
+	*buf++ = '\n';
+	return buf;
+}
+
+static char *
+format_router_key_json(char *buf, void const *elem, bool first)
+{
+	struct router_key const *key = elem;
+
+	if (!first)
+		*buf++ = ',';
+	buf = PUT_LITERAL(buf, "\n  { \"asn\" : \"AS");
+	buf = put_uint(buf, key->as);
+	buf = PUT_LITERAL(buf, "\", \"ski\" : \"");
+	buf = put_base64url(buf, key->ski, RK_SKI_LEN);
+	buf = PUT_LITERAL(buf, "\", \"spki\" : \"");
+	buf = put_base64url(buf, key->spk, RK_SPKI_LEN);
+	buf = PUT_LITERAL(buf, "\" }");
+	return buf;
+}
+
+static char *
+put_be16(char *buf, uint16_t value)
 {
-	JSON_OUT *json_out = arg;
-	FILE *out;
+	*buf++ = value >> 8;
+	*buf++ = value;
+	return buf;
+}
 
-	out = json_out->file;
-	if (!json_out->first)
-		fprintf(out, ",");
+static char *
+put_be32(char *buf, uint32_t value)
+{
+	buf = put_be16(buf, value >> 16);
+	return put_be16(buf, value);
+}
 
+static char *
+put_be64(char *buf, uint64_t value)
+{
+	buf = put_be32(buf, value >> 32);
+	return put_be32(buf, value);
+}
+
+static char *
+put_bin_header(char *buf, uint8_t content, serial_t serial,
+    serial_t previous, uint32_t count, bool delta)
+{
+	buf = PUT_LITERAL(buf, BIN_MAGIC);
+	*buf++ = BIN_VERSION;
+	*buf++ = content;
+	*buf++ = delta ? BIN_FLAG_DELTA : 0;
+	*buf++ = 0;
+	buf = put_be16(buf, get_current_session_id(RTR_V1));
+	buf = put_be16(buf, 0);
+	buf = put_be32(buf, serial);
+	buf = put_be32(buf, previous);
+	buf = put_be32(buf, count);
+	return put_be64(buf, time(NULL));
+}
+
+static char *
+put_bin_roa(char *buf, struct vrp const *vrp, uint8_t flags)
+{
+	buf = put_be32(buf, vrp->asn);
 	switch (vrp->addr_fam) {
 	case AF_INET:
-		fprintf(out,
-		    "\n  { \"asn\" : \"AS%u\", \"prefix\" : \"%s/%u\", \"maxLength\" : %u }",
-		    vrp->asn,
-		    addr2str4(&vrp->prefix.v4, addr_buf),
-		    vrp->prefix_length,
-		    vrp->max_prefix_length);
+		memcpy(buf, &vrp->prefix.v4, sizeof(vrp->prefix.v4));
+		memset(buf + sizeof(vrp->prefix.v4), 0,
+		    16 - sizeof(vrp->prefix.v4));
 		break;
 	case AF_INET6:
-		fprintf(out,
-		    "\n  { \"asn\" : \"AS%u\", \"prefix\" : \"%s/%u\", \"maxLength\" : %u }",
-		    vrp->asn,
-		    addr2str6(&vrp->prefix.v6, addr_buf),
-		    vrp->prefix_length,
-		    vrp->max_prefix_length);
+		memcpy(buf, &vrp->prefix.v6, sizeof(vrp->prefix.v6));
 		break;
 	default:
 		pr_crit("Unknown family type");
 	}
+	buf += 16;
+	*buf++ = vrp->prefix_length;
+	*buf++ = vrp->max_prefix_length;
+	*buf++ = (vrp->addr_fam == AF_INET) ? 4 : 6;
+	*buf++ = flags;
+	return buf;
+}
+
+static char *
+put_bin_router_key(char *buf, struct router_key const *key, uint8_t flags)
+{
+	buf = put_be32(buf, key->as);
+	memcpy(buf, key->ski, RK_SKI_LEN);
+	buf += RK_SKI_LEN;
+	memcpy(buf, key->spk, RK_SPKI_LEN);
+	buf += RK_SPKI_LEN;
+	*buf++ = flags;
+	return buf;
+}
+
+static char *
+format_roa_binary(char *buf, void const *elem, bool first)
+{
+	return put_bin_roa(buf, elem, FLAG_ANNOUNCEMENT);
+}
+
+static char *
+format_router_key_binary(char *buf, void const *elem, bool first)
+{
+	return put_bin_router_key(buf, elem, FLAG_ANNOUNCEMENT);
+}
+
+static char *
+format_delta_roa_binary(char *buf, void const *elem, bool first)
+{
+	struct delta_vrp const *delta = elem;
+	return put_bin_roa(buf, &delta->vrp, delta->flags);
+}
+
+static char *
+format_delta_router_key_binary(char *buf, void const *elem, bool first)
+{
+	struct delta_router_key const *delta = elem;
+	return put_bin_router_key(buf, &delta->router_key, delta->flags);
+}
+
+static int
+vrp_cmp(struct vrp const *a, struct vrp const *b)
+{
+	int cmp;
 
-	json_out->first = false;
+	if (a->addr_fam != b->addr_fam)
+		return (a->addr_fam == AF_INET) ? -1 : 1;
+
+	cmp = (a->addr_fam == AF_INET)
+	    ? memcmp(&a->prefix.v4, &b->prefix.v4, sizeof(a->prefix.v4))
+	    : memcmp(&a->prefix.v6, &b->prefix.v6, sizeof(a->prefix.v6));
+	if (cmp != 0)
+		return cmp;
+	if (a->prefix_length != b->prefix_length)
+		return a->prefix_length - b->prefix_length;
+	if (a->max_prefix_length != b->max_prefix_length)
+		return a->max_prefix_length - b->max_prefix_length;
+	if (a->asn != b->asn)
+		return (a->asn < b->asn) ? -1 : 1;
 	return 0;
 }
 
-/* Print as base64url strings without trailing pad */
 static int
-print_router_key_csv(struct router_key const *key, void *arg)
+router_key_cmp(struct router_key const *a, struct router_key const *b)
+{
+	int cmp;
+
+	if (a->as != b->as)
+		return (a->as < b->as) ? -1 : 1;
+	cmp = memcmp(a->ski, b->ski, RK_SKI_LEN);
+	if (cmp != 0)
+		return cmp;
+	return memcmp(a->spk, b->spk, RK_SPKI_LEN);
+}
+
+/* qsort() callbacks; the arrays contain pointers to the elements */
+
+static int
+vrp_ptr_cmp(void const *a, void const *b)
+{
+	return vrp_cmp(*((struct vrp const **) a), *((struct vrp const **) b));
+}
+
+static int
+router_key_ptr_cmp(void const *a, void const *b)
+{
+	return router_key_cmp(*((struct router_key const **) a),
+	    *((struct router_key const **) b));
+}
+
+static int
+delta_vrp_ptr_cmp(void const *a, void const *b)
+{
+	return vrp_cmp(&(*((struct delta_vrp const **) a))->vrp,
+	    &(*((struct delta_vrp const **) b))->vrp);
+}
+
+static int
+delta_router_key_ptr_cmp(void const *a, void const *b)
+{
+	return router_key_cmp(&(*((struct delta_router_key const **) a))->router_key,
+	    &(*((struct delta_router_key const **) b))->router_key);
+}
+
+static void *
+format_chunk(void *arg)
+{
+	struct format_chunk *chunk = arg;
+	char *cursor;
+	unsigned int i;
+
+	cursor = chunk->buf;
+	for (i = 0; i < chunk->count; i++)
+		cursor = chunk->format(cursor, chunk->elems[i],
+		    chunk->first && i == 0);
+
+	chunk->len = cursor - chunk->buf;
+	return NULL;
+}
+
+/*
+ * Opens @path (or the standard output, if @path is "-") for writing, and
+ * compresses if configured to. Unless it's the standard output, the content is
+ * written to a temporal file, which replaces @path once it's complete (see
+ * output_close()).
+ */
+static int
+output_open(char const *path, struct output_file *out)
 {
-	FILE *out = arg;
-	char *buf1, *buf2;
+	struct stat stat;
+	size_t len;
+	bool gzip;
+#ifdef HAVE_ZLIB
+	int fd;
+#endif
 	int error;
 
-	error = base64url_encode(key->ski, RK_SKI_LEN, &buf1);
-	if (error)
+	out->file = NULL;
+#ifdef HAVE_ZLIB
+	out->gz = NULL;
+	gzip = config_get_output_compression() == OCM_GZIP;
+#else
+	gzip = false; /* Rejected by the configuration */
+#endif
+
+	if (strcmp(path, "-") == 0) {
+		out->path = NULL;
+		out->tmp_path = NULL;
+		if (!gzip) {
+			out->file = stdout;
+			return 0;
+		}
+#ifdef HAVE_ZLIB
+		fflush(stdout);
+		fd = dup(STDOUT_FILENO);
+		if (fd < 0)
+			return -pr_op_errno(errno, "Could not duplicate the standard output");
+		out->gz = gzdopen(fd, "wb");
+		if (out->gz == NULL) {
+			close(fd);
+			return pr_enomem();
+		}
+		return 0;
+#endif
+	}
+
+	out->path = path;
+	len = strlen(path);
+	out->tmp_path = malloc(len + sizeof(".tmp"));
+	if (out->tmp_path == NULL)
+		return pr_enomem();
+	memcpy(out->tmp_path, path, len);
+	strcpy(out->tmp_path + len, ".tmp");
+
+	error = file_write(out->tmp_path, &out->file, &stat);
+	if (error) {
+		free(out->tmp_path);
+		return pr_op_err("Error getting file '%s'", path);
+	}
+
+#ifdef HAVE_ZLIB
+	if (gzip) {
+		/* The FILE is only needed to create the file */
+		fd = dup(fileno(out->file));
+		fclose(out->file);
+		out->file = NULL;
+		out->gz = (fd >= 0) ? gzdopen(fd, "wb") : NULL;
+		if (out->gz == NULL) {
+			if (fd >= 0)
+				close(fd);
+			unlink(out->tmp_path);
+			free(out->tmp_path);
+			return pr_op_err("Could not start the compression of '%s'",
+			    path);
+		}
+	}
+#endif
+
+	return 0;
+}
+
+static int
+output_write(struct output_file *out, void const *buf, size_t len)
+{
+	if (len == 0)
+		return 0;
+
+#ifdef HAVE_ZLIB
+	if (out->gz != NULL) {
+		if (gzwrite(out->gz, buf, len) != (int) len)
+			return pr_op_err("Could not write the compressed output.");
+		return 0;
+	}
+#endif
+
+	if (fwrite(buf, 1, len, out->file) != len)
+		return -pr_op_errno(errno, "Could not write the output file");
+	return 0;
+}
+
+#define output_puts(out, literal) \
+	output_write(out, literal, sizeof(literal) - 1)
+
+/*
+ * Finishes the file opened by output_open(). If everything was written
+ * successfully (@error is zero), the temporal file replaces the final one;
+ * otherwise, the final file is left untouched.
+ */
+static int
+output_close(struct output_file *out, int error)
+{
+#ifdef HAVE_ZLIB
+	if (out->gz != NULL) {
+		if (gzclose(out->gz) != Z_OK && !error)
+			error = pr_op_err("Could not finish the compressed output.");
+	} else
+#endif
+	if (out->path == NULL) {
+		fflush(out->file);
+	} else if (fclose(out->file) != 0 && !error) {
+		error = -pr_op_errno(errno, "Could not write file '%s'",
+		    out->tmp_path);
+	}
+
+	if (out->path == NULL)
 		return error;
 
-	error = base64url_encode(key->spk, RK_SPKI_LEN, &buf2);
+	if (!error && rename(out->tmp_path, out->path) != 0)
+		error = -pr_op_errno(errno, "Could not replace file '%s'",
+		    out->path);
 	if (error)
-		goto free1;
-
-	fprintf(out, "AS%u,%s,%s\n", key->as, buf1, buf2);
+		unlink(out->tmp_path);
 
-	free(buf2);
-free1:
-	free(buf1);
+	free(out->tmp_path);
 	return error;
 }
 
-/* Print as base64url strings without trailing pad */
+/*
+ * Formats the @elems with @format (each one at most @max_len characters long)
+ * and writes them at @out, in order.
+ */
 static int
-print_router_key_json(struct router_key const *key, void *arg)
+print_elems(struct output_file *out, struct elem_array *elems,
+    format_cb format, size_t max_len)
 {
-	JSON_OUT *json_out = arg;
-	FILE *out;
-	char *buf1, *buf2;
+	struct format_chunk *chunks;
+	unsigned int threads, c, chunk_count;
+	unsigned int offset;
 	int error;
 
-	error = base64url_encode(key->ski, RK_SKI_LEN, &buf1);
-	if (error)
-		return error;
+	threads = 1;
+	if (output_pool != NULL)
+		threads = config_get_thread_pool_output_max();
+	chunk_count = (elems->len + CHUNK_LEN - 1) / CHUNK_LEN;
+	if (threads > chunk_count)
+		threads = chunk_count;
+	if (threads == 0)
+		return 0;
 
-	error = base64url_encode(key->spk, RK_SPKI_LEN, &buf2);
-	if (error)
-		goto free1;
-
-	out = json_out->file;
-	if (!json_out->first)
-		fprintf(out, ",");
-
-	fprintf(out,
-	    "\n  { \"asn\" : \"AS%u\", \"ski\" : \"%s\", \"spki\" : \"%s\" }",
-	    key->as,
-	    buf1,
-	    buf2);
-
-	free(buf2);
-free1:
-	free(buf1);
-	json_out->first = false;
+	chunks = calloc(threads, sizeof(struct format_chunk));
+	if (chunks == NULL)
+		return pr_enomem();
+
+	error = 0;
+	for (c = 0; c < threads; c++) {
+		chunks[c].format = format;
+		chunks[c].buf = malloc(CHUNK_LEN * max_len);
+		if (chunks[c].buf == NULL) {
+			error = pr_enomem();
+			goto end;
+		}
+	}
+
+	offset = 0;
+	while (offset < elems->len) {
+		/* Format up to @threads chunks at the same time... */
+		for (c = 0; c < threads && offset < elems->len; c++) {
+			chunks[c].elems = elems->array + offset;
+			chunks[c].count = elems->len - offset;
+			if (chunks[c].count > CHUNK_LEN)
+				chunks[c].count = CHUNK_LEN;
+			chunks[c].first = (offset == 0);
+			offset += chunks[c].count;
+
+			if (threads == 1) {
+				format_chunk(&chunks[c]);
+				continue;
+			}
+			error = thread_pool_push(output_pool, format_chunk,
+			    &chunks[c]);
+			if (error) {
+				thread_pool_wait(output_pool);
+				goto end;
+			}
+		}
+		chunk_count = c;
+		if (threads > 1)
+			thread_pool_wait(output_pool);
+
+		/* ... and write them in order */
+		for (c = 0; c < chunk_count; c++) {
+			error = output_write(out, chunks[c].buf, chunks[c].len);
+			if (error)
+				goto end;
+		}
+	}
+
+end:
+	for (c = 0; c < threads; c++)
+		free(chunks[c].buf);
+	free(chunks);
 	return error;
 }
 
+/* Prints a binary section header, followed by the sorted @elems. */
 static int
-open_file(char const *loc, FILE **out, bool *fopen)
+print_bin_section(struct output_file *out, uint8_t content, serial_t serial,
+    serial_t previous, bool delta, struct elem_array *elems,
+    int (*cmp)(void const *, void const *), format_cb format, size_t len)
 {
+	char header[BIN_HEADER_LEN];
 	int error;
 
-	error = load_output_file(loc, out, fopen);
+	put_bin_header(header, content, serial, previous, elems->len, delta);
+	error = output_write(out, header, sizeof(header));
 	if (error)
-		return pr_op_err("Error getting file '%s'", loc);
+		return error;
 
-	/* No output configured */
-	if (*out == NULL)
-		return -ENOENT;
+	qsort(elems->array, elems->len, sizeof(void *), cmp);
+	return print_elems(out, elems, format, len);
+}
+
+static int
+collect_roa(struct vrp const *vrp, void *arg)
+{
+	struct elem_array *elems = arg;
+
+	elems->array[elems->len++] = vrp;
+	return 0;
+}
+
+/* The table doesn't store Router Keys whole, so they need to be copied */
+struct router_key_copies {
+	struct elem_array *elems;
+	struct router_key *keys;
+};
 
+static int
+collect_router_key(struct router_key const *key, void *arg)
+{
+	struct router_key_copies *copies = arg;
+	struct router_key *copy;
+
+	copy = &copies->keys[copies->elems->len];
+	*copy = *key;
+	copies->elems->array[copies->elems->len++] = copy;
 	return 0;
 }
 
 static void
-print_roas(struct db_table *db)
+print_roas(struct db_table *db, serial_t serial)
 {
-	FILE *out;
-	JSON_OUT json_out;
-	bool fopen;
+	char const *path;
+	struct output_file out;
+	struct elem_array elems;
 	int error;
 
-	out = NULL;
-	error = open_file(config_get_output_roa(), &out, &fopen);
+	path = config_get_output_roa();
+	if (path == NULL)
+		return;
+	error = output_open(path, &out);
 	if (error)
 		return;
 
-	if (config_get_output_format() == OFM_CSV) {
-		fprintf(out, "ASN,Prefix,Max prefix length\n");
-		error = db_table_foreach_roa(db, print_roa_csv, out);
-	} else {
-		json_out.file = out;
-		json_out.first = true;
+	elems.len = 0;
+	elems.array = malloc(db_table_roa_count(db) * sizeof(void *) + 1);
+	if (elems.array == NULL) {
+		error = pr_enomem();
+		goto end;
+	}
+	db_table_foreach_roa(db, collect_roa, &elems);
 
-		fprintf(out, "{ \"roas\" : [");
-		error = db_table_foreach_roa(db, print_roa_json, &json_out);
-		fprintf(out, "\n]}\n");
+	switch (config_get_output_format()) {
+	case OFM_CSV:
+		error = output_puts(&out, "ASN,Prefix,Max prefix length\n");
+		if (!error)
+			error = print_elems(&out, &elems, format_roa_csv,
+			    ROA_MAX_LEN);
+		break;
+	case OFM_JSON:
+		error = output_puts(&out, "{ \"roas\" : [");
+		if (!error)
+			error = print_elems(&out, &elems, format_roa_json,
+			    ROA_MAX_LEN);
+		if (!error)
+			error = output_puts(&out, "\n]}\n");
+		break;
+	case OFM_BINARY:
+		error = print_bin_section(&out, BIN_CONTENT_ROAS, serial,
+		    serial, false, &elems, vrp_ptr_cmp, format_roa_binary,
+		    BIN_ROA_LEN);
+		break;
 	}
 
-	if (fopen)
-		file_close(out);
+	free(elems.array);
+end:
+	error = output_close(&out, error);
 	if (error)
 		pr_op_err("Error printing ROAs");
 }
 
 static void
-print_router_keys(struct db_table *db)
+print_router_keys(struct db_table *db, serial_t serial)
 {
-	FILE *out;
-	JSON_OUT json_out;
-	bool fopen;
+	char const *path;
+	struct output_file out;
+	struct elem_array elems;
+	struct router_key_copies copies;
+	unsigned int count;
 	int error;
 
-	out = NULL;
-	error = open_file(config_get_output_bgpsec(), &out, &fopen);
+	path = config_get_output_bgpsec();
+	if (path == NULL)
+		return;
+	error = output_open(path, &out);
 	if (error)
 		return;
 
-	if (config_get_output_format() == OFM_CSV) {
-		fprintf(out,
-		    "ASN,Subject Key Identifier,Subject Public Key Info\n");
-		error = db_table_foreach_router_key(db, print_router_key_csv,
-		    out);
-	} else {
-		json_out.file = out;
-		json_out.first = true;
+	count = db_table_router_key_count(db);
+	elems.len = 0;
+	elems.array = malloc(count * sizeof(void *) + 1);
+	if (elems.array == NULL) {
+		error = pr_enomem();
+		goto end;
+	}
+	copies.elems = &elems;
+	copies.keys = malloc(count * sizeof(struct router_key) + 1);
+	if (copies.keys == NULL) {
+		error = pr_enomem();
+		goto free_array;
+	}
+	db_table_foreach_router_key(db, collect_router_key, &copies);
 
-		fprintf(out, "{ \"router-keys\" : [");
-		error = db_table_foreach_router_key(db, print_router_key_json,
-		    &json_out);
-		fprintf(out, "\n]}\n");
+	switch (config_get_output_format()) {
+	case OFM_CSV:
+		error = output_puts(&out,
+		    "ASN,Subject Key Identifier,Subject Public Key Info\n");
+		if (!error)
+			error = print_elems(&out, &elems,
+			    format_router_key_csv, ROUTER_KEY_MAX_LEN);
+		break;
+	case OFM_JSON:
+		error = output_puts(&out, "{ \"router-keys\" : [");
+		if (!error)
+			error = print_elems(&out, &elems,
+			    format_router_key_json, ROUTER_KEY_MAX_LEN);
+		if (!error)
+			error = output_puts(&out, "\n]}\n");
+		break;
+	case OFM_BINARY:
+		error = print_bin_section(&out, BIN_CONTENT_ROUTER_KEYS,
+		    serial, serial, false, &elems, router_key_ptr_cmp,
+		    format_router_key_binary, BIN_ROUTER_KEY_LEN);
+		break;
 	}
 
-	if (fopen)
-		file_close(out);
+	free(copies.keys);
+free_array:
+	free(elems.array);
+end:
+	error = output_close(&out, error);
 	if (error)
 		pr_op_err("Error printing Router Keys");
 }
 
+/*
+ * Is @name one of the files written by output_print_deltas()? (Complete or
+ * not, compressed or not.)
+ */
+static bool
+is_delta_file(char const *name)
+{
+	size_t digits;
+
+	digits = strspn(name, "0123456789");
+	if (digits == 0)
+		return false;
+	name += digits;
+
+	return strcmp(name, ".delta") == 0 ||
+	    strcmp(name, ".delta.tmp") == 0 ||
+	    strcmp(name, ".delta.gz") == 0 ||
+	    strcmp(name, ".delta.gz.tmp") == 0;
+}
+
+/*
+ * The serials restart at every run (with a new session ID), so the delta files
+ * found at @dir were written by a previous one. Deletes them, so they're
+ * neither mixed with nor overwritten by the new session's.
+ */
+static void
+delta_files_clean(char const *dir)
+{
+	DIR *dirp;
+	struct dirent *entry;
+
+	dirp = opendir(dir);
+	if (dirp == NULL) {
+		pr_op_warn("Could not open the deltas directory '%s': %s", dir,
+		    strerror(errno));
+		return;
+	}
+
+	while ((entry = readdir(dirp)) != NULL) {
+		if (!is_delta_file(entry->d_name))
+			continue;
+		if (unlinkat(dirfd(dirp), entry->d_name, 0) != 0)
+			pr_op_warn("Could not delete the old delta file '%s/%s': %s",
+			    dir, entry->d_name, strerror(errno));
+	}
+
+	closedir(dirp);
+}
+
+int
+output_printer_init(void)
+{
+	unsigned int threads;
+
+	output_pool = NULL;
+
+	if (config_get_mode() == SERVER && config_get_output_deltas() != NULL)
+		delta_files_clean(config_get_output_deltas());
+
+	if (config_get_output_roa() == NULL &&
+	    config_get_output_bgpsec() == NULL &&
+	    config_get_output_deltas() == NULL)
+		return 0;
+
+	threads = config_get_thread_pool_output_max();
+	if (threads <= 1)
+		return 0;
+
+	return thread_pool_create(threads, &output_pool);
+}
+
+void
+output_printer_cleanup(void)
+{
+	if (output_pool != NULL)
+		thread_pool_destroy(output_pool);
+	output_pool = NULL;
+}
+
+void
+output_print_data(struct db_table *db, serial_t serial)
+{
+	print_roas(db, serial);
+	print_router_keys(db, serial);
+}
+
+static int
+collect_delta_vrp(struct delta_vrp const *delta, void *arg)
+{
+	struct output_deltas *deltas = arg;
+	return output_delta_vrps_add(&deltas->vrps,
+	    (struct delta_vrp *) delta);
+}
+
+static int
+collect_delta_router_key(struct delta_router_key const *delta, void *arg)
+{
+	struct output_deltas *deltas = arg;
+	return output_delta_keys_add(&deltas->router_keys,
+	    (struct delta_router_key *) delta);
+}
+
+/* Returns the path of the delta file of @serial. */
+static char *
+delta_path(char const *dir, serial_t serial)
+{
+	char const *ext;
+	char *path;
+	size_t len;
+
+	ext = (config_get_output_compression() == OCM_GZIP)
+	    ? ".delta.gz"
+	    : ".delta";
+	len = strlen(dir) + 1 + 10 + strlen(ext) + 1;
+
+	path = malloc(len);
+	if (path == NULL)
+		return NULL;
+	snprintf(path, len, "%s/%u%s", dir, serial, ext);
+	return path;
+}
+
+static int
+print_delta_sections(struct output_file *out, struct output_deltas *deltas,
+    serial_t serial)
+{
+	struct elem_array elems;
+	array_index i;
+	int error;
+
+	elems.len = 0;
+	elems.array = malloc((deltas->vrps.len + deltas->router_keys.len) *
+	    sizeof(void *) + 1);
+	if (elems.array == NULL)
+		return pr_enomem();
+
+	for (i = 0; i < deltas->vrps.len; i++)
+		elems.array[elems.len++] = &deltas->vrps.array[i];
+	error = print_bin_section(out, BIN_CONTENT_ROAS, serial, serial - 1,
+	    true, &elems, delta_vrp_ptr_cmp, format_delta_roa_binary,
+	    BIN_ROA_LEN);
+	if (error)
+		goto end;
+
+	elems.len = 0;
+	for (i = 0; i < deltas->router_keys.len; i++)
+		elems.array[elems.len++] = &deltas->router_keys.array[i];
+	error = print_bin_section(out, BIN_CONTENT_ROUTER_KEYS, serial,
+	    serial - 1, true, &elems, delta_router_key_ptr_cmp,
+	    format_delta_router_key_binary, BIN_ROUTER_KEY_LEN);
+
+end:
+	free(elems.array);
+	return error;
+}
+
 void
-output_print_data(struct db_table *db)
+output_print_deltas(struct deltas *raw, serial_t serial)
 {
-	print_roas(db);
-	print_router_keys(db);
+	char const *dir;
+	struct output_deltas deltas;
+	struct output_file out;
+	char *path;
+	int error;
+
+	dir = config_get_output_deltas();
+	if (dir == NULL)
+		return;
+
+	output_delta_vrps_init(&deltas.vrps);
+	output_delta_keys_init(&deltas.router_keys);
+	error = deltas_foreach(serial, raw, collect_delta_vrp,
+	    collect_delta_router_key, &deltas);
+	if (error)
+		goto end;
+
+	path = delta_path(dir, serial);
+	if (path == NULL) {
+		error = pr_enomem();
+		goto end;
+	}
+
+	error = output_open(path, &out);
+	if (error) {
+		free(path);
+		goto end;
+	}
+	error = print_delta_sections(&out, &deltas, serial);
+	error = output_close(&out, error);
+	free(path);
+	if (error)
+		goto end;
+
+	/* Forget the oldest one (serial arithmetic wraps around) */
+	path = delta_path(dir, serial - DELTA_FILES_KEPT);
+	if (path != NULL) {
+		unlink(path);
+		free(path);
+	}
+
+end:
+	output_delta_vrps_cleanup(&deltas.vrps, NULL);
+	output_delta_keys_cleanup(&deltas.router_keys, NULL);
+	if (error)
+		pr_op_err("Error printing the deltas of serial %u", serial);
 }
@@ -2,7 +2,15 @@
 #define SRC_OUTPUT_PRINTER_H_
 
 #include "rtr/db/db_table.h"
+#include "rtr/db/delta.h"
 
-void output_print_data(struct db_table *);
+/* Spawns the threads that format the output files (if they're needed). */
+int output_printer_init(void);
+void output_printer_cleanup(void);
+
+/* Prints the full table of @serial at --output.roa and --output.bgpsec. */
+void output_print_data(struct db_table *, serial_t);
+/* Prints the changes that led to @serial at --output.deltas. */
+void output_print_deltas(struct deltas *, serial_t);
 
 #endif /* SRC_OUTPUT_PRINTER_H_ */
@@ -0,0 +1,596 @@
+#include "profile.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/queue.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "file.h"
+#include "log.h"
+#include "metrics.h"
+#include "data_structure/uthash_nonfatal.h"
+
+/* Nesting levels tracked per thread; deeper phases are ignored */
+#define PROFILE_MAX_DEPTH	16
+
+#define PP_COUNT (PP_OUTPUT + 1)
+
+static char const *const phase_names[PP_COUNT] = {
+	[PP_TAL_LOAD] = "tal-load",
+	[PP_FETCH_RSYNC] = "rsync",
+	[PP_FETCH_RRDP] = "rrdp",
+	[PP_FETCH_HTTP] = "http",
+	[PP_MANIFEST] = "manifest",
+	[PP_CRL] = "crl",
+	[PP_CERTIFICATE] = "certificate",
+	[PP_CHAIN] = "chain-verification",
+	[PP_ROA] = "roa",
+	[PP_GHOSTBUSTERS] = "ghostbusters",
+	[PP_SLURM] = "slurm",
+	[PP_DELTAS] = "deltas",
+	[PP_OUTPUT] = "output",
+};
+
+struct phase_counter {
+	double seconds;
+	unsigned long count;
+};
+
+/* Time spent on the phases related to a repository */
+struct repo_profile {
+	char *uri;
+	double seconds;
+	struct phase_counter phases[PP_COUNT];
+	UT_hash_handle hh;
+};
+
+struct profile_tal {
+	/* NULL if the phases didn't happen during a TAL validation */
+	char *name;
+	double duration;
+
+	/* Protected by @lock (several threads can work for the same TAL) */
+	struct phase_counter phases[PP_COUNT];
+	struct repo_profile *repos;
+	pthread_mutex_t lock;
+
+	SLIST_ENTRY(profile_tal) next;
+};
+
+SLIST_HEAD(profile_tals, profile_tal);
+
+struct phase_frame {
+	enum profile_phase phase;
+	/* Not NULL-terminated; its length is @repo_len */
+	char const *repo;
+	size_t repo_len;
+	struct metrics_timer timer;
+	/* Time spent on the nested phases */
+	double nested;
+};
+
+/* Profiling state of a thread */
+struct profile_thread {
+	struct profile_tal *tal;
+	unsigned int depth;
+	/* Phases started beyond PROFILE_MAX_DEPTH, not tracked */
+	unsigned int ignored;
+	struct phase_frame stack[PROFILE_MAX_DEPTH];
+};
+
+static bool enabled;
+static pthread_key_t thread_key;
+
+static time_t cycle_start_time;
+/* Phases that didn't happen during a TAL validation */
+static struct profile_tal cycle_tal;
+/* Finished TAL validations of the current cycle, slowest first */
+static struct profile_tals tals;
+static pthread_mutex_t tals_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+repos_cleanup(struct profile_tal *tal)
+{
+	struct repo_profile *repo, *tmp;
+
+	HASH_ITER(hh, tal->repos, repo, tmp) {
+		HASH_DEL(tal->repos, repo);
+		free(repo->uri);
+		free(repo);
+	}
+}
+
+static struct profile_tal *
+tal_create(char const *name)
+{
+	struct profile_tal *tal;
+	int error;
+
+	tal = calloc(1, sizeof(struct profile_tal));
+	if (tal == NULL)
+		goto enomem;
+
+	tal->name = strdup(name);
+	if (tal->name == NULL) {
+		free(tal);
+		goto enomem;
+	}
+
+	error = pthread_mutex_init(&tal->lock, NULL);
+	if (error) {
+		pr_op_errno(error, "Could not create the TAL profile's mutex");
+		free(tal->name);
+		free(tal);
+		return NULL;
+	}
+
+	return tal;
+
+enomem:
+	pr_enomem();
+	return NULL;
+}
+
+static void
+tal_destroy(struct profile_tal *tal)
+{
+	repos_cleanup(tal);
+	pthread_mutex_destroy(&tal->lock);
+	free(tal->name);
+	free(tal);
+}
+
+int
+profile_init(void)
+{
+	int error;
+
+	enabled = (config_get_output_profile() != NULL);
+	if (!enabled)
+		return 0;
+
+	error = pthread_key_create(&thread_key, free);
+	if (error)
+		return pr_op_errno(error,
+		    "Could not create the profiling thread key");
+
+	error = pthread_mutex_init(&cycle_tal.lock, NULL);
+	if (error) {
+		pthread_key_delete(thread_key);
+		return pr_op_errno(error,
+		    "Could not create the cycle profile's mutex");
+	}
+
+	SLIST_INIT(&tals);
+	return 0;
+}
+
+static void
+tals_cleanup(void)
+{
+	struct profile_tal *tal;
+
+	pthread_mutex_lock(&tals_lock);
+	while (!SLIST_EMPTY(&tals)) {
+		tal = SLIST_FIRST(&tals);
+		SLIST_REMOVE_HEAD(&tals, next);
+		tal_destroy(tal);
+	}
+	pthread_mutex_unlock(&tals_lock);
+
+	pthread_mutex_lock(&cycle_tal.lock);
+	repos_cleanup(&cycle_tal);
+	memset(cycle_tal.phases, 0, sizeof(cycle_tal.phases));
+	pthread_mutex_unlock(&cycle_tal.lock);
+}
+
+void
+profile_cleanup(void)
+{
+	if (!enabled)
+		return;
+
+	tals_cleanup();
+	pthread_mutex_destroy(&cycle_tal.lock);
+	/* The key destructor isn't called on the main thread */
+	free(pthread_getspecific(thread_key));
+	pthread_key_delete(thread_key);
+}
+
+static struct profile_thread *
+get_thread(void)
+{
+	struct profile_thread *thread;
+	int error;
+
+	thread = pthread_getspecific(thread_key);
+	if (thread != NULL)
+		return thread;
+
+	thread = calloc(1, sizeof(struct profile_thread));
+	if (thread == NULL) {
+		pr_enomem();
+		return NULL;
+	}
+
+	error = pthread_setspecific(thread_key, thread);
+	if (error) {
+		pr_op_errno(error, "Could not store the thread's profiling state");
+		free(thread);
+		return NULL;
+	}
+
+	return thread;
+}
+
+/*
+ * Length of the repository @uri of @phase. The file name of the objects is
+ * removed, so that they're grouped by publication point.
+ */
+static size_t
+repo_length(enum profile_phase phase, char const *uri)
+{
+	char const *slash;
+	size_t len;
+
+	switch (phase) {
+	case PP_MANIFEST:
+	case PP_CRL:
+	case PP_CERTIFICATE:
+	case PP_ROA:
+	case PP_GHOSTBUSTERS:
+		slash = strrchr(uri, '/');
+		if (slash != NULL)
+			return slash - uri;
+		break;
+	default:
+		break;
+	}
+
+	len = strlen(uri);
+	if (len > 0 && uri[len - 1] == '/')
+		len--;
+	return len;
+}
+
+void
+profile_start(enum profile_phase phase, char const *repo)
+{
+	struct profile_thread *thread;
+	struct phase_frame *frame;
+
+	if (!enabled)
+		return;
+
+	thread = get_thread();
+	if (thread == NULL)
+		return;
+	if (thread->depth == PROFILE_MAX_DEPTH) {
+		thread->ignored++;
+		return;
+	}
+
+	frame = &thread->stack[thread->depth];
+	frame->phase = phase;
+	if (repo != NULL) {
+		frame->repo = repo;
+		frame->repo_len = repo_length(phase, repo);
+	} else if (thread->depth > 0) {
+		frame->repo = thread->stack[thread->depth - 1].repo;
+		frame->repo_len = thread->stack[thread->depth - 1].repo_len;
+	} else {
+		frame->repo = NULL;
+		frame->repo_len = 0;
+	}
+	frame->nested = 0;
+	metrics_timer_start(&frame->timer);
+
+	thread->depth++;
+}
+
+/* Returns the @tal's profile of @uri, creating it if needed. */
+static struct repo_profile *
+get_repo(struct profile_tal *tal, char const *uri, size_t uri_len)
+{
+	struct repo_profile *repo;
+
+	HASH_FIND(hh, tal->repos, uri, uri_len, repo);
+	if (repo != NULL)
+		return repo;
+
+	repo = calloc(1, sizeof(struct repo_profile));
+	if (repo == NULL)
+		goto enomem;
+	repo->uri = strndup(uri, uri_len);
+	if (repo->uri == NULL) {
+		free(repo);
+		goto enomem;
+	}
+
+	errno = 0;
+	HASH_ADD_KEYPTR(hh, tal->repos, repo->uri, uri_len, repo);
+	if (errno) {
+		free(repo->uri);
+		free(repo);
+		goto enomem;
+	}
+
+	return repo;
+
+enomem:
+	pr_enomem();
+	return NULL;
+}
+
+static void
+account(struct profile_tal *tal, struct phase_frame const *frame,
+    double seconds)
+{
+	struct repo_profile *repo;
+
+	pthread_mutex_lock(&tal->lock);
+
+	tal->phases[frame->phase].seconds += seconds;
+	tal->phases[frame->phase].count++;
+
+	if (frame->repo != NULL) {
+		repo = get_repo(tal, frame->repo, frame->repo_len);
+		if (repo != NULL) {
+			repo->seconds += seconds;
+			repo->phases[frame->phase].seconds += seconds;
+			repo->phases[frame->phase].count++;
+		}
+	}
+
+	pthread_mutex_unlock(&tal->lock);
+}
+
+void
+profile_end(void)
+{
+	struct profile_thread *thread;
+	struct phase_frame *frame;
+	double total;
+
+	if (!enabled)
+		return;
+
+	thread = pthread_getspecific(thread_key);
+	if (thread == NULL)
+		return;
+	if (thread->ignored > 0) {
+		thread->ignored--;
+		return;
+	}
+	if (thread->depth == 0)
+		return;
+
+	thread->depth--;
+	frame = &thread->stack[thread->depth];
+	total = metrics_timer_elapsed(&frame->timer);
+	if (thread->depth > 0)
+		thread->stack[thread->depth - 1].nested += total;
+
+	account((thread->tal != NULL) ? thread->tal : &cycle_tal, frame,
+	    total - frame->nested);
+}
+
+void
+profile_tal_start(char const *name)
+{
+	struct profile_thread *thread;
+
+	if (!enabled)
+		return;
+
+	thread = get_thread();
+	if (thread != NULL)
+		thread->tal = tal_create(name);
+}
+
+/* @duration is the time the validation of the TAL took. */
+void
+profile_tal_end(double duration)
+{
+	struct profile_thread *thread;
+	struct profile_tal *tal, *cursor, *prev;
+
+	if (!enabled)
+		return;
+
+	thread = pthread_getspecific(thread_key);
+	if (thread == NULL || thread->tal == NULL)
+		return;
+
+	tal = thread->tal;
+	thread->tal = NULL;
+	tal->duration = duration;
+
+	pthread_mutex_lock(&tals_lock);
+	prev = NULL;
+	SLIST_FOREACH(cursor, &tals, next) {
+		if (cursor->duration < tal->duration)
+			break;
+		prev = cursor;
+	}
+	if (prev == NULL)
+		SLIST_INSERT_HEAD(&tals, tal, next);
+	else
+		SLIST_INSERT_AFTER(prev, tal, next);
+	pthread_mutex_unlock(&tals_lock);
+}
+
+struct profile_tal *
+profile_tal_get(void)
+{
+	struct profile_thread *thread;
+
+	if (!enabled)
+		return NULL;
+
+	thread = pthread_getspecific(thread_key);
+	return (thread != NULL) ? thread->tal : NULL;
+}
+
+void
+profile_tal_set(struct profile_tal *tal)
+{
+	struct profile_thread *thread;
+
+	if (!enabled)
+		return;
+
+	thread = get_thread();
+	if (thread != NULL)
+		thread->tal = tal;
+}
+
+void
+profile_cycle_start(void)
+{
+	if (!enabled)
+		return;
+
+	tals_cleanup();
+	cycle_start_time = time(NULL);
+}
+
+static void
+print_string(FILE *out, char const *str)
+{
+	fputc('"', out);
+	for (; *str != '\0'; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf(out, "\\%c", *str);
+		else if ((unsigned char) *str < 0x20)
+			fprintf(out, "\\u%04x", (unsigned char) *str);
+		else
+			fputc(*str, out);
+	}
+	fputc('"', out);
+}
+
+/* Prints the @phases as a JSON object; the unused ones are skipped. */
+static void
+print_phases(FILE *out, struct phase_counter const *phases)
+{
+	bool first;
+	int i;
+
+	first = true;
+	fprintf(out, "{");
+	for (i = 0; i < PP_COUNT; i++) {
+		if (phases[i].count == 0)
+			continue;
+		fprintf(out, "%s \"%s\": { \"seconds\": %.6f, \"count\": %lu }",
+		    first ? "" : ",", phase_names[i], phases[i].seconds,
+		    phases[i].count);
+		first = false;
+	}
+	fprintf(out, " }");
+}
+
+static int
+repo_cmp(struct repo_profile *a, struct repo_profile *b)
+{
+	/* Slowest first */
+	if (a->seconds > b->seconds)
+		return -1;
+	return (a->seconds < b->seconds) ? 1 : 0;
+}
+
+static void
+print_tal(FILE *out, struct profile_tal *tal)
+{
+	struct repo_profile *repo;
+
+	fprintf(out, "    {\n      \"tal\": ");
+	print_string(out, tal->name);
+	fprintf(out, ",\n      \"duration\": %.6f,\n", tal->duration);
+	fprintf(out, "      \"phases\": ");
+	print_phases(out, tal->phases);
+	fprintf(out, ",\n      \"repositories\": [");
+
+	HASH_SORT(tal->repos, repo_cmp);
+	for (repo = tal->repos; repo != NULL; repo = repo->hh.next) {
+		fprintf(out, "%s\n        { \"uri\": ",
+		    (repo == tal->repos) ? "" : ",");
+		print_string(out, repo->uri);
+		fprintf(out, ", \"seconds\": %.6f, \"phases\": ", repo->seconds);
+		print_phases(out, repo->phases);
+		fprintf(out, " }");
+	}
+
+	fprintf(out, "\n      ]\n    }");
+}
+
+static void
+print_report(double duration, int result)
+{
+	char const *output;
+	struct phase_counter totals[PP_COUNT];
+	struct profile_tal *tal;
+	struct rusage usage;
+	FILE *out;
+	struct stat stat;
+	int i;
+
+	output = config_get_output_profile();
+	if (strcmp(output, "-") == 0) {
+		out = stdout;
+	} else if (file_write(output, &out, &stat) != 0) {
+		pr_op_err("Could not write the profiling report at '%s'.",
+		    output);
+		return;
+	}
+
+	memcpy(totals, cycle_tal.phases, sizeof(totals));
+	SLIST_FOREACH(tal, &tals, next) {
+		for (i = 0; i < PP_COUNT; i++) {
+			totals[i].seconds += tal->phases[i].seconds;
+			totals[i].count += tal->phases[i].count;
+		}
+	}
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"start\": %lld,\n", (long long) cycle_start_time);
+	fprintf(out, "  \"duration\": %.6f,\n", duration);
+	fprintf(out, "  \"result\": \"%s\",\n", result ? "failure" : "success");
+	/* Peak resident set size of the process (so far), in KiB */
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		fprintf(out, "  \"max-rss\": %ld,\n", usage.ru_maxrss);
+	fprintf(out, "  \"phases\": ");
+	print_phases(out, totals);
+	fprintf(out, ",\n  \"tals\": [");
+	SLIST_FOREACH(tal, &tals, next) {
+		fprintf(out, "%s\n", (tal == SLIST_FIRST(&tals)) ? "" : ",");
+		print_tal(out, tal);
+	}
+	fprintf(out, "\n  ]\n}\n");
+
+	if (out == stdout)
+		fflush(out);
+	else
+		file_close(out);
+}
+
+/* Prints the report of the cycle (@duration seconds, ended with @result). */
+void
+profile_cycle_end(double duration, int result)
+{
+	if (!enabled)
+		return;
+
+	pthread_mutex_lock(&tals_lock);
+	print_report(duration, result);
+	pthread_mutex_unlock(&tals_lock);
+
+	tals_cleanup();
+}
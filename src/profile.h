@@ -0,0 +1,61 @@
+#ifndef SRC_PROFILE_H_
+#define SRC_PROFILE_H_
+
+/*
+ * Per-phase profiling of the validation cycles.
+ *
+ * If --output.profile is set, the time spent at each phase is aggregated per
+ * TAL and per repository, and printed as a JSON report at the end of each
+ * cycle. Otherwise, the functions below do nothing.
+ */
+
+enum profile_phase {
+	PP_TAL_LOAD,
+	PP_FETCH_RSYNC,
+	PP_FETCH_RRDP,
+	PP_FETCH_HTTP,
+	PP_MANIFEST,
+	PP_CRL,
+	PP_CERTIFICATE,
+	PP_CHAIN,
+	PP_ROA,
+	PP_GHOSTBUSTERS,
+	PP_SLURM,
+	PP_DELTAS,
+	PP_OUTPUT,
+};
+
+int profile_init(void);
+void profile_cleanup(void);
+
+/* Validation cycle; the report is printed by profile_cycle_end() */
+void profile_cycle_start(void);
+void profile_cycle_end(double, int);
+
+/*
+ * Validation of a TAL. Every phase measured by the calling thread (until
+ * profile_tal_end()) is accounted to the TAL.
+ *
+ * The durations of the cycles and the TALs are measured by the callers (see
+ * struct metrics_timer), who also report them to the metrics.
+ */
+struct profile_tal;
+
+void profile_tal_start(char const *);
+void profile_tal_end(double);
+/* For the threads that work on behalf of a TAL */
+struct profile_tal *profile_tal_get(void);
+void profile_tal_set(struct profile_tal *);
+
+/*
+ * Phases. They can be nested; only the time spent outside of the nested
+ * phases is accounted to each phase.
+ *
+ * The second argument is the URI of the fetched repository, or the URI of the
+ * validated object (whose publication point is the repository). If NULL, the
+ * repository of the enclosing phase is inherited.
+ */
+void profile_start(enum profile_phase, char const *);
+void profile_end(void);
+
+#endif /* SRC_PROFILE_H_ */
@@ -12,7 +12,13 @@
 #include <sys/socket.h>
 
 
-/* The resources we extracted from one certificate. */
+/*
+ * The resources we extracted from one certificate.
+ *
+ * The sets are reference counted, and immutable once the certificate has been
+ * parsed. A set is shared with the parent's whenever the certificate inherits
+ * it, or lists the same resources. (See resources_share_parent().)
+ */
 struct resources {
 	struct resources_ipv4 *ip4s;
 	struct resources_ipv6 *ip6s;
@@ -125,7 +131,7 @@ inherit_aors(struct resources *resources, int family)
 }
 
 static int
-add_prefix4(struct resources *resources, IPAddress_t *addr)
+add_prefix4(struct resources *resources, IPAddress_t *addr, unsigned int hint)
 {
 	struct resources *parent;
 	struct ipv4_prefix prefix;
@@ -152,7 +158,7 @@ add_prefix4(struct resources *resources, IPAddress_t *addr)
 	}
 
 	if (resources->ip4s == NULL) {
-		resources->ip4s = res4_create();
+		resources->ip4s = res4_create(hint);
 		if (resources->ip4s == NULL)
 			return pr_enomem();
 	}
@@ -170,7 +176,7 @@ add_prefix4(struct resources *resources, IPAddress_t *addr)
 }
 
 static int
-add_prefix6(struct resources *resources, IPAddress_t *addr)
+add_prefix6(struct resources *resources, IPAddress_t *addr, unsigned int hint)
 {
 	struct resources *parent;
 	struct ipv6_prefix prefix;
@@ -197,7 +203,7 @@ add_prefix6(struct resources *resources, IPAddress_t *addr)
 	}
 
 	if (resources->ip6s == NULL) {
-		resources->ip6s = res6_create();
+		resources->ip6s = res6_create(hint);
 		if (resources->ip6s == NULL)
 			return pr_enomem();
 	}
@@ -215,20 +221,22 @@ add_prefix6(struct resources *resources, IPAddress_t *addr)
 }
 
 static int
-add_prefix(struct resources *resources, int family, IPAddress_t *addr)
+add_prefix(struct resources *resources, int family, IPAddress_t *addr,
+    unsigned int hint)
 {
 	switch (family) {
 	case AF_INET:
-		return add_prefix4(resources, addr);
+		return add_prefix4(resources, addr, hint);
 	case AF_INET6:
-		return add_prefix6(resources, addr);
+		return add_prefix6(resources, addr, hint);
 	}
 
 	pr_crit("Unknown address family '%d'", family);
 }
 
 static int
-add_range4(struct resources *resources, IPAddressRange_t *input)
+add_range4(struct resources *resources, IPAddressRange_t *input,
+    unsigned int hint)
 {
 	struct resources *parent;
 	struct ipv4_range range;
@@ -255,7 +263,7 @@ add_range4(struct resources *resources, IPAddressRange_t *input)
 	}
 
 	if (resources->ip4s == NULL) {
-		resources->ip4s = res4_create();
+		resources->ip4s = res4_create(hint);
 		if (resources->ip4s == NULL)
 			return pr_enomem();
 	}
@@ -274,7 +282,8 @@ add_range4(struct resources *resources, IPAddressRange_t *input)
 }
 
 static int
-add_range6(struct resources *resources, IPAddressRange_t *input)
+add_range6(struct resources *resources, IPAddressRange_t *input,
+    unsigned int hint)
 {
 	struct resources *parent;
 	struct ipv6_range range;
@@ -301,7 +310,7 @@ add_range6(struct resources *resources, IPAddressRange_t *input)
 	}
 
 	if (resources->ip6s == NULL) {
-		resources->ip6s = res6_create();
+		resources->ip6s = res6_create(hint);
 		if (resources->ip6s == NULL)
 			return pr_enomem();
 	}
@@ -320,13 +329,14 @@ add_range6(struct resources *resources, IPAddressRange_t *input)
 }
 
 static int
-add_range(struct resources *resources, int family, IPAddressRange_t *range)
+add_range(struct resources *resources, int family, IPAddressRange_t *range,
+    unsigned int hint)
 {
 	switch (family) {
 	case AF_INET:
-		return add_range4(resources, range);
+		return add_range4(resources, range, hint);
 	case AF_INET6:
-		return add_range6(resources, range);
+		return add_range6(resources, range, hint);
 	}
 
 	pr_crit("Unknown address family '%d'", family);
@@ -345,18 +355,19 @@ add_aors(struct resources *resources, int family,
 	if (aors->list.count == 0)
 		return pr_val_err("IP extension's set of IP address records is empty.");
 
+	/* The count is passed along so the set is allocated in one go. */
 	for (i = 0; i < aors->list.count; i++) {
 		aor = aors->list.array[i];
 		switch (aor->present) {
 		case IPAddressOrRange_PR_addressPrefix:
 			error = add_prefix(resources, family,
-			    &aor->choice.addressPrefix);
+			    &aor->choice.addressPrefix, aors->list.count);
 			if (error)
 				return error;
 			break;
 		case IPAddressOrRange_PR_addressRange:
 			error = add_range(resources, family,
-			    &aor->choice.addressRange);
+			    &aor->choice.addressRange, aors->list.count);
 			if (error)
 				return error;
 			break;
@@ -436,7 +447,7 @@ ASId2ulong(ASId_t *as_id, unsigned long *result)
 
 static int
 add_asn(struct resources *resources, unsigned long min, unsigned long max,
-    struct resources *parent)
+    struct resources *parent, unsigned int hint)
 {
 	int error;
 
@@ -455,7 +466,7 @@ add_asn(struct resources *resources, unsigned long min, unsigned long max,
 	}
 
 	if (resources->asns == NULL) {
-		resources->asns = rasn_create();
+		resources->asns = rasn_create(hint);
 		if (resources->asns == NULL)
 			return pr_enomem();
 	}
@@ -475,7 +486,8 @@ add_asn(struct resources *resources, unsigned long min, unsigned long max,
 }
 
 static int
-add_asior(struct resources *resources, struct ASIdOrRange *obj)
+add_asior(struct resources *resources, struct ASIdOrRange *obj,
+    unsigned int hint)
 {
 	struct resources *parent;
 	unsigned long asn_min;
@@ -495,7 +507,7 @@ add_asior(struct resources *resources, struct ASIdOrRange *obj)
 		error = ASId2ulong(&obj->choice.id, &asn_min);
 		if (error)
 			return error;
-		return add_asn(resources, asn_min, asn_min, parent);
+		return add_asn(resources, asn_min, asn_min, parent, hint);
 
 	case ASIdOrRange_PR_range:
 		error = ASId2ulong(&obj->choice.range.min, &asn_min);
@@ -504,7 +516,7 @@ add_asior(struct resources *resources, struct ASIdOrRange *obj)
 		error = ASId2ulong(&obj->choice.range.max, &asn_max);
 		if (error)
 			return error;
-		return add_asn(resources, asn_min, asn_max, parent);
+		return add_asn(resources, asn_min, asn_max, parent, hint);
 	}
 
 	return pr_val_err("Unknown ASIdOrRange type: %u", obj->present);
@@ -524,8 +536,10 @@ add_asiors(struct resources *resources, struct ASIdentifiers *ids)
 	if (iors->list.count == 0)
 		return pr_val_err("AS extension's set of AS number records is empty.");
 
+	/* The count is passed along so the set is allocated in one go. */
 	for (i = 0; i < iors->list.count; i++) {
-		error = add_asior(resources, iors->list.array[i]);
+		error = add_asior(resources, iors->list.array[i],
+		    iors->list.count);
 		if (error)
 			return error;
 	}
@@ -557,6 +571,42 @@ resources_add_asn(struct resources *resources, struct ASIdentifiers *ids,
 	return pr_val_err("Unknown ASIdentifierChoice: %u", ids->asnum->present);
 }
 
+/*
+ * Child certificates often list the exact same resources as their parent.
+ * Once @resources is complete, this replaces the sets that equal the parent's
+ * with references to the parent's, so each distinct set is only kept once.
+ */
+void
+resources_share_parent(struct resources *resources)
+{
+	struct resources *parent;
+
+	parent = get_parent_resources();
+	if (parent == NULL)
+		return;
+
+	if (resources->ip4s != NULL && resources->ip4s != parent->ip4s
+	    && res4_equals(resources->ip4s, parent->ip4s)) {
+		res4_put(resources->ip4s);
+		resources->ip4s = parent->ip4s;
+		res4_get(resources->ip4s);
+	}
+
+	if (resources->ip6s != NULL && resources->ip6s != parent->ip6s
+	    && res6_equals(resources->ip6s, parent->ip6s)) {
+		res6_put(resources->ip6s);
+		resources->ip6s = parent->ip6s;
+		res6_get(resources->ip6s);
+	}
+
+	if (resources->asns != NULL && resources->asns != parent->asns
+	    && rasn_equals(resources->asns, parent->asns)) {
+		rasn_put(resources->asns);
+		resources->asns = parent->asns;
+		rasn_get(resources->asns);
+	}
+}
+
 bool
 resources_empty(struct resources *res)
 {
@@ -29,6 +29,7 @@ void resources_destroy(struct resources *);
 
 int resources_add_ip(struct resources *, struct IPAddressFamily *);
 int resources_add_asn(struct resources *, struct ASIdentifiers *, bool);
+void resources_share_parent(struct resources *);
 
 bool resources_empty(struct resources *);
 bool resources_contains_asn(struct resources *, unsigned long);
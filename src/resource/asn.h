@@ -6,13 +6,14 @@
 
 struct resources_asn;
 
-struct resources_asn *rasn_create(void);
+struct resources_asn *rasn_create(unsigned int);
 void rasn_get(struct resources_asn *);
 void rasn_put(struct resources_asn *);
 
 int rasn_add(struct resources_asn *, unsigned long, unsigned long);
 bool rasn_empty(struct resources_asn *);
 bool rasn_contains(struct resources_asn *, unsigned long, unsigned long);
+bool rasn_equals(struct resources_asn *, struct resources_asn *);
 
 typedef int (*foreach_asn_cb)(unsigned long, void *);
 int rasn_foreach(struct resources_asn *, foreach_asn_cb, void *);
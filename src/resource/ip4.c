@@ -2,108 +2,75 @@
 
 #include "sorted_array.h"
 
-struct r4_node {
-	uint32_t min; /* This is an IPv4 address in host byte order */
-	uint32_t max; /* This is an IPv4 address in host byte order */
-};
-
-static enum sarray_comparison
-r4_cmp(void *arg1, void *arg2)
-{
-	uint32_t n1min = ((struct r4_node *) arg1)->min;
-	uint32_t n2min = ((struct r4_node *) arg2)->min;
-	uint32_t n1max = ((struct r4_node *) arg1)->max;
-	uint32_t n2max = ((struct r4_node *) arg2)->max;
-
-	if (n1min == n2min && n1max == n2max)
-		return SACMP_EQUAL;
-	if (n1min <= n2min && n2max <= n1max)
-		return SACMP_CHILD;
-	if (n2min <= n1min && n1max <= n2max)
-		return SACMP_PARENT;
-	if (n2min != 0 && n1max == n2min - 1)
-		return SACMP_ADJACENT_RIGHT;
-	if (n1max < n2min)
-		return SACMP_RIGHT;
-	if (n1min != 0 && n2max == n1min - 1)
-		return SACMP_ADJACENT_LEFT;
-	if (n2max < n1min)
-		return SACMP_LEFT;
-
-	return SACMP_INTERSECTION;
-}
+/* IPv4 addresses are stored in host byte order */
 
 static void
-pton(struct ipv4_prefix *p, struct r4_node *n)
+pton(struct ipv4_prefix *p, uint32_t *min, uint32_t *max)
 {
-	n->min = ntohl(p->addr.s_addr);
-	n->max = n->min | u32_suffix_mask(p->len);
-}
-
-static void
-rton(struct ipv4_range *r, struct r4_node *n)
-{
-	n->min = ntohl(r->min.s_addr);
-	n->max = ntohl(r->max.s_addr);
+	*min = ntohl(p->addr.s_addr);
+	*max = *min | u32_suffix_mask(p->len);
 }
 
 struct resources_ipv4 *
-res4_create(void)
+res4_create(unsigned int hint)
 {
-	return (struct resources_ipv4 *)
-	    sarray_create(sizeof(struct r4_node), r4_cmp);
+	return (struct resources_ipv4 *) sarray32_create(hint);
 }
 
 void
 res4_get(struct resources_ipv4 *ips)
 {
-	sarray_get((struct sorted_array *) ips);
+	sarray32_get((struct sarray32 *) ips);
 }
 
 void
 res4_put(struct resources_ipv4 *ips)
 {
-	sarray_put((struct sorted_array *) ips);
+	sarray32_put((struct sarray32 *) ips);
 }
 
 int
 res4_add_prefix(struct resources_ipv4 *ips, struct ipv4_prefix *prefix)
 {
-	struct r4_node n;
-	pton(prefix, &n);
-	return sarray_add((struct sorted_array *) ips, &n);
+	uint32_t min, max;
+	pton(prefix, &min, &max);
+	return sarray32_add((struct sarray32 *) ips, min, max);
 }
 
 int
 res4_add_range(struct resources_ipv4 *ips, struct ipv4_range *range)
 {
-	struct r4_node n;
-	rton(range, &n);
-	return sarray_add((struct sorted_array *) ips, &n);
+	return sarray32_add((struct sarray32 *) ips, ntohl(range->min.s_addr),
+	    ntohl(range->max.s_addr));
 }
 
 bool
 res4_empty(struct resources_ipv4 *ips)
 {
-	return sarray_empty((struct sorted_array *) ips);
+	return sarray32_empty((struct sarray32 *) ips);
 }
 
 bool
 res4_contains_prefix(struct resources_ipv4 *ips, struct ipv4_prefix *prefix)
 {
-	struct r4_node n;
+	uint32_t min, max;
 
 	if (ips == NULL)
 		return false;
 
-	pton(prefix, &n);
-	return sarray_contains((struct sorted_array *) ips, &n);
+	pton(prefix, &min, &max);
+	return sarray32_contains((struct sarray32 *) ips, min, max);
 }
 
 bool
 res4_contains_range(struct resources_ipv4 *ips, struct ipv4_range *range)
 {
-	struct r4_node n;
-	rton(range, &n);
-	return sarray_contains((struct sorted_array *) ips, &n);
+	return sarray32_contains((struct sarray32 *) ips,
+	    ntohl(range->min.s_addr), ntohl(range->max.s_addr));
+}
+
+bool
+res4_equals(struct resources_ipv4 *a, struct resources_ipv4 *b)
+{
+	return sarray32_equals((struct sarray32 *) a, (struct sarray32 *) b);
 }
@@ -6,7 +6,7 @@
 
 struct resources_ipv4;
 
-struct resources_ipv4 *res4_create(void);
+struct resources_ipv4 *res4_create(unsigned int);
 void res4_get(struct resources_ipv4 *);
 void res4_put(struct resources_ipv4 *);
 
@@ -15,5 +15,6 @@ int res4_add_range(struct resources_ipv4 *, struct ipv4_range *);
 bool res4_empty(struct resources_ipv4 *);
 bool res4_contains_prefix(struct resources_ipv4 *, struct ipv4_prefix *);
 bool res4_contains_range(struct resources_ipv4 *, struct ipv4_range *);
+bool res4_equals(struct resources_ipv4 *, struct resources_ipv4 *);
 
 #endif /* SRC_RESOURCE_IP4_H_ */
@@ -1,138 +1,98 @@
 #include "ip6.h"
 
-#include <string.h>
 #include "sorted_array.h"
 
-static int
-addr_cmp(struct in6_addr const *a, struct in6_addr const *b)
-{
-	/* The addresses are stored in big endian. */
-	return memcmp(a, b, sizeof(uint32_t[4]));
-}
-
-/* a == b? */
-static bool
-addr_equals(struct in6_addr const *a, struct in6_addr const *b)
-{
-	return addr_cmp(a, b) == 0;
-}
-
-/* a <= b? */
-static bool
-addr_le(struct in6_addr const *a, struct in6_addr const *b)
+/* The address is stored in big endian; the number is in host byte order. */
+static void
+addr2u128(struct in6_addr const *addr, struct uint128 *result)
 {
-	return addr_cmp(a, b) <= 0;
-}
+	unsigned int i;
 
-/* a < b? */
-static bool
-addr_lt(struct in6_addr const *a, struct in6_addr const *b)
-{
-	return addr_cmp(a, b) < 0;
+	result->hi = 0;
+	result->lo = 0;
+	for (i = 0; i < 8; i++) {
+		result->hi = (result->hi << 8) | addr->s6_addr[i];
+		result->lo = (result->lo << 8) | addr->s6_addr[i + 8];
+	}
 }
 
-/* a + 1 == b? */
-static bool
-addr_is_successor(struct in6_addr const *a, struct in6_addr const *b)
+static void
+ptor(struct ipv6_prefix const *p, struct uint128 *min, struct uint128 *max)
 {
-	struct in6_addr a_plus_1;
-	int i;
-
-	memcpy(&a_plus_1, a, sizeof(a_plus_1));
-	for (i = 15; i >= 0; i--) {
-		if (a_plus_1.s6_addr[i] != UINT8_MAX) {
-			a_plus_1.s6_addr[i]++;
-			return memcmp(&a_plus_1, b, sizeof(a_plus_1)) == 0;
-		}
-		a_plus_1.s6_addr[i] = 0;
-	}
+	struct in6_addr last;
 
-	return false; /* b cannot be the successor of 0xFFFFF...FFF */
-}
+	last = p->addr;
+	ipv6_suffix_mask(p->len, &last);
 
-static enum sarray_comparison
-r6_cmp(void *arg1, void *arg2)
-{
-	struct in6_addr const *a1min = &((struct ipv6_range *) arg1)->min;
-	struct in6_addr const *a2min = &((struct ipv6_range *) arg2)->min;
-	struct in6_addr const *a1max = &((struct ipv6_range *) arg1)->max;
-	struct in6_addr const *a2max = &((struct ipv6_range *) arg2)->max;
-
-	if (addr_equals(a1min, a2min) && addr_equals(a1max, a2max))
-		return SACMP_EQUAL;
-	if (addr_le(a1min, a2min) && addr_le(a2max, a1max))
-		return SACMP_CHILD;
-	if (addr_le(a2min, a1min) && addr_le(a1max, a2max))
-		return SACMP_PARENT;
-	if (addr_is_successor(a1max, a2min))
-		return SACMP_ADJACENT_RIGHT;
-	if (addr_lt(a1max, a2min))
-		return SACMP_RIGHT;
-	if (addr_is_successor(a2max, a1min))
-		return SACMP_ADJACENT_LEFT;
-	if (addr_lt(a2max, a1min))
-		return SACMP_LEFT;
-
-	return SACMP_INTERSECTION;
+	addr2u128(&p->addr, min);
+	addr2u128(&last, max);
 }
 
 static void
-ptor(struct ipv6_prefix const *p, struct ipv6_range *r)
+rtor(struct ipv6_range const *r, struct uint128 *min, struct uint128 *max)
 {
-	r->min = p->addr;
-	r->max = p->addr;
-	ipv6_suffix_mask(p->len, &r->max);
+	addr2u128(&r->min, min);
+	addr2u128(&r->max, max);
 }
 
 struct resources_ipv6 *
-res6_create(void)
+res6_create(unsigned int hint)
 {
-	return (struct resources_ipv6 *)
-	    sarray_create(sizeof(struct ipv6_range), r6_cmp);
+	return (struct resources_ipv6 *) sarray128_create(hint);
 }
 
 void
 res6_get(struct resources_ipv6 *ips)
 {
-	sarray_get((struct sorted_array *) ips);
+	sarray128_get((struct sarray128 *) ips);
 }
 
 void
 res6_put(struct resources_ipv6 *ips)
 {
-	sarray_put((struct sorted_array *) ips);
+	sarray128_put((struct sarray128 *) ips);
 }
 
 int
 res6_add_prefix(struct resources_ipv6 *ips, struct ipv6_prefix *prefix)
 {
-	struct ipv6_range r;
-	ptor(prefix, &r);
-	return sarray_add((struct sorted_array *) ips, &r);
+	struct uint128 min, max;
+	ptor(prefix, &min, &max);
+	return sarray128_add((struct sarray128 *) ips, &min, &max);
 }
 
 int
 res6_add_range(struct resources_ipv6 *ips, struct ipv6_range *range)
 {
-	return sarray_add((struct sorted_array *) ips, range);
+	struct uint128 min, max;
+	rtor(range, &min, &max);
+	return sarray128_add((struct sarray128 *) ips, &min, &max);
 }
 
 bool
 res6_empty(struct resources_ipv6 *ips)
 {
-	return sarray_empty((struct sorted_array *) ips);
+	return sarray128_empty((struct sarray128 *) ips);
 }
 
 bool
 res6_contains_prefix(struct resources_ipv6 *ips, struct ipv6_prefix *prefix)
 {
-	struct ipv6_range r;
-	ptor(prefix, &r);
-	return sarray_contains((struct sorted_array *) ips, &r);
+	struct uint128 min, max;
+	ptor(prefix, &min, &max);
+	return sarray128_contains((struct sarray128 *) ips, &min, &max);
 }
 
 bool
 res6_contains_range(struct resources_ipv6 *ips, struct ipv6_range *range)
 {
-	return sarray_contains((struct sorted_array *) ips, range);
+	struct uint128 min, max;
+	rtor(range, &min, &max);
+	return sarray128_contains((struct sarray128 *) ips, &min, &max);
+}
+
+bool
+res6_equals(struct resources_ipv6 *a, struct resources_ipv6 *b)
+{
+	return sarray128_equals((struct sarray128 *) a, (struct sarray128 *) b);
 }
@@ -6,7 +6,7 @@
 
 struct resources_ipv6;
 
-struct resources_ipv6 *res6_create(void);
+struct resources_ipv6 *res6_create(unsigned int);
 void res6_get(struct resources_ipv6 *);
 void res6_put(struct resources_ipv6 *);
 
@@ -15,5 +15,6 @@ int res6_add_range(struct resources_ipv6 *, struct ipv6_range *);
 bool res6_empty(struct resources_ipv6 *ips);
 bool res6_contains_prefix(struct resources_ipv6 *, struct ipv6_prefix *);
 bool res6_contains_range(struct resources_ipv6 *, struct ipv6_range *);
+bool res6_equals(struct resources_ipv6 *, struct resources_ipv6 *);
 
 #endif /* SRC_RESOURCE_IP6_H_ */
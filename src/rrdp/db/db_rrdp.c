@@ -1,14 +1,43 @@
 #include "rrdp/db/db_rrdp.h"
 
 #include <sys/queue.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <unistd.h>
 #include "crypto/hash.h"
 #include "common.h"
+#include "config.h"
+#include "file.h"
+#include "line_file.h"
 #include "log.h"
+#include "visited_uris.h"
+#include "object/manifest.h"
+
+/*
+ * The RRDP state (session ID, serial, last update and visited manifests of
+ * each Update Notification, per TAL) is stored at this file of the local
+ * repository, so that a restart doesn't need to download every snapshot again.
+ *
+ * It's a text file; the first line is STATE_HEADER, and each of the following
+ * ones is a tab-separated record:
+ *
+ *	T	<TAL file>
+ *	N	<notification URI>	<session ID>	<serial>	<last update>	<level>
+ *	M	<manifest URI>
+ *
+ * N records belong to the last T, and M records to the last N. On load, a
+ * notification's state is only kept if its manifests, and every file they
+ * list, are still at the workspace; otherwise its snapshot is downloaded.
+ */
+#define STATE_FILE	".rrdp-state"
+#define STATE_HEADER	"FORT RRDP state 1"
+#define STATE_MAX_FIELDS 6
 
 struct tal_elem {
 	char *file_name;
@@ -258,10 +287,11 @@ db_rrdp_reset_visited_tals(void)
 void
 db_rrdp_rem_nonvisited_tals(void)
 {
-	struct tal_elem *found;
+	struct tal_elem *found, *next;
 
 	rwlock_write_lock(&lock);
-	SLIST_FOREACH(found, &db.tals, next) {
+	for (found = SLIST_FIRST(&db.tals); found != NULL; found = next) {
+		next = SLIST_NEXT(found, next);
 		if (!found->visited) {
 			SLIST_REMOVE(&db.tals, found, tal_elem, next);
 			tal_elem_destroy(found, true);
@@ -269,3 +299,438 @@ db_rrdp_rem_nonvisited_tals(void)
 	}
 	rwlock_unlock(&lock);
 }
+
+static char *
+get_state_path(void)
+{
+	char const *repository;
+	char *path;
+	size_t len;
+
+	repository = config_get_local_repository();
+	len = strlen(repository) + 1 + strlen(STATE_FILE) + 1;
+
+	path = malloc(len);
+	if (path == NULL)
+		return NULL;
+
+	snprintf(path, len, "%s%s%s", repository,
+	    (repository[strlen(repository) - 1] == '/') ? "" : "/",
+	    STATE_FILE);
+	return path;
+}
+
+/* Notification being read from the state file */
+struct state_notification {
+	char *uri;
+	struct global_data data;
+	long last_update;
+	unsigned int level;
+	struct visited_uris *visited;
+	/*
+	 * The first manifest (or file listed by a manifest) that's missing
+	 * from the workspace, if any
+	 */
+	char *missing;
+};
+
+struct state_loader {
+	struct tal_elem *tal;
+	struct state_notification *notif;
+	unsigned int loaded;
+	unsigned int discarded;
+};
+
+static void
+state_notification_destroy(struct state_notification *notif)
+{
+	if (notif->visited != NULL)
+		visited_uris_refput(notif->visited);
+	free(notif->missing);
+	free(notif->data.session_id);
+	free(notif->uri);
+	free(notif);
+}
+
+/*
+ * Hands the notification being read to its TAL, unless its files aren't
+ * complete at the local workspace anymore. (In which case the notification
+ * will be handled as unknown, and its snapshot will be downloaded again.)
+ */
+static int
+commit_notification(struct state_loader *loader)
+{
+	struct state_notification *notif;
+	int error;
+
+	notif = loader->notif;
+	if (notif == NULL)
+		return 0;
+	loader->notif = NULL;
+
+	error = 0;
+	if (notif->missing != NULL) {
+		pr_op_debug("'%s' is not at the local repository; the RRDP state of '%s' will be discarded.",
+		    notif->missing, notif->uri);
+		loader->discarded++;
+		goto end;
+	}
+
+	error = db_rrdp_uris_add(loader->tal->uris, notif->uri, &notif->data,
+	    notif->last_update, notif->level, notif->visited);
+	if (error)
+		goto end;
+	notif->visited = NULL; /* Ownership transferred */
+	loader->loaded++;
+
+end:
+	state_notification_destroy(notif);
+	return error;
+}
+
+static int
+load_tal(struct state_loader *loader, char const *tal_name)
+{
+	struct tal_elem *elem;
+	int error;
+
+	error = commit_notification(loader);
+	if (error)
+		return error;
+
+	elem = db_rrdp_find_tal(tal_name);
+	if (elem == NULL) {
+		error = tal_elem_create(&elem, tal_name);
+		if (error)
+			return error;
+		rwlock_write_lock(&lock);
+		SLIST_INSERT_HEAD(&db.tals, elem, next);
+		rwlock_unlock(&lock);
+	}
+
+	loader->tal = elem;
+	return 0;
+}
+
+/* Unlike strtoul(), rejects signs and whitespace. */
+static int
+parse_ulong(char const *str, unsigned long *result)
+{
+	char *end;
+
+	if (!isdigit((unsigned char) str[0]))
+		return -EINVAL;
+
+	errno = 0;
+	*result = strtoul(str, &end, 10);
+	return (errno != 0 || *end != '\0') ? -EINVAL : 0;
+}
+
+static int
+load_notification(struct state_loader *loader, char **fields)
+{
+	struct state_notification *notif;
+	unsigned long last_update, level;
+	int error;
+
+	error = commit_notification(loader);
+	if (error)
+		return error;
+
+	if (loader->tal == NULL || fields[2][0] == '\0')
+		return -EINVAL;
+
+	notif = calloc(1, sizeof(struct state_notification));
+	if (notif == NULL)
+		return pr_enomem();
+
+	if (parse_ulong(fields[3], &notif->data.serial) != 0 ||
+	    parse_ulong(fields[4], &last_update) != 0 ||
+	    parse_ulong(fields[5], &level) != 0 ||
+	    last_update > LONG_MAX || level > UINT_MAX) {
+		error = -EINVAL;
+		goto fail;
+	}
+	notif->last_update = last_update;
+	notif->level = level;
+
+	notif->uri = strdup(fields[1]);
+	notif->data.session_id = strdup(fields[2]);
+	if (notif->uri == NULL || notif->data.session_id == NULL) {
+		error = pr_enomem();
+		goto fail;
+	}
+
+	error = visited_uris_create(&notif->visited);
+	if (error)
+		goto fail;
+
+	loader->notif = notif;
+	return 0;
+
+fail:
+	state_notification_destroy(notif);
+	return error;
+}
+
+static int
+load_manifest(struct state_loader *loader, char const *uri)
+{
+	struct state_notification *notif;
+	char *local;
+	int error;
+
+	notif = loader->notif;
+	if (notif == NULL)
+		return -EINVAL;
+	if (notif->missing != NULL)
+		return 0; /* Already doomed */
+	if (strncmp(uri, "rsync://", strlen("rsync://")) != 0)
+		return -EINVAL;
+
+	error = map_uri_to_local(uri, "rsync://", loader->tal->workspace,
+	    &local);
+	if (error)
+		return error;
+	if (!valid_file_or_dir(local, true, false, NULL)) {
+		free(local);
+		notif->missing = strdup(uri);
+		return (notif->missing != NULL) ? 0 : pr_enomem();
+	}
+
+	/* The manifest alone doesn't vouch for the files it lists */
+	error = manifest_find_missing(local, &notif->missing);
+	free(local);
+	if (error || notif->missing != NULL)
+		return error;
+
+	return visited_uris_add(notif->visited, uri);
+}
+
+/* Splits @line in tab-separated fields. Returns the number of fields. */
+static unsigned int
+split_fields(char *line, char **fields)
+{
+	unsigned int count;
+
+	count = 0;
+	fields[count++] = line;
+	for (; *line != '\0'; line++) {
+		if (*line != '\t')
+			continue;
+		if (count == STATE_MAX_FIELDS)
+			return STATE_MAX_FIELDS + 1;
+		*line = '\0';
+		fields[count++] = line + 1;
+	}
+
+	return count;
+}
+
+static int
+load_line(struct state_loader *loader, char *line)
+{
+	char *fields[STATE_MAX_FIELDS];
+	unsigned int count;
+
+	count = split_fields(line, fields);
+	if (strcmp(fields[0], "T") == 0 && count == 2)
+		return load_tal(loader, fields[1]);
+	if (strcmp(fields[0], "N") == 0 && count == 6)
+		return load_notification(loader, fields);
+	if (strcmp(fields[0], "M") == 0 && count == 2)
+		return load_manifest(loader, fields[1]);
+
+	return -EINVAL;
+}
+
+/*
+ * Loads the RRDP state stored by db_rrdp_store() at a previous run, so that
+ * the RRDP repositories whose files are still present only need their deltas.
+ *
+ * Meant to be called once, before the first validation cycle. Errors are
+ * logged, and the whole state is discarded on error; the worst consequence is
+ * that the snapshots are downloaded again.
+ */
+void
+db_rrdp_load(void)
+{
+	struct line_file *lfile;
+	struct state_loader loader;
+	struct tal_elem *elem;
+	char *path;
+	char *line;
+	int error;
+
+	path = get_state_path();
+	if (path == NULL) {
+		pr_enomem();
+		return;
+	}
+
+	error = lfile_open(path, &lfile);
+	if (error) {
+		if (error != ENOENT)
+			pr_op_warn("Cannot open the RRDP state '%s': %s", path,
+			    strerror(error));
+		free(path);
+		return;
+	}
+
+	loader.tal = NULL;
+	loader.notif = NULL;
+	loader.loaded = 0;
+	loader.discarded = 0;
+
+	line = NULL;
+	error = lfile_read(lfile, &line);
+	if (error || line == NULL || strcmp(line, STATE_HEADER) != 0) {
+		pr_op_warn("'%s' is not a known RRDP state file; ignoring it.",
+		    path);
+		free(line);
+		goto end;
+	}
+	free(line);
+
+	do {
+		line = NULL;
+		error = lfile_read(lfile, &line);
+		if (error || line == NULL)
+			break;
+		error = load_line(&loader, line);
+		if (error == -EINVAL)
+			pr_op_warn("Malformed line at the RRDP state '%s' (offset %zu).",
+			    path, lfile_offset(lfile));
+		free(line);
+	} while (!error);
+
+	if (!error)
+		error = commit_notification(&loader);
+	if (loader.notif != NULL)
+		state_notification_destroy(loader.notif);
+
+	if (error) {
+		pr_op_warn("Discarding the RRDP state; the RRDP snapshots will be downloaded again.");
+		while (!SLIST_EMPTY(&db.tals)) {
+			elem = SLIST_FIRST(&db.tals);
+			SLIST_REMOVE_HEAD(&db.tals, next);
+			tal_elem_destroy(elem, false);
+		}
+		goto end;
+	}
+
+	pr_op_info("Loaded the RRDP state of %u repositories (%u discarded because their files are incomplete).",
+	    loader.loaded, loader.discarded);
+
+end:
+	lfile_close(lfile);
+	free(path);
+}
+
+/* Tabs and newlines would break the records */
+static bool
+is_storable(char const *str)
+{
+	return strpbrk(str, "\t\r\n") == NULL;
+}
+
+static int
+store_manifest(char const *uri, void *arg)
+{
+	FILE *file = arg;
+
+	if (!is_storable(uri))
+		return -EINVAL;
+	return (fprintf(file, "M\t%s\n", uri) < 0) ? -EIO : 0;
+}
+
+static int
+store_notification(char const *uri, struct global_data const *data,
+    long last_update, unsigned int level, struct visited_uris *visited,
+    void *arg)
+{
+	FILE *file = arg;
+
+	if (!is_storable(uri) || !is_storable(data->session_id)) {
+		pr_op_debug("RRDP state of '%s' cannot be stored; skipping it.",
+		    uri);
+		return 0;
+	}
+
+	if (fprintf(file, "N\t%s\t%s\t%lu\t%ld\t%u\n", uri, data->session_id,
+	    data->serial, last_update, level) < 0)
+		return -EIO;
+
+	return (visited != NULL)
+	    ? visited_uris_foreach(visited, store_manifest, file)
+	    : 0;
+}
+
+/*
+ * Stores the state of every known RRDP repository at the local repository
+ * (see db_rrdp_load()).
+ *
+ * Meant to be called after a validation cycle, when no TAL is being
+ * validated. The previous file is only replaced if the new one was completely
+ * written.
+ */
+void
+db_rrdp_store(void)
+{
+	struct tal_elem *elem;
+	struct stat stat;
+	FILE *file;
+	char *path;
+	char *tmp_path;
+	size_t len;
+	int error;
+
+	path = get_state_path();
+	if (path == NULL) {
+		pr_enomem();
+		return;
+	}
+	len = strlen(path) + strlen(".tmp") + 1;
+	tmp_path = malloc(len);
+	if (tmp_path == NULL) {
+		pr_enomem();
+		goto free_path;
+	}
+	snprintf(tmp_path, len, "%s.tmp", path);
+
+	error = file_write(tmp_path, &file, &stat);
+	if (error)
+		goto free_tmp;
+
+	error = (fprintf(file, STATE_HEADER "\n") < 0) ? -EIO : 0;
+
+	rwlock_read_lock(&lock);
+	SLIST_FOREACH(elem, &db.tals, next) {
+		if (error)
+			break;
+		if (!is_storable(elem->file_name))
+			continue;
+		if (fprintf(file, "T\t%s\n", elem->file_name) < 0) {
+			error = -EIO;
+			break;
+		}
+		error = db_rrdp_uris_foreach_state(elem->uris,
+		    store_notification, file);
+	}
+	rwlock_unlock(&lock);
+
+	if (fclose(file) != 0 && !error)
+		error = -errno;
+	if (!error && rename(tmp_path, path) != 0)
+		error = -errno;
+	if (error) {
+		pr_op_warn("Could not store the RRDP state at '%s': %s", path,
+		    strerror(abs(error)));
+		unlink(tmp_path);
+	}
+
+free_tmp:
+	free(tmp_path);
+free_path:
+	free(path);
+}
@@ -15,4 +15,7 @@ char const *db_rrdp_get_workspace(char const *);
 void db_rrdp_reset_visited_tals(void);
 void db_rrdp_rem_nonvisited_tals(void);
 
+void db_rrdp_load(void);
+void db_rrdp_store(void);
+
 #endif /* SRC_RRDP_DB_DB_RRDP_H_ */
@@ -19,12 +19,18 @@ struct uris_table {
 	rrdp_req_status_t request_status;
 	/* MFT URIs loaded from the @uri */
 	struct visited_uris *visited_uris;
+	/* Repository level at which the @uri was last fetched */
+	unsigned int level;
 	UT_hash_handle hh;
 };
 
 struct db_rrdp_uri {
 	struct uris_table *table;
-	char const *current_workspace;
+	/*
+	 * Protects @table. Besides the TAL's validation thread, the RRDP
+	 * prefetch workers can also be working on it.
+	 */
+	pthread_rwlock_t lock;
 };
 
 static int
@@ -57,6 +63,7 @@ uris_table_create(char const *uri, char const *session_id,
 	tmp->last_update = 0;
 	tmp->request_status = req_status;
 	tmp->visited_uris = NULL;
+	tmp->level = 0;
 
 	*result = tmp;
 	return 0;
@@ -86,8 +93,10 @@ find_rrdp_uri(struct db_rrdp_uri *uris, const char *search)
 
 #define RET_NOT_FOUND_URI(uris, search, found)				\
 	found = find_rrdp_uri(uris, search);				\
-	if (found == NULL)						\
-		return -ENOENT;
+	if (found == NULL) {						\
+		rwlock_unlock(&uris->lock);				\
+		return -ENOENT;						\
+	}
 
 static void
 add_rrdp_uri(struct db_rrdp_uri *uris, struct uris_table *new_uri)
@@ -116,30 +125,23 @@ get_thread_rrdp_uris(struct db_rrdp_uri **result)
 	return 0;
 }
 
-static int
-get_thread_rrdp_workspace(char const **result)
-{
-	struct validation *state;
-
-	state = state_retrieve();
-	if (state == NULL)
-		return pr_val_err("No state related to this thread");
-
-	*result = validation_get_rrdp_workspace(state);
-	return 0;
-}
-
 int
 db_rrdp_uris_create(struct db_rrdp_uri **uris)
 {
 	struct db_rrdp_uri *tmp;
+	int error;
 
 	tmp = malloc(sizeof(struct db_rrdp_uri));
 	if (tmp == NULL)
 		return pr_enomem();
 
+	error = pthread_rwlock_init(&tmp->lock, NULL);
+	if (error) {
+		free(tmp);
+		return pr_op_errno(error, "RRDP URIs pthread_rwlock_init() errored");
+	}
+
 	tmp->table = NULL;
-	tmp->current_workspace = NULL;
 
 	*uris = tmp;
 	return 0;
@@ -154,6 +156,7 @@ db_rrdp_uris_destroy(struct db_rrdp_uri *uris)
 		HASH_DEL(uris->table, uri_node);
 		uris_table_destroy(uri_node);
 	}
+	pthread_rwlock_destroy(&uris->lock);
 	free(uris);
 }
 
@@ -170,23 +173,18 @@ db_rrdp_uris_cmp(char const *uri, char const *session_id, unsigned long serial,
 	if (error)
 		return error;
 
+	rwlock_read_lock(&uris->lock);
 	found = find_rrdp_uri(uris, uri);
-	if (found == NULL) {
+	if (found == NULL)
 		*result = RRDP_URI_NOTFOUND;
-		return 0;
-	}
-
-	if (strcmp(session_id, found->data.session_id) != 0) {
+	else if (strcmp(session_id, found->data.session_id) != 0)
 		*result = RRDP_URI_DIFF_SESSION;
-		return 0;
-	}
-
-	if (serial != found->data.serial) {
+	else if (serial != found->data.serial)
 		*result = RRDP_URI_DIFF_SERIAL;
-		return 0;
-	}
+	else
+		*result = RRDP_URI_EQUAL;
+	rwlock_unlock(&uris->lock);
 
-	*result = RRDP_URI_EQUAL;
 	return 0;
 }
 
@@ -211,8 +209,11 @@ db_rrdp_uris_update(char const *uri, char const *session_id,
 
 	/* Ownership transfered */
 	db_uri->visited_uris = visited_uris;
+	db_uri->level = working_repo_peek_level();
 
+	rwlock_write_lock(&uris->lock);
 	add_rrdp_uri(uris, db_uri);
+	rwlock_unlock(&uris->lock);
 
 	return 0;
 }
@@ -229,8 +230,10 @@ db_rrdp_uris_get_serial(char const *uri, unsigned long *serial)
 	if (error)
 		return error;
 
+	rwlock_read_lock(&uris->lock);
 	RET_NOT_FOUND_URI(uris, uri, found)
 	*serial = found->data.serial;
+	rwlock_unlock(&uris->lock);
 	return 0;
 }
 
@@ -246,8 +249,10 @@ db_rrdp_uris_get_last_update(char const *uri, long *date)
 	if (error)
 		return error;
 
+	rwlock_read_lock(&uris->lock);
 	RET_NOT_FOUND_URI(uris, uri, found)
 	*date = found->last_update;
+	rwlock_unlock(&uris->lock);
 	return 0;
 }
 
@@ -265,14 +270,15 @@ db_rrdp_uris_set_last_update(char const *uri)
 	if (error)
 		return error;
 
-	RET_NOT_FOUND_URI(uris, uri, found)
-
 	now = 0;
 	error = get_current_time(&now);
 	if (error)
 		return error;
 
+	rwlock_write_lock(&uris->lock);
+	RET_NOT_FOUND_URI(uris, uri, found)
 	found->last_update = (long)now;
+	rwlock_unlock(&uris->lock);
 	return 0;
 }
 
@@ -288,8 +294,10 @@ db_rrdp_uris_get_request_status(char const *uri, rrdp_req_status_t *result)
 	if (error)
 		return error;
 
+	rwlock_read_lock(&uris->lock);
 	RET_NOT_FOUND_URI(uris, uri, found)
 	*result = found->request_status;
+	rwlock_unlock(&uris->lock);
 	return 0;
 }
 
@@ -305,8 +313,10 @@ db_rrdp_uris_set_request_status(char const *uri, rrdp_req_status_t value)
 	if (error)
 		return error;
 
+	rwlock_write_lock(&uris->lock);
 	RET_NOT_FOUND_URI(uris, uri, found)
 	found->request_status = value;
+	rwlock_unlock(&uris->lock);
 	return 0;
 }
 
@@ -322,12 +332,47 @@ db_rrdp_uris_set_all_unvisited(void)
 	if (error)
 		return error;
 
+	rwlock_write_lock(&uris->lock);
 	HASH_ITER(hh, uris->table, uri_node, uri_tmp)
 		uri_node->request_status = RRDP_URI_REQ_UNVISITED;
+	rwlock_unlock(&uris->lock);
 
 	return 0;
 }
 
+/*
+ * Call @cb for each URI of the current thread that has been successfully
+ * fetched at some point (ie. it has a session ID), along with the repository
+ * level where it was found.
+ *
+ * @cb is called while holding the lock, so it must not use any other
+ * db_rrdp_uris function.
+ */
+int
+db_rrdp_uris_foreach_fetched(rrdp_uri_cb cb, void *arg)
+{
+	struct db_rrdp_uri *uris;
+	struct uris_table *uri_node, *uri_tmp;
+	int error;
+
+	uris = NULL;
+	error = get_thread_rrdp_uris(&uris);
+	if (error)
+		return error;
+
+	rwlock_read_lock(&uris->lock);
+	HASH_ITER(hh, uris->table, uri_node, uri_tmp) {
+		if (uri_node->data.session_id[0] == '\0')
+			continue;
+		error = cb(uri_node->uri, uri_node->level, arg);
+		if (error)
+			break;
+	}
+	rwlock_unlock(&uris->lock);
+
+	return error;
+}
+
 /*
  * Returns a pointer (set in @result) to the visited_uris of the current
  * thread.
@@ -344,8 +389,10 @@ db_rrdp_uris_get_visited_uris(char const *uri, struct visited_uris **result)
 	if (error)
 		return error;
 
+	rwlock_read_lock(&uris->lock);
 	RET_NOT_FOUND_URI(uris, uri, found)
 	*result = found->visited_uris;
+	rwlock_unlock(&uris->lock);
 	return 0;
 }
 
@@ -356,55 +403,119 @@ db_rrdp_uris_remove_all_local(struct db_rrdp_uri *uris, char const *workspace)
 	int error;
 
 	/* Remove each 'visited_uris' from all the table */
+	error = 0;
+	rwlock_read_lock(&uris->lock);
 	HASH_ITER(hh, uris->table, uri_node, uri_tmp) {
 		error = visited_uris_delete_local(uri_node->visited_uris,
 		    workspace);
 		if (error)
-			return error;
+			break;
 	}
+	rwlock_unlock(&uris->lock);
+
+	return error;
+}
+
+/*
+ * Adds the @uri, as it was stored at a previous run (@last_update and @level
+ * included), to @uris. Unlike db_rrdp_uris_update(), @uris doesn't need to
+ * belong to the current thread.
+ *
+ * On success, the ownership of @visited_uris is transferred.
+ */
+int
+db_rrdp_uris_add(struct db_rrdp_uri *uris, char const *uri,
+    struct global_data const *data, long last_update, unsigned int level,
+    struct visited_uris *visited_uris)
+{
+	struct uris_table *db_uri;
+	int error;
+
+	db_uri = NULL;
+	error = uris_table_create(uri, data->session_id, data->serial,
+	    RRDP_URI_REQ_UNVISITED, &db_uri);
+	if (error)
+		return error;
+
+	db_uri->last_update = last_update;
+	db_uri->level = level;
+	db_uri->visited_uris = visited_uris;
+
+	rwlock_write_lock(&uris->lock);
+	add_rrdp_uri(uris, db_uri);
+	rwlock_unlock(&uris->lock);
 
 	return 0;
 }
 
+/*
+ * Call @cb for each URI of @uris whose files are (as far as the DB knows)
+ * complete at the local workspace; ie. it was successfully fetched at some
+ * point, and its last fetch didn't fail.
+ *
+ * @cb is called while holding the lock, so it must not use any other
+ * db_rrdp_uris function.
+ */
+int
+db_rrdp_uris_foreach_state(struct db_rrdp_uri *uris, rrdp_uri_state_cb cb,
+    void *arg)
+{
+	struct uris_table *uri_node, *uri_tmp;
+	int error;
+
+	error = 0;
+	rwlock_read_lock(&uris->lock);
+	HASH_ITER(hh, uris->table, uri_node, uri_tmp) {
+		if (uri_node->data.session_id[0] == '\0' ||
+		    uri_node->request_status == RRDP_URI_REQ_ERROR)
+			continue;
+		error = cb(uri_node->uri, &uri_node->data,
+		    uri_node->last_update, uri_node->level,
+		    uri_node->visited_uris, arg);
+		if (error)
+			break;
+	}
+	rwlock_unlock(&uris->lock);
+
+	return error;
+}
+
 char const *
 db_rrdp_uris_workspace_get(void)
 {
-	struct db_rrdp_uri *uris;
-	int error;
+	struct validation *state;
 
-	uris = NULL;
-	error = get_thread_rrdp_uris(&uris);
-	if (error)
+	state = state_retrieve();
+	if (state == NULL)
 		return NULL;
 
-	return uris->current_workspace;
+	return validation_rrdp_workspace_enabled(state)
+	    ? validation_get_rrdp_workspace(state)
+	    : NULL;
 }
 
 int
 db_rrdp_uris_workspace_enable(void)
 {
-	struct db_rrdp_uri *uris;
-	int error;
+	struct validation *state;
 
-	uris = NULL;
-	error = get_thread_rrdp_uris(&uris);
-	if (error)
-		return error;
+	state = state_retrieve();
+	if (state == NULL)
+		return pr_val_err("No state related to this thread");
 
-	return get_thread_rrdp_workspace(&uris->current_workspace);
+	validation_set_rrdp_workspace_enabled(state, true);
+	return 0;
 }
 
 int
 db_rrdp_uris_workspace_disable(void)
 {
-	struct db_rrdp_uri *uris;
-	int error;
+	struct validation *state;
 
-	uris = NULL;
-	error = get_thread_rrdp_uris(&uris);
-	if (error)
-		return error;
+	state = state_retrieve();
+	if (state == NULL)
+		return pr_val_err("No state related to this thread");
 
-	uris->current_workspace = NULL;
+	validation_set_rrdp_workspace_enabled(state, false);
 	return 0;
 }
@@ -34,10 +34,21 @@ int db_rrdp_uris_get_request_status(char const *, rrdp_req_status_t *);
 int db_rrdp_uris_set_request_status(char const *, rrdp_req_status_t);
 int db_rrdp_uris_set_all_unvisited(void);
 
+typedef int (*rrdp_uri_cb)(char const *, unsigned int, void *);
+int db_rrdp_uris_foreach_fetched(rrdp_uri_cb, void *);
+
 int db_rrdp_uris_get_visited_uris(char const *, struct visited_uris **);
 
 int db_rrdp_uris_remove_all_local(struct db_rrdp_uri *, char const *);
 
+/* Persistence (see db_rrdp_load() and db_rrdp_store()) */
+int db_rrdp_uris_add(struct db_rrdp_uri *, char const *,
+    struct global_data const *, long, unsigned int, struct visited_uris *);
+typedef int (*rrdp_uri_state_cb)(char const *, struct global_data const *,
+    long, unsigned int, struct visited_uris *, void *);
+int db_rrdp_uris_foreach_state(struct db_rrdp_uri *, rrdp_uri_state_cb,
+    void *);
+
 char const *db_rrdp_uris_workspace_get(void);
 int db_rrdp_uris_workspace_enable(void);
 int db_rrdp_uris_workspace_disable(void);
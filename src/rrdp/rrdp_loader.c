@@ -1,5 +1,8 @@
 #include "rrdp_loader.h"
 
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
 #include "rrdp/db/db_rrdp_uris.h"
 #include "rrdp/rrdp_objects.h"
 #include "rrdp/rrdp_parser.h"
@@ -7,9 +10,13 @@
 #include "common.h"
 #include "config.h"
 #include "log.h"
+#include "metrics.h"
+#include "profile.h"
 #include "reqs_errors.h"
+#include "state.h"
 #include "thread_var.h"
 #include "visited_uris.h"
+#include "thread/thread_pool.h"
 
 /* Fetch and process the deltas from the @notification */
 static int
@@ -116,6 +123,7 @@ __rrdp_load(struct rpki_uri *uri, bool force_snapshot, bool *data_updated)
 	struct visited_uris *visited;
 	rrdp_req_status_t requested;
 	rrdp_uri_cmp_result_t res;
+	struct metrics_fetch fetch;
 	bool log_operation;
 	int error, upd_error;
 
@@ -151,6 +159,8 @@ __rrdp_load(struct rpki_uri *uri, bool force_snapshot, bool *data_updated)
 		}
 	}
 
+	metrics_fetch_start(&fetch, MP_RRDP);
+	profile_start(PP_FETCH_RRDP, uri_get_global(uri));
 	log_operation = reqs_errors_log_uri(uri_get_global(uri));
 	error = rrdp_parse_notification(uri, log_operation, force_snapshot,
 	    &upd_notification);
@@ -237,6 +247,9 @@ upd_destroy:
 		fnstack_pop(); /* Pop from rrdp_parse_notification */
 	}
 upd_end:
+	profile_end();
+	metrics_fetch_end(&fetch, uri_get_global(uri), error);
+
 	/* Just return on success */
 	if (!error) {
 		/* The repository URI is the notification file URI */
@@ -299,3 +312,188 @@ rrdp_reload_snapshot(struct rpki_uri *uri)
 	tmp = false;
 	return __rrdp_load(uri, true, &tmp);
 }
+
+/* A known RRDP repository to be downloaded before the tree traversal */
+struct prefetch_task {
+	char *uri;
+	/* Repository level where the @uri was found (used for logging) */
+	unsigned int level;
+	/* Owner of the RRDP URIs table and workspace */
+	struct tal *tal;
+	struct validation_handler handler;
+	/* Where the time spent is accounted */
+	struct profile_tal *profile;
+	SLIST_ENTRY(prefetch_task) next;
+};
+
+SLIST_HEAD(prefetch_list, prefetch_task);
+
+struct prefetch_tasks {
+	struct prefetch_list list;
+	unsigned int count;
+};
+
+static int
+prefetch_task_add(char const *uri, unsigned int level, void *arg)
+{
+	struct prefetch_tasks *tasks = arg;
+	struct prefetch_task *task;
+
+	task = malloc(sizeof(struct prefetch_task));
+	if (task == NULL)
+		return pr_enomem();
+
+	task->uri = strdup(uri);
+	if (task->uri == NULL) {
+		free(task);
+		return pr_enomem();
+	}
+	task->level = level;
+
+	SLIST_INSERT_HEAD(&tasks->list, task, next);
+	tasks->count++;
+	return 0;
+}
+
+static void
+prefetch_task_destroy(struct prefetch_task *task)
+{
+	free(task->uri);
+	free(task);
+}
+
+/*
+ * Worker thread. Mimics the thread state of a TAL validation, so that the
+ * RRDP loader writes on the same URIs table and workspace than its TAL.
+ */
+static void *
+prefetch_task_run(void *arg)
+{
+	struct prefetch_task *task = arg;
+	struct validation *state;
+	struct rpki_uri *uri;
+	bool data_updated;
+	int error;
+
+	fnstack_init();
+	working_repo_init();
+	profile_tal_set(task->profile);
+
+	error = validation_prepare(&state, task->tal, &task->handler);
+	if (error)
+		goto end;
+
+	working_repo_push_level(task->level);
+	db_rrdp_uris_workspace_enable();
+
+	error = uri_create_https_str_rrdp(&uri, task->uri, strlen(task->uri));
+	if (error)
+		goto destroy_state;
+
+	/*
+	 * Errors are already stored at the DB (the traversal will skip the
+	 * URI), so there's nothing else to do here.
+	 */
+	error = rrdp_load(uri, &data_updated);
+	if (error)
+		pr_val_debug("RRDP prefetch of '%s' failed; the traversal will fall back to the alternative access methods.",
+		    task->uri);
+
+	uri_refput(uri);
+destroy_state:
+	db_rrdp_uris_workspace_disable();
+	validation_destroy(state);
+end:
+	profile_tal_set(NULL);
+	working_repo_cleanup();
+	fnstack_cleanup();
+	prefetch_task_destroy(task);
+	return NULL;
+}
+
+/*
+ * The traversal won't try rsync for a prefetched repository (it's already
+ * visited), so prefetching only makes sense when RRDP would be the first
+ * choice anyway. When both priorities are equal, each CA decides (through
+ * the order of its SIA), and the CAs aren't known yet.
+ */
+static bool
+prefetch_enabled(void)
+{
+	if (config_get_thread_pool_rrdp_prefetch_max() == 0)
+		return false;
+	if (!config_get_http_enabled())
+		return false;
+	if (!config_get_rsync_enabled())
+		return true;
+	return config_get_http_priority() > config_get_rsync_priority();
+}
+
+/*
+ * Download (and process) simultaneously every RRDP repository that the
+ * current TAL fetched during previous validation cycles.
+ *
+ * Meant to be called right before the tree traversal, once all the URIs have
+ * been set as unvisited: every fetched URI will be marked as visited (or
+ * errored), so the traversal won't have to wait for them.
+ *
+ * Any error is logged and ignored; the traversal will request again whatever
+ * wasn't fetched here.
+ */
+void
+rrdp_prefetch(void)
+{
+	struct prefetch_tasks tasks;
+	struct prefetch_task *task;
+	struct thread_pool *pool;
+	struct validation *state;
+	unsigned int threads;
+	int error;
+
+	if (!prefetch_enabled())
+		return;
+
+	state = state_retrieve();
+	if (state == NULL)
+		return;
+
+	SLIST_INIT(&tasks.list);
+	tasks.count = 0;
+	error = db_rrdp_uris_foreach_fetched(prefetch_task_add, &tasks);
+	if (error)
+		goto release;
+	if (tasks.count == 0)
+		return;
+
+	threads = config_get_thread_pool_rrdp_prefetch_max();
+	if (threads > tasks.count)
+		threads = tasks.count;
+
+	error = thread_pool_create(threads, &pool);
+	if (error)
+		goto release;
+
+	pr_val_debug("Prefetching known RRDP repositories {");
+	while (!SLIST_EMPTY(&tasks.list)) {
+		task = SLIST_FIRST(&tasks.list);
+		task->tal = validation_tal(state);
+		task->handler = *validation_get_validation_handler(state);
+		task->profile = profile_tal_get();
+
+		error = thread_pool_push(pool, prefetch_task_run, task);
+		if (error)
+			break;
+		/* Ownership transferred to the worker */
+		SLIST_REMOVE_HEAD(&tasks.list, next);
+	}
+	thread_pool_wait(pool);
+	thread_pool_destroy(pool);
+	pr_val_debug("}");
+
+release:
+	while (!SLIST_EMPTY(&tasks.list)) {
+		task = SLIST_FIRST(&tasks.list);
+		SLIST_REMOVE_HEAD(&tasks.list, next);
+		prefetch_task_destroy(task);
+	}
+}
@@ -6,5 +6,6 @@
 
 int rrdp_load(struct rpki_uri *, bool *);
 int rrdp_reload_snapshot(struct rpki_uri *);
+void rrdp_prefetch(void);
 
 #endif /* SRC_RRDP_RRDP_LOADER_H_ */
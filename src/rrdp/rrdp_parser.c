@@ -12,9 +12,12 @@
 #include "rrdp/db/db_rrdp_uris.h"
 #include "crypto/base64.h"
 #include "crypto/hash.h"
+#include "data_structure/uthash_nonfatal.h"
 #include "http/http.h"
+#include "thread/thread_pool.h"
 #include "xml/relax_ng.h"
 #include "common.h"
+#include "config.h"
 #include "file.h"
 #include "log.h"
 #include "thread_var.h"
@@ -58,6 +61,51 @@ struct rdr_snapshot_ctx {
 	struct visited_uris *visited_uris;
 };
 
+/* A <publish> or a <withdraw> element from a delta, only one is set */
+struct delta_change {
+	struct publish *publish;
+	struct withdraw *withdraw;
+};
+
+/* Array list to remember the elements of a delta, in the same order */
+DEFINE_ARRAY_LIST_STRUCT(delta_changes, struct delta_change);
+DEFINE_ARRAY_LIST_FUNCTIONS(delta_changes, struct delta_change, static)
+
+/* A delta to be downloaded and parsed (possibly by another thread) */
+struct delta_job {
+	struct delta_head *head;
+	/* HTTPS URI of the delta file */
+	struct rpki_uri *uri;
+	/* Parent data to validate session ID */
+	struct update_notification *parent;
+	/* Elements of the delta, in order */
+	struct delta_changes changes;
+	/* Is there a local file to delete? */
+	bool downloaded;
+	/* Result of the parsing */
+	int error;
+};
+
+/* Array list of deltas, sorted by serial */
+DEFINE_ARRAY_LIST_STRUCT(delta_jobs, struct delta_job);
+DEFINE_ARRAY_LIST_FUNCTIONS(delta_jobs, struct delta_job, static)
+
+/*
+ * The latest change of a file, once all the deltas are coalesced. It's
+ * indexed by the file's URI.
+ */
+struct pending_file {
+	/* Key, owned by @change */
+	char const *uri;
+	struct delta_change const *change;
+	/*
+	 * Was the file created by these deltas? (ie. it was first published
+	 * without hash, so it's a new object.)
+	 */
+	bool created;
+	UT_hash_handle hh;
+};
+
 /* Context while reading a delta */
 struct rdr_delta_ctx {
 	/* Data being parsed */
@@ -66,8 +114,8 @@ struct rdr_delta_ctx {
 	struct update_notification *parent;
 	/* Current serial loaded from update notification deltas list */
 	unsigned long expected_serial;
-	/* Visited URIs related to this thread */
-	struct visited_uris *visited_uris;
+	/* Where the elements of the delta are stored */
+	struct delta_changes *changes;
 };
 
 /* Args to send on update (snapshot/delta) files parsing */
@@ -471,12 +519,15 @@ end:
 	return 0;
 }
 
+/*
+ * Note: the hash (if present) isn't validated here, it refers to the file
+ * that's being replaced. See coalesce_change().
+ */
 static int
 parse_publish(xmlTextReaderPtr reader, bool parse_hash, bool hash_required,
     struct publish **publish)
 {
 	struct publish *tmp;
-	struct rpki_uri *uri;
 	char *base64_str;
 	int error;
 
@@ -504,26 +555,6 @@ parse_publish(xmlTextReaderPtr reader, bool parse_hash, bool hash_required,
 	if (error)
 		goto release_base64;
 
-	/* rfc8181#section-2.2 but considering optional hash */
-	uri = NULL;
-	if (tmp->doc_data.hash_len > 0) {
-		/* Get the current file from the uri */
-		error = uri_create_rsync_str_rrdp(&uri, tmp->doc_data.uri,
-		    strlen(tmp->doc_data.uri));
-		if (error)
-			goto release_base64;
-
-		error = hash_validate_file("sha256", uri, tmp->doc_data.hash,
-		    tmp->doc_data.hash_len);
-		uri_refput(uri);
-		if (error != 0) {
-			pr_val_info("Hash of base64 decoded element from URI '%s' doesn't match <publish> element hash",
-			    tmp->doc_data.uri);
-			error = EINVAL;
-			goto release_base64;
-		}
-	}
-
 	free(base64_str);
 	*publish = tmp;
 	return 0;
@@ -534,11 +565,11 @@ release_tmp:
 	return error;
 }
 
+/* The hash isn't validated here either, see coalesce_change(). */
 static int
 parse_withdraw(xmlTextReaderPtr reader, struct withdraw **withdraw)
 {
 	struct withdraw *tmp;
-	struct rpki_uri *uri;
 	int error;
 
 	error = withdraw_create(&tmp);
@@ -546,28 +577,13 @@ parse_withdraw(xmlTextReaderPtr reader, struct withdraw **withdraw)
 		return error;
 
 	error = parse_doc_data(reader, true, true, &tmp->doc_data);
-	if (error)
-		goto release_tmp;
-
-	/* rfc8181#section-2.2, get the file from the uri */
-	error = uri_create_rsync_str_rrdp(&uri, tmp->doc_data.uri,
-	    strlen(tmp->doc_data.uri));
-	if (error)
-		goto release_tmp;
-
-	error = hash_validate_file("sha256", uri,
-	    tmp->doc_data.hash, tmp->doc_data.hash_len);
-	if (error)
-		goto release_uri;
+	if (error) {
+		withdraw_destroy(tmp);
+		return error;
+	}
 
-	uri_refput(uri);
 	*withdraw = tmp;
 	return 0;
-release_uri:
-	uri_refput(uri);
-release_tmp:
-	withdraw_destroy(tmp);
-	return error;
 }
 
 static int
@@ -677,25 +693,65 @@ parse_publish_elem(xmlTextReaderPtr reader, bool parse_hash, bool hash_required,
 }
 
 /*
+ * Parse a delta's <publish> element and remember it at @changes.
+ *
  * This function will call 'xmlTextReaderRead' so there's no need to expect any
  * other type at the caller.
  */
 static int
-parse_withdraw_elem(xmlTextReaderPtr reader, struct visited_uris *visited_uris)
+parse_delta_publish(xmlTextReaderPtr reader, struct delta_changes *changes)
 {
-	struct withdraw *tmp;
+	struct delta_change change;
 	int error;
 
-	error = parse_withdraw(reader, &tmp);
+	change.publish = NULL;
+	change.withdraw = NULL;
+	error = parse_publish(reader, true, false, &change.publish);
 	if (error)
 		return error;
 
-	error = __delete_from_uri(tmp->doc_data.uri, visited_uris);
-	withdraw_destroy(tmp);
+	error = delta_changes_add(changes, &change);
+	if (error)
+		publish_destroy(change.publish);
+
+	return error;
+}
+
+/* Parse a delta's <withdraw> element and remember it at @changes. */
+static int
+parse_delta_withdraw(xmlTextReaderPtr reader, struct delta_changes *changes)
+{
+	struct delta_change change;
+	int error;
+
+	change.publish = NULL;
+	change.withdraw = NULL;
+	error = parse_withdraw(reader, &change.withdraw);
 	if (error)
 		return error;
 
-	return 0;
+	error = delta_changes_add(changes, &change);
+	if (error)
+		withdraw_destroy(change.withdraw);
+
+	return error;
+}
+
+static void
+delta_change_cleanup(struct delta_change *change)
+{
+	if (change->publish != NULL)
+		publish_destroy(change->publish);
+	if (change->withdraw != NULL)
+		withdraw_destroy(change->withdraw);
+}
+
+static struct doc_data const *
+delta_change_doc_data(struct delta_change const *change)
+{
+	return (change->publish != NULL)
+	    ? &change->publish->doc_data
+	    : &change->withdraw->doc_data;
 }
 
 static int
@@ -950,10 +1006,9 @@ xml_read_delta(xmlTextReaderPtr reader, void *arg)
 	switch (type) {
 	case XML_READER_TYPE_ELEMENT:
 		if (xmlStrEqual(name, BAD_CAST RRDP_ELEM_PUBLISH))
-			error = parse_publish_elem(reader, true, false,
-			    ctx->visited_uris);
+			error = parse_delta_publish(reader, ctx->changes);
 		else if (xmlStrEqual(name, BAD_CAST RRDP_ELEM_WITHDRAW))
-			error = parse_withdraw_elem(reader, ctx->visited_uris);
+			error = parse_delta_withdraw(reader, ctx->changes);
 		else if (xmlStrEqual(name, BAD_CAST RRDP_ELEM_DELTA))
 			error = parse_global_data(reader,
 			    &ctx->delta->global_data,
@@ -972,19 +1027,23 @@ xml_read_delta(xmlTextReaderPtr reader, void *arg)
 	return 0;
 }
 
+/*
+ * Parse the downloaded delta of @job into @job->changes. Nothing is written
+ * (nor read, besides the delta itself) at the local repository, so several
+ * deltas can be parsed at the same time.
+ */
 static int
-parse_delta(struct rpki_uri *uri, struct delta_head *parents_data,
-    struct proc_upd_args *args)
+parse_delta(struct delta_job *job)
 {
 	struct rdr_delta_ctx ctx;
 	struct delta *delta;
 	struct doc_data *expected_data;
 	int error;
 
-	expected_data = &parents_data->doc_data;
+	expected_data = &job->head->doc_data;
 
-	fnstack_push_uri(uri);
-	error = hash_validate_file("sha256", uri, expected_data->hash,
+	fnstack_push_uri(job->uri);
+	error = hash_validate_file("sha256", job->uri, expected_data->hash,
 	    expected_data->hash_len);
 	if (error)
 		goto pop_fnstack;
@@ -994,10 +1053,10 @@ parse_delta(struct rpki_uri *uri, struct delta_head *parents_data,
 		goto pop_fnstack;
 
 	ctx.delta = delta;
-	ctx.parent = args->parent;
-	ctx.visited_uris = args->visited_uris;
-	ctx.expected_serial = parents_data->serial;
-	error = relax_ng_parse(uri_get_local(uri), xml_read_delta, &ctx);
+	ctx.parent = job->parent;
+	ctx.changes = &job->changes;
+	ctx.expected_serial = job->head->serial;
+	error = relax_ng_parse(uri_get_local(job->uri), xml_read_delta, &ctx);
 
 	/* Error 0 is ok */
 	delta_destroy(delta);
@@ -1006,35 +1065,303 @@ pop_fnstack:
 	return error;
 }
 
+/* Thread pool task: parse a single delta */
+static void *
+parse_delta_task(void *arg)
+{
+	struct delta_job *job = arg;
+
+	fnstack_init();
+	job->error = parse_delta(job);
+	fnstack_cleanup();
+
+	return NULL;
+}
+
 static int
-process_delta(struct delta_head *delta_head, void *arg)
+add_delta_job(struct delta_head *delta_head, void *arg)
 {
-	struct proc_upd_args *args = arg;
-	struct rpki_uri *uri;
-	struct doc_data *head_data;
+	struct delta_jobs *jobs = arg;
+	struct delta_job job;
 	int error;
 
-	head_data = &delta_head->doc_data;
+	job.head = delta_head;
+	job.parent = NULL;
+	job.downloaded = false;
+	job.error = 0;
+	delta_changes_init(&job.changes);
 
-	pr_val_debug("Processing delta '%s'.", delta_head->doc_data.uri);
-	error = uri_create_https_str_rrdp(&uri, head_data->uri,
-	    strlen(head_data->uri));
+	error = uri_create_https_str_rrdp(&job.uri, delta_head->doc_data.uri,
+	    strlen(delta_head->doc_data.uri));
 	if (error)
 		return error;
 
-	error = download_file(uri, 0, args->log_operation);
+	error = delta_jobs_add(jobs, &job);
 	if (error)
-		goto release_uri;
+		uri_refput(job.uri);
 
-	error = parse_delta(uri, delta_head, args);
+	return error;
+}
 
-	delete_from_uri(uri, NULL);
-	/* Error 0 its ok */
-release_uri:
-	uri_refput(uri);
+static void
+delta_job_cleanup(struct delta_job *job)
+{
+	if (job->downloaded)
+		delete_from_uri(job->uri, NULL);
+	uri_refput(job->uri);
+	delta_changes_cleanup(&job->changes, delta_change_cleanup);
+}
+
+/* Download all the deltas at once, reusing (and multiplexing) connections */
+static int
+download_deltas(struct delta_jobs *jobs, bool log_operation)
+{
+	struct http_transfer *transfers;
+	array_index i;
+	bool aborted;
+	int error;
+
+	transfers = calloc(jobs->len, sizeof(struct http_transfer));
+	if (transfers == NULL)
+		return pr_enomem();
+
+	for (i = 0; i < jobs->len; i++) {
+		pr_val_debug("Downloading delta '%s'.",
+		    jobs->array[i].head->doc_data.uri);
+		transfers[i].uri = jobs->array[i].uri;
+	}
+
+	error = http_download_files(transfers, jobs->len, log_operation);
+	aborted = (error != 0);
+
+	for (i = 0; i < jobs->len; i++) {
+		/*
+		 * Even if the rest of the transfers were aborted, the completed
+		 * ones left their files, which need to be deleted.
+		 */
+		if (transfers[i].result == 0) {
+			jobs->array[i].downloaded = true;
+			continue;
+		}
+		if (aborted)
+			continue;
+
+		/* Same as download_file() */
+		if (transfers[i].result == -EREQFAILED ||
+		    transfers[i].result == EREQFAILED) {
+			error = EREQFAILED;
+			continue;
+		}
+		error = transfers[i].result;
+	}
+
+	free(transfers);
 	return error;
 }
 
+/*
+ * Parse the downloaded deltas; if there are enough of them, each one at a
+ * separate thread.
+ */
+static int
+parse_deltas(struct delta_jobs *jobs)
+{
+	struct thread_pool *pool;
+	unsigned int threads;
+	array_index i;
+	int error;
+
+	threads = config_get_thread_pool_rrdp_deltas_max();
+	if (threads > jobs->len)
+		threads = jobs->len;
+
+	if (threads <= 1) {
+		for (i = 0; i < jobs->len; i++) {
+			pr_val_debug("Processing delta '%s'.",
+			    jobs->array[i].head->doc_data.uri);
+			error = parse_delta(&jobs->array[i]);
+			if (error)
+				return error;
+		}
+		return 0;
+	}
+
+	error = thread_pool_create(threads, &pool);
+	if (error)
+		return error;
+
+	for (i = 0; i < jobs->len; i++) {
+		pr_val_debug("Processing delta '%s'.",
+		    jobs->array[i].head->doc_data.uri);
+		error = thread_pool_push(pool, parse_delta_task,
+		    &jobs->array[i]);
+		if (error)
+			break;
+	}
+	thread_pool_wait(pool);
+	thread_pool_destroy(pool);
+	if (error)
+		return error;
+
+	/* Report the first error, in serial order */
+	for (i = 0; i < jobs->len; i++)
+		if (jobs->array[i].error)
+			return jobs->array[i].error;
+
+	return 0;
+}
+
+/*
+ * rfc8181#section-2.2: the hash of a <withdraw> (or a <publish> that replaces
+ * a file) must match the current content of the file. The current content is
+ * the one left by the previous deltas, or the local file if none of them
+ * touched it.
+ */
+static int
+validate_current_hash(struct pending_file *pending,
+    struct doc_data const *doc_data)
+{
+	struct rpki_uri *uri;
+	struct publish *current;
+	int error;
+
+	if (pending == NULL) {
+		error = uri_create_rsync_str_rrdp(&uri, doc_data->uri,
+		    strlen(doc_data->uri));
+		if (error)
+			return error;
+
+		error = hash_validate_file("sha256", uri, doc_data->hash,
+		    doc_data->hash_len);
+		uri_refput(uri);
+		return error;
+	}
+
+	current = pending->change->publish;
+	if (current == NULL)
+		return pr_val_err("File '%s' was already withdrawn by a previous delta.",
+		    doc_data->uri);
+
+	if (hash_validate("sha256", doc_data->hash, doc_data->hash_len,
+	    current->content, current->content_len) != 0)
+		return pr_val_err("File '%s' does not match its expected hash.",
+		    doc_data->uri);
+
+	return 0;
+}
+
+/* Apply @change on top of the @table of pending files */
+static int
+coalesce_change(struct pending_file **table, struct delta_change const *change)
+{
+	struct doc_data const *doc_data;
+	struct pending_file *pending;
+	int error;
+
+	doc_data = delta_change_doc_data(change);
+	HASH_FIND_STR(*table, doc_data->uri, pending);
+
+	if (doc_data->hash_len > 0) {
+		error = validate_current_hash(pending, doc_data);
+		if (error) {
+			if (change->publish != NULL) {
+				pr_val_info("Hash of base64 decoded element from URI '%s' doesn't match <publish> element hash",
+				    doc_data->uri);
+				return EINVAL;
+			}
+			return error;
+		}
+	}
+
+	/* Later changes win */
+	if (pending != NULL) {
+		/* Created and withdrawn, it never has to reach the disk */
+		if (pending->created && change->withdraw != NULL) {
+			HASH_DEL(*table, pending);
+			free(pending);
+			return 0;
+		}
+		pending->uri = doc_data->uri;
+		pending->change = change;
+		return 0;
+	}
+
+	pending = malloc(sizeof(struct pending_file));
+	if (pending == NULL)
+		return pr_enomem();
+
+	pending->uri = doc_data->uri;
+	pending->change = change;
+	pending->created = (change->publish != NULL && doc_data->hash_len == 0);
+
+	errno = 0;
+	HASH_ADD_KEYPTR(hh, *table, pending->uri, strlen(pending->uri),
+	    pending);
+	if (errno) {
+		free(pending);
+		return pr_enomem();
+	}
+
+	return 0;
+}
+
+static int
+coalesce_deltas(struct delta_jobs *jobs, struct pending_file **table)
+{
+	struct delta_job *job;
+	struct delta_change *change;
+	array_index i, j;
+	int error;
+
+	ARRAYLIST_FOREACH(jobs, job, i) {
+		fnstack_push_uri(job->uri);
+		ARRAYLIST_FOREACH(&job->changes, change, j) {
+			error = coalesce_change(table, change);
+			if (error) {
+				fnstack_pop();
+				return error;
+			}
+		}
+		fnstack_pop();
+	}
+
+	return 0;
+}
+
+/* Write (or delete) each file once, in the order they were first seen. */
+static int
+apply_pending_files(struct pending_file *table,
+    struct visited_uris *visited_uris)
+{
+	struct pending_file *pending, *tmp;
+	struct publish *publish;
+	int error;
+
+	HASH_ITER(hh, table, pending, tmp) {
+		publish = pending->change->publish;
+		if (publish != NULL)
+			error = write_from_uri(pending->uri, publish->content,
+			    publish->content_len, visited_uris);
+		else
+			error = __delete_from_uri(pending->uri, visited_uris);
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
+static void
+pending_files_destroy(struct pending_file *table)
+{
+	struct pending_file *pending, *tmp;
+
+	HASH_ITER(hh, table, pending, tmp) {
+		HASH_DEL(table, pending);
+		free(pending);
+	}
+}
+
 /*
  * Download from @uri and set result file contents to @result, the file name
  * is pushed into fnstack, so don't forget to do the pop when done working
@@ -1130,17 +1457,54 @@ release_uri:
 	return error;
 }
 
+/*
+ * Process the deltas from @cur_serial to the @parent's serial.
+ *
+ * The deltas are downloaded simultaneously, parsed (in parallel) into memory,
+ * and then coalesced so that every file is written (or deleted) only once,
+ * with its latest content. If any delta fails, nothing is applied.
+ */
 int
 rrdp_process_deltas(struct update_notification *parent,
     unsigned long cur_serial, struct visited_uris *visited_uris,
     bool log_operation)
 {
-	struct proc_upd_args args;
+	struct delta_jobs jobs;
+	struct pending_file *table;
+	array_index i;
+	int error;
 
-	args.parent = parent;
-	args.visited_uris = visited_uris;
-	args.log_operation = log_operation;
+	delta_jobs_init(&jobs);
+	table = NULL;
+
+	error = deltas_head_for_each(parent->deltas_list,
+	    parent->global_data.serial, cur_serial, add_delta_job, &jobs);
+	if (error)
+		goto release_jobs;
+	for (i = 0; i < jobs.len; i++)
+		jobs.array[i].parent = parent;
+	if (jobs.len == 0)
+		goto release_jobs;
+
+	error = download_deltas(&jobs, log_operation);
+	if (error)
+		goto release_jobs;
 
-	return deltas_head_for_each(parent->deltas_list,
-	    parent->global_data.serial, cur_serial, process_delta, &args);
+	error = parse_deltas(&jobs);
+	if (error)
+		goto release_jobs;
+
+	error = coalesce_deltas(&jobs, &table);
+	if (error)
+		goto release_table;
+
+	pr_val_debug("Applying %u RRDP files from %zu deltas.",
+	    HASH_COUNT(table), jobs.len);
+	error = apply_pending_files(table, visited_uris);
+
+release_table:
+	pending_files_destroy(table);
+release_jobs:
+	delta_jobs_cleanup(&jobs, delta_job_cleanup);
+	return error;
 }
@@ -11,6 +11,8 @@
 #include "common.h"
 #include "config.h"
 #include "log.h"
+#include "metrics.h"
+#include "profile.h"
 #include "reqs_errors.h"
 #include "str_token.h"
 #include "thread_var.h"
@@ -569,6 +571,7 @@ download_files(struct rpki_uri *requested_uri, bool is_ta, bool force)
 	struct validation *state;
 	struct uri_list *visited_uris;
 	struct rpki_uri *rsync_uri;
+	struct metrics_fetch fetch;
 	bool to_op_log;
 	int error;
 
@@ -602,7 +605,11 @@ download_files(struct rpki_uri *requested_uri, bool is_ta, bool force)
 	pr_val_debug("Going to RSYNC '%s'.", uri_val_get_printable(rsync_uri));
 
 	to_op_log = reqs_errors_log_uri(uri_get_global(rsync_uri));
+	metrics_fetch_start(&fetch, MP_RSYNC);
+	profile_start(PP_FETCH_RSYNC, uri_get_global(rsync_uri));
 	error = do_rsync(rsync_uri, is_ta, to_op_log);
+	profile_end();
+	metrics_fetch_end(&fetch, uri_get_global(rsync_uri), error);
 	switch(error) {
 	case 0:
 		/* Don't store when "force" and if its already downloaded */
@@ -1,5 +1,7 @@
 #include "rtr/db/db_table.h"
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include <sys/types.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
 #include <sys/socket.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
 #include "data_structure/uthash_nonfatal.h"
@@ -9,16 +11,110 @@ struct hashable_roa {
 	UT_hash_handle hh;
 };
 
+/*
+ * An interned SPKI. Router certificates that list several ASNs yield one Router
+ * Key per ASN, all of them with the same SPKI, and most keys survive from one
+ * table to the next. So SPKIs are stored once, in a pool shared by all the
+ * tables, and deduplicated by content.
+ */
+struct spki_entry {
+	unsigned char spk[RK_SPKI_LEN];
+	/* Router Keys (of any table) pointing here. Protected by spki_lock. */
+	unsigned int references;
+	UT_hash_handle hh;
+};
+
+/*
+ * Compact Router Key. Because SPKIs are interned, comparing @spki pointers is
+ * the same as comparing SPKIs, even between different tables.
+ */
+struct router_key_ref {
+	unsigned char ski[RK_SKI_LEN];
+	uint32_t as;
+	struct spki_entry *spki;
+};
+
 struct hashable_key {
-	struct router_key data;
+	struct router_key_ref data;
 	UT_hash_handle hh;
 };
 
+static struct spki_entry *spki_pool;
+static pthread_mutex_t spki_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Once a table is published as the VRPS base, it's immutable; readers hold a
+ * reference while they iterate it, and the last one frees it.
+ */
 struct db_table {
 	struct hashable_roa *roas;
 	struct hashable_key *router_keys;
+
+	atomic_uint references;
 };
 
+static int
+spki_get(unsigned char const *spk, struct spki_entry **result)
+{
+	struct spki_entry *entry;
+	int error;
+
+	error = 0;
+	pthread_mutex_lock(&spki_lock);
+
+	HASH_FIND(hh, spki_pool, spk, RK_SPKI_LEN, entry);
+	if (entry != NULL) {
+		entry->references++;
+		goto end;
+	}
+
+	entry = malloc(sizeof(struct spki_entry));
+	if (entry == NULL) {
+		error = pr_enomem();
+		goto end;
+	}
+	memcpy(entry->spk, spk, RK_SPKI_LEN);
+	entry->references = 1;
+
+	errno = 0;
+	HASH_ADD(hh, spki_pool, spk, RK_SPKI_LEN, entry);
+	if (errno) {
+		free(entry);
+		error = -pr_val_errno(errno,
+		    "SPKI couldn't be added to hash table");
+	}
+
+end:
+	pthread_mutex_unlock(&spki_lock);
+	*result = entry;
+	return error;
+}
+
+static void
+spki_put(struct spki_entry *entry)
+{
+	pthread_mutex_lock(&spki_lock);
+	entry->references--;
+	if (entry->references == 0) {
+		HASH_DEL(spki_pool, entry);
+		free(entry);
+	}
+	pthread_mutex_unlock(&spki_lock);
+}
+
+static void
+router_key_ref_export(struct router_key_ref const *ref, struct router_key *key)
+{
+	router_key_init(key, ref->ski, ref->as, ref->spki->spk);
+}
+
+static void
+free_router_key(struct hashable_key *key)
+{
+	spki_put(key->data.spki);
+	free(key);
+}
+
 struct db_table *
 db_table_create(void)
 {
@@ -30,17 +126,28 @@ db_table_create(void)
 
 	table->roas = NULL;
 	table->router_keys = NULL;
+	atomic_init(&table->references, 1);
 	return table;
 }
 
 void
-db_table_destroy(struct db_table *table)
+db_table_refget(struct db_table *table)
+{
+	atomic_fetch_add(&table->references, 1);
+}
+
+void
+db_table_refput(struct db_table *table)
 {
 	struct hashable_roa *node;
 	struct hashable_roa *tmp;
 	struct hashable_key *node_key;
 	struct hashable_key *tmp_key;
 
+	/* atomic_fetch_sub() returns the previous value */
+	if (atomic_fetch_sub(&table->references, 1) != 1)
+		return;
+
 	HASH_ITER(hh, table->roas, node, tmp) {
 		HASH_DEL(table->roas, node);
 		free(node);
@@ -48,7 +155,7 @@ db_table_destroy(struct db_table *table)
 
 	HASH_ITER(hh, table->router_keys, node_key, tmp_key) {
 		HASH_DEL(table->router_keys, node_key);
-		free(node_key);
+		free_router_key(node_key);
 	}
 
 	free(table);
@@ -74,10 +181,13 @@ db_table_foreach_router_key(struct db_table *table, router_key_foreach_cb cb,
     void *arg)
 {
 	struct hashable_key *node, *tmp;
+	struct router_key key;
 	int error;
 
+	/* @key only lives during the callback */
 	HASH_ITER(hh, table->router_keys, node, tmp) {
-		error = cb(&node->data, arg);
+		router_key_ref_export(&node->data, &key);
+		error = cb(&key, arg);
 		if (error)
 			return error;
 	}
@@ -127,7 +237,7 @@ add_router_key(struct db_table *table, struct hashable_key *new)
 	if (errno)
 		return -pr_val_errno(errno, "Router Key couldn't be added to hash table");
 	if (old != NULL)
-		free(old);
+		free_router_key(old);
 
 	return 0;
 }
@@ -160,7 +270,7 @@ static int
 duplicate_key(struct db_table *dst, struct hashable_key *new)
 {
 	return rtrhandler_handle_router_key(dst, new->data.ski, new->data.as,
-	    new->data.spk);
+	    new->data.spki->spk);
 }
 
 #define MERGE_ITER(table_prop, name, err_var)				\
@@ -199,7 +309,7 @@ db_table_clone(struct db_table **dst, struct db_table *src)
 
 	error = db_table_merge(result, src);
 	if (error) {
-		db_table_destroy(result);
+		db_table_refput(result);
 		return error;
 	}
 
@@ -235,12 +345,24 @@ void
 db_table_remove_router_key(struct db_table *table,
     struct router_key const *del)
 {
+	struct router_key_ref ref;
 	struct hashable_key *ptr;
 
-	HASH_FIND(hh, table->router_keys, del, sizeof(*del), ptr);
+	memset(&ref, 0, sizeof(ref));
+	memcpy(ref.ski, del->ski, RK_SKI_LEN);
+	ref.as = del->as;
+
+	pthread_mutex_lock(&spki_lock);
+	HASH_FIND(hh, spki_pool, del->spk, RK_SPKI_LEN, ref.spki);
+	pthread_mutex_unlock(&spki_lock);
+	/* The table holds a reference to the SPKI of each of its keys */
+	if (ref.spki == NULL)
+		return;
+
+	HASH_FIND(hh, table->router_keys, &ref, sizeof(ref), ptr);
 	if (ptr != NULL) {
 		HASH_DELETE(hh, table->router_keys, ptr);
-		free(ptr);
+		free_router_key(ptr);
 	}
 }
 
@@ -297,11 +419,17 @@ rtrhandler_handle_router_key(struct db_table *table,
 	/* Needed by uthash */
 	memset(key, 0, sizeof(struct hashable_key));
 
-	router_key_init(&key->data, ski, as, spk);
+	memcpy(key->data.ski, ski, RK_SKI_LEN);
+	key->data.as = as;
+	error = spki_get(spk, &key->data.spki);
+	if (error) {
+		free(key);
+		return error;
+	}
 
 	error = add_router_key(table, key);
 	if (error)
-		free(key);
+		free_router_key(key);
 
 	return error;
 }
@@ -358,7 +486,10 @@ add_roa_deltas(struct hashable_roa *roas1, struct hashable_roa *roas2,
 static int
 add_router_key_delta(struct deltas *deltas, struct hashable_key *key, int op)
 {
-	return deltas_add_router_key(deltas, &key->data, op);
+	struct router_key router_key;
+
+	router_key_ref_export(&key->data, &router_key);
+	return deltas_add_router_key(deltas, &router_key, op);
 }
 
 /*
@@ -7,7 +7,8 @@
 struct db_table;
 
 struct db_table *db_table_create(void);
-void db_table_destroy(struct db_table *);
+void db_table_refget(struct db_table *);
+void db_table_refput(struct db_table *);
 
 int db_table_clone(struct db_table **, struct db_table *);
 
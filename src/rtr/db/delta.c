@@ -1,6 +1,7 @@
 #include "rtr/db/delta.h"
 
 #include <stdatomic.h>
+#include <string.h>
 #include <sys/types.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
 #include <sys/socket.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
 #include "data_structure/array_list.h"
@@ -159,6 +160,258 @@ deltas_is_empty(struct deltas *deltas)
 	    && (deltas->rk.removes.len == 0);
 }
 
+/* Counts the announcements (@adds) and withdrawals (@removes) of @deltas. */
+void
+deltas_count(struct deltas *deltas, unsigned int *adds, unsigned int *removes)
+{
+	*adds = deltas->v4.adds.len + deltas->v6.adds.len +
+	    deltas->rk.adds.len;
+	*removes = deltas->v4.removes.len + deltas->v6.removes.len +
+	    deltas->rk.removes.len;
+}
+
+/* Bytes allocated by @deltas. */
+size_t
+deltas_memory(struct deltas *deltas)
+{
+	return sizeof(struct deltas)
+	    + (deltas->v4.adds.capacity + deltas->v4.removes.capacity)
+	      * sizeof(struct delta_v4)
+	    + (deltas->v6.adds.capacity + deltas->v6.removes.capacity)
+	      * sizeof(struct delta_v6)
+	    + (deltas->rk.adds.capacity + deltas->rk.removes.capacity)
+	      * sizeof(struct delta_rk);
+}
+
+/*
+ * An announcement or withdrawal of @elem, made by the @seq'th of the deltas
+ * being merged.
+ */
+struct merge_op {
+	void const *elem;
+	size_t seq;
+	bool announcement;
+};
+
+static int
+cmp_delta_v4(void const *arg1, void const *arg2)
+{
+	struct delta_v4 const *d1 = arg1;
+	struct delta_v4 const *d2 = arg2;
+	uint32_t addr1, addr2;
+
+	if (d1->as != d2->as)
+		return (d1->as < d2->as) ? -1 : 1;
+	addr1 = ntohl(d1->prefix.addr.s_addr);
+	addr2 = ntohl(d2->prefix.addr.s_addr);
+	if (addr1 != addr2)
+		return (addr1 < addr2) ? -1 : 1;
+	if (d1->prefix.len != d2->prefix.len)
+		return (d1->prefix.len < d2->prefix.len) ? -1 : 1;
+	return (int)d1->max_length - (int)d2->max_length;
+}
+
+static int
+cmp_delta_v6(void const *arg1, void const *arg2)
+{
+	struct delta_v6 const *d1 = arg1;
+	struct delta_v6 const *d2 = arg2;
+	int result;
+
+	if (d1->as != d2->as)
+		return (d1->as < d2->as) ? -1 : 1;
+	result = memcmp(&d1->prefix.addr, &d2->prefix.addr,
+	    sizeof(d1->prefix.addr));
+	if (result != 0)
+		return result;
+	if (d1->prefix.len != d2->prefix.len)
+		return (d1->prefix.len < d2->prefix.len) ? -1 : 1;
+	return (int)d1->max_length - (int)d2->max_length;
+}
+
+static int
+cmp_delta_rk(void const *arg1, void const *arg2)
+{
+	struct delta_rk const *d1 = arg1;
+	struct delta_rk const *d2 = arg2;
+	int result;
+
+	if (d1->as != d2->as)
+		return (d1->as < d2->as) ? -1 : 1;
+	result = memcmp(d1->ski, d2->ski, RK_SKI_LEN);
+	if (result != 0)
+		return result;
+	return memcmp(d1->spk, d2->spk, RK_SPKI_LEN);
+}
+
+/* Sorts the operations by element, and then chronologically. */
+#define DEFINE_OP_CMP(name, cmp)					\
+	static int							\
+	name(void const *arg1, void const *arg2)			\
+	{								\
+		struct merge_op const *op1 = arg1;			\
+		struct merge_op const *op2 = arg2;			\
+		int result;						\
+									\
+		result = cmp(op1->elem, op2->elem);			\
+		if (result != 0)					\
+			return result;					\
+		return (op1->seq > op2->seq) - (op1->seq < op2->seq);	\
+	}
+
+DEFINE_OP_CMP(op_cmp_delta_v4, cmp_delta_v4)
+DEFINE_OP_CMP(op_cmp_delta_v6, cmp_delta_v6)
+DEFINE_OP_CMP(op_cmp_delta_rk, cmp_delta_rk)
+
+static int
+add_delta_v4(struct deltas *deltas, void const *elem, bool announcement)
+{
+	return deltas_v4_add(announcement ? &deltas->v4.adds
+	    : &deltas->v4.removes, (struct delta_v4 *)elem);
+}
+
+static int
+add_delta_v6(struct deltas *deltas, void const *elem, bool announcement)
+{
+	return deltas_v6_add(announcement ? &deltas->v6.adds
+	    : &deltas->v6.removes, (struct delta_v6 *)elem);
+}
+
+static int
+add_delta_rk(struct deltas *deltas, void const *elem, bool announcement)
+{
+	return deltas_rk_add(announcement ? &deltas->rk.adds
+	    : &deltas->rk.removes, (struct delta_rk *)elem);
+}
+
+/* Appends the @len elements of @array (of @size bytes each) to @ops. */
+static size_t
+collect_ops(struct merge_op *ops, size_t n, void const *array, size_t len,
+    size_t size, size_t seq, bool announcement)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		ops[n].elem = (unsigned char const *)array + i * size;
+		ops[n].seq = seq;
+		ops[n].announcement = announcement;
+		n++;
+	}
+
+	return n;
+}
+
+/*
+ * @ops is sorted, so the operations on each element are contiguous and
+ * chronological. They alternate (an element can only be withdrawn if it was
+ * announced, and vice versa), so they cancel each other unless the first and
+ * the last one are the same; in which case the last one is the net change.
+ */
+static int
+reduce_ops(struct merge_op *ops, size_t n,
+    int (*cmp)(void const *, void const *),
+    int (*add)(struct deltas *, void const *, bool), struct deltas *result)
+{
+	size_t first, last;
+	int error;
+
+	for (first = 0; first < n; first = last + 1) {
+		for (last = first; last + 1 < n; last++)
+			if (cmp(ops[first].elem, ops[last + 1].elem) != 0)
+				break;
+
+		if (ops[first].announcement != ops[last].announcement)
+			continue;
+
+		error = add(result, ops[last].elem, ops[last].announcement);
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
+/*
+ * Merges the @count consecutive @deltas (oldest first) into a new one
+ * (@result), in which nothing is announced and withdrawn at the same time.
+ */
+int
+deltas_merge(struct deltas **deltas, size_t count, struct deltas **result)
+{
+	struct deltas *merged;
+	struct merge_op *ops;
+	size_t max, n, i;
+	int error;
+
+	max = 0;
+	for (i = 0; i < count; i++)
+		max += deltas[i]->v4.adds.len + deltas[i]->v4.removes.len
+		    + deltas[i]->v6.adds.len + deltas[i]->v6.removes.len
+		    + deltas[i]->rk.adds.len + deltas[i]->rk.removes.len;
+
+	error = deltas_create(&merged);
+	if (error)
+		return error;
+	if (max == 0)
+		goto end;
+
+	/* Enough for any of the three types */
+	ops = malloc(max * sizeof(struct merge_op));
+	if (ops == NULL) {
+		deltas_refput(merged);
+		return pr_enomem();
+	}
+
+	n = 0;
+	for (i = 0; i < count; i++) {
+		n = collect_ops(ops, n, deltas[i]->v4.adds.array,
+		    deltas[i]->v4.adds.len, sizeof(struct delta_v4), i, true);
+		n = collect_ops(ops, n, deltas[i]->v4.removes.array,
+		    deltas[i]->v4.removes.len, sizeof(struct delta_v4), i,
+		    false);
+	}
+	qsort(ops, n, sizeof(struct merge_op), op_cmp_delta_v4);
+	error = reduce_ops(ops, n, cmp_delta_v4, add_delta_v4, merged);
+	if (error)
+		goto fail;
+
+	n = 0;
+	for (i = 0; i < count; i++) {
+		n = collect_ops(ops, n, deltas[i]->v6.adds.array,
+		    deltas[i]->v6.adds.len, sizeof(struct delta_v6), i, true);
+		n = collect_ops(ops, n, deltas[i]->v6.removes.array,
+		    deltas[i]->v6.removes.len, sizeof(struct delta_v6), i,
+		    false);
+	}
+	qsort(ops, n, sizeof(struct merge_op), op_cmp_delta_v6);
+	error = reduce_ops(ops, n, cmp_delta_v6, add_delta_v6, merged);
+	if (error)
+		goto fail;
+
+	n = 0;
+	for (i = 0; i < count; i++) {
+		n = collect_ops(ops, n, deltas[i]->rk.adds.array,
+		    deltas[i]->rk.adds.len, sizeof(struct delta_rk), i, true);
+		n = collect_ops(ops, n, deltas[i]->rk.removes.array,
+		    deltas[i]->rk.removes.len, sizeof(struct delta_rk), i,
+		    false);
+	}
+	qsort(ops, n, sizeof(struct merge_op), op_cmp_delta_rk);
+	error = reduce_ops(ops, n, cmp_delta_rk, add_delta_rk, merged);
+	if (error)
+		goto fail;
+
+	free(ops);
+end:
+	*result = merged;
+	return 0;
+
+fail:
+	free(ops);
+	deltas_refput(merged);
+	return error;
+}
+
 static int
 __foreach_v4(struct deltas_v4 *array, delta_vrp_foreach_cb cb, void *arg,
     serial_t serial, uint8_t flags)
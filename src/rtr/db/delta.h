@@ -16,6 +16,9 @@ int deltas_add_roa_v6(struct deltas *, uint32_t, struct v6_address *, int);
 int deltas_add_router_key(struct deltas *, struct router_key *, int);
 
 bool deltas_is_empty(struct deltas *);
+void deltas_count(struct deltas *, unsigned int *, unsigned int *);
+size_t deltas_memory(struct deltas *);
+int deltas_merge(struct deltas **, size_t, struct deltas **);
 int deltas_foreach(serial_t, struct deltas *, delta_vrp_foreach_cb,
     delta_router_key_foreach_cb, void *);
 
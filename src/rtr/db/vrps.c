@@ -3,10 +3,11 @@
 #include <pthread.h>
 #include <string.h>
 #include <time.h>
-#include <sys/queue.h>
 #include "clients.h"
 #include "common.h"
+#include "metrics.h"
 #include "output_printer.h"
+#include "profile.h"
 #include "validation_handler.h"
 #include "data_structure/array_list.h"
 #include "object/router_key.h"
@@ -22,26 +23,23 @@
 
 #define START_SERIAL		0
 
-DEFINE_ARRAY_LIST_FUNCTIONS(deltas_db, struct delta_group, )
-
-struct vrp_node {
-	struct delta_vrp delta;
-	SLIST_ENTRY(vrp_node) next;
-};
-
-struct rk_node {
-	struct delta_router_key delta;
-	SLIST_ENTRY(rk_node) next;
+/*
+ * The changes from serial @serial - 1 to @serial.
+ */
+struct delta_group {
+	serial_t serial;
+	struct deltas *deltas;
+	/* When @deltas were computed */
+	time_t created;
+	/*
+	 * The changes from serial @serial - 1 to the current serial, merged.
+	 * Computed when some client first needs them, and then shared by
+	 * every other client that needs them, until the next update.
+	 */
+	struct deltas *merged;
 };
 
-/** Sorted list to filter deltas */
-SLIST_HEAD(vrp_slist, vrp_node);
-SLIST_HEAD(rk_slist, rk_node);
-
-struct sorted_lists {
-	struct vrp_slist prefixes;
-	struct rk_slist router_keys;
-};
+STATIC_ARRAY_LIST(deltas_db, struct delta_group)
 
 struct state {
 	/**
@@ -52,10 +50,23 @@ struct state {
 	 * during the current iteration.)
 	 */
 	struct db_table *base;
-	/** DB changes to @base over time. */
+	/**
+	 * DB changes to @base over time, oldest first.
+	 *
+	 * deltas.array[i] is the change from serial @deltas_first + i to
+	 * @deltas_first + i + 1, so the deltas a client needs are found by
+	 * subtracting serials. (The last one always leads to the current
+	 * serial.)
+	 */
 	struct deltas_db deltas;
+	serial_t deltas_first;
 
-	/* Last valid SLURM applied to base */
+	/*
+	 * Last valid SLURM, applied to base.
+	 *
+	 * Its filters are applied while the validation adds the VRPs to the
+	 * new table, so it's only replaced before the validation starts.
+	 */
 	struct db_slurm *slurm;
 
 	serial_t next_serial;
@@ -74,10 +85,45 @@ static pthread_rwlock_t state_lock;
 /** Lock to protect ROA table during construction. */
 static pthread_rwlock_t table_lock;
 
-void
+/**
+ * Protects the delta_group.merged caches, which are filled while @state_lock
+ * is only read-locked. Never held while waiting for @state_lock.
+ */
+static pthread_mutex_t merge_lock;
+
+/*
+ * Wrappers of the @state_lock lockers, which also record how long the caller
+ * had to wait for the lock.
+ */
+static int
+state_read_lock(void)
+{
+	struct metrics_timer timer;
+	int error;
+
+	metrics_timer_start(&timer);
+	error = rwlock_read_lock(&state_lock);
+	metrics_state_lock_waited(false, metrics_timer_elapsed(&timer));
+
+	return error;
+}
+
+static void
+state_write_lock(void)
+{
+	struct metrics_timer timer;
+
+	metrics_timer_start(&timer);
+	rwlock_write_lock(&state_lock);
+	metrics_state_lock_waited(true, metrics_timer_elapsed(&timer));
+}
+
+static void
 deltagroup_cleanup(struct delta_group *group)
 {
 	deltas_refput(group->deltas);
+	if (group->merged != NULL)
+		deltas_refput(group->merged);
 }
 
 int
@@ -95,6 +141,7 @@ vrps_init(void)
 	state.base = NULL;
 
 	deltas_db_init(&state.deltas);
+	state.deltas_first = START_SERIAL;
 
 	/*
 	 * Use the same start serial, the session ID will avoid
@@ -129,7 +176,15 @@ vrps_init(void)
 		goto release_state_lock;
 	}
 
+	error = pthread_mutex_init(&merge_lock, NULL);
+	if (error) {
+		error = pr_op_errno(error, "pthread_mutex_init() errored");
+		goto release_table_lock;
+	}
+
 	return 0;
+release_table_lock:
+	pthread_rwlock_destroy(&table_lock);
 release_state_lock:
 	pthread_rwlock_destroy(&state_lock);
 release_deltas:
@@ -142,13 +197,14 @@ void
 vrps_destroy(void)
 {
 	if (state.base != NULL)
-		db_table_destroy(state.base);
+		db_table_refput(state.base);
 	if (state.slurm != NULL)
 		db_slurm_destroy(state.slurm);
 	deltas_db_cleanup(&state.deltas, deltagroup_cleanup);
 	/* Nothing to do with error codes from now on */
 	pthread_rwlock_destroy(&state_lock);
 	pthread_rwlock_destroy(&table_lock);
+	pthread_mutex_destroy(&merge_lock);
 	thread_pool_destroy(pool);
 }
 
@@ -159,6 +215,14 @@ vrps_destroy(void)
 	rwlock_unlock(lock);						\
 	return error;
 
+/* Discard the element if the SLURM filters it, otherwise add it */
+#define SLURM_WLOCK_HANDLER(filtered, lock, cb)				\
+	if (state.slurm != NULL && (filtered))				\
+		return 0;						\
+	{								\
+		WLOCK_HANDLER(lock, cb)					\
+	}
+
 #define RLOCK_HANDLER(lock, cb)						\
 	int error;							\
 	rwlock_read_lock(lock);						\
@@ -166,28 +230,68 @@ vrps_destroy(void)
 	rwlock_unlock(lock);						\
 	return error;
 
+static bool
+slurm_filters_roa_v4(uint32_t as, struct ipv4_prefix const *prefix,
+    uint8_t max_length)
+{
+	struct vrp vrp;
+
+	vrp.asn = as;
+	vrp.prefix.v4 = prefix->addr;
+	vrp.prefix_length = prefix->len;
+	vrp.max_prefix_length = max_length;
+	vrp.addr_fam = AF_INET;
+
+	return db_slurm_vrp_is_filtered(state.slurm, &vrp);
+}
+
+static bool
+slurm_filters_roa_v6(uint32_t as, struct ipv6_prefix const *prefix,
+    uint8_t max_length)
+{
+	struct vrp vrp;
+
+	vrp.asn = as;
+	vrp.prefix.v6 = prefix->addr;
+	vrp.prefix_length = prefix->len;
+	vrp.max_prefix_length = max_length;
+	vrp.addr_fam = AF_INET6;
+
+	return db_slurm_vrp_is_filtered(state.slurm, &vrp);
+}
+
+static bool
+slurm_filters_router_key(unsigned char const *ski, uint32_t as,
+    unsigned char const *spk)
+{
+	struct router_key key;
+
+	router_key_init(&key, ski, as, spk);
+	return db_slurm_bgpsec_is_filtered(state.slurm, &key);
+}
+
 int
 handle_roa_v4(uint32_t as, struct ipv4_prefix const *prefix,
     uint8_t max_length, void *arg)
 {
-	WLOCK_HANDLER(&table_lock,
-	    rtrhandler_handle_roa_v4(arg, as, prefix, max_length))
+	SLURM_WLOCK_HANDLER(slurm_filters_roa_v4(as, prefix, max_length),
+	    &table_lock, rtrhandler_handle_roa_v4(arg, as, prefix, max_length))
 }
 
 int
 handle_roa_v6(uint32_t as, struct ipv6_prefix const * prefix,
     uint8_t max_length, void *arg)
 {
-	WLOCK_HANDLER(&table_lock,
-	    rtrhandler_handle_roa_v6(arg, as, prefix, max_length))
+	SLURM_WLOCK_HANDLER(slurm_filters_roa_v6(as, prefix, max_length),
+	    &table_lock, rtrhandler_handle_roa_v6(arg, as, prefix, max_length))
 }
 
 int
 handle_router_key(unsigned char const *ski, uint32_t as,
     unsigned char const *spk, void *arg)
 {
-	WLOCK_HANDLER(&table_lock,
-	    rtrhandler_handle_router_key(arg, ski, as, spk))
+	SLURM_WLOCK_HANDLER(slurm_filters_router_key(ski, as, spk),
+	    &table_lock, rtrhandler_handle_router_key(arg, ski, as, spk))
 }
 
 static int
@@ -202,7 +306,7 @@ __perform_standalone_validation(struct db_table **result)
 
 	error = perform_standalone_validation(pool, db);
 	if (error) {
-		db_table_destroy(db);
+		db_table_refput(db);
 		return error;
 	}
 
@@ -211,83 +315,106 @@ __perform_standalone_validation(struct db_table **result)
 }
 
 /*
- * Make an empty dummy delta array.
- * It's annoying, but temporary. (Until it expires.) Otherwise, it'd be a pain
- * to have to check NULL delta_group.deltas all the time.
+ * Appends @deltas (the changes from the current serial to the next one) to the
+ * history. The history takes over the caller's reference.
+ *
+ * Lock must be requested before calling this function
  */
 static int
-create_empty_delta(struct deltas **deltas)
+history_add(struct deltas *deltas)
 {
-	struct delta_group deltas_node;
+	struct delta_group group;
+	struct delta_group *cursor;
+	array_index i;
 	int error;
 
-	error = deltas_create(deltas);
+	group.serial = state.next_serial;
+	group.deltas = deltas;
+	group.merged = NULL;
+	error = get_current_time(&group.created);
 	if (error)
 		return error;
 
-	deltas_node.serial = state.next_serial;
-	deltas_node.deltas = *deltas;
-	error = deltas_db_add(&state.deltas, &deltas_node);
+	error = deltas_db_add(&state.deltas, &group);
 	if (error)
-		deltas_refput(*deltas);
-	return error;
+		return error;
+
+	/* The merged deltas no longer reach the current serial */
+	ARRAYLIST_FOREACH(&state.deltas, cursor, i) {
+		if (cursor->merged != NULL) {
+			deltas_refput(cursor->merged);
+			cursor->merged = NULL;
+		}
+	}
+
+	return 0;
 }
 
-/**
- * Reallocate the array of @db starting at @start, the length and capacity are
- * calculated according to the new start.
+/*
+ * How many of the oldest deltas can be dropped. A delta is kept while some
+ * client might still need it, but never beyond the configured limits.
  */
-static int
-resize_deltas_db(struct deltas_db *db, struct delta_group *start)
+static size_t
+history_purgeable(void)
 {
-	struct delta_group *tmp, *ptr;
-
-	db->len -= (start - db->array);
-	while (db->len < db->capacity / 2)
-		db->capacity /= 2;
-	tmp = malloc(sizeof(struct delta_group) * db->capacity);
-	if (tmp == NULL)
-		return pr_enomem();
+	serial_t min_serial;
+	size_t drop;
+	size_t max_count;
+	size_t max_memory;
+	size_t memory;
+	unsigned int max_age;
+	time_t now;
+	array_index i;
 
-	memcpy(tmp, start, db->len * sizeof(struct delta_group));
-	/* Release memory allocated */
-	for (ptr = db->array; ptr < start; ptr++)
-		deltas_refput(ptr->deltas);
-	free(db->array);
-	db->array = tmp;
+	if (clients_get_min_serial(&min_serial) != 0)
+		return state.deltas.len; /* Nobody will need deltas */
+
+	/* Serial arithmetic; also drops nothing if @min_serial is unknown */
+	drop = (serial_t)(min_serial - state.deltas_first);
+	if (drop > state.deltas.len)
+		drop = 0;
+
+	max_count = config_get_deltas_max_count();
+	if (max_count != 0 && state.deltas.len - drop > max_count)
+		drop = state.deltas.len - max_count;
+
+	max_age = config_get_deltas_max_age();
+	if (max_age != 0 && get_current_time(&now) == 0)
+		while (drop < state.deltas.len &&
+		    state.deltas.array[drop].created + max_age < now)
+			drop++;
+
+	max_memory = (size_t)config_get_deltas_max_memory() << 20;
+	if (max_memory != 0) {
+		memory = 0;
+		for (i = drop; i < state.deltas.len; i++)
+			memory += deltas_memory(state.deltas.array[i].deltas);
+		for (; drop < state.deltas.len && memory > max_memory; drop++)
+			memory -= deltas_memory(state.deltas.array[drop].deltas);
+	}
 
-	return 0;
+	return drop;
 }
 
 /*
  * Lock must be requested before calling this function
  */
-static int
-vrps_purge(struct deltas **deltas)
+static void
+vrps_purge(void)
 {
-	struct delta_group *group;
+	size_t drop;
 	array_index i;
-	serial_t min_serial;
-
-	if (clients_get_min_serial(&min_serial) != 0) {
-		/* Nobody will need deltas, just leave an empty one */
-		deltas_refput(*deltas);
-		deltas_db_cleanup(&state.deltas, deltagroup_cleanup);
-		deltas_db_init(&state.deltas);
-		return create_empty_delta(deltas);
-	}
 
-	/* Assume its ordered by serial, so get the new initial pointer */
-	ARRAYLIST_FOREACH(&state.deltas, group, i)
-		if (group->serial >= min_serial)
-			break;
-
-	/* Its the first element or reached end, nothing to purge */
-	if (group == state.deltas.array ||
-	    (group - state.deltas.array) == state.deltas.len)
-		return 0;
+	drop = history_purgeable();
+	if (drop == 0)
+		return;
 
-	return resize_deltas_db(&state.deltas, group);
+	for (i = 0; i < drop; i++)
+		deltagroup_cleanup(&state.deltas.array[i]);
+	state.deltas.len -= drop;
+	memmove(state.deltas.array, state.deltas.array + drop,
+	    state.deltas.len * sizeof(struct delta_group));
+	state.deltas_first += drop;
 }
 
 static int
@@ -296,85 +423,104 @@ __vrps_update(bool *changed)
 	struct db_table *old_base;
 	struct db_table *new_base;
 	struct deltas *deltas; /* Deltas in raw form */
-	struct delta_group deltas_node; /* Deltas in database node form */
-	serial_t min_serial;
+	struct deltas *output_deltas; /* Deltas to be printed */
+	serial_t serial;
+	unsigned int adds, removes;
 	int error;
 
 	*changed = false;
 	old_base = NULL;
 	new_base = NULL;
+	output_deltas = NULL;
+
+	/* The SLURM filters are applied while the VRPs are being added */
+	profile_start(PP_SLURM, NULL);
+	error = slurm_load(&state.slurm);
+	profile_end();
+	if (error)
+		return error;
 
 	error = __perform_standalone_validation(&new_base);
 	if (error)
 		return error;
 
-	error = slurm_apply(&new_base, &state.slurm);
+	profile_start(PP_SLURM, NULL);
+	error = slurm_apply_assertions(new_base, state.slurm);
+	profile_end();
 	if (error)
 		goto revert_base;
 
-	rwlock_write_lock(&state_lock);
-
+	/*
+	 * Only this thread replaces the base, and the published base is
+	 * immutable, so it can be read without the lock. The write lock is
+	 * only needed to publish the result.
+	 */
+	deltas = NULL;
 	if (state.base != NULL) {
+		profile_start(PP_DELTAS, NULL);
 		error = compute_deltas(state.base, new_base, &deltas);
-		if (error) {
-			rwlock_unlock(&state_lock);
+		profile_end();
+		if (error)
 			goto revert_base;
-		}
 
-		if (deltas_is_empty(deltas)) {
-			rwlock_unlock(&state_lock);
+		deltas_count(deltas, &adds, &removes);
+		metrics_delta_set(adds, removes);
+
+		if (deltas_is_empty(deltas))
 			goto revert_deltas; /* error == 0 is good */
-		}
 
-		/* Just store deltas if someone will care about it */
-		if (clients_get_min_serial(&min_serial) == 0) {
-			deltas_node.serial = state.next_serial;
-			deltas_node.deltas = deltas;
-			error = deltas_db_add(&state.deltas, &deltas_node);
-			if (error) {
-				rwlock_unlock(&state_lock);
-				goto revert_deltas;
-			}
-		}
+		/* The purge might release them; they're still needed */
+		output_deltas = deltas;
+		deltas_refget(output_deltas);
+	} else if (db_table_roa_count(new_base) +
+	    db_table_router_key_count(new_base) == 0) {
+		/* There's also an empty base, don't alter state */
+		goto revert_base; /* error == 0 is good */
+	}
 
-		/*
-		 * Postpone destruction of the old database,
-		 * to release the lock ASAP.
-		 */
-		old_base = state.base;
+	state_write_lock();
 
-		/* Remove unnecessary deltas */
-		error = vrps_purge(&deltas);
+	if (deltas != NULL) {
+		error = history_add(deltas);
 		if (error) {
 			rwlock_unlock(&state_lock);
-			goto revert_base;
+			deltas_refput(output_deltas);
+			goto revert_deltas;
 		}
+
+		/* Remove unnecessary deltas */
+		vrps_purge();
 	} else {
-		/* There's also an empty base, don't alter state */
-		if (db_table_roa_count(new_base) +
-		    db_table_router_key_count(new_base) == 0) {
-			rwlock_unlock(&state_lock);
-			error = 0; /* OK (said explicitly) */
-			goto revert_base;
-		}
-		error = create_empty_delta(&deltas);
-		if (error) {
-			rwlock_unlock(&state_lock);
-			goto revert_base;
-		}
+		/* No deltas yet; the history starts at the first serial */
+		state.deltas_first = state.next_serial;
 	}
 
+	/*
+	 * Readers that are still iterating the old base hold their own
+	 * references; the last one will release it.
+	 */
+	old_base = state.base;
+
 	*changed = true;
 	state.base = new_base;
 	state.next_serial++;
+	serial = state.next_serial - 1;
+	metrics_vrps_set(db_table_roa_count(new_base),
+	    db_table_router_key_count(new_base), serial);
 
 	rwlock_unlock(&state_lock);
 
 	if (old_base != NULL)
-		db_table_destroy(old_base);
+		db_table_refput(old_base);
 
 	/* Print after validation to avoid duplicated info */
-	output_print_data(new_base);
+	profile_start(PP_OUTPUT, NULL);
+	output_print_data(new_base, serial);
+	if (output_deltas != NULL) {
+		output_print_deltas(output_deltas, serial);
+		deltas_refput(output_deltas);
+	}
+	profile_end();
 
 	return 0;
 
@@ -382,16 +528,21 @@ revert_deltas:
 	deltas_refput(deltas);
 revert_base:
 	/* Print info that was already validated */
-	output_print_data(new_base);
-	db_table_destroy(new_base);
+	if (get_last_serial_number(&serial) != 0)
+		serial = 0;
+
+	profile_start(PP_OUTPUT, NULL);
+	output_print_data(new_base, serial);
+	profile_end();
+	db_table_refput(new_base);
 	return error;
 }
 
 int
 vrps_update(bool *changed)
 {
-	time_t start, finish;
-	long int exec_time;
+	struct metrics_timer timer;
+	double exec_time;
 	serial_t serial;
 	int error;
 
@@ -399,8 +550,15 @@ vrps_update(bool *changed)
 	 * This wrapper is mainly for log informational data, so if there's no
 	 * need don't do unnecessary calls
 	 */
-	if (!log_op_info_enabled())
-		return __vrps_update(changed);
+	if (!log_op_info_enabled()) {
+		metrics_timer_start(&timer);
+		profile_cycle_start();
+		error = __vrps_update(changed);
+		exec_time = metrics_timer_elapsed(&timer);
+		profile_cycle_end(exec_time, error);
+		metrics_validation_run(exec_time, error);
+		return error;
+	}
 
 	pr_op_info("Starting validation.");
 	serial = START_SERIAL;
@@ -410,13 +568,15 @@ vrps_update(bool *changed)
 			pr_op_info("- Current serial number is %u.", serial);
 	}
 
-	time(&start);
+	metrics_timer_start(&timer);
+	profile_cycle_start();
 	error = __vrps_update(changed);
-	time(&finish);
-	exec_time = finish - start;
+	exec_time = metrics_timer_elapsed(&timer);
+	profile_cycle_end(exec_time, error);
+	metrics_validation_run(exec_time, error);
 
 	pr_op_info("Validation finished:");
-	rwlock_read_lock(&state_lock);
+	state_read_lock();
 	do {
 		if (state.base == NULL) {
 			rwlock_unlock(&state_lock);
@@ -437,7 +597,7 @@ vrps_update(bool *changed)
 		}
 		rwlock_unlock(&state_lock);
 	} while(0);
-	pr_op_info("- Real execution time: %ld secs.", exec_time);
+	pr_op_info("- Real execution time: %ld secs.", (long int) exec_time);
 
 	return error;
 }
@@ -448,150 +608,77 @@ vrps_update(bool *changed)
  * 1. 0: No errors.
  * 2. -EAGAIN: No data available; database still under construction.
  */
+/*
+ * Iterates the current base, without holding the lock; the snapshot is
+ * reference-counted, so the validator can publish a new one meanwhile.
+ * @serial is the serial of the iterated base.
+ */
 int
-vrps_foreach_base(vrp_foreach_cb cb_roa, router_key_foreach_cb cb_rk, void *arg)
+vrps_foreach_base(vrp_foreach_cb cb_roa, router_key_foreach_cb cb_rk,
+    void *arg, serial_t *serial)
 {
+	struct db_table *base;
 	int error;
 
-	error = rwlock_read_lock(&state_lock);
+	error = state_read_lock();
 	if (error)
 		return error;
 
-	if (state.base != NULL) {
-		error = db_table_foreach_roa(state.base, cb_roa, arg);
-		if (error)
-			goto unlock;
-		error = db_table_foreach_router_key(state.base, cb_rk, arg);
-	} else
-		error = -EAGAIN;
+	base = state.base;
+	if (base != NULL) {
+		db_table_refget(base);
+		*serial = state.next_serial - 1;
+	}
 
-unlock:
 	rwlock_unlock(&state_lock);
 
-	return error;
-}
-
-/*
- * Remove the announcements/withdrawals that override each other.
- *
- * (Note: We're assuming the array is already duplicateless enough thanks to the
- * hash table.)
- */
-static int
-vrp_ovrd_remove(struct delta_vrp const *delta, void *arg)
-{
-	struct sorted_lists *lists = arg;
-	struct vrp_node *ptr;
-	struct vrp_slist *filtered_vrps;
-
-	filtered_vrps = &lists->prefixes;
-	SLIST_FOREACH(ptr, filtered_vrps, next)
-		if (VRP_EQ(&delta->vrp, &ptr->delta.vrp) &&
-		    delta->flags != ptr->delta.flags) {
-			SLIST_REMOVE(filtered_vrps, ptr, vrp_node, next);
-			free(ptr);
-			return 0;
-		}
-
-	ptr = malloc(sizeof(struct vrp_node));
-	if (ptr == NULL)
-		return pr_enomem();
-
-	ptr->delta = *delta;
-	SLIST_INSERT_HEAD(filtered_vrps, ptr, next);
-	return 0;
-}
-
-static int
-router_key_ovrd_remove(struct delta_router_key const *delta, void *arg)
-{
-	struct sorted_lists *lists = arg;
-	struct rk_node *ptr;
-	struct rk_slist *filtered_keys;
-	struct router_key const *key;
-
-	filtered_keys = &lists->router_keys;
-	SLIST_FOREACH(ptr, filtered_keys, next) {
-		key = &delta->router_key;
-		if (key->as == ptr->delta.router_key.as &&
-		    memcmp(key->ski, ptr->delta.router_key.ski, RK_SKI_LEN) == 0
-		    && memcmp(key->spk, ptr->delta.router_key.spk,
-		    RK_SPKI_LEN) == 0 &&
-		    delta->flags != ptr->delta.flags) {
-			SLIST_REMOVE(filtered_keys, ptr, rk_node, next);
-			free(ptr);
-			return 0;
-		}
-	}
+	if (base == NULL)
+		return -EAGAIN;
 
-	ptr = malloc(sizeof(struct rk_node));
-	if (ptr == NULL)
-		return pr_enomem();
+	error = db_table_foreach_roa(base, cb_roa, arg);
+	if (!error)
+		error = db_table_foreach_router_key(base, cb_rk, arg);
 
-	ptr->delta = *delta;
-	SLIST_INSERT_HEAD(filtered_keys, ptr, next);
-	return 0;
+	db_table_refput(base);
+	return error;
 }
 
 /*
- * Remove all operations on @deltas that override each other, and do @cb (with
- * @arg) on each element of the resultant delta.
+ * Stores @merged (the changes from serial @from to @to) in the history, so
+ * other clients can reuse it. Unless the history has moved on in the
+ * meantime.
  */
-int
-vrps_foreach_filtered_delta(struct deltas_db *deltas,
-    delta_vrp_foreach_cb cb_prefix, delta_router_key_foreach_cb cb_rk,
-    void *arg)
+static void
+cache_merged(serial_t from, serial_t to, struct deltas *merged)
 {
-	struct sorted_lists filtered_lists;
 	struct delta_group *group;
-	struct vrp_node *vnode;
-	struct rk_node *rnode;
-	array_index i;
-	int error = 0;
-
-	/*
-	 * Filter: Remove entries that cancel each other.
-	 * (We'll have to build a separate list because the database nodes
-	 * are immutable.)
-	 */
-	SLIST_INIT(&filtered_lists.prefixes);
-	SLIST_INIT(&filtered_lists.router_keys);
-	ARRAYLIST_FOREACH(deltas, group, i) {
-		error = deltas_foreach(group->serial, group->deltas,
-		    vrp_ovrd_remove, router_key_ovrd_remove, &filtered_lists);
-		if (error)
-			goto release_list;
-	}
-
-	/* Now do the corresponding callback on the filtered deltas */
-	SLIST_FOREACH(vnode, &filtered_lists.prefixes, next) {
-		error = cb_prefix(&vnode->delta, arg);
-		if (error)
-			break;
-	}
-	SLIST_FOREACH(rnode, &filtered_lists.router_keys, next) {
-		error = cb_rk(&rnode->delta, arg);
-		if (error)
-			break;
-	}
-
-release_list:
-	while (!SLIST_EMPTY(&filtered_lists.prefixes)) {
-		vnode = filtered_lists.prefixes.slh_first;
-		SLIST_REMOVE_HEAD(&filtered_lists.prefixes, next);
-		free(vnode);
-	}
-	while (!SLIST_EMPTY(&filtered_lists.router_keys)) {
-		rnode = filtered_lists.router_keys.slh_first;
-		SLIST_REMOVE_HEAD(&filtered_lists.router_keys, next);
-		free(rnode);
+	size_t index;
+
+	if (state_read_lock() != 0)
+		return;
+
+	index = (serial_t)(from - state.deltas_first);
+	if (state.base != NULL && state.next_serial - 1 == to &&
+	    index < state.deltas.len) {
+		group = &state.deltas.array[index];
+		pthread_mutex_lock(&merge_lock);
+		if (group->merged == NULL) {
+			deltas_refget(merged);
+			group->merged = merged;
+		}
+		pthread_mutex_unlock(&merge_lock);
 	}
 
-	return error;
+	rwlock_unlock(&state_lock);
 }
 
 /**
- * Adds to @result the deltas whose serial > @from.
+ * Returns (in @result) the changes from serial @from to the current one (@to),
+ * merged: Announcements and withdrawals that cancel each other are already
+ * gone. The caller must release @result with deltas_refput().
+ *
+ * The merge (if it's not cached already) happens outside of the lock, so it
+ * never stalls the validator.
  *
  * Please keep in mind that there is at least one errcode-aware caller. The most
  * important ones are
@@ -600,49 +687,84 @@ release_list:
  * 3. -ESRCH: @from was not found.
  *
  * As usual, only 0 guarantees valid out parameters. (@to and @result.)
- * (But note that @result is supposed to be already initialized, so caller will
- * have to clean it up regardless of error.)
  */
 int
-vrps_get_deltas_from(serial_t from, serial_t *to, struct deltas_db *result)
+vrps_get_deltas_from(serial_t from, serial_t *to, struct deltas **result)
 {
 	struct delta_group *group;
+	struct deltas **array;
+	size_t index;
+	size_t count;
 	array_index i;
-	bool from_found;
 	int error;
 
-	from_found = false;
-
-	error = rwlock_read_lock(&state_lock);
+	error = state_read_lock();
 	if (error)
 		return error;
 
 	if (state.base == NULL) {
-		rwlock_unlock(&state_lock);
-		return -EAGAIN;
+		error = -EAGAIN;
+		goto unlock;
 	}
 
-	ARRAYLIST_FOREACH(&state.deltas, group, i) {
-		if (!from_found) {
-			if (group->serial == from) {
-				from_found = true;
-				*to = group->serial;
-			}
-			continue;
-		}
+	/* Serial arithmetic; serials older than the history wrap around */
+	index = (serial_t)(from - state.deltas_first);
+	if (index > state.deltas.len) {
+		error = -ESRCH;
+		goto unlock;
+	}
 
-		error = deltas_db_add(result, group);
-		if (error) {
-			rwlock_unlock(&state_lock);
-			return error;
-		}
+	*to = state.next_serial - 1;
+
+	if (index == state.deltas.len) {
+		/* Already up to date */
+		error = deltas_create(result);
+		goto unlock;
+	}
 
+	group = &state.deltas.array[index];
+	if (index == state.deltas.len - 1) {
+		/* One serial behind; nothing to merge */
 		deltas_refget(group->deltas);
-		*to = group->serial;
+		*result = group->deltas;
+		goto unlock;
 	}
 
+	pthread_mutex_lock(&merge_lock);
+	*result = group->merged;
+	if (*result != NULL)
+		deltas_refget(*result);
+	pthread_mutex_unlock(&merge_lock);
+	if (*result != NULL)
+		goto unlock;
+
+	/* Grab references to the deltas, and merge them without the lock */
+	count = state.deltas.len - index;
+	array = malloc(count * sizeof(struct deltas *));
+	if (array == NULL) {
+		error = pr_enomem();
+		goto unlock;
+	}
+	for (i = 0; i < count; i++) {
+		array[i] = state.deltas.array[index + i].deltas;
+		deltas_refget(array[i]);
+	}
+
+	rwlock_unlock(&state_lock);
+
+	error = deltas_merge(array, count, result);
+
+	for (i = 0; i < count; i++)
+		deltas_refput(array[i]);
+	free(array);
+
+	if (!error)
+		cache_merged(from, *to, *result);
+	return error;
+
+unlock:
 	rwlock_unlock(&state_lock);
-	return from_found ? 0 : -ESRCH;
+	return error;
 }
 
 int
@@ -650,7 +772,7 @@ get_last_serial_number(serial_t *result)
 {
 	int error;
 
-	error = rwlock_read_lock(&state_lock);
+	error = state_read_lock();
 	if (error)
 		return error;
 
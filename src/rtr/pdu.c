@@ -104,22 +104,31 @@ validate_rtr_version(int fd, struct pdu_header *header,
 	return clients_set_rtr_version(fd, header->protocol_version);
 }
 
+/*
+ * Extracts the next PDU from @stream, into @request. @request->bytes stays
+ * valid until the next call.
+ */
 int
-pdu_load(int fd, struct sockaddr_storage *client_addr,
+pdu_load(struct pdu_stream *stream, struct sockaddr_storage *client_addr,
     struct rtr_request *request, struct pdu_metadata const **metadata)
 {
-	unsigned char hdr_bytes[RTRPDU_HDR_LEN];
+	unsigned char *hdr_bytes;
 	struct pdu_reader reader;
 	struct pdu_header header;
 	struct pdu_metadata const *meta;
 	uint8_t version;
+	int fd;
 	int error;
 
-	/* Read the header into its buffer. */
-	error = pdu_reader_init(&reader, fd, hdr_bytes, RTRPDU_HDR_LEN, true);
+	fd = stream->fd;
+
+	/* Wait for the header. */
+	error = pdu_stream_peek(stream, RTRPDU_HDR_LEN, true, &hdr_bytes);
 	if (error)
 		/* Communication interrupted; omit error response */
 		return error;
+	reader.buffer = hdr_bytes;
+	reader.size = RTRPDU_HDR_LEN;
 	error = pdu_header_from_reader(&reader, &header);
 	if (error)
 		/* No error response because the PDU might have been an error */
@@ -160,36 +169,24 @@ pdu_load(int fd, struct sockaddr_storage *client_addr,
 		return RESPOND_ERROR(err_pdu_send_invalid_request_truncated(fd,
 		    version, hdr_bytes, "PDU is too large. (> 512 bytes)"));
 
-	/* Read the rest of the PDU into its buffer. */
-	request->bytes_len = header.length;
-	request->bytes = malloc(header.length);
-	if (request->bytes == NULL)
-		/* No error report PDU on allocation failures. */
-		return pr_enomem();
-
-	memcpy(request->bytes, hdr_bytes, RTRPDU_HDR_LEN);
-	error = pdu_reader_init(&reader, fd,
-	    request->bytes + RTRPDU_HDR_LEN,
-	    header.length - RTRPDU_HDR_LEN,
-	    false);
+	/* Wait for the rest of the PDU. (@hdr_bytes might move.) */
+	error = pdu_stream_peek(stream, header.length, false, &request->bytes);
 	if (error)
 		/* Communication interrupted; no error PDU. */
-		goto revert_bytes;
+		return error;
+	request->bytes_len = header.length;
+	pdu_stream_consume(stream, header.length);
+
+	reader.buffer = request->bytes + RTRPDU_HDR_LEN;
+	reader.size = header.length - RTRPDU_HDR_LEN;
 
 	/* Deserialize the PDU. */
 	meta = pdu_get_metadata(header.pdu_type);
-	if (!meta) {
-		error = RESPOND_ERROR(err_pdu_send_unsupported_pdu_type(fd,
+	if (!meta)
+		return RESPOND_ERROR(err_pdu_send_unsupported_pdu_type(fd,
 		    version, request));
-		goto revert_bytes;
-	}
-
-	request->pdu = malloc(meta->length);
-	if (request->pdu == NULL) {
-		error = pr_enomem();
-		goto revert_bytes;
-	}
 
+	request->pdu = &request->storage;
 	error = meta->from_stream(&header, &reader, request->pdu);
 	if (reader.size != 0) {
 		error = RESPOND_ERROR(err_pdu_send_invalid_request(fd, version,
@@ -207,9 +204,8 @@ pdu_load(int fd, struct sockaddr_storage *client_addr,
 	return 0;
 
 revert_pdu:
-	free(request->pdu);
-revert_bytes:
-	free(request->bytes);
+	if (meta->destructor != NULL)
+		meta->destructor(request->pdu);
 	return error;
 }
 
@@ -313,9 +309,13 @@ error_report_from_stream(struct pdu_header *header, struct pdu_reader *reader,
 
 	memcpy(&pdu->header, header, sizeof(*header));
 
+	pdu->error_message = NULL;
+
 	error = read_int32(reader, &pdu->error_pdu_length);
 	if (error)
 		return error;
+	if (pdu->error_pdu_length > RTRPDU_ERR_MAX_LEN)
+		return -EINVAL;
 	error = read_bytes(reader, pdu->erroneous_pdu, pdu->error_pdu_length);
 	if (error)
 		return error;
@@ -331,7 +331,6 @@ error_report_destroy(void *pdu_void)
 {
 	struct error_report_pdu *pdu = pdu_void;
 	free(pdu->error_message);
-	free(pdu);
 }
 
 #define DEFINE_METADATA(name, dtor)					\
@@ -342,15 +341,15 @@ error_report_destroy(void *pdu_void)
 		.destructor = dtor,					\
 	}
 
-DEFINE_METADATA(serial_notify, free);
-DEFINE_METADATA(serial_query, free);
-DEFINE_METADATA(reset_query, free);
-DEFINE_METADATA(cache_response, free);
-DEFINE_METADATA(ipv4_prefix, free);
-DEFINE_METADATA(ipv6_prefix, free);
-DEFINE_METADATA(end_of_data, free);
-DEFINE_METADATA(cache_reset, free);
-DEFINE_METADATA(router_key, free);
+DEFINE_METADATA(serial_notify, NULL);
+DEFINE_METADATA(serial_query, NULL);
+DEFINE_METADATA(reset_query, NULL);
+DEFINE_METADATA(cache_response, NULL);
+DEFINE_METADATA(ipv4_prefix, NULL);
+DEFINE_METADATA(ipv6_prefix, NULL);
+DEFINE_METADATA(end_of_data, NULL);
+DEFINE_METADATA(cache_reset, NULL);
+DEFINE_METADATA(router_key, NULL);
 DEFINE_METADATA(error_report, error_report_destroy);
 
 static struct pdu_metadata const *const pdu_metadatas[] = {
@@ -11,16 +11,6 @@
 #define RTR_V0	0
 #define RTR_V1	1
 
-/** A request from an RTR client. */
-struct rtr_request {
-	/** Raw bytes. */
-	unsigned char *bytes;
-	/** Length of @bytes. */
-	size_t bytes_len;
-	/** Deserialized PDU. One of the *_pdu struct below. */
-	void *pdu;
-};
-
 enum pdu_type {
 	PDU_TYPE_SERIAL_NOTIFY =	0,
 	PDU_TYPE_SERIAL_QUERY =		1,
@@ -138,6 +128,29 @@ struct error_report_pdu {
 	rtr_char	*error_message;
 };
 
+/** A request from an RTR client. */
+struct rtr_request {
+	/** Raw bytes. They live in the connection's pdu_stream. */
+	unsigned char *bytes;
+	/** Length of @bytes. */
+	size_t bytes_len;
+	/** Deserialized PDU. One of the *_pdu struct above. */
+	void *pdu;
+	/** Room for @pdu, so it doesn't need to be allocated. */
+	union {
+		struct serial_notify_pdu serial_notify;
+		struct serial_query_pdu serial_query;
+		struct reset_query_pdu reset_query;
+		struct cache_response_pdu cache_response;
+		struct ipv4_prefix_pdu ipv4_prefix;
+		struct ipv6_prefix_pdu ipv6_prefix;
+		struct end_of_data_pdu end_of_data;
+		struct cache_reset_pdu cache_reset;
+		struct router_key_pdu router_key;
+		struct error_report_pdu error_report;
+	} storage;
+};
+
 struct pdu_metadata {
 	size_t	length;
 	/**
@@ -154,11 +167,12 @@ struct pdu_metadata {
 	 * Also, they are supposed to send error PDUs on discretion.
 	 */
 	int	(*handle)(int, struct rtr_request const *);
+	/** Releases whatever the PDU allocated. (Not the PDU itself.) */
 	void	(*destructor)(void *);
 };
 
-int pdu_load(int, struct sockaddr_storage *, struct rtr_request *,
-    struct pdu_metadata const **);
+int pdu_load(struct pdu_stream *, struct sockaddr_storage *,
+    struct rtr_request *, struct pdu_metadata const **);
 struct pdu_metadata const *pdu_get_metadata(uint8_t);
 struct pdu_header *pdu_get_header(void *);
 
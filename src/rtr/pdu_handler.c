@@ -26,7 +26,7 @@ int
 handle_serial_query_pdu(int fd, struct rtr_request const *request)
 {
 	struct serial_query_pdu *query = request->pdu;
-	struct deltas_db deltas;
+	struct deltas *deltas;
 	serial_t final_serial;
 	uint8_t version;
 	int error;
@@ -45,38 +45,30 @@ handle_serial_query_pdu(int fd, struct rtr_request const *request)
 		    "Session ID doesn't match.");
 
 	/*
-	 * For the record, there are two reasons why we want to work on a
-	 * (shallow) copy of the deltas (as opposed to eg. a foreach):
-	 * 1. We need to remove deltas that cancel each other.
-	 *    (Which can't be done directly on the DB.)
-	 * 2. It's probably best not to hold the VRPS read lock while writing
-	 *    PDUs, to minimize writer stagnation.
+	 * We get a reference to the (already merged) deltas, rather than
+	 * iterating them, because it's probably best not to hold the VRPS read
+	 * lock while writing PDUs, to minimize writer stagnation.
 	 */
-
-	deltas_db_init(&deltas);
 	error = vrps_get_deltas_from(query->serial_number, &final_serial,
 	    &deltas);
 	switch (error) {
 	case 0:
 		break;
 	case -EAGAIN: /* Database still under construction */
-		error = err_pdu_send_no_data_available(fd, version);
-		goto end;
+		return err_pdu_send_no_data_available(fd, version);
 	case -ESRCH: /* Invalid serial */
 		/* https://tools.ietf.org/html/rfc6810#section-6.3 */
-		error = send_cache_reset_pdu(fd, version);
-		goto end;
+		return send_cache_reset_pdu(fd, version);
 	case -ENOMEM: /* Memory allocation failure */
 		pr_enomem();
-		goto end;
+		return error;
 	case EAGAIN: /* Too many threads */
 		/*
 		 * I think this should be more of a "try again" thing, but
 		 * RTR does not provide a code for that. Just fall through.
 		 */
 	default:
-		error = err_pdu_send_internal_error(fd, version);
-		goto end;
+		return err_pdu_send_internal_error(fd, version);
 	}
 
 	/*
@@ -89,13 +81,13 @@ handle_serial_query_pdu(int fd, struct rtr_request const *request)
 	error = send_cache_response_pdu(fd, version);
 	if (error)
 		goto end;
-	error = send_delta_pdus(fd, version, &deltas);
+	error = send_delta_pdus(fd, version, final_serial, deltas);
 	if (error)
 		goto end;
 	error = send_end_of_data_pdu(fd, version, final_serial);
 
 end:
-	deltas_db_cleanup(&deltas, deltagroup_cleanup);
+	deltas_refput(deltas);
 	return error;
 }
 
@@ -152,25 +144,12 @@ handle_reset_query_pdu(int fd, struct rtr_request const *request)
 	args.fd = fd;
 	args.version = pdu->header.protocol_version;
 
-	error = get_last_serial_number(&current_serial);
-	switch (error) {
-	case 0:
-		break;
-	case -EAGAIN:
-		return err_pdu_send_no_data_available(fd, args.version);
-	default:
-		err_pdu_send_internal_error(fd, args.version);
-		return error;
-	}
-
 	/*
-	 * It's probably best not to work on a copy, because the tree is large.
-	 * Unfortunately, this means we'll have to encourage writer stagnation,
-	 * but thankfully, most clients are supposed to request far more serial
-	 * queries than reset queries.
+	 * The base is a reference-counted snapshot, so it's iterated without
+	 * holding any locks, and @current_serial is its own serial.
 	 */
-
-	error = vrps_foreach_base(send_base_roa, send_base_router_key, &args);
+	error = vrps_foreach_base(send_base_roa, send_base_router_key, &args,
+	    &current_serial);
 
 	/* See handle_serial_query_pdu() for some comments. */
 	switch (error) {
@@ -38,6 +38,7 @@ send_response(int fd, uint8_t pdu_type, unsigned char *data, size_t data_len)
 		return pr_op_errno(errno, "Error sending %s to client.",
 		    pdutype2str(pdu_type));
 
+	clients_add_sent(error);
 	return 0;
 }
 
@@ -239,26 +240,17 @@ router_key_simply_send(struct delta_router_key const *delta, void *arg)
 	    &delta->router_key, delta->flags);
 }
 
+/* @deltas are already merged, so they need no filtering. */
 int
-send_delta_pdus(int fd, uint8_t version, struct deltas_db *deltas)
+send_delta_pdus(int fd, uint8_t version, serial_t serial,
+    struct deltas *deltas)
 {
-	struct delta_group *group;
 	struct simple_param param;
 
 	param.fd = fd;
 	param.version = version;
 
-	/*
-	 * Short circuit: Entries that share serial are already guaranteed to
-	 * not contradict each other, so no filtering required.
-	 */
-	if (deltas->len == 1) {
-		group = &deltas->array[0];
-		return deltas_foreach(group->serial, group->deltas,
-		    vrp_simply_send, router_key_simply_send, &param);
-	}
-
-	return vrps_foreach_filtered_delta(deltas, vrp_simply_send,
+	return deltas_foreach(serial, deltas, vrp_simply_send,
 	    router_key_simply_send, &param);
 }
 
@@ -2,6 +2,7 @@
 
 #include <err.h>
 #include <errno.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
@@ -61,6 +62,121 @@ pdu_reader_init(struct pdu_reader *reader, int fd, unsigned char *buffer,
 	return read_exact(fd, reader->buffer, size, allow_eof);
 }
 
+void
+pdu_stream_init(struct pdu_stream *stream, int fd)
+{
+	stream->fd = fd;
+	stream->start = 0;
+	stream->end = 0;
+	stream->wakeup_fd = -1;
+	stream->wakeup_cb = NULL;
+}
+
+void
+pdu_stream_set_wakeup(struct pdu_stream *stream, int wakeup_fd,
+    void (*wakeup_cb)(int, int))
+{
+	stream->wakeup_fd = wakeup_fd;
+	stream->wakeup_cb = wakeup_cb;
+}
+
+/*
+ * Blocks until the client socket is readable, attending @stream's wakeup fd
+ * in the meantime.
+ */
+static int
+wait_readable(struct pdu_stream *stream)
+{
+	struct pollfd fds[2];
+
+	if (stream->wakeup_fd < 0)
+		return 0; /* read() will block by itself */
+
+	fds[0].fd = stream->fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = stream->wakeup_fd;
+	fds[1].events = POLLIN;
+
+	do {
+		fds[0].revents = 0;
+		fds[1].revents = 0;
+
+		if (poll(fds, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			return -pr_op_errno(errno, "Client socket poll failed");
+		}
+
+		if (fds[1].revents != 0)
+			stream->wakeup_cb(stream->fd, stream->wakeup_fd);
+	} while (fds[0].revents == 0);
+
+	/* Readable, EOF or error; read() will tell */
+	return 0;
+}
+
+/**
+ * Makes sure the next @len bytes of @stream have been received, and points
+ * @result to them. They stay in the stream (and @result stays valid) until
+ * pdu_stream_consume() and the next peek.
+ *
+ * If @allow_eof is true, EOF right at the start of the @len bytes is not
+ * logged. (It's the client closing the connection between PDUs.)
+ */
+int
+pdu_stream_peek(struct pdu_stream *stream, size_t len, bool allow_eof,
+    unsigned char **result)
+{
+	ssize_t read_result;
+	int error;
+
+	if (len > sizeof(stream->buffer))
+		pr_crit("Requested %zu bytes from a %zu-byte PDU stream.", len,
+		    sizeof(stream->buffer));
+
+	while (stream->end - stream->start < len) {
+		/* Not enough room at the end; move the pending bytes back */
+		if (stream->start + len > sizeof(stream->buffer)) {
+			memmove(stream->buffer, stream->buffer + stream->start,
+			    stream->end - stream->start);
+			stream->end -= stream->start;
+			stream->start = 0;
+		}
+
+		error = wait_readable(stream);
+		if (error)
+			return error;
+
+		read_result = read(stream->fd, stream->buffer + stream->end,
+		    sizeof(stream->buffer) - stream->end);
+		if (read_result == -1)
+			return -pr_op_errno(errno,
+			    "Client socket read interrupted");
+
+		if (read_result == 0) {
+			if (!allow_eof || stream->end != stream->start)
+				pr_op_warn("Stream ended mid-PDU.");
+			return -EPIPE;
+		}
+
+		stream->end += read_result;
+	}
+
+	*result = stream->buffer + stream->start;
+	return 0;
+}
+
+/** Discards the next @len bytes of @stream, which must have been peeked. */
+void
+pdu_stream_consume(struct pdu_stream *stream, size_t len)
+{
+	stream->start += len;
+	if (stream->start == stream->end) {
+		stream->start = 0;
+		stream->end = 0;
+	}
+}
+
 static int
 insufficient_bytes(void)
 {
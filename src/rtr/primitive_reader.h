@@ -13,9 +13,35 @@ struct pdu_reader {
 	size_t size;
 };
 
+/*
+ * Receive buffer of a client connection. Every read() fetches as many bytes
+ * as the socket has available, so pipelined PDUs are usually already here by
+ * the time the previous one has been handled.
+ */
+struct pdu_stream {
+	int fd;
+	/* Received bytes are @buffer[@start, @end) */
+	unsigned char buffer[4096];
+	size_t start;
+	size_t end;
+
+	/*
+	 * If @wakeup_fd is not -1, @wakeup_cb(@fd, @wakeup_fd) is called
+	 * whenever @wakeup_fd becomes readable while the stream is waiting for
+	 * the client. (That is, never in the middle of a response.)
+	 */
+	int wakeup_fd;
+	void (*wakeup_cb)(int, int);
+};
+
 int pdu_reader_init(struct pdu_reader *, int, unsigned char *, size_t size,
     bool);
 
+void pdu_stream_init(struct pdu_stream *, int);
+void pdu_stream_set_wakeup(struct pdu_stream *, int, void (*)(int, int));
+int pdu_stream_peek(struct pdu_stream *, size_t, bool, unsigned char **);
+void pdu_stream_consume(struct pdu_stream *, size_t);
+
 int read_int8(struct pdu_reader *, uint8_t *);
 int read_int16(struct pdu_reader *, uint16_t *);
 int read_int32(struct pdu_reader *, uint32_t *);
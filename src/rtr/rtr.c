@@ -16,6 +16,8 @@
 #include "clients.h"
 #include "internal_pool.h"
 #include "log.h"
+#include "metrics.h"
+#include "notify.h"
 #include "validation_run.h"
 #include "rtr/err_pdu.h"
 #include "rtr/pdu.h"
@@ -387,8 +389,8 @@ retry:
 static void
 clean_request(struct rtr_request *request, const struct pdu_metadata *meta)
 {
-	free(request->bytes);
-	meta->destructor(request->pdu);
+	if (meta->destructor != NULL)
+		meta->destructor(request->pdu);
 }
 
 static int
@@ -432,6 +434,7 @@ reject_client(int fd, struct sockaddr_storage *addr)
 
 	client.fd = fd;
 	client.addr = *addr;
+	client.notify_fd = -1;
 
 	/* Try to be polite notifying there was an error */
 	err_pdu_send_internal_error(fd, RTR_V0);
@@ -446,21 +449,34 @@ static void *
 client_thread_cb(void *arg)
 {
 	struct pdu_metadata const *meta;
+	struct pdu_stream stream;
 	struct rtr_request request;
 	struct thread_param param;
+	struct client_traffic traffic;
+	int notify_fds[2];
 	int error;
 
 	memcpy(&param, arg, sizeof(param));
 	free(arg);
 
-	error = clients_add(param.fd, param.addr);
+	error = notify_pipe_open(notify_fds);
 	if (error) {
 		close(param.fd);
 		return NULL;
 	}
 
+	error = clients_add(param.fd, param.addr, notify_fds[1],
+	    &traffic);
+	if (error) {
+		notify_pipe_close(notify_fds);
+		close(param.fd);
+		return NULL;
+	}
+
+	pdu_stream_init(&stream, param.fd);
+	pdu_stream_set_wakeup(&stream, notify_fds[0], notify_send_pending);
 	while (true) { /* For each PDU... */
-		error = pdu_load(param.fd, &param.addr, &request, &meta);
+		error = pdu_load(&stream, &param.addr, &request, &meta);
 		if (error)
 			break;
 
@@ -471,6 +487,8 @@ client_thread_cb(void *arg)
 	}
 
 	clients_forget(param.fd, end_client, CL_CLOSED);
+	/* Forgotten, so notify_clients() can't be writing to the pipe anymore */
+	notify_pipe_close(notify_fds);
 
 	return NULL;
 }
@@ -655,15 +673,19 @@ rtr_listen(void)
 	if (error)
 		return error;
 
+	error = metrics_init();
+	if (error)
+		goto revert_clients_db;
+
 	if (config_get_mode() == STANDALONE) {
 		error = validation_run_first();
-		goto revert_clients_db; /* Error 0 it's ok */
+		goto revert_metrics; /* Error 0 it's ok */
 	}
 
 	fds = malloc(sizeof(struct server_fds));
 	if (fds == NULL) {
 		error = pr_enomem();
-		goto revert_clients_db;
+		goto revert_metrics;
 	}
 
 	SLIST_INIT(fds);
@@ -699,6 +721,8 @@ revert_thread_pool:
 	thread_pool_destroy(pool);
 revert_server_fds:
 	server_fds_destroy(fds);
+revert_metrics:
+	metrics_cleanup();
 revert_clients_db:
 	clients_db_destroy();
 	return error;
@@ -6,6 +6,7 @@
 
 #include "crypto/base64.h"
 #include "data_structure/array_list.h"
+#include "data_structure/uthash_nonfatal.h"
 #include "object/router_key.h"
 #include "common.h"
 
@@ -31,8 +32,58 @@ struct slurm_lists {
 	struct al_assertion_bgpsec assertion_bgps_al;
 };
 
+/* Binary trie node, each level corresponds to a bit of the address */
+struct pfx_node {
+	struct pfx_node *children[2];
+	/* A filter's prefix ends at this node */
+	bool filtered;
+};
+
+/* Filter prefixes of both address families */
+struct pfx_tries {
+	struct pfx_node *v4;
+	struct pfx_node *v6;
+};
+
+/* Prefix filters that have an ASN */
+struct asn_filter {
+	uint32_t asn;
+	/* Is there a filter with this ASN and no prefix? */
+	bool any_prefix;
+	struct pfx_tries prefixes;
+	UT_hash_handle hh;
+};
+
+/*
+ * A BGPsec filter. The key is zeroed wherever the filter lacks the field, so
+ * that a Router Key can be looked up by its ASN, its SKI, and both.
+ */
+struct bgpsec_filter {
+	struct {
+		uint32_t asn;
+		unsigned char ski[RK_SKI_LEN];
+		/* SLURM_COM_FLAG_ASN and/or SLURM_BGPS_FLAG_SKI */
+		uint32_t flags;
+	} key;
+	UT_hash_handle hh;
+};
+
+/*
+ * Index of the filters, so that a VRP can be looked up in O(prefix length),
+ * and a Router Key in O(1), regardless of the number of filters.
+ */
+struct filter_index {
+	/* Prefix filters with an ASN (and maybe a prefix), indexed by ASN */
+	struct asn_filter *asns;
+	/* Prefix filters with a prefix and no ASN */
+	struct pfx_tries prefixes;
+	/* BGPsec filters */
+	struct bgpsec_filter *bgpsec;
+};
+
 struct db_slurm {
 	struct slurm_lists lists;
+	struct filter_index filter_idx;
 	struct slurm_lists *cache;
 	bool loaded_date_set;
 	time_t loaded_date;
@@ -110,6 +161,10 @@ db_slurm_create(struct db_slurm **result)
 	al_assertion_prefix_init(&db->lists.assertion_pfx_al);
 	al_filter_bgpsec_init(&db->lists.filter_bgps_al);
 	al_assertion_bgpsec_init(&db->lists.assertion_bgps_al);
+	db->filter_idx.asns = NULL;
+	db->filter_idx.prefixes.v4 = NULL;
+	db->filter_idx.prefixes.v6 = NULL;
+	db->filter_idx.bgpsec = NULL;
 	db->loaded_date_set = false;
 	db->cache = NULL;
 
@@ -120,125 +175,280 @@ db_slurm_create(struct db_slurm **result)
 	return 0;
 }
 
-/*
- * @filter_wrap is the prefix loaded from SLURM, @prefix is the VRP "masked" as
- * a slurm_prefix
- */
-static bool
-prefix_filtered_by(struct slurm_prefix_wrap *filter_wrap,
-    struct slurm_prefix *prefix)
-{
-	struct slurm_prefix *filter;
-	struct vrp *filter_vrp, *prefix_vrp;
-	bool equal;
-
-	filter = &filter_wrap->element;
-	filter_vrp = &filter->vrp;
-	prefix_vrp = &prefix->vrp;
-
-	/*
-	 * Ignore the comments, remember: FILTERS don't have the same data (no
-	 * max_length is declared), while ASSERTIONS do.
-	 */
-	if ((filter->data_flag & ~SLURM_COM_FLAG_COMMENT) !=
-	    (prefix->data_flag & ~SLURM_COM_FLAG_COMMENT)) {
-		/* The filter has ASN and prefix */
-		if ((filter->data_flag & ~SLURM_COM_FLAG_COMMENT) ==
-		    (SLURM_COM_FLAG_ASN | SLURM_PFX_FLAG_PREFIX))
-			return VRP_ASN_EQ(filter_vrp, prefix_vrp) &&
-			    VRP_PREFIX_COV(filter_vrp, prefix_vrp);
-
-		/* Both have ASN */
-		if ((filter->data_flag & SLURM_COM_FLAG_ASN) > 0 &&
-		    (prefix->data_flag & SLURM_COM_FLAG_ASN) > 0)
-			return VRP_ASN_EQ(filter_vrp, prefix_vrp);
-
-		/* Both have a prefix of the same type */
-		if ((filter->data_flag & SLURM_PFX_FLAG_PREFIX) > 0 &&
-		    (prefix->data_flag & SLURM_PFX_FLAG_PREFIX) > 0)
-			return VRP_PREFIX_COV(filter_vrp, prefix_vrp);
+/* Returns bit @i of @addr (which is in network byte order) */
+static unsigned int
+addr_bit(uint8_t const *addr, unsigned int i)
+{
+	return (addr[i >> 3] >> (7 - (i & 7))) & 1;
+}
 
-		return false;
+static uint8_t const *
+vrp_addr(struct vrp const *vrp)
+{
+	return (vrp->addr_fam == AF_INET)
+	    ? (uint8_t const *) &vrp->prefix.v4
+	    : vrp->prefix.v6.s6_addr;
+}
+
+static struct pfx_node **
+pfx_tries_get(struct pfx_tries *tries, struct vrp const *vrp)
+{
+	switch (vrp->addr_fam) {
+	case AF_INET:
+		return &tries->v4;
+	case AF_INET6:
+		return &tries->v6;
 	}
 
-	/* It has the same data, compare it */
-	equal = true;
-	if (equal && (filter->data_flag & SLURM_COM_FLAG_ASN) > 0)
-		equal = VRP_ASN_EQ(filter_vrp, prefix_vrp);
+	pr_crit("Unknown addr family type: %u", vrp->addr_fam);
+	return NULL;
+}
+
+static int
+pfx_node_create(struct pfx_node **result)
+{
+	struct pfx_node *node;
+
+	node = calloc(1, sizeof(struct pfx_node));
+	if (node == NULL)
+		return pr_enomem();
+
+	*result = node;
+	return 0;
+}
+
+static void
+pfx_node_destroy(struct pfx_node *node)
+{
+	if (node == NULL)
+		return;
+
+	pfx_node_destroy(node->children[0]);
+	pfx_node_destroy(node->children[1]);
+	free(node);
+}
+
+static void
+pfx_tries_cleanup(struct pfx_tries *tries)
+{
+	pfx_node_destroy(tries->v4);
+	pfx_node_destroy(tries->v6);
+}
+
+/* Add the prefix of @vrp to the corresponding trie of @tries */
+static int
+pfx_tries_add(struct pfx_tries *tries, struct vrp const *vrp)
+{
+	struct pfx_node **node;
+	uint8_t const *addr;
+	unsigned int i;
+	int error;
+
+	node = pfx_tries_get(tries, vrp);
+	addr = vrp_addr(vrp);
 
-	if (equal && (filter->data_flag & SLURM_PFX_FLAG_PREFIX) > 0)
-		equal = VRP_PREFIX_COV(filter_vrp, prefix_vrp);
+	for (i = 0; ; i++) {
+		if (*node == NULL) {
+			error = pfx_node_create(node);
+			if (error)
+				return error;
+		}
+		if (i == vrp->prefix_length)
+			break;
+		node = &(*node)->children[addr_bit(addr, i)];
+	}
 
-	return equal;
+	(*node)->filtered = true;
+	return 0;
 }
 
+/* Is the prefix of @vrp equal to, or covered by, a prefix from @tries? */
 static bool
-prefix_filtered(struct db_slurm *db, struct slurm_prefix *prefix)
+pfx_tries_covers(struct pfx_tries *tries, struct vrp const *vrp)
 {
-	struct slurm_prefix_wrap *cursor;
-	array_index i;
+	struct pfx_node *node;
+	uint8_t const *addr;
+	unsigned int i;
 
-	ARRAYLIST_FOREACH(&db->lists.filter_pfx_al, cursor, i)
-		if (prefix_filtered_by(cursor, prefix))
+	node = *pfx_tries_get(tries, vrp);
+	addr = vrp_addr(vrp);
+
+	for (i = 0; node != NULL; i++) {
+		if (node->filtered)
 			return true;
+		if (i == vrp->prefix_length)
+			break;
+		node = node->children[addr_bit(addr, i)];
+	}
 
 	return false;
 }
 
-static bool
-bgpsec_filtered_by(struct slurm_bgpsec_wrap *filter_wrap,
-    struct slurm_bgpsec *bgpsec)
-{
-	struct slurm_bgpsec *filter;
-	bool equal;
-
-	filter = &filter_wrap->element;
-
-	/* Ignore the comments */
-	if ((filter->data_flag & ~SLURM_COM_FLAG_COMMENT) !=
-	    (bgpsec->data_flag & ~SLURM_COM_FLAG_COMMENT)) {
-		/* The filter has ASN and SKI */
-		if ((filter->data_flag & ~SLURM_COM_FLAG_COMMENT) ==
-		    (SLURM_COM_FLAG_ASN | SLURM_BGPS_FLAG_SKI))
-			return bgpsec->asn == filter->asn &&
-			    memcmp(bgpsec->ski, filter->ski, RK_SKI_LEN) == 0;
-
-		/* Both have ASN */
-		if ((bgpsec->data_flag & SLURM_COM_FLAG_ASN) > 0 &&
-		    (filter->data_flag & SLURM_COM_FLAG_ASN) > 0)
-			return bgpsec->asn == filter->asn;
-
-		/* Both have a SKI */
-		if ((bgpsec->data_flag & SLURM_BGPS_FLAG_SKI) > 0 &&
-		    (filter->data_flag & SLURM_BGPS_FLAG_SKI) > 0)
-			return memcmp(bgpsec->ski, filter->ski, RK_SKI_LEN)
-			    == 0;
+static int
+asn_filter_get(struct filter_index *idx, uint32_t asn,
+    struct asn_filter **result)
+{
+	struct asn_filter *node;
 
-		return false;
+	HASH_FIND(hh, idx->asns, &asn, sizeof(asn), node);
+	if (node != NULL) {
+		*result = node;
+		return 0;
 	}
 
-	/* It has the same data, compare it */
-	equal = true;
-	if (equal && (filter->data_flag & SLURM_COM_FLAG_ASN) > 0)
-		equal = filter->asn == bgpsec->asn;
+	node = malloc(sizeof(struct asn_filter));
+	if (node == NULL)
+		return pr_enomem();
 
-	if (equal && (filter->data_flag & SLURM_BGPS_FLAG_SKI) > 0)
-		equal = memcmp(filter->ski, bgpsec->ski, RK_SKI_LEN) == 0;
+	node->asn = asn;
+	node->any_prefix = false;
+	node->prefixes.v4 = NULL;
+	node->prefixes.v6 = NULL;
 
-	return equal;
+	errno = 0;
+	HASH_ADD(hh, idx->asns, asn, sizeof(node->asn), node);
+	if (errno) {
+		free(node);
+		return pr_enomem();
+	}
+
+	*result = node;
+	return 0;
+}
+
+static int
+filter_index_add(struct filter_index *idx, struct slurm_prefix *filter)
+{
+	struct asn_filter *asn_filter;
+	int error;
+
+	if ((filter->data_flag & SLURM_COM_FLAG_ASN) == 0) {
+		/* Filters have at least an ASN or a prefix */
+		if ((filter->data_flag & SLURM_PFX_FLAG_PREFIX) == 0)
+			return 0;
+		return pfx_tries_add(&idx->prefixes, &filter->vrp);
+	}
+
+	asn_filter = NULL;
+	error = asn_filter_get(idx, filter->vrp.asn, &asn_filter);
+	if (error)
+		return error;
+
+	if ((filter->data_flag & SLURM_PFX_FLAG_PREFIX) == 0) {
+		asn_filter->any_prefix = true;
+		return 0;
+	}
+
+	return pfx_tries_add(&asn_filter->prefixes, &filter->vrp);
+}
+
+static int
+filter_index_add_bgpsec(struct filter_index *idx, struct slurm_bgpsec *filter)
+{
+	struct bgpsec_filter *node, *old;
+
+	/* Filters have at least an ASN or a SKI */
+	if ((filter->data_flag & (SLURM_COM_FLAG_ASN | SLURM_BGPS_FLAG_SKI))
+	    == 0)
+		return 0;
+
+	node = malloc(sizeof(struct bgpsec_filter));
+	if (node == NULL)
+		return pr_enomem();
+	/* Needed by uthash */
+	memset(node, 0, sizeof(struct bgpsec_filter));
+
+	node->key.flags = filter->data_flag &
+	    (SLURM_COM_FLAG_ASN | SLURM_BGPS_FLAG_SKI);
+	if (filter->data_flag & SLURM_COM_FLAG_ASN)
+		node->key.asn = filter->asn;
+	if (filter->data_flag & SLURM_BGPS_FLAG_SKI)
+		memcpy(node->key.ski, filter->ski, RK_SKI_LEN);
+
+	errno = 0;
+	HASH_REPLACE(hh, idx->bgpsec, key, sizeof(node->key), node, old);
+	if (errno) {
+		free(node);
+		return pr_enomem();
+	}
+	if (old != NULL)
+		free(old);
+
+	return 0;
 }
 
+static void
+filter_index_cleanup(struct filter_index *idx)
+{
+	struct asn_filter *node, *tmp;
+	struct bgpsec_filter *bgpsec, *tmp_bgpsec;
+
+	HASH_ITER(hh, idx->asns, node, tmp) {
+		HASH_DEL(idx->asns, node);
+		pfx_tries_cleanup(&node->prefixes);
+		free(node);
+	}
+	pfx_tries_cleanup(&idx->prefixes);
+
+	HASH_ITER(hh, idx->bgpsec, bgpsec, tmp_bgpsec) {
+		HASH_DEL(idx->bgpsec, bgpsec);
+		free(bgpsec);
+	}
+}
+
+/*
+ * A VRP is filtered if there's a filter with its ASN and no prefix, a filter
+ * with its ASN and a prefix that covers its own, or a filter without ASN and
+ * with a prefix that covers its own.
+ */
 static bool
-bgpsec_filtered(struct db_slurm *db, struct slurm_bgpsec *bgpsec)
+prefix_filtered(struct db_slurm *db, struct vrp const *vrp)
 {
-	struct slurm_bgpsec_wrap *cursor;
-	array_index i;
+	struct asn_filter *asn_filter;
 
-	ARRAYLIST_FOREACH(&db->lists.filter_bgps_al, cursor, i)
-		if (bgpsec_filtered_by(cursor, bgpsec))
-			return true;
+	HASH_FIND(hh, db->filter_idx.asns, &vrp->asn, sizeof(vrp->asn),
+	    asn_filter);
+	if (asn_filter != NULL && (asn_filter->any_prefix ||
+	    pfx_tries_covers(&asn_filter->prefixes, vrp)))
+		return true;
 
-	return false;
+	return pfx_tries_covers(&db->filter_idx.prefixes, vrp);
+}
+
+/*
+ * A Router Key is filtered if there's a filter with its ASN and no SKI, a
+ * filter with its SKI and no ASN, or a filter with both.
+ */
+static bool
+bgpsec_filtered(struct db_slurm *db, struct router_key const *key)
+{
+	struct bgpsec_filter lookup;
+	struct bgpsec_filter *found;
+
+	if (db->filter_idx.bgpsec == NULL)
+		return false;
+
+	memset(&lookup.key, 0, sizeof(lookup.key));
+
+	lookup.key.flags = SLURM_COM_FLAG_ASN;
+	lookup.key.asn = key->as;
+	HASH_FIND(hh, db->filter_idx.bgpsec, &lookup.key, sizeof(lookup.key),
+	    found);
+	if (found != NULL)
+		return true;
+
+	lookup.key.flags = SLURM_COM_FLAG_ASN | SLURM_BGPS_FLAG_SKI;
+	memcpy(lookup.key.ski, key->ski, RK_SKI_LEN);
+	HASH_FIND(hh, db->filter_idx.bgpsec, &lookup.key, sizeof(lookup.key),
+	    found);
+	if (found != NULL)
+		return true;
+
+	lookup.key.flags = SLURM_BGPS_FLAG_SKI;
+	lookup.key.asn = 0;
+	HASH_FIND(hh, db->filter_idx.bgpsec, &lookup.key, sizeof(lookup.key),
+	    found);
+	return found != NULL;
 }
 
 static bool
@@ -374,37 +584,13 @@ db_slurm_add_bgpsec_assertion(struct db_slurm *db, struct slurm_bgpsec *elem)
 bool
 db_slurm_vrp_is_filtered(struct db_slurm *db, struct vrp const *vrp)
 {
-	struct slurm_prefix slurm_prefix;
-
-	slurm_prefix.data_flag = SLURM_COM_FLAG_ASN | SLURM_PFX_FLAG_PREFIX
-	    | SLURM_PFX_FLAG_MAX_LENGTH;
-	slurm_prefix.vrp = *vrp;
-
-	return prefix_filtered(db, &slurm_prefix);
+	return prefix_filtered(db, vrp);
 }
 
 bool
 db_slurm_bgpsec_is_filtered(struct db_slurm *db, struct router_key const *key)
 {
-	struct slurm_bgpsec slurm_bgpsec;
-	unsigned char *tmp;
-	bool result;
-
-	tmp = malloc(RK_SKI_LEN);
-	if (tmp == NULL) {
-		pr_enomem();
-		return false;
-	}
-	slurm_bgpsec.data_flag = SLURM_COM_FLAG_ASN | SLURM_BGPS_FLAG_SKI;
-	slurm_bgpsec.asn = key->as;
-	memcpy(tmp, key->ski, RK_SKI_LEN);
-	slurm_bgpsec.ski = tmp;
-	/* Router public key isn't used at filters */
-	slurm_bgpsec.router_public_key = NULL;
-
-	result = bgpsec_filtered(db, &slurm_bgpsec);
-	free(tmp);
-	return result;
+	return bgpsec_filtered(db, key);
 }
 
 #define ITERATE_LIST_FUNC(type, object, db_list)			\
@@ -586,6 +772,9 @@ persist_filter_prefix(struct db_slurm *db)
 		error = al_filter_prefix_add(&db->lists.filter_pfx_al, cursor);
 		if (error)
 			return error;
+		error = filter_index_add(&db->filter_idx, &cursor->element);
+		if (error)
+			return error;
 	}
 
 	return 0;
@@ -603,6 +792,10 @@ persist_filter_bgpsec(struct db_slurm *db)
 		if (error)
 			return error;
 		slurm_bgpsec_wrap_refget(cursor);
+		error = filter_index_add_bgpsec(&db->filter_idx,
+		    &cursor->element);
+		if (error)
+			return error;
 	}
 
 	return 0;
@@ -686,12 +879,14 @@ db_slurm_destroy(struct db_slurm *db)
 	struct slurm_file_csum *tmp;
 
 	slurm_lists_cleanup(&db->lists);
+	filter_index_cleanup(&db->filter_idx);
 	if (db->cache)
 		slurm_lists_destroy(db->cache);
 
 	while (!SLIST_EMPTY(&db->csum_list)) {
 		tmp = SLIST_FIRST(&db->csum_list);
 		SLIST_REMOVE_HEAD(&db->csum_list, next);
+		free(tmp->path);
 		free(tmp);
 	}
 
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <sys/queue.h>
+#include <sys/stat.h>
 #include <openssl/evp.h>
 
 #include "rtr/db/vrp.h"
@@ -34,6 +35,16 @@ struct slurm_bgpsec {
 struct slurm_file_csum {
 	unsigned char csum[EVP_MAX_MD_SIZE];
 	unsigned int csum_len;
+	/*
+	 * The file, and its attributes when it was hashed. While they don't
+	 * change, the file doesn't need to be hashed again.
+	 */
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	struct timespec ctime;
 	SLIST_ENTRY(slurm_file_csum) next;
 };
 
@@ -1,9 +1,12 @@
 #include "slurm_loader.h"
 
+#include <errno.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <sys/types.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
 #include <sys/socket.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
+#include <sys/stat.h>
 
 #include "log.h"
 #include "config.h"
@@ -47,17 +50,6 @@ load_slurm_files(struct slurm_parser_params *params)
 	return 0;
 }
 
-static int
-slurm_pfx_filters_apply(struct vrp const *vrp, void *arg)
-{
-	struct slurm_parser_params *params = arg;
-
-	if (db_slurm_vrp_is_filtered(params->db_slurm, vrp))
-		db_table_remove_roa(params->db_table, vrp);
-
-	return 0;
-}
-
 static int
 slurm_pfx_assertions_add(struct slurm_prefix *prefix, void *arg)
 {
@@ -93,17 +85,6 @@ slurm_pfx_assertions_apply(struct slurm_parser_params *params)
 	    slurm_pfx_assertions_add, params);
 }
 
-static int
-slurm_bgpsec_filters_apply(struct router_key const *key, void *arg)
-{
-	struct slurm_parser_params *params = arg;
-
-	if (db_slurm_bgpsec_is_filtered(params->db_slurm, key))
-		db_table_remove_router_key(params->db_table, key);
-
-	return 0;
-}
-
 static int
 slurm_bgpsec_assertions_add(struct slurm_bgpsec *bgpsec, void *arg)
 {
@@ -136,11 +117,77 @@ slurm_create_parser_params(struct slurm_parser_params **result)
 	return 0;
 }
 
+/* Does @csum still describe the file whose attributes are @attr? */
+static bool
+csum_stamp_equals(struct slurm_file_csum const *csum, struct stat const *attr)
+{
+	return csum->dev == attr->st_dev
+	    && csum->ino == attr->st_ino
+	    && csum->size == attr->st_size
+	    && csum->mtime.tv_sec == attr->st_mtim.tv_sec
+	    && csum->mtime.tv_nsec == attr->st_mtim.tv_nsec
+	    && csum->ctime.tv_sec == attr->st_ctim.tv_sec
+	    && csum->ctime.tv_nsec == attr->st_ctim.tv_nsec;
+}
+
+struct stamp_check {
+	struct slurm_csum_list *list;
+	/* Files found, and whether all of them are unchanged so far */
+	unsigned int files;
+	bool unchanged;
+};
+
+static int
+__slurm_check_stamp(char const *location, void *arg)
+{
+	struct stamp_check *check = arg;
+	struct slurm_file_csum *csum;
+	struct stat attr;
+
+	check->files++;
+	if (!check->unchanged)
+		return 0;
+
+	if (stat(location, &attr) != 0) {
+		check->unchanged = false;
+		return 0;
+	}
+
+	SLIST_FOREACH(csum, check->list, next)
+		if (strcmp(csum->path, location) == 0)
+			break;
+
+	if (csum == NULL || !csum_stamp_equals(csum, &attr))
+		check->unchanged = false;
+	return 0;
+}
+
+/*
+ * Are the SLURM files exactly the ones that were hashed into @list, and none of
+ * them has been modified since? (Only the files' attributes are read.)
+ */
+static bool
+slurm_files_unchanged(struct slurm_csum_list *list)
+{
+	struct stamp_check check;
+
+	check.list = list;
+	check.files = 0;
+	check.unchanged = true;
+
+	if (process_file_or_dir(config_get_slurm(), SLURM_FILE_EXTENSION,
+	    false, __slurm_check_stamp, &check) != 0)
+		return false;
+
+	return check.unchanged && check.files == list->list_size;
+}
+
 static int
 __slurm_load_checksums(char const *location, void *arg)
 {
 	struct slurm_csum_list *list;
 	struct slurm_file_csum *csum;
+	struct stat attr;
 	int error;
 
 	list = arg;
@@ -148,10 +195,28 @@ __slurm_load_checksums(char const *location, void *arg)
 	if (csum == NULL)
 		return pr_enomem();
 
+	/* Before the hash; if the file changes meanwhile, it'll be rehashed */
+	if (stat(location, &attr) != 0) {
+		error = errno;
+		free(csum);
+		return -pr_op_errno(error, "Error reading path '%s'", location);
+	}
+	csum->dev = attr.st_dev;
+	csum->ino = attr.st_ino;
+	csum->size = attr.st_size;
+	csum->mtime = attr.st_mtim;
+	csum->ctime = attr.st_ctim;
+
+	csum->path = strdup(location);
+	if (csum->path == NULL) {
+		free(csum);
+		return pr_enomem();
+	}
 
 	error = hash_local_file("sha256", location, csum->csum,
 	    &csum->csum_len);
 	if (error) {
+		free(csum->path);
 		free(csum);
 		return pr_op_err("Calculating slurm hash");
 	}
@@ -170,6 +235,7 @@ destroy_local_csum_list(struct slurm_csum_list *list)
 	while (!SLIST_EMPTY(list)) {
 		tmp = SLIST_FIRST(list);
 		SLIST_REMOVE_HEAD(list, next);
+		free(tmp->path);
 		free(tmp);
 	}
 }
@@ -226,6 +292,9 @@ __load_slurm_files(struct db_slurm **last_slurm,
 use_last_slurm:
 	/* Any error: use last valid SLURM */
 	pr_op_info("Error loading SLURM, the validation will still continue.");
+	if (params->db_slurm != NULL)
+		db_slurm_destroy(params->db_slurm);
+	params->db_slurm = NULL;
 	if (*last_slurm != NULL) {
 		pr_op_info("A previous valid version of the SLURM exists and will be applied.");
 		params->db_slurm = *last_slurm;
@@ -279,6 +348,15 @@ load_updated_slurm(struct db_slurm **last_slurm,
 
 	list_equals = false;
 
+	if (*last_slurm != NULL) {
+		db_slurm_get_csum_list(*last_slurm, &old_csum_list);
+		if (slurm_files_unchanged(&old_csum_list)) {
+			pr_op_debug("The SLURM files haven't been modified.");
+			params->db_slurm = *last_slurm;
+			return 0;
+		}
+	}
+
 	pr_op_info("Checking if there are new or modified SLURM files");
 	error = slurm_load_checksums(&csum_list);
 	if (error)
@@ -314,7 +392,7 @@ load_updated_slurm(struct db_slurm **last_slurm,
 }
 
 int
-slurm_apply(struct db_table **base, struct db_slurm **last_slurm)
+slurm_load(struct db_slurm **last_slurm)
 {
 	struct slurm_parser_params *params;
 	int error;
@@ -328,45 +406,26 @@ slurm_apply(struct db_table **base, struct db_slurm **last_slurm)
 		return error;
 
 	error = load_updated_slurm(last_slurm, params);
-	if (error)
-		goto release_params;
 
-	/* If there's no new SLURM loaded, stop */
-	if (params->db_slurm == NULL)
-		goto success;
+	free(params);
+	return error;
+}
 
-	/* Deep copy of the base so that updates can be reverted */
-	error = db_table_clone(&params->db_table, *base);
-	if (error)
-		goto release_params;
+int
+slurm_apply_assertions(struct db_table *table, struct db_slurm *db_slurm)
+{
+	struct slurm_parser_params params;
+	int error;
 
-	error = db_table_foreach_roa(params->db_table, slurm_pfx_filters_apply,
-	    params);
-	if (error)
-		goto release_table;
+	if (db_slurm == NULL)
+		return 0;
 
-	error = db_table_foreach_router_key(params->db_table,
-	    slurm_bgpsec_filters_apply, params);
-	if (error)
-		goto release_table;
+	params.db_table = table;
+	params.db_slurm = db_slurm;
 
-	error = slurm_pfx_assertions_apply(params);
+	error = slurm_pfx_assertions_apply(&params);
 	if (error)
-		goto release_table;
-
-	error = slurm_bgpsec_assertions_apply(params);
-	if (error) {
-		goto release_table;
-	}
+		return error;
 
-	db_table_destroy(*base);
-	*base = params->db_table;
-success:
-	free(params);
-	return 0;
-release_table:
-	db_table_destroy(params->db_table);
-release_params:
-	free(params);
-	return error;
+	return slurm_bgpsec_assertions_apply(&params);
 }
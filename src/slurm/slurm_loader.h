@@ -5,18 +5,26 @@
 #include "slurm/db_slurm.h"
 
 /*
- * Load the SLURM file/dir and try to apply it on @db_table, point to the SLURM
- * applied at @db_slurm.
+ * Load the SLURM file/dir (only if it changed since @last_slurm was loaded),
+ * point @last_slurm to the SLURM that must be applied (NULL if there's none).
+ *
+ * Its filters must be applied while the VRPs are added to the table (see
+ * db_slurm_vrp_is_filtered() and db_slurm_bgpsec_is_filtered()), and its
+ * assertions once the table is complete (see slurm_apply_assertions()). This
+ * way the validated table doesn't need to be copied nor revisited.
  *
  * Return error only when there's a major issue on the process (no memory,
- * SLURM loaded but something happened applying it).
+ * the SLURM checksums couldn't be calculated).
  *
- * Return 0 when there's no problem applying the SLURM:
+ * Return 0 when there's no problem loading the SLURM:
  * - There's no SLURM configured
- * - The SLURM was successfully applied
- * - The @last_slurm was applied due to a syntax problem with a newer SLURM
+ * - The SLURM was successfully loaded (or didn't change)
+ * - The @last_slurm remains due to a syntax problem with a newer SLURM
  * - SLURM configured but couldn't be read (file doesn't exists, no permission)
  */
-int slurm_apply(struct db_table **, struct db_slurm **);
+int slurm_load(struct db_slurm **);
+
+/* Add the assertions of the SLURM (can be NULL) to @db_table. */
+int slurm_apply_assertions(struct db_table *, struct db_slurm *);
 
 #endif /* SRC_SLURM_SLURM_LOADER_H_ */
@@ -5,188 +5,380 @@
 #include <string.h>
 #include "log.h"
 
-struct sorted_array {
-	void *array;
-	/* Actual number of elements in @array */
+struct sarray32 {
+	uint32_t *mins;
+	uint32_t *maxs;
+	/* Actual number of elements in @mins and @maxs */
 	unsigned int count;
-	/* Total allocated slots in @array */
+	/* Total allocated slots in @mins and @maxs */
 	unsigned int len;
-	/* Size of each array element */
-	size_t size;
-	/* Comparison function for element insertion */
-	sarray_cmp cmp;
 
 	unsigned int refcount;
 };
 
-struct sorted_array *
-sarray_create(size_t elem_size, sarray_cmp cmp)
+struct sarray128 {
+	struct uint128 *mins;
+	struct uint128 *maxs;
+	/* Actual number of elements in @mins and @maxs */
+	unsigned int count;
+	/* Total allocated slots in @mins and @maxs */
+	unsigned int len;
+
+	unsigned int refcount;
+};
+
+/* Allocates @len slots in both @mins and @maxs. */
+static int
+alloc_arrays(void **mins, void **maxs, unsigned int len, size_t size)
+{
+	*mins = malloc(len * size);
+	if (*mins == NULL)
+		return -ENOMEM;
+	*maxs = malloc(len * size);
+	if (*maxs == NULL) {
+		free(*mins);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/* Doubles the slots of @mins and @maxs, which currently have @len. */
+static int
+grow_arrays(void **mins, void **maxs, unsigned int *len, size_t size)
 {
-	struct sorted_array *result;
+	void *tmp;
+
+	tmp = realloc(*mins, 2 * (*len) * size);
+	if (tmp == NULL)
+		return pr_enomem();
+	*mins = tmp;
 
-	result = malloc(sizeof(struct sorted_array));
+	tmp = realloc(*maxs, 2 * (*len) * size);
+	if (tmp == NULL)
+		return pr_enomem();
+	*maxs = tmp;
+
+	*len *= 2;
+	return 0;
+}
+
+struct sarray32 *
+sarray32_create(unsigned int hint)
+{
+	struct sarray32 *result;
+
+	result = malloc(sizeof(struct sarray32));
 	if (result == NULL)
 		return NULL;
 
-	result->array = calloc(8, elem_size);
-	if (result->array == NULL) {
+	result->len = (hint > 0) ? hint : 8;
+	if (alloc_arrays((void **) &result->mins, (void **) &result->maxs,
+	    result->len, sizeof(uint32_t)) != 0) {
 		free(result);
 		return NULL;
 	}
 	result->count = 0;
-	result->len = 8;
-	result->size = elem_size;
-	result->cmp = cmp;
 	result->refcount = 1;
 
 	return result;
 }
 
 void
-sarray_get(struct sorted_array *sarray)
+sarray32_get(struct sarray32 *sarray)
 {
 	sarray->refcount++;
 }
 
 void
-sarray_put(struct sorted_array *sarray)
+sarray32_put(struct sarray32 *sarray)
 {
 	sarray->refcount--;
 	if (sarray->refcount == 0) {
-		free(sarray->array);
+		free(sarray->mins);
+		free(sarray->maxs);
 		free(sarray);
 	}
 }
 
-/* Does not check boundaries. */
-static void *
-get_nth_element(struct sorted_array *sarray, unsigned int index)
-{
-	return ((char *)sarray->array) + index * sarray->size;
-}
-
 /**
- * Returns success only if @new can be added to @array.
- * (Meaning, returns success if @new is larger than all of the elements in
- * @array.)
+ * Returns success only if [@min, @max] can be appended after [@lmin, @lmax].
+ * (Meaning, returns success if the new range is larger than, and not adjacent
+ * to, the last one.)
  */
 static int
-compare(struct sorted_array *sarray, void *new)
+compare32(uint32_t lmin, uint32_t lmax, uint32_t min, uint32_t max)
 {
-	enum sarray_comparison cmp;
-
-	if (sarray->count == 0)
-		return 0;
-
-	cmp = sarray->cmp(get_nth_element(sarray, sarray->count - 1), new);
-	switch (cmp) {
-	case SACMP_EQUAL:
+	if (lmin == min && lmax == max)
 		return -EEQUAL;
-	case SACMP_CHILD:
+	if (lmin <= min && max <= lmax)
 		return -ECHILD2;
-	case SACMP_PARENT:
+	if (min <= lmin && lmax <= max)
 		return -EPARENT;
-	case SACMP_LEFT:
-		return -ELEFT;
-	case SACMP_RIGHT:
+	if (min != 0 && lmax == min - 1)
+		return -EADJRIGHT;
+	if (lmax < min)
 		return 0;
-	case SACMP_ADJACENT_LEFT:
+	if (lmin != 0 && max == lmin - 1)
 		return -EADJLEFT;
-	case SACMP_ADJACENT_RIGHT:
-		return -EADJRIGHT;
-	case SACMP_INTERSECTION:
-		return -EINTERSECTION;
-	}
+	if (max < lmin)
+		return -ELEFT;
 
-	pr_crit("Unknown comparison value: %u", cmp);
+	return -EINTERSECTION;
 }
 
 int
-sarray_add(struct sorted_array *sarray, void *element)
+sarray32_add(struct sarray32 *sarray, uint32_t min, uint32_t max)
 {
+	unsigned int last;
 	int error;
-	void *tmp;
 
-	error = compare(sarray, element);
-	if (error)
-		return error;
+	if (sarray->count > 0) {
+		last = sarray->count - 1;
+		error = compare32(sarray->mins[last], sarray->maxs[last], min,
+		    max);
+		if (error)
+			return error;
+	}
 
 	if (sarray->count >= sarray->len) {
-		tmp = realloc(sarray->array, 2 * sarray->len * sarray->size);
-		if (tmp == NULL)
-			return pr_enomem();
-		sarray->array = tmp;
-		sarray->len *= 2;
+		error = grow_arrays((void **) &sarray->mins,
+		    (void **) &sarray->maxs, &sarray->len, sizeof(uint32_t));
+		if (error)
+			return error;
 	}
 
-	memcpy(get_nth_element(sarray, sarray->count), element, sarray->size);
+	sarray->mins[sarray->count] = min;
+	sarray->maxs[sarray->count] = max;
 	sarray->count++;
 	return 0;
 }
 
 bool
-sarray_empty(struct sorted_array *sarray)
+sarray32_empty(struct sarray32 *sarray)
 {
 	return (sarray == NULL) || (sarray->count == 0);
 }
 
+/*
+ * Is [@min, @max] a subset of one of the ranges?
+ *
+ * The ranges are sorted and disjoint, so the only candidate is the last one
+ * whose minimum is <= @min. The loop that looks for it has a fixed number of
+ * iterations (log2(count)), and the compiler turns the conditional into a
+ * conditional move.
+ */
 bool
-sarray_contains(struct sorted_array *sarray, void *elem)
+sarray32_contains(struct sarray32 *sarray, uint32_t min, uint32_t max)
 {
-	unsigned int left, mid, right;
-	enum sarray_comparison cmp;
+	uint32_t const *base;
+	unsigned int n, half;
 
 	if (sarray == NULL || sarray->count == 0)
 		return false;
 
-	left = 0;
-	right = sarray->count - 1;
-
-	while (left <= right) {
-		mid = left + (right - left) / 2;
-		cmp = sarray->cmp(get_nth_element(sarray, mid), elem);
-		switch (cmp) {
-		case SACMP_LEFT:
-		case SACMP_ADJACENT_LEFT:
-			if (mid == 0) /* Prevents underflow */
-				return false;
-			right = mid - 1;
-			continue;
-		case SACMP_RIGHT:
-		case SACMP_ADJACENT_RIGHT:
-			if (mid == sarray->count - 1)
-				return false;
-			left = mid + 1;
-			continue;
-		case SACMP_EQUAL:
-		case SACMP_CHILD:
-			return true;
-		case SACMP_PARENT:
-		case SACMP_INTERSECTION:
-			return false;
-		}
-
-		pr_crit("Unknown comparison value: %u", cmp);
+	base = sarray->mins;
+	for (n = sarray->count; n > 1; n -= half) {
+		half = n / 2;
+		base = (base[half] <= min) ? (base + half) : base;
 	}
 
-	return false;
+	return (*base <= min) && (max <= sarray->maxs[base - sarray->mins]);
+}
+
+bool
+sarray32_equals(struct sarray32 *a, struct sarray32 *b)
+{
+	if (a == b)
+		return true;
+	if (a == NULL || b == NULL || a->count != b->count)
+		return false;
+
+	return memcmp(a->mins, b->mins, a->count * sizeof(uint32_t)) == 0
+	    && memcmp(a->maxs, b->maxs, a->count * sizeof(uint32_t)) == 0;
 }
 
 int
-sarray_foreach(struct sorted_array *sarray, sarray_foreach_cb cb, void *arg)
+sarray32_foreach(struct sarray32 *sarray, sarray32_foreach_cb cb, void *arg)
 {
 	unsigned int index;
 	int error;
 
 	for (index = 0; index < sarray->count; index++) {
-		error = cb(get_nth_element(sarray, index), arg);
+		error = cb(sarray->mins[index], sarray->maxs[index], arg);
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
+struct sarray128 *
+sarray128_create(unsigned int hint)
+{
+	struct sarray128 *result;
+
+	result = malloc(sizeof(struct sarray128));
+	if (result == NULL)
+		return NULL;
+
+	result->len = (hint > 0) ? hint : 8;
+	if (alloc_arrays((void **) &result->mins, (void **) &result->maxs,
+	    result->len, sizeof(struct uint128)) != 0) {
+		free(result);
+		return NULL;
+	}
+	result->count = 0;
+	result->refcount = 1;
+
+	return result;
+}
+
+void
+sarray128_get(struct sarray128 *sarray)
+{
+	sarray->refcount++;
+}
+
+void
+sarray128_put(struct sarray128 *sarray)
+{
+	sarray->refcount--;
+	if (sarray->refcount == 0) {
+		free(sarray->mins);
+		free(sarray->maxs);
+		free(sarray);
+	}
+}
+
+/* a == b? */
+static bool
+u128_eq(struct uint128 const *a, struct uint128 const *b)
+{
+	return (a->hi == b->hi) & (a->lo == b->lo);
+}
+
+/* a <= b? */
+static bool
+u128_le(struct uint128 const *a, struct uint128 const *b)
+{
+	return (a->hi < b->hi) | ((a->hi == b->hi) & (a->lo <= b->lo));
+}
+
+/* a < b? */
+static bool
+u128_lt(struct uint128 const *a, struct uint128 const *b)
+{
+	return (a->hi < b->hi) | ((a->hi == b->hi) & (a->lo < b->lo));
+}
+
+/* a + 1 == b? */
+static bool
+u128_is_successor(struct uint128 const *a, struct uint128 const *b)
+{
+	if (a->lo != UINT64_MAX)
+		return (a->hi == b->hi) && (a->lo + 1 == b->lo);
+	/* b cannot be the successor of 0xFFFFF...FFF */
+	return (a->hi != UINT64_MAX) && (a->hi + 1 == b->hi) && (b->lo == 0);
+}
+
+/* Same as compare32(), but for 128-bit ranges. */
+static int
+compare128(struct uint128 const *lmin, struct uint128 const *lmax,
+    struct uint128 const *min, struct uint128 const *max)
+{
+	if (u128_eq(lmin, min) && u128_eq(lmax, max))
+		return -EEQUAL;
+	if (u128_le(lmin, min) && u128_le(max, lmax))
+		return -ECHILD2;
+	if (u128_le(min, lmin) && u128_le(lmax, max))
+		return -EPARENT;
+	if (u128_is_successor(lmax, min))
+		return -EADJRIGHT;
+	if (u128_lt(lmax, min))
+		return 0;
+	if (u128_is_successor(max, lmin))
+		return -EADJLEFT;
+	if (u128_lt(max, lmin))
+		return -ELEFT;
+
+	return -EINTERSECTION;
+}
+
+int
+sarray128_add(struct sarray128 *sarray, struct uint128 const *min,
+    struct uint128 const *max)
+{
+	unsigned int last;
+	int error;
+
+	if (sarray->count > 0) {
+		last = sarray->count - 1;
+		error = compare128(&sarray->mins[last], &sarray->maxs[last],
+		    min, max);
+		if (error)
+			return error;
+	}
+
+	if (sarray->count >= sarray->len) {
+		error = grow_arrays((void **) &sarray->mins,
+		    (void **) &sarray->maxs, &sarray->len,
+		    sizeof(struct uint128));
 		if (error)
 			return error;
 	}
 
+	sarray->mins[sarray->count] = *min;
+	sarray->maxs[sarray->count] = *max;
+	sarray->count++;
 	return 0;
 }
 
+bool
+sarray128_empty(struct sarray128 *sarray)
+{
+	return (sarray == NULL) || (sarray->count == 0);
+}
+
+/* See sarray32_contains(). */
+bool
+sarray128_contains(struct sarray128 *sarray, struct uint128 const *min,
+    struct uint128 const *max)
+{
+	struct uint128 const *base;
+	unsigned int n, half;
+
+	if (sarray == NULL || sarray->count == 0)
+		return false;
+
+	base = sarray->mins;
+	for (n = sarray->count; n > 1; n -= half) {
+		half = n / 2;
+		base = u128_le(&base[half], min) ? (base + half) : base;
+	}
+
+	return u128_le(base, min)
+	    && u128_le(max, &sarray->maxs[base - sarray->mins]);
+}
+
+bool
+sarray128_equals(struct sarray128 *a, struct sarray128 *b)
+{
+	unsigned int i;
+
+	if (a == b)
+		return true;
+	if (a == NULL || b == NULL || a->count != b->count)
+		return false;
+
+	for (i = 0; i < a->count; i++)
+		if (!u128_eq(&a->mins[i], &b->mins[i])
+		    || !u128_eq(&a->maxs[i], &b->maxs[i]))
+			return false;
+
+	return true;
+}
+
 char const *sarray_err2str(int error)
 {
 	switch (abs(error)) {
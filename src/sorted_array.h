@@ -3,32 +3,43 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 /*
  * This implementation is not a generic sorted array; It's intended to store RFC
  * 3779 resources, which requires the elements to be sorted.
  * So you can only add elements to the tail of the array. The implementation
  * will validate this and prevent collisions too.
+ *
+ * Elements are [min, max] ranges. The minimums and the maximums are packed in
+ * two separate arrays, so lookups binary search a contiguous array of numbers,
+ * without callbacks or hard to predict branches.
+ *
+ * There are two flavors: sarray32 stores ranges of 32-bit numbers (IPv4
+ * addresses in host byte order, and AS numbers), and sarray128 stores ranges of
+ * 128-bit numbers (IPv6 addresses).
  */
 
-struct sorted_array;
-
-enum sarray_comparison {
-	SACMP_EQUAL,
-	SACMP_CHILD,
-	SACMP_PARENT,
-	SACMP_LEFT,
-	SACMP_RIGHT,
-	SACMP_ADJACENT_LEFT,
-	SACMP_ADJACENT_RIGHT,
-	SACMP_INTERSECTION,
+/* 128-bit unsigned number. */
+struct uint128 {
+	uint64_t hi;
+	uint64_t lo;
 };
 
-typedef enum sarray_comparison (*sarray_cmp)(void *, void *);
+struct sarray32;
+struct sarray128;
 
-struct sorted_array *sarray_create(size_t, sarray_cmp);
-void sarray_get(struct sorted_array *);
-void sarray_put(struct sorted_array *);
+/*
+ * The argument is the expected number of elements. (It's only a hint; the
+ * arrays still grow if needed.)
+ */
+struct sarray32 *sarray32_create(unsigned int);
+void sarray32_get(struct sarray32 *);
+void sarray32_put(struct sarray32 *);
+
+struct sarray128 *sarray128_create(unsigned int);
+void sarray128_get(struct sarray128 *);
+void sarray128_put(struct sarray128 *);
 
 #define EEQUAL		7894
 #define ECHILD2		7895
@@ -38,12 +49,20 @@ void sarray_put(struct sorted_array *);
 #define EADJRIGHT	7899
 #define EINTERSECTION	7900
 
-int sarray_add(struct sorted_array *, void *);
-bool sarray_empty(struct sorted_array *);
-bool sarray_contains(struct sorted_array *, void *);
+int sarray32_add(struct sarray32 *, uint32_t, uint32_t);
+bool sarray32_empty(struct sarray32 *);
+bool sarray32_contains(struct sarray32 *, uint32_t, uint32_t);
+bool sarray32_equals(struct sarray32 *, struct sarray32 *);
+
+typedef int (*sarray32_foreach_cb)(uint32_t, uint32_t, void *);
+int sarray32_foreach(struct sarray32 *, sarray32_foreach_cb, void *);
 
-typedef int (*sarray_foreach_cb)(void *, void *);
-int sarray_foreach(struct sorted_array *, sarray_foreach_cb, void *);
+int sarray128_add(struct sarray128 *, struct uint128 const *,
+    struct uint128 const *);
+bool sarray128_empty(struct sarray128 *);
+bool sarray128_contains(struct sarray128 *, struct uint128 const *,
+    struct uint128 const *);
+bool sarray128_equals(struct sarray128 *, struct sarray128 *);
 
 char const *sarray_err2str(int);
 
@@ -27,6 +27,8 @@ struct validation {
 
 	/* Local RRDP workspace path */
 	char const *rrdp_workspace;
+	/* Is this thread currently working on the RRDP workspace? */
+	bool rrdp_workspace_enabled;
 
 	/* Shallow copy of RRDP URIs and its corresponding visited uris */
 	struct db_rrdp_uri *rrdp_uris;
@@ -130,6 +132,7 @@ validation_prepare(struct validation **out, struct tal *tal,
 
 	result->rrdp_uris = db_rrdp_get_uris(tal_get_file_name(tal));
 	result->rrdp_workspace = db_rrdp_get_workspace(tal_get_file_name(tal));
+	result->rrdp_workspace_enabled = false;
 
 	result->pubkey_state = PKS_UNTESTED;
 	result->validation_handler = *validation_handler;
@@ -229,3 +232,15 @@ validation_get_rrdp_workspace(struct validation *state)
 {
 	return state->rrdp_workspace;
 }
+
+bool
+validation_rrdp_workspace_enabled(struct validation *state)
+{
+	return state->rrdp_workspace_enabled;
+}
+
+void
+validation_set_rrdp_workspace_enabled(struct validation *state, bool enabled)
+{
+	state->rrdp_workspace_enabled = enabled;
+}
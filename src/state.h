@@ -37,5 +37,7 @@ validation_get_validation_handler(struct validation *);
 
 struct db_rrdp_uri *validation_get_rrdp_uris(struct validation *);
 char const *validation_get_rrdp_workspace(struct validation *);
+bool validation_rrdp_workspace_enabled(struct validation *);
+void validation_set_rrdp_workspace_enabled(struct validation *, bool);
 
 #endif /* SRC_STATE_H_ */
@@ -9,18 +9,34 @@
 /*
  * Mainly based on a solution proposed by Ivaylo Josifov (from VarnaIX)
  * and from https://nachtimwald.com/2019/04/12/thread-pool-in-c/
+ *
+ * Each thread owns a deque per priority. Tasks pushed by a pool thread go to
+ * its own deques, tasks pushed from outside the pool are distributed among
+ * the threads. A thread pops the newest task from its own deques, and when
+ * they're empty it steals the oldest task from the other threads' deques.
  */
 
 /* Task to be done by each thread */
 struct task {
 	thread_pool_task_cb cb;
 	void *arg;
+	/* Group the task belongs to (NULL if none) */
+	struct thread_pool_group *group;
 	TAILQ_ENTRY(task) next;
 };
 
-/* Tasks queue (utilized as FIFO) */
+/* Tasks deque (the owner works at the tail, thieves at the head) */
 TAILQ_HEAD(task_queue, task);
 
+/* A pool thread and its own tasks */
+struct worker {
+	struct thread_pool *pool;
+	unsigned int id;
+	/* Protects @deques */
+	pthread_mutex_t lock;
+	struct task_queue deques[TASK_PRIORITY_COUNT];
+};
+
 struct thread_pool {
 	pthread_mutex_t lock;
 	/* Work/wait conditions, utilized accordingly to their names */
@@ -30,12 +46,31 @@ struct thread_pool {
 	unsigned int working_count;
 	/* Total number of spawned threads */
 	unsigned int thread_count;
+	/* Tasks at the deques that haven't been claimed by any thread */
+	unsigned int pending_count;
 	/* Use to stop all the threads */
 	bool stop;
-	/* Queue of pending tasks to attend */
-	struct task_queue queue;
+	/* One per thread */
+	struct worker *workers;
+	unsigned int worker_count;
+	/* Worker that will receive the next task pushed from outside */
+	unsigned int next_worker;
 };
 
+struct thread_pool_group {
+	struct thread_pool *pool;
+	pthread_mutex_t lock;
+	/* Signaled when @pending reaches 0 */
+	pthread_cond_t done_cond;
+	/* Tasks of the group that haven't ended */
+	unsigned int pending;
+};
+
+/* The worker that corresponds to the current thread (if it's a pool thread) */
+static pthread_key_t worker_key;
+static pthread_once_t worker_key_once = PTHREAD_ONCE_INIT;
+static int worker_key_error;
+
 static void
 thread_pool_lock(struct thread_pool *pool)
 {
@@ -58,6 +93,47 @@ thread_pool_unlock(struct thread_pool *pool)
 		    error);
 }
 
+static void
+worker_lock(struct worker *worker)
+{
+	int error;
+
+	error = pthread_mutex_lock(&(worker->lock));
+	if (error)
+		pr_crit("pthread_mutex_lock() returned error code %d. This is too critical for a graceful recovery; I must die now.",
+		    error);
+}
+
+static void
+worker_unlock(struct worker *worker)
+{
+	int error;
+
+	error = pthread_mutex_unlock(&(worker->lock));
+	if (error)
+		pr_crit("pthread_mutex_unlock() returned error code %d. This is too critical for a graceful recovery; I must die now.",
+		    error);
+}
+
+static void
+worker_key_init(void)
+{
+	worker_key_error = pthread_key_create(&worker_key, NULL);
+}
+
+/* Returns the worker of the calling thread, if it belongs to @pool */
+static struct worker *
+current_worker(struct thread_pool *pool)
+{
+	struct worker *worker;
+
+	if (worker_key_error)
+		return NULL;
+
+	worker = pthread_getspecific(worker_key);
+	return (worker != NULL && worker->pool == pool) ? worker : NULL;
+}
+
 static int
 task_create(thread_pool_task_cb cb, void *arg, struct task **result)
 {
@@ -69,6 +145,7 @@ task_create(thread_pool_task_cb cb, void *arg, struct task **result)
 
 	tmp->cb = cb;
 	tmp->arg = arg;
+	tmp->group = NULL;
 
 	*result = tmp;
 	return 0;
@@ -80,29 +157,139 @@ task_destroy(struct task *task)
 	free(task);
 }
 
-/* Get the TAIL, remove the ref from @queue, don't forget to free the task! */
+static void
+group_task_add(struct thread_pool_group *group)
+{
+	pthread_mutex_lock(&group->lock);
+	group->pending++;
+	pthread_mutex_unlock(&group->lock);
+}
+
+static void
+group_task_done(struct thread_pool_group *group)
+{
+	pthread_mutex_lock(&group->lock);
+	group->pending--;
+	if (group->pending == 0)
+		pthread_cond_broadcast(&group->done_cond);
+	pthread_mutex_unlock(&group->lock);
+}
+
+/* Do the @task and release it. */
+static void
+task_run(struct task *task)
+{
+	struct thread_pool_group *group;
+
+	group = task->group;
+	task->cb(task->arg);
+	/* Now releasing the task */
+	task_destroy(task);
+	pr_op_debug("Task ended");
+
+	if (group != NULL)
+		group_task_done(group);
+}
+
+/* Get the newest task of @worker's deques with @prio (or NULL) */
 static struct task *
-task_queue_pull(struct task_queue *queue)
+worker_pop(struct worker *worker, enum task_priority prio)
 {
-	struct task *tmp;
+	struct task_queue *deque;
+	struct task *task;
 
-	tmp = TAILQ_LAST(queue, task_queue);
-	TAILQ_REMOVE(queue, tmp, next);
-	pr_op_debug("Pulling a task from the pool");
+	worker_lock(worker);
+	deque = &worker->deques[prio];
+	task = TAILQ_LAST(deque, task_queue);
+	if (task != NULL)
+		TAILQ_REMOVE(deque, task, next);
+	worker_unlock(worker);
 
-	return tmp;
+	return task;
 }
 
-/* Insert the task at the HEAD */
-static void
-task_queue_push(struct task_queue *queue, struct task *task)
+/* Get the oldest task of @worker's deques with @prio (or NULL) */
+static struct task *
+worker_steal(struct worker *worker, enum task_priority prio)
 {
-	TAILQ_INSERT_HEAD(queue, task, next);
-	pr_op_debug("Pushing a task to the pool");
+	struct task_queue *deque;
+	struct task *task;
+
+	worker_lock(worker);
+	deque = &worker->deques[prio];
+	task = TAILQ_FIRST(deque);
+	if (task != NULL)
+		TAILQ_REMOVE(deque, task, next);
+	worker_unlock(worker);
+
+	return task;
+}
+
+/*
+ * Take a task from the deques of @pool, higher priorities first. @self (the
+ * calling thread's worker, can be NULL) is looked up before the rest of the
+ * workers.
+ *
+ * The caller must have claimed the task already (by decrementing the pool's
+ * @pending_count), so there's at least one task waiting at the deques. The
+ * exception is thread_pool_destroy(), which drains the deques even if their
+ * tasks were claimed; NULL is returned if that happens.
+ */
+static struct task *
+task_take(struct thread_pool *pool, struct worker *self)
+{
+	struct worker *victim;
+	struct task *task;
+	unsigned int start, i;
+	int prio;
+	bool stop;
+
+	start = (self != NULL) ? self->id : 0;
+	while (true) {
+		for (prio = 0; prio < TASK_PRIORITY_COUNT; prio++) {
+			if (self != NULL) {
+				task = worker_pop(self, prio);
+				if (task != NULL)
+					return task;
+			}
+			for (i = 0; i < pool->worker_count; i++) {
+				victim = &pool->workers[(start + i) %
+				    pool->worker_count];
+				if (victim == self)
+					continue;
+				task = worker_steal(victim, prio);
+				if (task != NULL) {
+					pr_op_debug("Stealing a task from the pool");
+					return task;
+				}
+			}
+		}
+
+		thread_pool_lock(pool);
+		stop = pool->stop;
+		thread_pool_unlock(pool);
+		if (stop)
+			return NULL;
+	}
+}
+
+/* Claim a pending task, if there's one. Don't forget to take it! */
+static bool
+task_claim(struct thread_pool *pool)
+{
+	bool claimed;
+
+	thread_pool_lock(pool);
+	claimed = pool->pending_count > 0;
+	if (claimed)
+		pool->pending_count--;
+	thread_pool_unlock(pool);
+
+	return claimed;
 }
 
 /*
- * Poll for pending tasks at the pool queue. Called by each spawned thread.
+ * Poll for pending tasks at the pool deques. Called by each spawned thread.
  *
  * Once a task is available, at least one thread of the pool will process it.
  *
@@ -111,15 +298,19 @@ task_queue_push(struct task_queue *queue, struct task *task)
 static void *
 tasks_poll(void *arg)
 {
-	struct thread_pool *pool = arg;
+	struct worker *self = arg;
+	struct thread_pool *pool = self->pool;
 	struct task *task;
 
+	if (!worker_key_error)
+		pthread_setspecific(worker_key, self);
+
 	/* The thread has started, send the signal */
 	thread_pool_lock(pool);
 	pthread_cond_signal(&(pool->waiting_cond));
 
 	while (true) {
-		while (TAILQ_EMPTY(&(pool->queue)) && !pool->stop) {
+		while (pool->pending_count == 0 && !pool->stop) {
 			pr_op_debug("Thread waiting for work...");
 			pthread_cond_wait(&(pool->working_cond), &(pool->lock));
 		}
@@ -127,23 +318,20 @@ tasks_poll(void *arg)
 		if (pool->stop)
 			break;
 
-		/* Pull the tail */
-		task = task_queue_pull(&(pool->queue));
+		/* Claim the task, then look for it */
+		pool->pending_count--;
 		pool->working_count++;
 		pr_op_debug("Working on task #%u", pool->working_count);
 		thread_pool_unlock(pool);
 
-		if (task != NULL) {
-			task->cb(task->arg);
-			/* Now releasing the task */
-			task_destroy(task);
-			pr_op_debug("Task ended");
-		}
+		task = task_take(pool, self);
+		if (task != NULL)
+			task_run(task);
 
 		thread_pool_lock(pool);
 		pool->working_count--;
 		if (!pool->stop && pool->working_count == 0 &&
-		    TAILQ_EMPTY(&(pool->queue)))
+		    pool->pending_count == 0)
 			pthread_cond_signal(&(pool->waiting_cond));
 	}
 
@@ -157,7 +345,10 @@ tasks_poll(void *arg)
 
 /*
  * Wait a couple of seconds to be sure the thread has started and is ready to
- * work
+ * work.
+ *
+ * The pool lock must be held since before the thread was spawned, otherwise
+ * its signal could be sent before anyone is waiting for it.
  */
 static int
 thread_pool_thread_wait_start(struct thread_pool *pool)
@@ -172,14 +363,10 @@ thread_pool_thread_wait_start(struct thread_pool *pool)
 	clock_gettime(CLOCK_REALTIME, &tmout);
 	tmout.tv_sec += 2;
 
-	thread_pool_lock(pool);
 	error = pthread_cond_timedwait(&(pool->waiting_cond), &(pool->lock),
 	    &tmout);
-	if (error) {
-		thread_pool_unlock(pool);
+	if (error)
 		return pr_op_errno(error, "Waiting thread to start");
-	}
-	thread_pool_unlock(pool);
 
 	return 0;
 }
@@ -213,22 +400,24 @@ thread_pool_attr_create(pthread_attr_t *attr)
 
 static int
 tpool_thread_spawn(struct thread_pool *pool, pthread_attr_t *attr,
-    thread_pool_task_cb entry_point)
+    thread_pool_task_cb entry_point, struct worker *worker)
 {
 	pthread_t thread_id;
 	int error;
 
 	memset(&thread_id, 0, sizeof(pthread_t));
 
-	error = pthread_create(&thread_id, attr, entry_point, pool);
-	if (error)
+	thread_pool_lock(pool);
+	error = pthread_create(&thread_id, attr, entry_point, worker);
+	if (error) {
+		thread_pool_unlock(pool);
 		return pr_op_errno(error, "Spawning pool thread");
+	}
 
 	error = thread_pool_thread_wait_start(pool);
-	if (error)
-		return error;
+	thread_pool_unlock(pool);
 
-	return 0;
+	return error;
 }
 
 int
@@ -237,12 +426,28 @@ thread_pool_create(unsigned int threads, struct thread_pool **pool)
 	struct thread_pool *tmp;
 	pthread_attr_t attr;
 	unsigned int i;
+	int prio;
 	int error;
 
+	if (threads == 0)
+		return pr_op_err("A thread pool needs at least one thread.");
+
+	pthread_once(&worker_key_once, worker_key_init);
+	if (worker_key_error)
+		pr_op_warn("Couldn't create the pool threads key (error code %d); tasks pushed from pool threads will be distributed among the rest of the threads.",
+		    worker_key_error);
+
 	tmp = malloc(sizeof(struct thread_pool));
 	if (tmp == NULL)
 		return pr_enomem();
 
+	tmp->workers = calloc(threads, sizeof(struct worker));
+	if (tmp->workers == NULL) {
+		free(tmp);
+		return pr_enomem();
+	}
+	tmp->worker_count = 0;
+
 	/* Init locking */
 	error = pthread_mutex_init(&(tmp->lock), NULL);
 	if (error) {
@@ -266,17 +471,33 @@ thread_pool_create(unsigned int threads, struct thread_pool **pool)
 		goto free_working_cond;
 	}
 
-	TAILQ_INIT(&(tmp->queue));
+	for (i = 0; i < threads; i++) {
+		error = pthread_mutex_init(&(tmp->workers[i].lock), NULL);
+		if (error) {
+			error = pr_op_errno(error,
+			    "Calling pthread_mutex_init() at worker");
+			goto free_workers;
+		}
+		tmp->workers[i].pool = tmp;
+		tmp->workers[i].id = i;
+		for (prio = 0; prio < TASK_PRIORITY_COUNT; prio++)
+			TAILQ_INIT(&(tmp->workers[i].deques[prio]));
+		tmp->worker_count++;
+	}
+
 	tmp->stop = false;
 	tmp->working_count = 0;
 	tmp->thread_count = 0;
+	tmp->pending_count = 0;
+	tmp->next_worker = 0;
 
 	error = thread_pool_attr_create(&attr);
 	if (error)
-		goto free_waiting_cond;
+		goto free_workers;
 
 	for (i = 0; i < threads; i++) {
-		error = tpool_thread_spawn(tmp, &attr, tasks_poll);
+		error = tpool_thread_spawn(tmp, &attr, tasks_poll,
+		    &tmp->workers[i]);
 		if (error) {
 			pthread_attr_destroy(&attr);
 			thread_pool_destroy(tmp);
@@ -289,13 +510,16 @@ thread_pool_create(unsigned int threads, struct thread_pool **pool)
 
 	*pool = tmp;
 	return 0;
-free_waiting_cond:
+free_workers:
+	for (i = 0; i < tmp->worker_count; i++)
+		pthread_mutex_destroy(&(tmp->workers[i].lock));
 	pthread_cond_destroy(&(tmp->waiting_cond));
 free_working_cond:
 	pthread_cond_destroy(&(tmp->working_cond));
 free_mutex:
 	pthread_mutex_destroy(&(tmp->lock));
 free_tmp:
+	free(tmp->workers);
 	free(tmp);
 	return error;
 }
@@ -303,17 +527,29 @@ free_tmp:
 void
 thread_pool_destroy(struct thread_pool *pool)
 {
-	struct task_queue *queue;
+	struct task_queue *deque;
 	struct task *tmp;
+	unsigned int i;
+	int prio;
 
 	/* Remove all pending work and send the signal to stop it */
 	thread_pool_lock(pool);
-	queue = &(pool->queue);
-	while (!TAILQ_EMPTY(queue)) {
-		tmp = TAILQ_FIRST(queue);
-		TAILQ_REMOVE(queue, tmp, next);
-		task_destroy(tmp);
+	for (i = 0; i < pool->worker_count; i++) {
+		worker_lock(&pool->workers[i]);
+		for (prio = 0; prio < TASK_PRIORITY_COUNT; prio++) {
+			deque = &(pool->workers[i].deques[prio]);
+			while (!TAILQ_EMPTY(deque)) {
+				tmp = TAILQ_FIRST(deque);
+				TAILQ_REMOVE(deque, tmp, next);
+				/* Don't leave anyone waiting for it */
+				if (tmp->group != NULL)
+					group_task_done(tmp->group);
+				task_destroy(tmp);
+			}
+		}
+		worker_unlock(&pool->workers[i]);
 	}
+	pool->pending_count = 0;
 	pool->stop = true;
 	pthread_cond_broadcast(&(pool->working_cond));
 	thread_pool_unlock(pool);
@@ -321,29 +557,51 @@ thread_pool_destroy(struct thread_pool *pool)
 	/* Wait for all to end */
 	thread_pool_wait(pool);
 
+	for (i = 0; i < pool->worker_count; i++)
+		pthread_mutex_destroy(&(pool->workers[i].lock));
 	pthread_cond_destroy(&(pool->waiting_cond));
 	pthread_cond_destroy(&(pool->working_cond));
 	pthread_mutex_destroy(&(pool->lock));
+	free(pool->workers);
 	free(pool);
 }
 
-/*
- * Push a new task to @pool, the task to be executed is @cb with the argument
- * @arg.
- */
-int
-thread_pool_push(struct thread_pool *pool, thread_pool_task_cb cb, void *arg)
+static int
+__thread_pool_push(struct thread_pool *pool, struct thread_pool_group *group,
+    enum task_priority prio, thread_pool_task_cb cb, void *arg)
 {
+	struct worker *worker;
 	struct task *task;
 	int error;
 
+	if ((unsigned int) prio >= TASK_PRIORITY_COUNT)
+		pr_crit("Unknown task priority: %u", prio);
+
 	task = NULL;
 	error = task_create(cb, arg, &task);
 	if (error)
 		return error;
 
+	task->group = group;
+	if (group != NULL)
+		group_task_add(group);
+
 	thread_pool_lock(pool);
-	task_queue_push(&(pool->queue), task);
+
+	/* Pool threads keep their tasks, the rest are distributed */
+	worker = current_worker(pool);
+	if (worker == NULL) {
+		worker = &pool->workers[pool->next_worker];
+		pool->next_worker = (pool->next_worker + 1) %
+		    pool->worker_count;
+	}
+
+	worker_lock(worker);
+	TAILQ_INSERT_TAIL(&(worker->deques[prio]), task, next);
+	worker_unlock(worker);
+	pr_op_debug("Pushing a task to the pool");
+
+	pool->pending_count++;
 	/* There's work to do! */
 	pthread_cond_signal(&(pool->working_cond));
 	thread_pool_unlock(pool);
@@ -351,6 +609,24 @@ thread_pool_push(struct thread_pool *pool, thread_pool_task_cb cb, void *arg)
 	return 0;
 }
 
+/*
+ * Push a new task to @pool, the task to be executed is @cb with the argument
+ * @arg.
+ */
+int
+thread_pool_push(struct thread_pool *pool, thread_pool_task_cb cb, void *arg)
+{
+	return __thread_pool_push(pool, NULL, TASK_PRIORITY_NORMAL, cb, arg);
+}
+
+/* Same as thread_pool_push(), but the task will have the priority @prio. */
+int
+thread_pool_push_prio(struct thread_pool *pool, enum task_priority prio,
+    thread_pool_task_cb cb, void *arg)
+{
+	return __thread_pool_push(pool, NULL, prio, cb, arg);
+}
+
 /* There are available threads to work? */
 bool
 thread_pool_avail_threads(struct thread_pool *pool)
@@ -374,10 +650,9 @@ thread_pool_wait(struct thread_pool *pool)
 		pr_op_debug("- Stop: %s", pool->stop ? "true" : "false");
 		pr_op_debug("- Working count: %u", pool->working_count);
 		pr_op_debug("- Thread count: %u", pool->thread_count);
-		pr_op_debug("- Empty queue: %s",
-		    TAILQ_EMPTY(&(pool->queue)) ? "true" : "false");
+		pr_op_debug("- Pending tasks: %u", pool->pending_count);
 		if ((!pool->stop &&
-		    (pool->working_count != 0 || !TAILQ_EMPTY(&(pool->queue)))) ||
+		    (pool->working_count != 0 || pool->pending_count != 0)) ||
 		    (pool->stop && pool->thread_count != 0))
 			pthread_cond_wait(&(pool->waiting_cond), &(pool->lock));
 		else
@@ -386,3 +661,87 @@ thread_pool_wait(struct thread_pool *pool)
 	thread_pool_unlock(pool);
 	pr_op_debug("Waiting has ended, all tasks have finished");
 }
+
+int
+thread_pool_group_create(struct thread_pool *pool,
+    struct thread_pool_group **group)
+{
+	struct thread_pool_group *tmp;
+	int error;
+
+	tmp = malloc(sizeof(struct thread_pool_group));
+	if (tmp == NULL)
+		return pr_enomem();
+
+	error = pthread_mutex_init(&(tmp->lock), NULL);
+	if (error) {
+		free(tmp);
+		return pr_op_errno(error, "Calling pthread_mutex_init()");
+	}
+
+	error = pthread_cond_init(&(tmp->done_cond), NULL);
+	if (error) {
+		pthread_mutex_destroy(&(tmp->lock));
+		free(tmp);
+		return pr_op_errno(error, "Calling pthread_cond_init()");
+	}
+
+	tmp->pool = pool;
+	tmp->pending = 0;
+
+	*group = tmp;
+	return 0;
+}
+
+/* The tasks of @group must have ended already (see thread_pool_group_wait()) */
+void
+thread_pool_group_destroy(struct thread_pool_group *group)
+{
+	pthread_cond_destroy(&(group->done_cond));
+	pthread_mutex_destroy(&(group->lock));
+	free(group);
+}
+
+/* Push a new task that belongs to @group to the group's pool. */
+int
+thread_pool_group_push(struct thread_pool_group *group,
+    enum task_priority prio, thread_pool_task_cb cb, void *arg)
+{
+	return __thread_pool_push(group->pool, group, prio, cb, arg);
+}
+
+/*
+ * Waits for all the tasks of @group to end (the rest of the pool's tasks may
+ * still be running).
+ *
+ * If the caller is a thread of the pool, it will work on pending tasks while
+ * waiting, instead of blocking (so a task can await the subtasks it pushed,
+ * even if the pool has a single thread).
+ */
+void
+thread_pool_group_wait(struct thread_pool_group *group)
+{
+	struct worker *self;
+	struct task *task;
+
+	self = current_worker(group->pool);
+
+	pthread_mutex_lock(&(group->lock));
+	while (group->pending > 0) {
+		if (self != NULL) {
+			pthread_mutex_unlock(&(group->lock));
+			if (task_claim(group->pool)) {
+				task = task_take(group->pool, self);
+				if (task != NULL)
+					task_run(task);
+				pthread_mutex_lock(&(group->lock));
+				continue;
+			}
+			pthread_mutex_lock(&(group->lock));
+			if (group->pending == 0)
+				break;
+		}
+		pthread_cond_wait(&(group->done_cond), &(group->lock));
+	}
+	pthread_mutex_unlock(&(group->lock));
+}
@@ -9,10 +9,41 @@ struct thread_pool;
 int thread_pool_create(unsigned int, struct thread_pool **);
 void thread_pool_destroy(struct thread_pool *);
 
+/*
+ * Priority classes of the tasks. A pool thread always takes the highest
+ * priority task available (at its own queues or any other thread's).
+ */
+enum task_priority {
+	/* Latency sensitive work (eg. attending RTR clients) */
+	TASK_PRIORITY_HIGH,
+	/* Default priority, utilized by thread_pool_push() */
+	TASK_PRIORITY_NORMAL,
+	/* Background work (eg. validation cycles) */
+	TASK_PRIORITY_LOW,
+};
+
+#define TASK_PRIORITY_COUNT	3
+
 typedef void *(*thread_pool_task_cb)(void *);
 int thread_pool_push(struct thread_pool *, thread_pool_task_cb, void *);
+int thread_pool_push_prio(struct thread_pool *, enum task_priority,
+    thread_pool_task_cb, void *);
 
 bool thread_pool_avail_threads(struct thread_pool *);
 void thread_pool_wait(struct thread_pool *);
 
+/*
+ * Set of tasks (from the same pool) that can be awaited independently of the
+ * rest of the pool's tasks.
+ */
+struct thread_pool_group;
+
+int thread_pool_group_create(struct thread_pool *,
+    struct thread_pool_group **);
+void thread_pool_group_destroy(struct thread_pool_group *);
+
+int thread_pool_group_push(struct thread_pool_group *, enum task_priority,
+    thread_pool_task_cb, void *);
+void thread_pool_group_wait(struct thread_pool_group *);
+
 #endif /* SRC_THREAD_THREAD_POOL_H_ */
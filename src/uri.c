@@ -1,8 +1,11 @@
 #include "uri.h"
 
 #include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <strings.h>
 #include "rrdp/db/db_rrdp_uris.h"
+#include "data_structure/uthash_nonfatal.h"
 #include "common.h"
 #include "config.h"
 #include "log.h"
@@ -32,6 +35,10 @@ static char const *const PFX_HTTPS = "https://";
  * the question.
  *
  * Aside from the reference counter, instances are meant to be immutable.
+ * That's why identical URIs (same @global, mapped to the same local
+ * workspace) are interned: while one of them is alive, creating it again
+ * yields the same instance (with an extra reference), instead of a new
+ * allocation.
  */
 struct rpki_uri {
 	/**
@@ -40,6 +47,8 @@ struct rpki_uri {
 	 *
 	 * These things are IA5-encoded, which means you're not bound to get
 	 * non-ASCII characters.
+	 *
+	 * Points to @key.
 	 */
 	char *global;
 	/** Length of @global. */
@@ -68,9 +77,29 @@ struct rpki_uri {
 	/* Type, currently rysnc and https are valid */
 	enum rpki_uri_type type;
 
-	unsigned int references;
+	atomic_uint references;
+
+	/* Is the instance indexed by the intern table? */
+	bool interned;
+	UT_hash_handle hh;
+	/* Length of @key */
+	size_t key_len;
+	/*
+	 * Intern table key: @global, a NULL chara, and the RRDP workspace that
+	 * @local was mapped to (empty if none).
+	 */
+	char key[];
 };
 
+/*
+ * Live interned URIs. An entry is removed as soon as its last reference is
+ * dropped, so the table only lasts as long as the validation cycle (or
+ * whatever) that is using its URIs.
+ */
+static struct rpki_uri *intern_table;
+/* Protects @intern_table, and the references counter of its entries */
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * @character is an integer because we sometimes receive signed chars, and other
  * times we get unsigned chars.
@@ -110,12 +139,8 @@ validate_url_character(int character)
 	    : pr_val_err("URL has non-printable character code '%d'.", character);
 }
 
-/**
- * Initializes @uri->global* by cloning @str.
- * This function does not assume that @str is null-terminated.
- */
 static int
-str2global(char const *str, size_t str_len, struct rpki_uri *uri)
+validate_url_characters(char const *str, size_t str_len)
 {
 	int error;
 	size_t i;
@@ -126,70 +151,47 @@ str2global(char const *str, size_t str_len, struct rpki_uri *uri)
 			return error;
 	}
 
-	uri->global = malloc(str_len + 1);
-	if (uri->global == NULL)
-		return pr_enomem();
-	strncpy(uri->global, str, str_len);
-	uri->global[str_len] = '\0';
-	uri->global_len = str_len;
-
 	return 0;
 }
 
 /**
- * Initializes @uri->global given manifest path @mft and its referenced file
- * @ia5.
- *
- * ie. if @mft is "rsync://a/b/c.mft" and @ia5 is "d/e/f.cer", @uri->global will
- * be "rsync://a/b/d/e/f.cer".
+ * Allocates a URI whose @global is the concatenation of @pfx and @sfx (neither
+ * is assumed to be NULL-terminated), and whose key is also completed with
+ * @workspace (can be NULL).
  *
- * Assumes that @mft is a "global" URL. (ie. extracted from rpki_uri.global.)
+ * Only @global and the key are initialized.
  */
 static int
-ia5str2global(struct rpki_uri *uri, char const *mft, IA5String_t *ia5)
+uri_alloc(char const *pfx, size_t pfx_len, char const *sfx, size_t sfx_len,
+    char const *workspace, struct rpki_uri **result)
 {
-	int error;
-	size_t i;
-
-	char *joined;
-	char *slash_pos;
-	int dir_len;
-
-	/*
-	 * IA5String is a subset of ASCII. However, IA5String_t doesn't seem to
-	 * be guaranteed to be NULL-terminated.
-	 * `(char *) ia5->buf` is fair, but `strlen(ia5->buf)` is not.
-	 */
-
-	for (i = 0; i < ia5->size; i++) {
-		error = validate_url_character(ia5->buf[i]);
-		if (error)
-			return error;
-	}
+	struct rpki_uri *uri;
+	size_t workspace_len;
+	size_t key_len;
 
-	slash_pos = strrchr(mft, '/');
-	if (slash_pos == NULL) {
-		joined = malloc(ia5->size + 1);
-		if (!joined)
-			return pr_enomem();
-		strncpy(joined, (char *) ia5->buf, ia5->size);
-		joined[ia5->size] = '\0';
-		dir_len = 0;
-		goto succeed;
-	}
+	workspace_len = (workspace != NULL) ? strlen(workspace) : 0;
+	key_len = pfx_len + sfx_len + 1 + workspace_len;
 
-	dir_len = (slash_pos + 1) - mft;
-	joined = malloc(dir_len + ia5->size + 1);
-	if (!joined)
+	uri = malloc(sizeof(struct rpki_uri) + key_len + 1);
+	if (uri == NULL)
 		return pr_enomem();
 
-	strncpy(joined, mft, dir_len);
-	strncpy(joined + dir_len, (char *) ia5->buf, ia5->size);
-	joined[dir_len + ia5->size] = '\0';
+	memcpy(uri->key, pfx, pfx_len);
+	if (sfx_len > 0)
+		memcpy(uri->key + pfx_len, sfx, sfx_len);
+	uri->key[pfx_len + sfx_len] = '\0';
+	if (workspace_len > 0)
+		memcpy(uri->key + pfx_len + sfx_len + 1, workspace,
+		    workspace_len);
+	uri->key[key_len] = '\0';
+	uri->key_len = key_len;
+
+	uri->global = uri->key;
+	uri->global_len = pfx_len + sfx_len;
+	uri->local = NULL;
+	uri->interned = false;
 
-succeed:
-	uri->global = joined;
-	uri->global_len = dir_len + ia5->size;
+	*result = uri;
 	return 0;
 }
 
@@ -254,76 +256,119 @@ validate_gprefix(char const *global, size_t global_len, uint8_t flags,
 	return 0;
 }
 
-static int
-get_local_workspace(char **result)
+/*
+ * Returns the interned URI that has the same key as @uri (with a new
+ * reference), or NULL if there's none.
+ */
+static struct rpki_uri *
+intern_find(struct rpki_uri *uri)
 {
-	char const *workspace;
-	char *tmp;
+	struct rpki_uri *found;
 
-	workspace = db_rrdp_uris_workspace_get();
-	if (workspace == NULL) {
-		*result = NULL;
-		return 0;
+	pthread_mutex_lock(&intern_lock);
+	HASH_FIND(hh, intern_table, uri->key, uri->key_len, found);
+	if (found != NULL)
+		atomic_fetch_add(&found->references, 1);
+	pthread_mutex_unlock(&intern_lock);
+
+	return found;
+}
+
+/*
+ * Adds @uri to the intern table, unless someone else won the race. Returns the
+ * instance that will represent @uri from now on.
+ *
+ * If the table can't grow, @uri simply won't be interned.
+ */
+static struct rpki_uri *
+intern_add(struct rpki_uri *uri)
+{
+	struct rpki_uri *found;
+
+	pthread_mutex_lock(&intern_lock);
+	HASH_FIND(hh, intern_table, uri->key, uri->key_len, found);
+	if (found != NULL) {
+		atomic_fetch_add(&found->references, 1);
+		pthread_mutex_unlock(&intern_lock);
+		return found;
 	}
 
-	tmp = strdup(workspace);
-	if (tmp == NULL)
-		return pr_enomem();
+	errno = 0;
+	HASH_ADD_KEYPTR(hh, intern_table, uri->key, uri->key_len, uri);
+	uri->interned = (errno == 0);
+	pthread_mutex_unlock(&intern_lock);
 
-	*result = tmp;
-	return 0;
+	return uri;
 }
 
-/**
- * Initializes @uri->local by converting @uri->global.
+static void
+uri_free(struct rpki_uri *uri)
+{
+	free(uri->local);
+	free(uri);
+}
+
+/*
+ * Finishes the initialization of @uri (see uri_alloc()), and then releases it
+ * if there's an identical interned instance already. Either way, @result will
+ * be the instance to work with.
  *
- * For example, given local cache repository "/tmp/rpki" and global uri
- * "rsync://rpki.ripe.net/repo/manifest.mft", initializes @uri->local as
- * "/tmp/rpki/rpki.ripe.net/repo/manifest.mft".
+ * @uri is released on error.
  *
- * By contract, if @guri is not RSYNC nor HTTPS, this will return ENOTRSYNC.
+ * By contract, if @uri is not RSYNC nor HTTPS, this will return ENOTRSYNC.
  * This often should not be treated as an error; please handle gracefully.
  */
 static int
-g2l(char const *global, size_t global_len, uint8_t flags, char **result,
-    enum rpki_uri_type *result_type)
+uri_intern(struct rpki_uri *uri, uint8_t flags, char const *workspace,
+    struct rpki_uri **result)
 {
-	char *local;
-	char *workspace;
-	enum rpki_uri_type type;
+	struct rpki_uri *interned;
 	int error;
 
-	error = validate_gprefix(global, global_len, flags, &type);
+	error = validate_gprefix(uri->global, uri->global_len, flags,
+	    &uri->type);
 	if (error)
-		return error;
+		goto fail;
 
-	workspace = NULL;
-	if ((flags & URI_USE_RRDP_WORKSPACE) != 0) {
-		error = get_local_workspace(&workspace);
-		if (error)
-			return error;
+	interned = intern_find(uri);
+	if (interned != NULL) {
+		uri_free(uri);
+		*result = interned;
+		return 0;
 	}
 
-	error = map_uri_to_local(global,
-	    type == URI_RSYNC ? PFX_RSYNC : PFX_HTTPS,
+	/*
+	 * Map @global to the local cache repository. For example, given local
+	 * cache repository "/tmp/rpki" and global uri
+	 * "rsync://rpki.ripe.net/repo/manifest.mft", @local will be
+	 * "/tmp/rpki/rpki.ripe.net/repo/manifest.mft".
+	 */
+	error = map_uri_to_local(uri->global,
+	    uri->type == URI_RSYNC ? PFX_RSYNC : PFX_HTTPS,
 	    workspace,
-	    &local);
-	if (error) {
-		free(workspace);
-		return error;
-	}
+	    &uri->local);
+	if (error)
+		goto fail;
 
-	free(workspace);
-	*result = local;
-	(*result_type) = type;
+	atomic_init(&uri->references, 1);
+
+	interned = intern_add(uri);
+	if (interned != uri)
+		uri_free(uri);
+
+	*result = interned;
 	return 0;
+fail:
+	uri_free(uri);
+	return error;
 }
 
-static int
-autocomplete_local(struct rpki_uri *uri, uint8_t flags)
+static char const *
+get_workspace(uint8_t flags)
 {
-	return g2l(uri->global, uri->global_len, flags, &uri->local,
-	    &uri->type);
+	return ((flags & URI_USE_RRDP_WORKSPACE) != 0)
+	    ? db_rrdp_uris_workspace_get()
+	    : NULL;
 }
 
 static int
@@ -331,28 +376,19 @@ uri_create(struct rpki_uri **result, uint8_t flags, void const *guri,
     size_t guri_len)
 {
 	struct rpki_uri *uri;
+	char const *workspace;
 	int error;
 
-	uri = malloc(sizeof(struct rpki_uri));
-	if (uri == NULL)
-		return pr_enomem();
-
-	error = str2global(guri, guri_len, uri);
-	if (error) {
-		free(uri);
+	error = validate_url_characters(guri, guri_len);
+	if (error)
 		return error;
-	}
 
-	error = autocomplete_local(uri, flags);
-	if (error) {
-		free(uri->global);
-		free(uri);
+	workspace = get_workspace(flags);
+	error = uri_alloc(guri, guri_len, NULL, 0, workspace, &uri);
+	if (error)
 		return error;
-	}
 
-	uri->references = 1;
-	*result = uri;
-	return 0;
+	return uri_intern(uri, flags, workspace, result);
 }
 
 int
@@ -391,39 +427,44 @@ uri_create_mixed_str(struct rpki_uri **uri, char const *guri, size_t guri_len)
 
 /*
  * Manifests URIs are a little special in that they are relative.
+ *
+ * ie. if @mft is "rsync://a/b/c.mft" and @ia5 is "d/e/f.cer", the global URI
+ * will be "rsync://a/b/d/e/f.cer".
  */
 int
 uri_create_mft(struct rpki_uri **result, struct rpki_uri *mft, IA5String_t *ia5,
     bool use_rrdp_workspace)
 {
 	struct rpki_uri *uri;
+	char const *workspace;
+	char *slash_pos;
+	size_t dir_len;
 	uint8_t flags;
 	int error;
 
-	uri = malloc(sizeof(struct rpki_uri));
-	if (uri == NULL)
-		return pr_enomem();
-
-	error = ia5str2global(uri, mft->global, ia5);
-	if (error) {
-		free(uri);
+	/*
+	 * IA5String is a subset of ASCII. However, IA5String_t doesn't seem to
+	 * be guaranteed to be NULL-terminated.
+	 * `(char *) ia5->buf` is fair, but `strlen(ia5->buf)` is not.
+	 */
+	error = validate_url_characters((char *) ia5->buf, ia5->size);
+	if (error)
 		return error;
-	}
 
 	flags = URI_VALID_RSYNC;
 	if (use_rrdp_workspace)
 		flags |= URI_USE_RRDP_WORKSPACE;
 
-	error = autocomplete_local(uri, flags);
-	if (error) {
-		free(uri->global);
-		free(uri);
+	slash_pos = strrchr(mft->global, '/');
+	dir_len = (slash_pos != NULL) ? ((slash_pos + 1) - mft->global) : 0;
+
+	workspace = get_workspace(flags);
+	error = uri_alloc(mft->global, dir_len, (char *) ia5->buf, ia5->size,
+	    workspace, &uri);
+	if (error)
 		return error;
-	}
 
-	uri->references = 1;
-	*result = uri;
-	return 0;
+	return uri_intern(uri, flags, workspace, result);
 }
 
 /*
@@ -481,18 +522,48 @@ uri_create_ad(struct rpki_uri **uri, ACCESS_DESCRIPTION *ad, int flags)
 void
 uri_refget(struct rpki_uri *uri)
 {
-	uri->references++;
+	atomic_fetch_add(&uri->references, 1);
+}
+
+/*
+ * Drops one of @uri's references, unless it's the last one. (Interned URIs
+ * can only die while holding the table lock, so they can't be found while
+ * they're being released.)
+ */
+static bool
+refput_not_last(struct rpki_uri *uri)
+{
+	unsigned int references;
+
+	references = atomic_load(&uri->references);
+	while (references > 1)
+		if (atomic_compare_exchange_weak(&uri->references, &references,
+		    references - 1))
+			return true;
+
+	return false;
 }
 
 void
 uri_refput(struct rpki_uri *uri)
 {
-	uri->references--;
-	if (uri->references == 0) {
-		free(uri->global);
-		free(uri->local);
-		free(uri);
+	if (refput_not_last(uri))
+		return;
+
+	if (uri->interned) {
+		pthread_mutex_lock(&intern_lock);
+		/* Someone might have found it in the meantime */
+		if (atomic_fetch_sub(&uri->references, 1) != 1) {
+			pthread_mutex_unlock(&intern_lock);
+			return;
+		}
+		HASH_DEL(intern_table, uri);
+		pthread_mutex_unlock(&intern_lock);
+	} else if (atomic_fetch_sub(&uri->references, 1) != 1) {
+		return;
 	}
+
+	uri_free(uri);
 }
 
 char const *
@@ -516,7 +587,16 @@ uri_get_global_len(struct rpki_uri *uri)
 bool
 uri_equals(struct rpki_uri *u1, struct rpki_uri *u2)
 {
-	return strcmp(u1->global, u2->global) == 0;
+	if (u1 == u2)
+		return true;
+	/* Different interned instances have different keys */
+	if (u1->interned && u2->interned &&
+	    strcmp(u1->key + u1->global_len + 1,
+	    u2->key + u2->global_len + 1) == 0)
+		return false;
+
+	return u1->global_len == u2->global_len &&
+	    strcmp(u1->global, u2->global) == 0;
 }
 
 /* @ext must include the period. */
@@ -135,6 +135,21 @@ visited_uris_remove(struct visited_uris *uris, char const *uri)
 	return 0;
 }
 
+int
+visited_uris_foreach(struct visited_uris *uris, visited_uris_cb cb, void *arg)
+{
+	struct visited_elem *elem;
+	int error;
+
+	for (elem = uris->table; elem != NULL; elem = elem->hh.next) {
+		error = cb(elem->uri, arg);
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
 static int
 visited_uris_to_arr(struct visited_uris *uris, struct uris_roots *roots)
 {
@@ -1,10 +1,34 @@
 #include <check.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <sys/socket.h>
 
 #include "clients.c"
 #include "common.c"
 #include "log.c"
 #include "impersonator.c"
+#include "notify.c"
+#include "rtr/primitive_reader.c"
+
+/* Serial Notifies "sent" by notify_send_pending() */
+static unsigned int notifies_sent;
+static int notify_last_fd;
+
+int
+get_last_serial_number(serial_t *result)
+{
+	*result = 1234;
+	return 0;
+}
+
+int
+send_serial_notify_pdu(int fd, uint8_t version, serial_t start_serial)
+{
+	ck_assert_uint_eq(1234, start_serial);
+	notifies_sent++;
+	notify_last_fd = fd;
+	return 0;
+}
 
 static int
 handle_foreach(struct client *client, void *arg)
@@ -51,10 +75,10 @@ START_TEST(basic_test)
 	 */
 
 	for (i = 0; i < 4; i++) {
-		ck_assert_int_eq(0, clients_add(1, addr));
-		ck_assert_int_eq(0, clients_add(2, addr));
-		ck_assert_int_eq(0, clients_add(3, addr));
-		ck_assert_int_eq(0, clients_add(4, addr));
+		ck_assert_int_eq(0, clients_add(1, addr, -1, NULL));
+		ck_assert_int_eq(0, clients_add(2, addr, -1, NULL));
+		ck_assert_int_eq(0, clients_add(3, addr, -1, NULL));
+		ck_assert_int_eq(0, clients_add(4, addr, -1, NULL));
 	}
 
 	clients_forget(3, NULL, NULL);
@@ -67,16 +91,156 @@ START_TEST(basic_test)
 }
 END_TEST
 
+static void
+notify_setup(int sockets[2], int pipe_fds[2], struct pdu_stream *stream)
+{
+	struct sockaddr_storage addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.ss_family = AF_INET;
+
+	notifies_sent = 0;
+	notify_last_fd = -1;
+
+	ck_assert_int_eq(0, clients_db_init());
+	ck_assert_int_eq(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sockets));
+	ck_assert_int_eq(0, notify_pipe_open(pipe_fds));
+	ck_assert_int_eq(0, clients_add(sockets[0], addr, pipe_fds[1], NULL));
+
+	pdu_stream_init(stream, sockets[0]);
+	pdu_stream_set_wakeup(stream, pipe_fds[0], notify_send_pending);
+}
+
+static void
+notify_teardown(int sockets[2], int pipe_fds[2])
+{
+	clients_forget(sockets[0], NULL, NULL);
+	notify_pipe_close(pipe_fds);
+	close(sockets[0]);
+	close(sockets[1]);
+	clients_db_destroy();
+}
+
+static void
+router_send(int fd, unsigned char byte)
+{
+	ck_assert_int_eq(1, write(fd, &byte, 1));
+}
+
+START_TEST(test_notify_merge)
+{
+	int sockets[2];
+	int pipe_fds[2];
+	struct pdu_stream stream;
+	unsigned char *result;
+	unsigned char byte;
+	unsigned int i;
+
+	notify_setup(sockets, pipe_fds, &stream);
+
+	/* Several cycles end while the client thread is busy */
+	for (i = 0; i < 5; i++)
+		ck_assert_int_eq(0, notify_clients());
+	ck_assert_uint_eq(0, notifies_sent);
+
+	/* The next time it waits for its router, they go out as one */
+	router_send(sockets[1], 7);
+	ck_assert_int_eq(0, pdu_stream_peek(&stream, 1, false, &result));
+	ck_assert_uint_eq(7, result[0]);
+	pdu_stream_consume(&stream, 1);
+	ck_assert_uint_eq(1, notifies_sent);
+	ck_assert_int_eq(sockets[0], notify_last_fd);
+
+	/* Drained */
+	ck_assert_int_eq(-1, read(pipe_fds[0], &byte, 1));
+	ck_assert(errno == EAGAIN || errno == EWOULDBLOCK);
+
+	/* Nothing pending; no further Serial Notifies */
+	router_send(sockets[1], 8);
+	ck_assert_int_eq(0, pdu_stream_peek(&stream, 1, false, &result));
+	ck_assert_uint_eq(8, result[0]);
+	ck_assert_uint_eq(1, notifies_sent);
+
+	notify_teardown(sockets, pipe_fds);
+}
+END_TEST
+
+START_TEST(test_notify_full_pipe)
+{
+	int sockets[2];
+	int pipe_fds[2];
+	struct pdu_stream stream;
+	unsigned char *result;
+	unsigned char byte;
+
+	notify_setup(sockets, pipe_fds, &stream);
+
+	/* Fill the pipe; notify_clients() must not block */
+	byte = 0;
+	while (write(pipe_fds[1], &byte, 1) == 1)
+		;
+	ck_assert(errno == EAGAIN || errno == EWOULDBLOCK);
+	ck_assert_int_eq(0, notify_clients());
+
+	router_send(sockets[1], 9);
+	ck_assert_int_eq(0, pdu_stream_peek(&stream, 1, false, &result));
+	ck_assert_uint_eq(9, result[0]);
+	ck_assert_uint_eq(1, notifies_sent);
+
+	notify_teardown(sockets, pipe_fds);
+}
+END_TEST
+
+static void *
+notify_later(void *arg)
+{
+	int *router_fd = arg;
+
+	usleep(100000);
+	ck_assert_int_eq(0, notify_clients());
+	usleep(100000);
+	router_send(*router_fd, 10);
+	return NULL;
+}
+
+START_TEST(test_notify_wakeup)
+{
+	int sockets[2];
+	int pipe_fds[2];
+	struct pdu_stream stream;
+	unsigned char *result;
+	pthread_t thread;
+
+	notify_setup(sockets, pipe_fds, &stream);
+
+	/* The Serial Notify is sent while the thread waits for its router */
+	ck_assert_int_eq(0, pthread_create(&thread, NULL, notify_later,
+	    &sockets[1]));
+	ck_assert_int_eq(0, pdu_stream_peek(&stream, 1, false, &result));
+	ck_assert_uint_eq(10, result[0]);
+	ck_assert_uint_eq(1, notifies_sent);
+	ck_assert_int_eq(0, pthread_join(thread, NULL));
+
+	notify_teardown(sockets, pipe_fds);
+}
+END_TEST
+
 Suite *clients_load_suite(void)
 {
 	Suite *suite;
-	TCase *core;
+	TCase *core, *notify;
 
 	core = tcase_create("Core");
 	tcase_add_test(core, basic_test);
 
+	notify = tcase_create("Notify");
+	tcase_add_test(notify, test_notify_merge);
+	tcase_add_test(notify, test_notify_full_pipe);
+	tcase_add_test(notify, test_notify_wakeup);
+
 	suite = suite_create("Clients suite");
 	suite_add_tcase(suite, core);
+	suite_add_tcase(suite, notify);
 	return suite;
 }
 
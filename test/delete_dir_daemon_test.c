@@ -0,0 +1,256 @@
+#include <check.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.c"
+#include "delete_dir_daemon.c"
+#include "impersonator.c"
+#include "internal_pool.c"
+#include "log.c"
+#include "random.c"
+#include "thread/thread_pool.c"
+
+/* Directory where the test trees are created; the CWD during the tests */
+static char sandbox[] = "/tmp/fort-delete-dir-XXXXXX";
+
+static void
+create_file(char const *path)
+{
+	FILE *file;
+
+	file = fopen(path, "w");
+	ck_assert_ptr_ne(NULL, file);
+	fprintf(file, "%s\n", path);
+	fclose(file);
+}
+
+/* Creates a tree of @depth levels, each dir containing @width subdirs. */
+static void
+create_tree(char const *path, unsigned int depth, unsigned int width,
+    unsigned int files)
+{
+	char child[PATH_MAX];
+	unsigned int i;
+
+	ck_assert_int_eq(0, mkdir(path, 0755));
+
+	for (i = 0; i < files; i++) {
+		snprintf(child, sizeof(child), "%s/f%u.roa", path, i);
+		create_file(child);
+	}
+
+	if (depth == 0)
+		return;
+	for (i = 0; i < width; i++) {
+		snprintf(child, sizeof(child), "%s/d%u", path, i);
+		create_tree(child, depth - 1, width, files);
+	}
+}
+
+/* Counts everything below @path, without following symbolic links. */
+static unsigned int
+count_entries(char const *path)
+{
+	DIR *dir;
+	struct dirent *entry;
+	struct stat attr;
+	char child[PATH_MAX];
+	unsigned int count;
+
+	dir = opendir(path);
+	ck_assert_ptr_ne(NULL, dir);
+
+	count = 0;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 ||
+		    strcmp(entry->d_name, "..") == 0)
+			continue;
+
+		snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+		ck_assert_int_eq(0, lstat(child, &attr));
+		count++;
+		if (S_ISDIR(attr.st_mode))
+			count += count_entries(child);
+	}
+
+	closedir(dir);
+	return count;
+}
+
+static void
+remove_tree(char const *path)
+{
+	DIR *dir;
+	struct dirent *entry;
+	struct stat attr;
+	char child[PATH_MAX];
+
+	dir = opendir(path);
+	if (dir == NULL)
+		return;
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 ||
+		    strcmp(entry->d_name, "..") == 0)
+			continue;
+
+		snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+		if (lstat(child, &attr) == 0 && S_ISDIR(attr.st_mode))
+			remove_tree(child);
+		else
+			unlink(child);
+	}
+
+	closedir(dir);
+	rmdir(path);
+}
+
+static void
+setup(void)
+{
+	ck_assert_ptr_ne(NULL, mkdtemp(sandbox));
+	ck_assert_int_eq(0, chdir(sandbox));
+	ck_assert_int_eq(0, mkdir("repository", 0755));
+	ck_assert_int_eq(0, mkdir("repository/host", 0755));
+	ck_assert_int_eq(0, internal_pool_init());
+}
+
+static void
+teardown(void)
+{
+	internal_pool_cleanup();
+	ck_assert_int_eq(0, chdir("/"));
+	remove_tree(sandbox);
+	strcpy(sandbox + strlen(sandbox) - 6, "XXXXXX");
+}
+
+static void
+delete_and_wait(char **roots, size_t roots_len)
+{
+	ck_assert_int_eq(0, delete_dir_daemon_start(roots, roots_len, NULL));
+	/* The workers don't wait for each other; the pool drains */
+	thread_pool_wait(pool);
+}
+
+START_TEST(test_nested)
+{
+	char *roots[] = { "rsync://host/tree" };
+
+	setup();
+	create_tree("repository/host/tree", 3, 4, 3);
+	ck_assert_uint_eq(4 + 16 + 64 + 3 * (1 + 4 + 16 + 64),
+	    count_entries("repository/host/tree"));
+
+	delete_and_wait(roots, 1);
+	ck_assert_uint_eq(0, count_entries("repository/host"));
+
+	teardown();
+}
+END_TEST
+
+START_TEST(test_symlink)
+{
+	char *roots[] = { "rsync://host/tree" };
+
+	setup();
+	create_tree("outside", 1, 2, 2);
+	create_tree("repository/host/tree", 2, 2, 2);
+	ck_assert_int_eq(0, symlink("../../../../outside",
+	    "repository/host/tree/d1/link"));
+	ck_assert_int_eq(0, symlink("../../../../outside/f0.roa",
+	    "repository/host/tree/d1/d0/file-link"));
+
+	delete_and_wait(roots, 1);
+
+	/* The targets survive */
+	ck_assert_uint_eq(2 + 2 + 2 * 2, count_entries("outside"));
+	/* So do the links, and the directories that contain them */
+	ck_assert_uint_eq(5, count_entries("repository/host"));
+
+	teardown();
+}
+END_TEST
+
+START_TEST(test_concurrent)
+{
+	char *roots[] = {
+		"rsync://host/a",
+		"rsync://host/b",
+		"rsync://host/c",
+		"rsync://host/d",
+		"rsync://host/e",
+	};
+	char path[PATH_MAX];
+	unsigned int i;
+
+	setup();
+	for (i = 0; i < 5; i++) {
+		snprintf(path, sizeof(path), "repository/host/%c", 'a' + i);
+		create_tree(path, 2, 12, 4);
+	}
+
+	delete_and_wait(roots, 5);
+	ck_assert_uint_eq(0, count_entries("repository/host"));
+
+	/* Twice, so the workers run again on a pool they already used */
+	for (i = 0; i < 5; i++) {
+		snprintf(path, sizeof(path), "repository/host/%c", 'a' + i);
+		create_tree(path, 3, 5, 1);
+	}
+
+	delete_and_wait(roots, 5);
+	ck_assert_uint_eq(0, count_entries("repository/host"));
+
+	teardown();
+}
+END_TEST
+
+START_TEST(test_missing_root)
+{
+	char *roots[] = { "rsync://host/nope", "rsync://host/tree" };
+
+	setup();
+	create_tree("repository/host/tree", 1, 3, 1);
+
+	delete_and_wait(roots, 2);
+	ck_assert_uint_eq(0, count_entries("repository/host"));
+
+	teardown();
+}
+END_TEST
+
+Suite *delete_dir_daemon_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, test_nested);
+	tcase_add_test(core, test_symlink);
+	tcase_add_test(core, test_concurrent);
+	tcase_add_test(core, test_missing_root);
+
+	suite = suite_create("Delete dir daemon");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = delete_dir_daemon_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,6 +1,8 @@
 #include <arpa/inet.h>
 
 #include "config.h"
+#include "metrics.h"
+#include "profile.h"
 #include "incidence/incidence.h"
 
 /**
@@ -13,6 +15,14 @@ static char addr_buffer2[INET6_ADDRSTRLEN];
 static unsigned int http_priority = 60;
 static unsigned int rsync_priority = 50;
 
+/* The delta history limits; tests can change them (0 means no limit) */
+static unsigned int deltas_max_count = 0;
+static unsigned int deltas_max_age = 0;
+static unsigned int deltas_max_memory = 0;
+
+/* Threads that format the output files; tests can change it */
+static unsigned int output_threads = 1;
+
 char const *
 v4addr2str(struct in_addr const *addr)
 {
@@ -146,6 +156,24 @@ config_get_slurm(void)
 	return NULL;
 }
 
+unsigned int
+config_get_deltas_max_count(void)
+{
+	return deltas_max_count;
+}
+
+unsigned int
+config_get_deltas_max_age(void)
+{
+	return deltas_max_age;
+}
+
+unsigned int
+config_get_deltas_max_memory(void)
+{
+	return deltas_max_memory;
+}
+
 enum mode
 config_get_mode(void)
 {
@@ -164,6 +192,24 @@ config_get_output_bgpsec(void)
 	return NULL;
 }
 
+enum output_format
+config_get_output_format(void)
+{
+	return OFM_CSV;
+}
+
+enum output_compression
+config_get_output_compression(void)
+{
+	return OCM_NONE;
+}
+
+char const *
+config_get_output_deltas(void)
+{
+	return NULL;
+}
+
 bool
 config_get_op_log_enabled(void)
 {
@@ -313,3 +359,120 @@ config_get_thread_pool_validation_max(void)
 {
 	return 10;
 }
+
+unsigned int
+config_get_thread_pool_output_max(void)
+{
+	return output_threads;
+}
+
+void
+metrics_timer_start(struct metrics_timer *timer)
+{
+	/* Nothing to do */
+}
+
+double
+metrics_timer_elapsed(struct metrics_timer *timer)
+{
+	return 0;
+}
+
+void
+metrics_validation_run(double duration, int error)
+{
+	/* Nothing to do */
+}
+
+void
+metrics_tal_validated(char const *tal, double duration, int error)
+{
+	/* Nothing to do */
+}
+
+void
+metrics_fetch_start(struct metrics_fetch *fetch,
+    enum metrics_protocol protocol)
+{
+	/* Nothing to do */
+}
+
+void
+metrics_fetch_add_bytes(size_t bytes)
+{
+	/* Nothing to do */
+}
+
+void
+metrics_fetch_end(struct metrics_fetch *fetch, char const *repository,
+    int error)
+{
+	/* Nothing to do */
+}
+
+void
+metrics_vrps_set(unsigned int vrps, unsigned int router_keys,
+    unsigned int serial)
+{
+	/* Nothing to do */
+}
+
+void
+metrics_delta_set(unsigned int announced, unsigned int withdrawn)
+{
+	/* Nothing to do */
+}
+
+void
+metrics_state_lock_waited(bool write, double duration)
+{
+	/* Nothing to do */
+}
+
+void
+profile_cycle_start(void)
+{
+	/* Nothing to do */
+}
+
+void
+profile_cycle_end(double duration, int result)
+{
+	/* Nothing to do */
+}
+
+void
+profile_tal_start(char const *name)
+{
+	/* Nothing to do */
+}
+
+void
+profile_tal_end(double duration)
+{
+	/* Nothing to do */
+}
+
+struct profile_tal *
+profile_tal_get(void)
+{
+	return NULL;
+}
+
+void
+profile_tal_set(struct profile_tal *tal)
+{
+	/* Nothing to do */
+}
+
+void
+profile_start(enum profile_phase phase, char const *repo)
+{
+	/* Nothing to do */
+}
+
+void
+profile_end(void)
+{
+	/* Nothing to do */
+}
@@ -0,0 +1,482 @@
+#include <check.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "address.c"
+#include "common.c"
+#include "file.c"
+#include "impersonator.c"
+#include "log.c"
+#include "output_printer.c"
+#include "object/router_key.c"
+#include "rtr/db/db_table.c"
+#include "rtr/db/delta.c"
+#include "thread/thread_pool.c"
+
+/* Impersonator functions */
+
+uint16_t
+get_current_session_id(uint8_t rtr_version)
+{
+	return 0xBEEF;
+}
+
+/* Test functions */
+
+static uint32_t
+get_be32(unsigned char const *buf)
+{
+	return (buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+}
+
+static void
+init_vrp4(struct vrp *vrp, uint32_t asn, uint32_t addr, uint8_t len,
+    uint8_t max)
+{
+	memset(vrp, 0, sizeof(*vrp));
+	vrp->asn = asn;
+	vrp->prefix.v4.s_addr = htonl(addr);
+	vrp->prefix_length = len;
+	vrp->max_prefix_length = max;
+	vrp->addr_fam = AF_INET;
+}
+
+static void
+check_ipv4(uint32_t addr)
+{
+	struct in_addr in;
+	char expected[INET_ADDRSTRLEN];
+	char actual[INET_ADDRSTRLEN];
+	char *end;
+
+	in.s_addr = htonl(addr);
+	ck_assert_ptr_ne(NULL, inet_ntop(AF_INET, &in, expected,
+	    sizeof(expected)));
+
+	end = put_ipv4(actual, (unsigned char const *) &in.s_addr);
+	*end = '\0';
+	ck_assert_str_eq(expected, actual);
+}
+
+static void
+check_ipv6(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+	struct in6_addr in;
+	char expected[INET6_ADDRSTRLEN];
+	char actual[INET6_ADDRSTRLEN];
+	char *end;
+
+	in6_addr_init(&in, a, b, c, d);
+	ck_assert_ptr_ne(NULL, inet_ntop(AF_INET6, &in, expected,
+	    sizeof(expected)));
+
+	end = put_ipv6(actual, &in);
+	*end = '\0';
+	ck_assert_str_eq(expected, actual);
+}
+
+START_TEST(test_put_ipv4)
+{
+	unsigned int i;
+
+	check_ipv4(0);
+	check_ipv4(1);
+	check_ipv4(0x0A000001u);
+	check_ipv4(0x64140300u);
+	check_ipv4(0xC0000200u);
+	check_ipv4(0x7FFFFFFFu);
+	check_ipv4(0xFFFFFFFFu);
+
+	srandom(4);
+	for (i = 0; i < 10000; i++)
+		check_ipv4(random() ^ (random() << 16));
+}
+END_TEST
+
+/* Random word, zero half of the time so the zero runs vary */
+static uint32_t
+random_words(void)
+{
+	uint32_t hi, lo;
+
+	hi = (random() & 1) ? (random() & 0xFFFF) : 0;
+	lo = (random() & 1) ? (random() & 0xFFFF) : 0;
+	return (hi << 16) | lo;
+}
+
+START_TEST(test_put_ipv6)
+{
+	unsigned int i;
+
+	/* Unspecified and loopback */
+	check_ipv6(0, 0, 0, 0);
+	check_ipv6(0, 0, 0, 1);
+	/* IPv4-mapped and IPv4-compatible */
+	check_ipv6(0, 0, 0xFFFF, 0xC0000201u);
+	check_ipv6(0, 0, 0xFFFF, 0);
+	check_ipv6(0, 0, 0, 0xC0000201u);
+	check_ipv6(0, 0, 0, 0x00010000u);
+	/* Almost IPv4-mapped */
+	check_ipv6(0, 0, 0xFFFE, 0xC0000201u);
+	check_ipv6(0, 1, 0xFFFF, 0xC0000201u);
+	/* Longest zero run ties; the first one wins */
+	check_ipv6(0x00010000u, 0x00000002u, 0, 0x00030004u);
+	check_ipv6(0x00010000u, 0x00020000u, 0x00030000u, 0x00040000u);
+	check_ipv6(0, 0x00010000u, 0, 0x00020000u);
+	/* A later run is longer */
+	check_ipv6(0x00010000u, 0x00020000u, 0, 0);
+	/* A single zero word isn't compressed */
+	check_ipv6(0x00010000u, 0x00020003u, 0x00040005u, 0x00060007u);
+	/* Leading and trailing runs */
+	check_ipv6(0, 0, 0x00010002u, 0x00030004u);
+	check_ipv6(0x20010db8u, 0, 0, 0);
+	check_ipv6(0x20010db8u, 0, 0, 1);
+	/* All ones */
+	check_ipv6(0xFFFFFFFFu, 0xFFFFFFFFu, 0xFFFFFFFFu, 0xFFFFFFFFu);
+
+	srandom(6);
+	for (i = 0; i < 100000; i++)
+		check_ipv6(random_words(), random_words(), random_words(),
+		    random_words());
+}
+END_TEST
+
+START_TEST(test_bin_header)
+{
+	unsigned char buf[BIN_HEADER_LEN + 1];
+	unsigned char expected[] = {
+		'F', 'O', 'R', 'T',
+		1, BIN_CONTENT_ROUTER_KEYS, BIN_FLAG_DELTA, 0,
+		0xBE, 0xEF, 0, 0,
+		0x01, 0x02, 0x03, 0x04,
+		0x01, 0x02, 0x03, 0x03,
+		0x00, 0x00, 0x01, 0x05,
+	};
+	time_t before, after;
+	uint64_t written;
+	char *end;
+	unsigned int i;
+
+	memset(buf, 0xAA, sizeof(buf));
+
+	before = time(NULL);
+	end = put_bin_header((char *) buf, BIN_CONTENT_ROUTER_KEYS, 0x01020304,
+	    0x01020303, 261, true);
+	after = time(NULL);
+
+	ck_assert_ptr_eq(buf + BIN_HEADER_LEN, end);
+	ck_assert_uint_eq(0xAA, buf[BIN_HEADER_LEN]);
+	for (i = 0; i < sizeof(expected); i++)
+		ck_assert_uint_eq(expected[i], buf[i]);
+
+	written = ((uint64_t) get_be32(buf + 24) << 32) | get_be32(buf + 28);
+	ck_assert(before <= written && written <= after);
+
+	/* Not a delta */
+	put_bin_header((char *) buf, BIN_CONTENT_ROAS, 7, 7, 0, false);
+	ck_assert_uint_eq(BIN_CONTENT_ROAS, buf[5]);
+	ck_assert_uint_eq(0, buf[6]);
+	ck_assert_uint_eq(7, get_be32(buf + 12));
+	ck_assert_uint_eq(7, get_be32(buf + 16));
+	ck_assert_uint_eq(0, get_be32(buf + 20));
+}
+END_TEST
+
+START_TEST(test_bin_roa)
+{
+	unsigned char buf[BIN_ROA_LEN + 1];
+	unsigned char expected4[BIN_ROA_LEN] = {
+		0x0A, 0x0B, 0x0C, 0x0D,
+		192, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		24, 32, 4, 1,
+	};
+	unsigned char expected6[BIN_ROA_LEN] = {
+		0x00, 0x00, 0xFF, 0xFF,
+		0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01,
+		128, 128, 6, 0,
+	};
+	struct vrp vrp;
+	struct delta_vrp delta;
+	char *end;
+	unsigned int i;
+
+	memset(buf, 0xAA, sizeof(buf));
+	init_vrp4(&vrp, 0x0A0B0C0D, 0xC0000200, 24, 32);
+	end = format_roa_binary((char *) buf, &vrp, true);
+	ck_assert_ptr_eq(buf + BIN_ROA_LEN, end);
+	ck_assert_uint_eq(0xAA, buf[BIN_ROA_LEN]);
+	for (i = 0; i < BIN_ROA_LEN; i++)
+		ck_assert_uint_eq(expected4[i], buf[i]);
+
+	/* Withdrawn IPv6 */
+	memset(&delta, 0, sizeof(delta));
+	delta.vrp.asn = 0xFFFF;
+	delta.vrp.addr_fam = AF_INET6;
+	in6_addr_init(&delta.vrp.prefix.v6, 0x20010db8u, 0, 0, 1);
+	delta.vrp.prefix_length = 128;
+	delta.vrp.max_prefix_length = 128;
+	delta.flags = FLAG_WITHDRAWAL;
+	end = format_delta_roa_binary((char *) buf, &delta, false);
+	ck_assert_ptr_eq(buf + BIN_ROA_LEN, end);
+	for (i = 0; i < BIN_ROA_LEN; i++)
+		ck_assert_uint_eq(expected6[i], buf[i]);
+
+	/* Announced, through the delta formatter */
+	delta.flags = FLAG_ANNOUNCEMENT;
+	format_delta_roa_binary((char *) buf, &delta, false);
+	ck_assert_uint_eq(1, buf[BIN_ROA_LEN - 1]);
+}
+END_TEST
+
+START_TEST(test_bin_router_key)
+{
+	unsigned char buf[BIN_ROUTER_KEY_LEN + 1];
+	struct router_key key;
+	struct delta_router_key delta;
+	char *end;
+	unsigned int i;
+
+	ck_assert_uint_eq(116, BIN_ROUTER_KEY_LEN);
+
+	memset(&key, 0, sizeof(key));
+	key.as = 0x01020304;
+	for (i = 0; i < RK_SKI_LEN; i++)
+		key.ski[i] = i;
+	for (i = 0; i < RK_SPKI_LEN; i++)
+		key.spk[i] = 0x80 + i;
+
+	memset(buf, 0xAA, sizeof(buf));
+	end = format_router_key_binary((char *) buf, &key, true);
+	ck_assert_ptr_eq(buf + BIN_ROUTER_KEY_LEN, end);
+	ck_assert_uint_eq(0xAA, buf[BIN_ROUTER_KEY_LEN]);
+
+	ck_assert_uint_eq(0x01020304, get_be32(buf));
+	for (i = 0; i < RK_SKI_LEN; i++)
+		ck_assert_uint_eq(i, buf[4 + i]);
+	for (i = 0; i < RK_SPKI_LEN; i++)
+		ck_assert_uint_eq(0x80 + i, buf[24 + i]);
+	ck_assert_uint_eq(1, buf[115]);
+
+	delta.router_key = key;
+	delta.flags = FLAG_WITHDRAWAL;
+	format_delta_router_key_binary((char *) buf, &delta, true);
+	ck_assert_uint_eq(0x01020304, get_be32(buf));
+	ck_assert_uint_eq(0, buf[115]);
+}
+END_TEST
+
+/* Reference JSON formatter, through the standard library */
+static int
+print_roa_json_ref(char *buf, size_t size, struct vrp const *vrp, bool first)
+{
+	char addr[INET6_ADDRSTRLEN];
+
+	ck_assert_ptr_ne(NULL, inet_ntop(vrp->addr_fam, &vrp->prefix, addr,
+	    sizeof(addr)));
+	return snprintf(buf, size,
+	    "%s\n  { \"asn\" : \"AS%u\", \"prefix\" : \"%s/%u\", \"maxLength\" : %u }",
+	    first ? "" : ",", vrp->asn, addr, vrp->prefix_length,
+	    vrp->max_prefix_length);
+}
+
+/*
+ * Prints @count ROAs through print_elems(), and compares the result with the
+ * reference formatter's.
+ */
+static void
+check_print_elems(unsigned int count, unsigned int threads)
+{
+	struct vrp *vrps;
+	struct elem_array elems;
+	struct output_file out;
+	char *expected, *actual;
+	size_t expected_len, actual_len, size;
+	unsigned int i;
+
+	vrps = calloc(count + 1, sizeof(struct vrp));
+	ck_assert_ptr_ne(NULL, vrps);
+	elems.array = calloc(count + 1, sizeof(void *));
+	ck_assert_ptr_ne(NULL, elems.array);
+	elems.len = count;
+
+	size = (size_t) count * ROA_MAX_LEN + 1;
+	expected = malloc(size);
+	ck_assert_ptr_ne(NULL, expected);
+	expected_len = 0;
+
+	for (i = 0; i < count; i++) {
+		if (i & 1) {
+			vrps[i].addr_fam = AF_INET6;
+			in6_addr_init(&vrps[i].prefix.v6, 0x20010db8u, 0, i,
+			    i & 0xFF);
+			vrps[i].prefix_length = 48 + i % 80;
+			vrps[i].max_prefix_length = 128;
+		} else {
+			init_vrp4(&vrps[i], i, i << 8, 8 + i % 24, 32);
+		}
+		vrps[i].asn = 0xFFFFFFFFu - i;
+		elems.array[i] = &vrps[i];
+		expected_len += print_roa_json_ref(expected + expected_len,
+		    size - expected_len, &vrps[i], i == 0);
+	}
+
+	output_threads = threads;
+	output_pool = NULL;
+	if (threads > 1)
+		ck_assert_int_eq(0, thread_pool_create(threads, &output_pool));
+
+	memset(&out, 0, sizeof(out));
+	out.file = tmpfile();
+	ck_assert_ptr_ne(NULL, out.file);
+
+	ck_assert_int_eq(0, print_elems(&out, &elems, format_roa_json,
+	    ROA_MAX_LEN));
+	ck_assert_int_eq(0, output_close(&out, 0));
+
+	actual_len = ftell(out.file);
+	ck_assert_uint_eq(expected_len, actual_len);
+	actual = malloc(actual_len + 1);
+	ck_assert_ptr_ne(NULL, actual);
+	rewind(out.file);
+	ck_assert_uint_eq(actual_len, fread(actual, 1, actual_len, out.file));
+	ck_assert_msg(memcmp(expected, actual, actual_len) == 0,
+	    "%u elements, %u threads", count, threads);
+
+	fclose(out.file);
+	output_printer_cleanup();
+	output_threads = 1;
+	free(actual);
+	free(expected);
+	free(elems.array);
+	free(vrps);
+}
+
+START_TEST(test_chunks_serial)
+{
+	unsigned int counts[] = {
+		0, 1, CHUNK_LEN - 1, CHUNK_LEN, CHUNK_LEN + 1,
+		2 * CHUNK_LEN - 1, 2 * CHUNK_LEN, 2 * CHUNK_LEN + 1,
+	};
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LEN(counts); i++)
+		check_print_elems(counts[i], 1);
+}
+END_TEST
+
+START_TEST(test_chunks_parallel)
+{
+	unsigned int counts[] = {
+		0, 1, CHUNK_LEN - 1, CHUNK_LEN, CHUNK_LEN + 1,
+		3 * CHUNK_LEN - 1, 3 * CHUNK_LEN, 3 * CHUNK_LEN + 1,
+		7 * CHUNK_LEN,
+	};
+	unsigned int i;
+
+	/* 7 chunks across 3 threads need three rounds, the last one partial */
+	for (i = 0; i < ARRAY_LEN(counts); i++)
+		check_print_elems(counts[i], 3);
+}
+END_TEST
+
+static void
+touch(char const *dir, char const *name)
+{
+	char path[PATH_MAX];
+	FILE *file;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	file = fopen(path, "w");
+	ck_assert_ptr_ne(NULL, file);
+	fclose(file);
+}
+
+static bool
+exists(char const *dir, char const *name)
+{
+	char path[PATH_MAX];
+	struct stat attr;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	return stat(path, &attr) == 0;
+}
+
+START_TEST(test_delta_files_clean)
+{
+	char dir[] = "/tmp/fort-deltas-XXXXXX";
+	char const *deleted[] = {
+		"0.delta", "1.delta", "4294967295.delta", "2.delta.gz",
+		"3.delta.tmp", "4.delta.gz.tmp",
+	};
+	char const *kept[] = {
+		"README", "x.delta", "5a.delta", ".delta", "6.delta.old",
+		"7.roa",
+	};
+	char path[PATH_MAX];
+	unsigned int i;
+
+	ck_assert_ptr_ne(NULL, mkdtemp(dir));
+	for (i = 0; i < ARRAY_LEN(deleted); i++)
+		touch(dir, deleted[i]);
+	for (i = 0; i < ARRAY_LEN(kept); i++)
+		touch(dir, kept[i]);
+
+	delta_files_clean(dir);
+
+	for (i = 0; i < ARRAY_LEN(deleted); i++)
+		ck_assert_msg(!exists(dir, deleted[i]), "%s", deleted[i]);
+	for (i = 0; i < ARRAY_LEN(kept); i++)
+		ck_assert_msg(exists(dir, kept[i]), "%s", kept[i]);
+
+	for (i = 0; i < ARRAY_LEN(kept); i++) {
+		snprintf(path, sizeof(path), "%s/%s", dir, kept[i]);
+		unlink(path);
+	}
+	rmdir(dir);
+}
+END_TEST
+
+Suite *output_printer_suite(void)
+{
+	Suite *suite;
+	TCase *text, *chunks, *binary, *deltas;
+
+	text = tcase_create("Text format");
+	tcase_add_test(text, test_put_ipv4);
+	tcase_add_test(text, test_put_ipv6);
+
+	chunks = tcase_create("Chunks");
+	tcase_add_test(chunks, test_chunks_serial);
+	tcase_add_test(chunks, test_chunks_parallel);
+
+	binary = tcase_create("Binary format");
+	tcase_add_test(binary, test_bin_header);
+	tcase_add_test(binary, test_bin_roa);
+	tcase_add_test(binary, test_bin_router_key);
+
+	deltas = tcase_create("Delta files");
+	tcase_add_test(deltas, test_delta_files_clean);
+
+	suite = suite_create("Output printer");
+	suite_add_tcase(suite, text);
+	suite_add_tcase(suite, chunks);
+	suite_add_tcase(suite, binary);
+	suite_add_tcase(suite, deltas);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = output_printer_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
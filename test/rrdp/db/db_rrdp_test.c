@@ -0,0 +1,515 @@
+#include <check.h>
+#include <dirent.h>
+#include <openssl/evp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.c"
+#include "file.c"
+#include "impersonator.c"
+#include "line_file.c"
+#include "log.c"
+#include "visited_uris.c"
+#include "rrdp/db/db_rrdp.c"
+/* The impersonator already has one of these */
+#define db_rrdp_uris_workspace_get db_rrdp_uris_workspace_get_unused
+#include "rrdp/db/db_rrdp_uris.c"
+#undef db_rrdp_uris_workspace_get
+
+#define NOTIF1 "https://host/notification1.xml"
+#define NOTIF2 "https://host/notification2.xml"
+#define NOTIF3 "https://host/notification3.xml"
+#define MFT1 "rsync://host/repo/ca1.mft"
+#define MFT2 "rsync://host/repo/ca2.mft"
+#define MFT3 "rsync://host/repo/ca3.mft"
+
+/* Directory where the local repository is created; the CWD during the tests */
+static char sandbox[] = "/tmp/fort-db-rrdp-XXXXXX";
+
+/* Impersonator functions */
+
+int
+hash_str(char const *algorithm, char const *str, unsigned char *result,
+    unsigned int *result_len)
+{
+	return EVP_Digest(str, strlen(str), result, result_len, EVP_sha1(),
+	    NULL) ? 0 : -EINVAL;
+}
+
+struct validation *
+state_retrieve(void)
+{
+	return NULL;
+}
+
+struct db_rrdp_uri *
+validation_get_rrdp_uris(struct validation *state)
+{
+	return NULL;
+}
+
+char const *
+validation_get_rrdp_workspace(struct validation *state)
+{
+	return NULL;
+}
+
+bool
+validation_rrdp_workspace_enabled(struct validation *state)
+{
+	return false;
+}
+
+void
+validation_set_rrdp_workspace_enabled(struct validation *state, bool enabled)
+{
+	/* Nothing here */
+}
+
+unsigned int
+working_repo_peek_level(void)
+{
+	return 0;
+}
+
+int
+delete_dir_daemon_start(char **roots, size_t roots_len, char const *workspace)
+{
+	return 0;
+}
+
+/*
+ * The manifests of these tests are text files, which list the names of their
+ * files (one per line).
+ */
+int
+manifest_find_missing(char const *path, char **missing)
+{
+	struct line_file *lfile;
+	char *line;
+	char *file;
+	size_t dir_len;
+	int error;
+
+	*missing = NULL;
+
+	error = lfile_open(path, &lfile);
+	if (error) {
+		*missing = strdup(path);
+		return 0;
+	}
+
+	dir_len = strrchr(path, '/') - path + 1;
+	do {
+		line = NULL;
+		error = lfile_read(lfile, &line);
+		if (error || line == NULL)
+			break;
+
+		file = malloc(dir_len + strlen(line) + 1);
+		ck_assert_ptr_ne(NULL, file);
+		memcpy(file, path, dir_len);
+		strcpy(file + dir_len, line);
+		free(line);
+
+		if (access(file, F_OK) != 0) {
+			*missing = file;
+			break;
+		}
+		free(file);
+	} while (true);
+
+	lfile_close(lfile);
+	return error;
+}
+
+/* Test functions */
+
+static void
+write_file(char const *path, char const *content)
+{
+	FILE *file;
+
+	file = fopen(path, "w");
+	ck_assert_ptr_ne(NULL, file);
+	ck_assert_int_ge(fputs(content, file), 0);
+	ck_assert_int_eq(0, fclose(file));
+}
+
+/* Creates the @mft of @tal at its workspace, along with its @files. */
+static void
+create_manifest(char const *tal, char const *mft, char const *files)
+{
+	char *local;
+	char path[PATH_MAX];
+	char *copy, *name, *save;
+
+	ck_assert_int_eq(0, map_uri_to_local(mft, "rsync://",
+	    db_rrdp_get_workspace(tal), &local));
+	ck_assert_int_eq(0, create_dir_recursive(local));
+	write_file(local, files);
+
+	copy = strdup(files);
+	ck_assert_ptr_ne(NULL, copy);
+	for (name = strtok_r(copy, "\n", &save); name != NULL;
+	    name = strtok_r(NULL, "\n", &save)) {
+		snprintf(path, sizeof(path), "%.*s%s",
+		    (int) (strrchr(local, '/') - local + 1), local, name);
+		write_file(path, "Nothing to see here.\n");
+	}
+
+	free(copy);
+	free(local);
+}
+
+static void
+remove_tree(char const *path)
+{
+	DIR *dir;
+	struct dirent *entry;
+	struct stat attr;
+	char child[PATH_MAX];
+
+	dir = opendir(path);
+	if (dir == NULL)
+		return;
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 ||
+		    strcmp(entry->d_name, "..") == 0)
+			continue;
+
+		snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+		if (lstat(child, &attr) == 0 && S_ISDIR(attr.st_mode))
+			remove_tree(child);
+		else
+			unlink(child);
+	}
+
+	closedir(dir);
+	rmdir(path);
+}
+
+static void
+setup(void)
+{
+	ck_assert_ptr_ne(NULL, mkdtemp(sandbox));
+	ck_assert_int_eq(0, chdir(sandbox));
+	ck_assert_int_eq(0, mkdir("repository", 0755));
+	ck_assert_int_eq(0, db_rrdp_init());
+}
+
+static void
+teardown(void)
+{
+	db_rrdp_cleanup();
+	ck_assert_int_eq(0, chdir("/"));
+	remove_tree(sandbox);
+	strcpy(sandbox + strlen(sandbox) - 6, "XXXXXX");
+}
+
+/* Forgets everything, as if Fort was restarted. */
+static void
+restart(void)
+{
+	db_rrdp_cleanup();
+	ck_assert_int_eq(0, db_rrdp_init());
+}
+
+static void
+add_notification(char const *tal, char const *uri, char *session_id,
+    unsigned long serial, long last_update, unsigned int level,
+    char const *mft1, char const *mft2)
+{
+	struct global_data data;
+	struct visited_uris *visited;
+
+	ck_assert_int_eq(0, visited_uris_create(&visited));
+	if (mft1 != NULL)
+		ck_assert_int_eq(0, visited_uris_add(visited, mft1));
+	if (mft2 != NULL)
+		ck_assert_int_eq(0, visited_uris_add(visited, mft2));
+
+	data.session_id = session_id;
+	data.serial = serial;
+	ck_assert_int_eq(0, db_rrdp_uris_add(db_rrdp_get_uris(tal), uri, &data,
+	    last_update, level, visited));
+}
+
+static int
+count_visited(char const *uri, void *arg)
+{
+	unsigned int *count = arg;
+	(*count)++;
+	return 0;
+}
+
+static struct uris_table *
+find_notification(char const *tal, char const *uri)
+{
+	struct tal_elem *elem;
+
+	elem = db_rrdp_find_tal(tal);
+	if (elem == NULL)
+		return NULL;
+	return find_rrdp_uri(elem->uris, uri);
+}
+
+static void
+check_notification(char const *tal, char const *uri, char const *session_id,
+    unsigned long serial, long last_update, unsigned int level,
+    unsigned int manifests)
+{
+	struct uris_table *notif;
+	unsigned int count;
+
+	notif = find_notification(tal, uri);
+	ck_assert_msg(notif != NULL, "%s is not at %s", uri, tal);
+	ck_assert_str_eq(session_id, notif->data.session_id);
+	ck_assert_uint_eq(serial, notif->data.serial);
+	ck_assert_int_eq(last_update, notif->last_update);
+	ck_assert_uint_eq(level, notif->level);
+	ck_assert_int_eq(RRDP_URI_REQ_UNVISITED, notif->request_status);
+
+	count = 0;
+	ck_assert_int_eq(0, visited_uris_foreach(notif->visited_uris,
+	    count_visited, &count));
+	ck_assert_uint_eq(manifests, count);
+}
+
+static unsigned int
+count_tals(void)
+{
+	struct tal_elem *elem;
+	unsigned int count;
+
+	count = 0;
+	SLIST_FOREACH(elem, &db.tals, next)
+		count++;
+	return count;
+}
+
+START_TEST(test_round_trip)
+{
+	setup();
+
+	ck_assert_int_eq(0, db_rrdp_add_tal("tal/a.tal"));
+	ck_assert_int_eq(0, db_rrdp_add_tal("tal/b.tal"));
+	create_manifest("tal/a.tal", MFT1, "a.roa\nb.roa\nc.crl\n");
+	create_manifest("tal/a.tal", MFT2, "");
+	create_manifest("tal/b.tal", MFT3, "d.roa\n");
+
+	add_notification("tal/a.tal", NOTIF1, "session-1", 10, 1000, 2, MFT1,
+	    MFT2);
+	add_notification("tal/a.tal", NOTIF2, "session-2", 4294967296ul, 2000,
+	    0, NULL, NULL);
+	add_notification("tal/b.tal", NOTIF1, "session-3", 30, 3000, 5, MFT3,
+	    NULL);
+	/* Never fetched, so not stored */
+	add_notification("tal/b.tal", NOTIF3, "", 0, 0, 0, NULL, NULL);
+	/* Would break the file */
+	add_notification("tal/b.tal", NOTIF2, "session\t4", 40, 4000, 1, NULL,
+	    NULL);
+
+	db_rrdp_store();
+	ck_assert_int_eq(0, access("repository/" STATE_FILE, F_OK));
+	ck_assert_int_ne(0, access("repository/" STATE_FILE ".tmp", F_OK));
+
+	restart();
+	db_rrdp_load();
+
+	ck_assert_uint_eq(2, count_tals());
+	check_notification("tal/a.tal", NOTIF1, "session-1", 10, 1000, 2, 2);
+	check_notification("tal/a.tal", NOTIF2, "session-2", 4294967296ul,
+	    2000, 0, 0);
+	check_notification("tal/b.tal", NOTIF1, "session-3", 30, 3000, 5, 1);
+	ck_assert_ptr_eq(NULL, find_notification("tal/b.tal", NOTIF3));
+	ck_assert_ptr_eq(NULL, find_notification("tal/b.tal", NOTIF2));
+
+	/* Storing what was loaded yields the same state */
+	db_rrdp_store();
+	restart();
+	db_rrdp_load();
+	check_notification("tal/a.tal", NOTIF1, "session-1", 10, 1000, 2, 2);
+	check_notification("tal/b.tal", NOTIF1, "session-3", 30, 3000, 5, 1);
+
+	teardown();
+}
+END_TEST
+
+START_TEST(test_no_state)
+{
+	setup();
+
+	/* First run */
+	db_rrdp_load();
+	ck_assert_uint_eq(0, count_tals());
+
+	/* Not a state file */
+	write_file("repository/" STATE_FILE, "T\ttal/a.tal\n");
+	db_rrdp_load();
+	ck_assert_uint_eq(0, count_tals());
+
+	write_file("repository/" STATE_FILE, "");
+	db_rrdp_load();
+	ck_assert_uint_eq(0, count_tals());
+
+	teardown();
+}
+END_TEST
+
+static void
+write_state(char const *records)
+{
+	char content[1024];
+
+	snprintf(content, sizeof(content), "%s\n%s", STATE_HEADER, records);
+	write_file("repository/" STATE_FILE, content);
+}
+
+/* Loads a state file whose records are @valid, followed by @garbage. */
+static void
+load_garbled(char const *valid, char const *garbage)
+{
+	char records[1024];
+
+	snprintf(records, sizeof(records), "%s%s", valid, garbage);
+	write_state(records);
+
+	db_rrdp_load();
+	ck_assert_msg(count_tals() == 0, "The state was loaded despite '%s'",
+	    garbage);
+	restart();
+}
+
+START_TEST(test_garbled)
+{
+	char const *valid =
+	    "T\ttal/a.tal\n"
+	    "N\t" NOTIF1 "\tsession-1\t10\t1000\t2\n"
+	    "M\t" MFT1 "\n"
+	    "T\ttal/b.tal\n"
+	    "N\t" NOTIF2 "\tsession-2\t20\t2000\t0\n";
+
+	setup();
+	ck_assert_int_eq(0, db_rrdp_add_tal("tal/a.tal"));
+	create_manifest("tal/a.tal", MFT1, "a.roa\n");
+	restart();
+
+	/* The valid records alone are loaded */
+	write_state(valid);
+	db_rrdp_load();
+	ck_assert_uint_eq(2, count_tals());
+	check_notification("tal/a.tal", NOTIF1, "session-1", 10, 1000, 2, 1);
+	check_notification("tal/b.tal", NOTIF2, "session-2", 20, 2000, 0, 0);
+	restart();
+
+	/* Truncated records */
+	load_garbled(valid, "T\n");
+	load_garbled(valid, "N\t" NOTIF3 "\tsession-3\t30\t3000\n");
+	load_garbled(valid, "N\t" NOTIF3 "\tsession-3\t30\t3000\t");
+	load_garbled(valid, "N\t" NOTIF3 "\n");
+	load_garbled(valid, "M\n");
+	/* Garbled records */
+	load_garbled(valid, "N\t" NOTIF3 "\tsession-3\t3x\t3000\t1\n");
+	load_garbled(valid, "N\t" NOTIF3 "\tsession-3\t30\t\t1\n");
+	load_garbled(valid, "N\t" NOTIF3 "\tsession-3\t-30\t3000\t1\n");
+	load_garbled(valid, "N\t" NOTIF3 "\tsession-3\t30\t3000\t-1\n");
+	load_garbled(valid, "N\t" NOTIF3 "\tsession-3\t30\t3000\t 1\n");
+	load_garbled(valid, "N\t" NOTIF3 "\tsession-3\t30\t3000\t4294967296\n");
+	load_garbled(valid, "N\t" NOTIF3 "\t\t30\t3000\t1\n");
+	load_garbled(valid, "N\t" NOTIF3 "\tsession-3\t30\t3000\t1\t7\n");
+	load_garbled(valid, "M\thttps://host/repo/ca1.mft\n");
+	load_garbled(valid, "M\t" MFT1 "\tjunk\n");
+	load_garbled(valid, "X\tjunk\n");
+	load_garbled(valid, "\n");
+	/* Records out of place */
+	load_garbled("", "N\t" NOTIF1 "\tsession-1\t10\t1000\t2\n");
+	load_garbled("T\ttal/c.tal\n", "M\t" MFT1 "\n");
+	/* The garbage is in the middle */
+	load_garbled("T\ttal/c.tal\nX\n", valid);
+
+	teardown();
+}
+END_TEST
+
+START_TEST(test_missing_files)
+{
+	char const *records =
+	    "T\ttal/a.tal\n"
+	    "N\t" NOTIF1 "\tsession-1\t10\t1000\t2\n"
+	    "M\t" MFT1 "\n"
+	    "N\t" NOTIF2 "\tsession-2\t20\t2000\t2\n"
+	    "M\t" MFT1 "\n"
+	    "M\t" MFT2 "\n"
+	    /* This manifest is not at the workspace */
+	    "N\t" NOTIF3 "\tsession-3\t30\t3000\t2\n"
+	    "M\t" MFT3 "\n"
+	    "M\t" MFT1 "\n";
+	char *local;
+
+	setup();
+	ck_assert_int_eq(0, db_rrdp_add_tal("tal/a.tal"));
+	create_manifest("tal/a.tal", MFT1, "a.roa\nb.roa\n");
+	create_manifest("tal/a.tal", MFT2, "c.roa\nd.roa\n");
+	ck_assert_int_eq(0, map_uri_to_local("rsync://host/repo/d.roa",
+	    "rsync://", db_rrdp_get_workspace("tal/a.tal"), &local));
+	restart();
+
+	write_state(records);
+	db_rrdp_load();
+	check_notification("tal/a.tal", NOTIF1, "session-1", 10, 1000, 2, 1);
+	check_notification("tal/a.tal", NOTIF2, "session-2", 20, 2000, 2, 2);
+	ck_assert_ptr_eq(NULL, find_notification("tal/a.tal", NOTIF3));
+	restart();
+
+	/* A file listed by the second manifest is gone */
+	ck_assert_int_eq(0, unlink(local));
+	free(local);
+
+	db_rrdp_load();
+	check_notification("tal/a.tal", NOTIF1, "session-1", 10, 1000, 2, 1);
+	ck_assert_ptr_eq(NULL, find_notification("tal/a.tal", NOTIF2));
+	ck_assert_ptr_eq(NULL, find_notification("tal/a.tal", NOTIF3));
+
+	teardown();
+}
+END_TEST
+
+Suite *db_rrdp_suite(void)
+{
+	Suite *suite;
+	TCase *core, *errors;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, test_round_trip);
+	tcase_add_test(core, test_no_state);
+
+	errors = tcase_create("Errors");
+	tcase_add_test(errors, test_garbled);
+	tcase_add_test(errors, test_missing_files);
+
+	suite = suite_create("DB RRDP");
+	suite_add_tcase(suite, core);
+	suite_add_tcase(suite, errors);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = db_rrdp_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -159,7 +159,7 @@ START_TEST(test_basic)
 	for (i = 0; i < TOTAL_ROAS; i++)
 		ck_assert_int_eq(true, roas_found[i]);
 
-	db_table_destroy(table);
+	db_table_refput(table);
 }
 END_TEST
 
@@ -242,8 +242,8 @@ START_TEST(test_merge)
 	ck_assert_int_eq(total_merged, TOTAL_ROAS);
 
 	/* Check table contents and that merged table has new memory refs */
-	db_table_destroy(left);
-	db_table_destroy(right);
+	db_table_refput(left);
+	db_table_refput(right);
 
 	memset(roas_found, 0, sizeof(roas_found));
 	total_found = 0;
@@ -252,7 +252,85 @@ START_TEST(test_merge)
 	for (i = 0; i < TOTAL_ROAS; i++)
 		ck_assert_int_eq(true, roas_found[i]);
 
-	db_table_destroy(merged);
+	db_table_refput(merged);
+}
+END_TEST
+
+static int
+count_router_key(struct router_key const *key, void *arg)
+{
+	unsigned int *count = arg;
+
+	/* The test SPKIs start with the same byte as their SKIs */
+	ck_assert_uint_eq(key->ski[0], key->spk[0]);
+	(*count)++;
+	return 0;
+}
+
+static int
+count_delta_router_key(struct delta_router_key const *delta, void *arg)
+{
+	unsigned int *counts = arg;
+
+	ck_assert_uint_eq(3, delta->router_key.as);
+	counts[delta->flags == FLAG_ANNOUNCEMENT ? 0 : 1]++;
+	return 0;
+}
+
+START_TEST(test_router_keys)
+{
+	unsigned char ski1[RK_SKI_LEN] = { 1 };
+	unsigned char ski2[RK_SKI_LEN] = { 2 };
+	unsigned char spk1[RK_SPKI_LEN] = { 1 };
+	unsigned char spk2[RK_SPKI_LEN] = { 2 };
+	struct router_key key;
+	struct db_table *old, *new;
+	struct deltas *deltas;
+	unsigned int count;
+	unsigned int delta_counts[2];
+
+	old = db_table_create();
+	ck_assert_ptr_ne(NULL, old);
+	new = db_table_create();
+	ck_assert_ptr_ne(NULL, new);
+
+	/* One certificate, several ASNs: the SPKI is stored once */
+	ck_assert_int_eq(0, rtrhandler_handle_router_key(old, ski1, 1, spk1));
+	ck_assert_int_eq(0, rtrhandler_handle_router_key(old, ski1, 1, spk1));
+	ck_assert_int_eq(0, rtrhandler_handle_router_key(old, ski1, 2, spk1));
+	ck_assert_int_eq(0, rtrhandler_handle_router_key(old, ski2, 3, spk2));
+	ck_assert_uint_eq(3, db_table_router_key_count(old));
+	ck_assert_uint_eq(2, HASH_COUNT(spki_pool));
+
+	/* Tables share the pool */
+	ck_assert_int_eq(0, rtrhandler_handle_router_key(new, ski1, 1, spk1));
+	ck_assert_int_eq(0, rtrhandler_handle_router_key(new, ski1, 2, spk1));
+	ck_assert_int_eq(0, rtrhandler_handle_router_key(new, ski1, 3, spk1));
+	ck_assert_uint_eq(2, HASH_COUNT(spki_pool));
+
+	count = 0;
+	ck_assert_int_eq(0, db_table_foreach_router_key(old, count_router_key,
+	    &count));
+	ck_assert_uint_eq(3, count);
+
+	/* Only AS3 changed */
+	ck_assert_int_eq(0, compute_deltas(old, new, &deltas));
+	memset(delta_counts, 0, sizeof(delta_counts));
+	ck_assert_int_eq(0, deltas_foreach(1, deltas, NULL,
+	    count_delta_router_key, delta_counts));
+	ck_assert_uint_eq(1, delta_counts[0]);
+	ck_assert_uint_eq(1, delta_counts[1]);
+	deltas_refput(deltas);
+
+	router_key_init(&key, ski2, 3, spk2);
+	db_table_remove_router_key(old, &key);
+	ck_assert_uint_eq(2, db_table_router_key_count(old));
+	ck_assert_uint_eq(1, HASH_COUNT(spki_pool));
+
+	db_table_refput(old);
+	ck_assert_uint_eq(1, HASH_COUNT(spki_pool));
+	db_table_refput(new);
+	ck_assert_uint_eq(0, HASH_COUNT(spki_pool));
 }
 END_TEST
 
@@ -266,6 +344,7 @@ Suite *pdu_suite(void)
 
 	merge = tcase_create("Merge");
 	tcase_add_test(core, test_merge);
+	tcase_add_test(core, test_router_keys);
 
 	suite = suite_create("DB Table");
 	suite_add_tcase(suite, core);
@@ -55,13 +55,7 @@ static const bool deltas_0to2[] = { 1, 0, 1, 0, 1, 0, 0, 1, 0, 1, 0, 1, };
 static const bool deltas_1to2[] = { 1, 0, 1, 0, 1, 0, 0, 0, 0, 0, 0, 0, };
 static const bool deltas_2to2[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, };
 
-/* Deltas with rules that override each other */
-static const bool deltas_0to3_ovrd[] = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, };
-static const bool deltas_1to3_ovrd[] = { 1, 1, 1, 1, 1, 1, 1, 0, 1, 0, 1, 0, };
-static const bool deltas_2to3_ovrd[] = { 0, 1, 0, 1, 0, 1, 1, 0, 1, 0, 1, 0, };
-static const bool deltas_3to3_ovrd[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, };
-
-/* Deltas cleaned up */
+/* Deltas whose rules override each other (merged, so they cancel out) */
 static const bool deltas_0to3_clean[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, };
 static const bool deltas_1to3_clean[] = { 0, 1, 0, 1, 0, 1, 0, 0, 0, 0, 0, 0, };
 static const bool deltas_2to3_clean[] = { 0, 1, 0, 1, 0, 1, 1, 0, 1, 0, 1, 0, };
@@ -247,141 +241,75 @@ check_base(serial_t expected_serial, bool const *expected_base)
 	array_index i;
 
 	memset(actual_base, 0, sizeof(actual_base));
-	ck_assert_int_eq(0, get_last_serial_number(&actual_serial));
 	ck_assert_int_eq(0, vrps_foreach_base(vrp_check, rk_check,
-	    actual_base));
+	    actual_base, &actual_serial));
 	ck_assert_uint_eq(expected_serial, actual_serial);
 	for (i = 0; i < ARRAY_LEN(actual_base); i++)
 		ck_assert_uint_eq(expected_base[i], actual_base[i]);
 }
 
-static int
-vrp_add(struct delta_vrp const *delta, void *arg)
-{
-	struct deltas *deltas = arg;
-	struct vrp const *vrp;
-	struct v4_address v4;
-	struct v6_address v6;
-
-	vrp = &delta->vrp;
-	switch (vrp->addr_fam) {
-	case AF_INET:
-		v4.prefix.len = vrp->prefix_length;
-		v4.prefix.addr = vrp->prefix.v4;
-		v4.max_length = vrp->max_prefix_length;
-		deltas_add_roa_v4(deltas, vrp->asn, &v4, delta->flags);
-		break;
-	case AF_INET6:
-		v6.prefix.len = vrp->prefix_length;
-		v6.prefix.addr = vrp->prefix.v6;
-		v6.max_length = vrp->max_prefix_length;
-		deltas_add_roa_v6(deltas, vrp->asn, &v6, delta->flags);
-		break;
-	default:
-		ck_abort_msg("Unknown addr family");
-	}
-	return 0;
-}
-
-static int
-rk_add(struct delta_router_key const *delta, void *arg)
-{
-	struct deltas *deltas = arg;
-	struct router_key key;
-
-	key = delta->router_key;
-	deltas_add_router_key(deltas, &key, delta->flags);
-	return 0;
-}
-
 static void
-filter_deltas(struct deltas_db *db)
-{
-	struct deltas_db tmp;
-	struct delta_group group;
-	struct deltas *deltas;
-
-	group.serial = 0;
-	ck_assert_int_eq(0, deltas_create(&deltas));
-	group.deltas = deltas;
-	ck_assert_int_eq(0, vrps_foreach_filtered_delta(db, vrp_add,
-	    rk_add, group.deltas));
-	deltas_db_init(&tmp);
-	ck_assert_int_eq(0, deltas_db_add(&tmp, &group));
-
-	*db = tmp;
-}
-
-static void
-check_deltas(serial_t from, serial_t to, bool const *expected_deltas,
-    bool filter)
+check_deltas(serial_t from, serial_t to, bool const *expected_deltas)
 {
 	serial_t actual_serial;
 	bool actual_deltas[12];
-	struct deltas_db deltas;
-	struct delta_group *group;
+	struct deltas *deltas;
 	array_index i;
 
-	deltas_db_init(&deltas);
 	ck_assert_int_eq(0, vrps_get_deltas_from(from, &actual_serial,
 	    &deltas));
 	ck_assert_uint_eq(to, actual_serial);
 
-	if (filter)
-		filter_deltas(&deltas);
-
 	memset(actual_deltas, 0, sizeof(actual_deltas));
-	ARRAYLIST_FOREACH(&deltas, group, i)
-		ck_assert_int_eq(0, deltas_foreach(group->serial, group->deltas,
-		    delta_vrp_check, delta_rk_check, actual_deltas));
+	ck_assert_int_eq(0, deltas_foreach(actual_serial, deltas,
+	    delta_vrp_check, delta_rk_check, actual_deltas));
 	for (i = 0; i < ARRAY_LEN(actual_deltas); i++)
 		ck_assert_uint_eq(expected_deltas[i], actual_deltas[i]);
+
+	deltas_refput(deltas);
 }
 
 static void
 check_no_deltas(serial_t from, serial_t to)
 {
 	serial_t actual_serial;
-	struct deltas_db deltas;
+	struct deltas *deltas;
 
-	deltas_db_init(&deltas);
 	ck_assert_int_eq(-ESRCH, vrps_get_deltas_from(from, &actual_serial,
 	    &deltas));
 }
 
 static void
-create_deltas_0to1(struct deltas_db *deltas, serial_t *serial, bool *changed,
+create_deltas_0to1(struct deltas **deltas, serial_t *serial, bool *changed,
     bool *iterated_entries)
 {
 	current_min_serial = 0;
 
-	deltas_db_init(deltas);
-
 	ck_assert_int_eq(0, vrps_init());
 
 	/* First validation not yet performed: Tell routers to wait */
 	ck_assert_int_eq(-EAGAIN, get_last_serial_number(serial));
 	ck_assert_int_eq(-EAGAIN, vrps_foreach_base(vrp_fail, rk_fail,
-	    iterated_entries));
+	    iterated_entries, serial));
 	ck_assert_int_eq(-EAGAIN, vrps_get_deltas_from(0, serial, deltas));
 
 	/* First validation: One tree, no deltas */
 	ck_assert_int_eq(0, vrps_update(changed));
 	check_serial(0);
 	check_base(0, iteration0_base);
-	check_deltas(0, 0, deltas_0to0, false);
+	check_deltas(0, 0, deltas_0to0);
 
 	/* Second validation: One tree, added deltas */
 	ck_assert_int_eq(0, vrps_update(changed));
 	check_serial(1);
 	check_base(1, iteration1_base);
-	check_deltas(0, 1, deltas_0to1, false);
-	check_deltas(1, 1, deltas_1to1, false);
+	check_deltas(0, 1, deltas_0to1);
+	check_deltas(1, 1, deltas_1to1);
 }
 
 START_TEST(test_basic)
 {
-	struct deltas_db deltas;
+	struct deltas *deltas;
 	serial_t serial;
 	bool changed;
 	bool iterated_entries[12];
@@ -392,9 +320,9 @@ START_TEST(test_basic)
 	ck_assert_int_eq(0, vrps_update(&changed));
 	check_serial(2);
 	check_base(2, iteration2_base);
-	check_deltas(0, 2, deltas_0to2, false);
-	check_deltas(1, 2, deltas_1to2, false);
-	check_deltas(2, 2, deltas_2to2, false);
+	check_deltas(0, 2, deltas_0to2);
+	check_deltas(1, 2, deltas_1to2);
+	check_deltas(2, 2, deltas_2to2);
 
 	vrps_destroy();
 }
@@ -402,7 +330,7 @@ END_TEST
 
 START_TEST(test_delta_forget)
 {
-	struct deltas_db deltas;
+	struct deltas *deltas;
 	serial_t serial;
 	bool changed;
 	bool iterated_entries[12];
@@ -420,8 +348,8 @@ START_TEST(test_delta_forget)
 	check_serial(2);
 	check_base(2, iteration2_base);
 	check_no_deltas(0, 2);
-	check_deltas(1, 2, deltas_1to2, false);
-	check_deltas(2, 2, deltas_2to2, false);
+	check_deltas(1, 2, deltas_1to2);
+	check_deltas(2, 2, deltas_2to2);
 
 	vrps_destroy();
 
@@ -432,7 +360,7 @@ END_TEST
 
 START_TEST(test_delta_ovrd)
 {
-	struct deltas_db deltas;
+	struct deltas *deltas;
 	serial_t serial;
 	bool changed;
 	bool iterated_entries[12];
@@ -443,24 +371,22 @@ START_TEST(test_delta_ovrd)
 	ck_assert_int_eq(0, vrps_update(&changed));
 	check_serial(2);
 	check_base(2, iteration2_base);
-	check_deltas(0, 2, deltas_0to2, false);
-	check_deltas(1, 2, deltas_1to2, false);
-	check_deltas(2, 2, deltas_2to2, false);
+	check_deltas(0, 2, deltas_0to2);
+	check_deltas(1, 2, deltas_1to2);
+	check_deltas(2, 2, deltas_2to2);
 
 	/* Fourth validation with deltas that override each other */
 	ck_assert_int_eq(0, vrps_update(&changed));
 	check_serial(3);
 	check_base(3, iteration3_base);
-	check_deltas(0, 3, deltas_0to3_ovrd, false);
-	check_deltas(1, 3, deltas_1to3_ovrd, false);
-	check_deltas(2, 3, deltas_2to3_ovrd, false);
-	check_deltas(3, 3, deltas_3to3_ovrd, false);
+	check_deltas(0, 3, deltas_0to3_clean);
+	check_deltas(1, 3, deltas_1to3_clean);
+	check_deltas(2, 3, deltas_2to3_clean);
+	check_deltas(3, 3, deltas_3to3_clean);
 
-	/* Check "cleaned up" deltas */
-	check_deltas(0, 3, deltas_0to3_clean, true);
-	check_deltas(1, 3, deltas_1to3_clean, true);
-	check_deltas(2, 3, deltas_2to3_clean, true);
-	check_deltas(3, 3, deltas_3to3_clean, true);
+	/* Again, from the merged deltas cached by the previous queries */
+	check_deltas(0, 3, deltas_0to3_clean);
+	check_deltas(1, 3, deltas_1to3_clean);
 
 	vrps_destroy();
 
@@ -469,6 +395,110 @@ START_TEST(test_delta_ovrd)
 }
 END_TEST
 
+static void
+check_history(serial_t first, size_t len)
+{
+	ck_assert_uint_eq(first, state.deltas_first);
+	ck_assert_uint_eq(len, state.deltas.len);
+}
+
+START_TEST(test_delta_max_count)
+{
+	struct deltas *deltas;
+	serial_t serial;
+	bool changed;
+	bool iterated_entries[12];
+
+	/* Every client is still at serial 0, but only two deltas fit */
+	deltas_max_count = 2;
+
+	create_deltas_0to1(&deltas, &serial, &changed, iterated_entries);
+	check_history(0, 1);
+
+	ck_assert_int_eq(0, vrps_update(&changed));
+	check_serial(2);
+	check_history(0, 2);
+	check_deltas(0, 2, deltas_0to2);
+
+	/* The oldest delta goes */
+	ck_assert_int_eq(0, vrps_update(&changed));
+	check_serial(3);
+	check_history(1, 2);
+	check_no_deltas(0, 3);
+	check_deltas(1, 3, deltas_1to3_clean);
+	check_deltas(2, 3, deltas_2to3_clean);
+	check_deltas(3, 3, deltas_3to3_clean);
+
+	vrps_destroy();
+
+	deltas_max_count = 0;
+}
+END_TEST
+
+START_TEST(test_delta_max_age)
+{
+	struct deltas *deltas;
+	serial_t serial;
+	bool changed;
+	bool iterated_entries[12];
+
+	deltas_max_age = 60;
+
+	create_deltas_0to1(&deltas, &serial, &changed, iterated_entries);
+	ck_assert_int_eq(0, vrps_update(&changed));
+	check_serial(2);
+	check_history(0, 2);
+
+	/* Only the first delta is old enough */
+	state.deltas.array[0].created -= 2 * deltas_max_age;
+
+	ck_assert_int_eq(0, vrps_update(&changed));
+	check_serial(3);
+	check_history(1, 2);
+	check_no_deltas(0, 3);
+	check_deltas(1, 3, deltas_1to3_clean);
+	check_deltas(2, 3, deltas_2to3_clean);
+
+	vrps_destroy();
+
+	deltas_max_age = 0;
+}
+END_TEST
+
+START_TEST(test_delta_max_memory)
+{
+	struct deltas *deltas;
+	serial_t serial;
+	bool changed;
+	bool iterated_entries[12];
+
+	deltas_max_memory = 1; /* MB */
+
+	create_deltas_0to1(&deltas, &serial, &changed, iterated_entries);
+	ck_assert_int_eq(0, vrps_update(&changed));
+	check_serial(2);
+	check_history(0, 2);
+
+	/*
+	 * The test deltas are tiny; pretend the first one reserved over a MB.
+	 * (Only its accounting changes; nothing is ever added to it again.)
+	 */
+	state.deltas.array[0].deltas->v4.adds.capacity += (1 << 20)
+	    / sizeof(struct delta_v4) + 1;
+
+	ck_assert_int_eq(0, vrps_update(&changed));
+	check_serial(3);
+	check_history(1, 2);
+	check_no_deltas(0, 3);
+	check_deltas(1, 3, deltas_1to3_clean);
+	check_deltas(2, 3, deltas_2to3_clean);
+
+	vrps_destroy();
+
+	deltas_max_memory = 0;
+}
+END_TEST
+
 Suite *pdu_suite(void)
 {
 	Suite *suite;
@@ -478,6 +508,9 @@ Suite *pdu_suite(void)
 	tcase_add_test(core, test_basic);
 	tcase_add_test(core, test_delta_forget);
 	tcase_add_test(core, test_delta_ovrd);
+	tcase_add_test(core, test_delta_max_count);
+	tcase_add_test(core, test_delta_max_age);
+	tcase_add_test(core, test_delta_max_memory);
 
 	suite = suite_create("VRP Database");
 	suite_add_tcase(suite, core);
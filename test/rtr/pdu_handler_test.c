@@ -196,15 +196,11 @@ handle_delta_router_key(struct delta_router_key const *delta, void *arg)
 }
 
 int
-send_delta_pdus(int fd, uint8_t version, struct deltas_db *deltas)
+send_delta_pdus(int fd, uint8_t version, serial_t serial,
+    struct deltas *deltas)
 {
-	struct delta_group *group;
-	array_index i;
-
-	ARRAYLIST_FOREACH(deltas, group, i)
-		ck_assert_int_eq(0, deltas_foreach(group->serial, group->deltas,
-		    handle_delta, handle_delta_router_key, &fd));
-
+	ck_assert_int_eq(0, deltas_foreach(serial, deltas, handle_delta,
+	    handle_delta_router_key, &fd));
 	return 0;
 }
 
@@ -275,10 +271,10 @@ START_TEST(test_typical_exchange)
 	expected_pdu_add(PDU_TYPE_CACHE_RESPONSE);
 	expected_pdu_add(PDU_TYPE_IPV4_PREFIX);
 	expected_pdu_add(PDU_TYPE_IPV6_PREFIX);
-	expected_pdu_add(PDU_TYPE_ROUTER_KEY);
 	expected_pdu_add(PDU_TYPE_IPV4_PREFIX);
 	expected_pdu_add(PDU_TYPE_IPV6_PREFIX);
 	expected_pdu_add(PDU_TYPE_ROUTER_KEY);
+	expected_pdu_add(PDU_TYPE_ROUTER_KEY);
 	expected_pdu_add(PDU_TYPE_END_OF_DATA);
 
 	/* From serial 0: Run and validate */
@@ -343,6 +339,40 @@ START_TEST(test_no_incremental_update_available)
 }
 END_TEST
 
+/* A client whose serial was dropped from the delta history has to start over */
+START_TEST(test_serial_purged)
+{
+	struct rtr_request request;
+	struct serial_query_pdu serial_query;
+
+	pr_op_info("-- Serial Purged From The History --");
+
+	/* Prepare DB; only the delta from serial 1 to 2 is kept */
+	deltas_max_count = 1;
+	init_db_full();
+
+	/* From serial 0: Cache Reset */
+	init_serial_query(&request, &serial_query, 0);
+	expected_pdu_add(PDU_TYPE_CACHE_RESET);
+	ck_assert_int_eq(0, handle_serial_query_pdu(0, &request));
+	ck_assert_uint_eq(false, has_expected_pdus());
+
+	/* From serial 1: Still served incrementally */
+	init_serial_query(&request, &serial_query, 1);
+	expected_pdu_add(PDU_TYPE_CACHE_RESPONSE);
+	expected_pdu_add(PDU_TYPE_IPV4_PREFIX);
+	expected_pdu_add(PDU_TYPE_IPV6_PREFIX);
+	expected_pdu_add(PDU_TYPE_ROUTER_KEY);
+	expected_pdu_add(PDU_TYPE_END_OF_DATA);
+	ck_assert_int_eq(0, handle_serial_query_pdu(0, &request));
+	ck_assert_uint_eq(false, has_expected_pdus());
+
+	/* Clean up */
+	vrps_destroy();
+	deltas_max_count = 0;
+}
+END_TEST
+
 /* https://tools.ietf.org/html/rfc8210#section-8.4 */
 START_TEST(test_cache_has_no_data_available)
 {
@@ -427,6 +457,7 @@ START_TEST(test_bad_length)
 	struct rtr_request request;
 	struct serial_query_pdu client_pdu;
 	struct pdu_metadata const *meta;
+	struct pdu_stream stream;
 	unsigned char buf[BUF_SIZE];
 	int fd;
 
@@ -448,7 +479,8 @@ START_TEST(test_bad_length)
 	expected_pdu_add(PDU_TYPE_ERROR_REPORT);
 
 	/* Run and validate, before handling */
-	ck_assert_int_eq(-EINVAL, pdu_load(fd, NULL, &request, &meta));
+	pdu_stream_init(&stream, fd);
+	ck_assert_int_eq(-EINVAL, pdu_load(&stream, NULL, &request, &meta));
 	ck_assert_uint_eq(false, has_expected_pdus());
 
 	/* Clean up */
@@ -467,6 +499,7 @@ Suite *pdu_suite(void)
 	tcase_add_test(core, test_start_or_restart);
 	tcase_add_test(core, test_typical_exchange);
 	tcase_add_test(core, test_no_incremental_update_available);
+	tcase_add_test(core, test_serial_purged);
 	tcase_add_test(core, test_cache_has_no_data_available);
 
 	error = tcase_create("Unhappy path cases");
@@ -292,10 +292,56 @@ START_TEST(test_error_report_from_stream)
 	 * Not sure how to fix it without making a huge mess.
 	 */
 	error_report_destroy(pdu);
+	free(pdu);
 	free(sub_pdu);
 }
 END_TEST
 
+START_TEST(test_pipelined)
+{
+	unsigned char input[] = {
+			/* Reset Query */
+			0, 2, 0, 0, 0, 0, 0, 8,
+			/* Serial Query */
+			0, 1, 0x30, 0x39, 0, 0, 0, 12, 1, 2, 3, 4,
+			/* Serial Query */
+			0, 1, 0x30, 0x39, 0, 0, 0, 12, 5, 6, 7, 8,
+	};
+	struct pdu_metadata const *meta;
+	struct rtr_request request;
+	struct serial_query_pdu *query;
+	struct pdu_stream stream;
+	int fd;
+
+	fd = buffer2fd(input, sizeof(input));
+	ck_assert_int_ge(fd, 0);
+	pdu_stream_init(&stream, fd);
+
+	ck_assert_int_eq(pdu_load(&stream, NULL, &request, &meta), 0);
+	ck_assert_ptr_eq(meta, &reset_query_meta);
+	ck_assert_uint_eq(request.bytes_len, 8);
+	/* The rest of the PDUs were received by the same read() */
+	ck_assert_uint_eq(stream.end, sizeof(input));
+
+	ck_assert_int_eq(pdu_load(&stream, NULL, &request, &meta), 0);
+	ck_assert_ptr_eq(meta, &serial_query_meta);
+	query = request.pdu;
+	ck_assert_uint_eq(query->header.m.session_id, 12345);
+	ck_assert_uint_eq(query->serial_number, 0x01020304);
+	ck_assert_uint_eq(request.bytes_len, 12);
+	ck_assert_int_eq(memcmp(request.bytes, input + 8, 12), 0);
+
+	ck_assert_int_eq(pdu_load(&stream, NULL, &request, &meta), 0);
+	ck_assert_ptr_eq(meta, &serial_query_meta);
+	query = request.pdu;
+	ck_assert_uint_eq(query->serial_number, 0x05060708);
+
+	/* Connection closed between PDUs */
+	ck_assert_int_eq(pdu_load(&stream, NULL, &request, &meta), -EPIPE);
+	close(fd);
+}
+END_TEST
+
 START_TEST(test_interrupted)
 {
 	unsigned char input[] = { 0, 1 };
@@ -328,6 +374,7 @@ Suite *pdu_suite(void)
 	tcase_add_test(core, test_end_of_data_from_stream);
 	tcase_add_test(core, test_cache_reset_from_stream);
 	tcase_add_test(core, test_error_report_from_stream);
+	tcase_add_test(core, test_pipelined);
 
 	errors = tcase_create("Errors");
 	tcase_add_test(errors, test_interrupted);
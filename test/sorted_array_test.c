@@ -0,0 +1,212 @@
+#include <check.h>
+#include <stdlib.h>
+
+#include "log.c"
+#include "impersonator.c"
+#include "sorted_array.c"
+
+#define ADD32(sarray, min, max) ck_assert_int_eq(0, sarray32_add(sarray, min, max))
+
+START_TEST(test_add32)
+{
+	struct sarray32 *sarray;
+
+	/* Force the arrays to grow */
+	sarray = sarray32_create(1);
+	ck_assert_ptr_ne(NULL, sarray);
+	ck_assert(sarray32_empty(sarray));
+
+	ADD32(sarray, 10, 20);
+	ck_assert_int_eq(-EEQUAL, sarray32_add(sarray, 10, 20));
+	ck_assert_int_eq(-ECHILD2, sarray32_add(sarray, 12, 20));
+	ck_assert_int_eq(-EPARENT, sarray32_add(sarray, 5, 25));
+	ck_assert_int_eq(-EADJRIGHT, sarray32_add(sarray, 21, 30));
+	ck_assert_int_eq(-EADJLEFT, sarray32_add(sarray, 0, 9));
+	ck_assert_int_eq(-ELEFT, sarray32_add(sarray, 0, 8));
+	ck_assert_int_eq(-EINTERSECTION, sarray32_add(sarray, 15, 30));
+	ADD32(sarray, 22, 30);
+	ADD32(sarray, 40, 40);
+	ADD32(sarray, 50, UINT32_MAX);
+	ck_assert(!sarray32_empty(sarray));
+
+	sarray32_put(sarray);
+}
+END_TEST
+
+START_TEST(test_contains32)
+{
+	struct sarray32 *sarray;
+
+	ck_assert(!sarray32_contains(NULL, 0, 0));
+
+	sarray = sarray32_create(0);
+	ck_assert_ptr_ne(NULL, sarray);
+	ck_assert(!sarray32_contains(sarray, 0, 0));
+
+	ADD32(sarray, 0, 5);
+	ADD32(sarray, 10, 20);
+	ADD32(sarray, 22, 30);
+	ADD32(sarray, 40, 40);
+	ADD32(sarray, 50, UINT32_MAX);
+
+	ck_assert(sarray32_contains(sarray, 0, 0));
+	ck_assert(sarray32_contains(sarray, 0, 5));
+	ck_assert(!sarray32_contains(sarray, 0, 6));
+	ck_assert(!sarray32_contains(sarray, 6, 9));
+	ck_assert(sarray32_contains(sarray, 10, 20));
+	ck_assert(sarray32_contains(sarray, 15, 15));
+	ck_assert(!sarray32_contains(sarray, 15, 22));
+	ck_assert(!sarray32_contains(sarray, 21, 21));
+	ck_assert(sarray32_contains(sarray, 30, 30));
+	ck_assert(!sarray32_contains(sarray, 39, 40));
+	ck_assert(sarray32_contains(sarray, 40, 40));
+	ck_assert(!sarray32_contains(sarray, 41, 41));
+	ck_assert(sarray32_contains(sarray, 50, UINT32_MAX));
+	ck_assert(sarray32_contains(sarray, UINT32_MAX, UINT32_MAX));
+
+	sarray32_put(sarray);
+}
+END_TEST
+
+/* Compare against a linear search, for every count from 1 to 33 */
+START_TEST(test_contains32_exhaustive)
+{
+	struct sarray32 *sarray;
+	unsigned int count, i;
+	uint32_t min, max;
+	bool expected;
+
+	for (count = 1; count <= 33; count++) {
+		sarray = sarray32_create(0);
+		ck_assert_ptr_ne(NULL, sarray);
+		/* Ranges [4i + 1, 4i + 2] */
+		for (i = 0; i < count; i++)
+			ADD32(sarray, 4 * i + 1, 4 * i + 2);
+
+		for (min = 0; min < 4 * count + 4; min++) {
+			for (max = min; max < min + 3; max++) {
+				expected = (min % 4 != 0) && (min % 4 != 3)
+				    && (max / 4 == min / 4) && (max % 4 <= 2)
+				    && (min / 4 < count);
+				ck_assert_msg(expected == sarray32_contains(
+				    sarray, min, max), "%u: %u-%u", count, min,
+				    max);
+			}
+		}
+
+		sarray32_put(sarray);
+	}
+}
+END_TEST
+
+START_TEST(test_equals32)
+{
+	struct sarray32 *a, *b;
+
+	a = sarray32_create(0);
+	ck_assert_ptr_ne(NULL, a);
+	b = sarray32_create(4);
+	ck_assert_ptr_ne(NULL, b);
+
+	ck_assert(sarray32_equals(NULL, NULL));
+	ck_assert(!sarray32_equals(a, NULL));
+	ck_assert(sarray32_equals(a, b));
+
+	ADD32(a, 1, 2);
+	ADD32(a, 4, 8);
+	ADD32(b, 1, 2);
+	ck_assert(!sarray32_equals(a, b));
+	ADD32(b, 4, 9);
+	ck_assert(!sarray32_equals(a, b));
+
+	sarray32_put(b);
+	b = sarray32_create(0);
+	ck_assert_ptr_ne(NULL, b);
+	ADD32(b, 1, 2);
+	ADD32(b, 4, 8);
+	ck_assert(sarray32_equals(a, b));
+
+	sarray32_put(a);
+	sarray32_put(b);
+}
+END_TEST
+
+static struct uint128
+u128(uint64_t hi, uint64_t lo)
+{
+	struct uint128 result = { hi, lo };
+	return result;
+}
+
+#define ADD128(sarray, min, max, expected) do {				\
+		struct uint128 a = min, b = max;			\
+		ck_assert_int_eq(expected, sarray128_add(sarray, &a, &b)); \
+	} while (0)
+#define CONTAINS128(sarray, min, max, expected) do {			\
+		struct uint128 a = min, b = max;			\
+		ck_assert(expected == sarray128_contains(sarray, &a, &b)); \
+	} while (0)
+
+START_TEST(test_sarray128)
+{
+	struct sarray128 *sarray;
+
+	sarray = sarray128_create(1);
+	ck_assert_ptr_ne(NULL, sarray);
+	ck_assert(sarray128_empty(sarray));
+
+	ADD128(sarray, u128(1, 0), u128(1, UINT64_MAX), 0);
+	ADD128(sarray, u128(1, 0), u128(1, UINT64_MAX), -EEQUAL);
+	ADD128(sarray, u128(0, 5), u128(0, UINT64_MAX), -EADJLEFT);
+	ADD128(sarray, u128(2, 0), u128(2, 0), -EADJRIGHT);
+	ADD128(sarray, u128(1, 5), u128(2, 5), -EINTERSECTION);
+	ADD128(sarray, u128(2, 1), u128(2, 1), 0);
+	ADD128(sarray, u128(5, 0), u128(UINT64_MAX, UINT64_MAX), 0);
+	ck_assert(!sarray128_empty(sarray));
+	ck_assert(sarray128_equals(sarray, sarray));
+
+	CONTAINS128(sarray, u128(0, 0), u128(0, 0), false);
+	CONTAINS128(sarray, u128(1, 0), u128(1, 0), true);
+	CONTAINS128(sarray, u128(1, 7), u128(1, UINT64_MAX), true);
+	CONTAINS128(sarray, u128(1, 7), u128(2, 0), false);
+	CONTAINS128(sarray, u128(2, 1), u128(2, 1), true);
+	CONTAINS128(sarray, u128(2, 2), u128(2, 2), false);
+	CONTAINS128(sarray, u128(4, 0), u128(5, 0), false);
+	CONTAINS128(sarray, u128(9, 0), u128(UINT64_MAX, 3), true);
+
+	sarray128_put(sarray);
+}
+END_TEST
+
+Suite *sarray_load_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, test_add32);
+	tcase_add_test(core, test_contains32);
+	tcase_add_test(core, test_contains32_exhaustive);
+	tcase_add_test(core, test_equals32);
+	tcase_add_test(core, test_sarray128);
+
+	suite = suite_create("Sorted array");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = sarray_load_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,4 +1,6 @@
 #include <check.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <unistd.h>
 
@@ -61,20 +63,281 @@ START_TEST(tpool_multiple_work)
 }
 END_TEST
 
+/* A task that blocks its thread until the test releases it */
+static pthread_mutex_t gate_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+static bool gate_started;
+static bool gate_open;
+
+static void *
+gate_work(void *arg)
+{
+	pthread_mutex_lock(&gate_lock);
+	gate_started = true;
+	pthread_cond_broadcast(&gate_cond);
+	while (!gate_open)
+		pthread_cond_wait(&gate_cond, &gate_lock);
+	pthread_mutex_unlock(&gate_lock);
+	return NULL;
+}
+
+static void
+gate_close(struct thread_pool *pool)
+{
+	gate_started = false;
+	gate_open = false;
+	ck_assert_int_eq(thread_pool_push(pool, gate_work, NULL), 0);
+
+	/* Wait until a thread is blocked at the gate */
+	pthread_mutex_lock(&gate_lock);
+	while (!gate_started)
+		pthread_cond_wait(&gate_cond, &gate_lock);
+	pthread_mutex_unlock(&gate_lock);
+}
+
+static void
+gate_release(void)
+{
+	pthread_mutex_lock(&gate_lock);
+	gate_open = true;
+	pthread_cond_broadcast(&gate_cond);
+	pthread_mutex_unlock(&gate_lock);
+}
+
+/* Records the order in which the tasks were done */
+static int order[TASK_PRIORITY_COUNT];
+static unsigned int order_len;
+
+static void *
+order_work(void *arg)
+{
+	order[order_len++] = *((int *) arg);
+	return NULL;
+}
+
+START_TEST(tpool_priority)
+{
+	struct thread_pool *pool;
+	int low = TASK_PRIORITY_LOW;
+	int normal = TASK_PRIORITY_NORMAL;
+	int high = TASK_PRIORITY_HIGH;
+
+	ck_assert_int_eq(thread_pool_create(1, &pool), 0);
+	order_len = 0;
+
+	/* Queue everything while the only thread is busy */
+	gate_close(pool);
+	ck_assert_int_eq(thread_pool_push_prio(pool, TASK_PRIORITY_LOW,
+	    order_work, &low), 0);
+	ck_assert_int_eq(thread_pool_push_prio(pool, TASK_PRIORITY_NORMAL,
+	    order_work, &normal), 0);
+	ck_assert_int_eq(thread_pool_push_prio(pool, TASK_PRIORITY_HIGH,
+	    order_work, &high), 0);
+	gate_release();
+
+	thread_pool_wait(pool);
+	ck_assert_uint_eq(order_len, 3);
+	ck_assert_int_eq(order[0], TASK_PRIORITY_HIGH);
+	ck_assert_int_eq(order[1], TASK_PRIORITY_NORMAL);
+	ck_assert_int_eq(order[2], TASK_PRIORITY_LOW);
+
+	thread_pool_destroy(pool);
+}
+END_TEST
+
+#define SUBTASKS 50
+
+struct parent_arg {
+	struct thread_pool *pool;
+	int values[SUBTASKS];
+	int sum;
+};
+
+/* Pushes subtasks from inside the pool, and waits for them */
+static void *
+parent_work(void *arg)
+{
+	struct parent_arg *parent = arg;
+	struct thread_pool_group *group;
+	int i;
+
+	ck_assert_int_eq(thread_pool_group_create(parent->pool, &group), 0);
+	for (i = 0; i < SUBTASKS; i++) {
+		parent->values[i] = 0;
+		ck_assert_int_eq(thread_pool_group_push(group,
+		    TASK_PRIORITY_NORMAL, thread_work, &parent->values[i]), 0);
+	}
+	thread_pool_group_wait(group);
+	thread_pool_group_destroy(group);
+
+	parent->sum = 0;
+	for (i = 0; i < SUBTASKS; i++)
+		parent->sum += parent->values[i];
+
+	return NULL;
+}
+
+static void
+test_nested_groups(unsigned int total_threads)
+{
+	struct thread_pool *pool;
+	struct parent_arg parents[4];
+	int i;
+
+	ck_assert_int_eq(thread_pool_create(total_threads, &pool), 0);
+
+	for (i = 0; i < 4; i++) {
+		parents[i].pool = pool;
+		parents[i].sum = -1;
+		ck_assert_int_eq(thread_pool_push(pool, parent_work,
+		    &parents[i]), 0);
+	}
+	thread_pool_wait(pool);
+
+	for (i = 0; i < 4; i++)
+		ck_assert_int_eq(parents[i].sum, 2 * SUBTASKS);
+
+	thread_pool_destroy(pool);
+}
+
+START_TEST(tpool_group_nested_single)
+{
+	/* The parent has to do the subtasks while it waits */
+	test_nested_groups(1);
+}
+END_TEST
+
+START_TEST(tpool_group_nested_multiple)
+{
+	test_nested_groups(4);
+}
+END_TEST
+
+START_TEST(tpool_group_independent)
+{
+	struct thread_pool *pool;
+	struct thread_pool_group *group;
+	int values[SUBTASKS];
+	int i;
+
+	ck_assert_int_eq(thread_pool_create(2, &pool), 0);
+	ck_assert_int_eq(thread_pool_group_create(pool, &group), 0);
+
+	/* A task that isn't part of the group is blocking a thread */
+	gate_close(pool);
+
+	for (i = 0; i < SUBTASKS; i++) {
+		values[i] = 0;
+		ck_assert_int_eq(thread_pool_group_push(group,
+		    TASK_PRIORITY_NORMAL, thread_work, &values[i]), 0);
+	}
+
+	/* Shouldn't wait for the gate */
+	thread_pool_group_wait(group);
+	for (i = 0; i < SUBTASKS; i++)
+		ck_assert_int_eq(values[i], 2);
+	ck_assert(!gate_open);
+
+	gate_release();
+	thread_pool_wait(pool);
+
+	thread_pool_group_destroy(group);
+	thread_pool_destroy(pool);
+}
+END_TEST
+
+/* Opens the gate after a while, so thread_pool_destroy() has to wait for it */
+static void *
+gate_release_later(void *arg)
+{
+	usleep(100000);
+	gate_release();
+	return NULL;
+}
+
+static void *
+count_work(void *arg)
+{
+	atomic_fetch_add((atomic_uint *) arg, 1);
+	return NULL;
+}
+
+START_TEST(tpool_destroy_pending)
+{
+	struct thread_pool *pool;
+	pthread_t releaser;
+	atomic_uint count;
+	int i;
+
+	ck_assert_int_eq(thread_pool_create(1, &pool), 0);
+	atomic_init(&count, 0);
+
+	/* The queued tasks will never be done */
+	gate_close(pool);
+	for (i = 0; i < SUBTASKS; i++)
+		ck_assert_int_eq(thread_pool_push_prio(pool, TASK_PRIORITY_LOW,
+		    count_work, &count), 0);
+
+	ck_assert_int_eq(pthread_create(&releaser, NULL, gate_release_later,
+	    NULL), 0);
+	thread_pool_destroy(pool);
+	pthread_join(releaser, NULL);
+
+	ck_assert_uint_eq(atomic_load(&count), 0);
+}
+END_TEST
+
+/*
+ * Destroy pools while their threads are claiming tasks. (A thread that claimed
+ * a task drained by the destroyer must not look for it forever.)
+ */
+START_TEST(tpool_destroy_busy)
+{
+	struct thread_pool *pool;
+	atomic_uint count;
+	int round, i;
+
+	for (round = 0; round < 200; round++) {
+		ck_assert_int_eq(thread_pool_create(8, &pool), 0);
+		atomic_init(&count, 0);
+		for (i = 0; i < 200; i++)
+			ck_assert_int_eq(thread_pool_push(pool, count_work,
+			    &count), 0);
+		thread_pool_destroy(pool);
+		ck_assert(atomic_load(&count) <= 200);
+	}
+}
+END_TEST
+
 Suite *thread_pool_suite(void)
 {
 	Suite *suite;
-	TCase *single, *multiple;
+	TCase *single, *multiple, *priority, *groups, *destroy;
 
 	single = tcase_create("single_work");
-	tcase_add_test(multiple, tpool_single_work);
+	tcase_add_test(single, tpool_single_work);
 
 	multiple = tcase_create("multiple_work");
 	tcase_add_test(multiple, tpool_multiple_work);
 
+	priority = tcase_create("priority");
+	tcase_add_test(priority, tpool_priority);
+
+	groups = tcase_create("groups");
+	tcase_add_test(groups, tpool_group_nested_single);
+	tcase_add_test(groups, tpool_group_nested_multiple);
+	tcase_add_test(groups, tpool_group_independent);
+
+	destroy = tcase_create("destroy");
+	tcase_add_test(destroy, tpool_destroy_pending);
+	tcase_add_test(destroy, tpool_destroy_busy);
+
 	suite = suite_create("thread_pool_test()");
 	suite_add_tcase(suite, single);
 	suite_add_tcase(suite, multiple);
+	suite_add_tcase(suite, priority);
+	suite_add_tcase(suite, groups);
+	suite_add_tcase(suite, destroy);
 
 	return suite;
 }
@@ -0,0 +1,106 @@
+#include <check.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#include "common.c"
+#include "log.c"
+#include "impersonator.c"
+#include "uri.c"
+
+#define URI_STR(uri, str) \
+	ck_assert_int_eq(0, uri_create_rsync_str(&uri, str, strlen(str)))
+
+START_TEST(uri_interned)
+{
+	struct rpki_uri *uri1, *uri2, *uri3;
+
+	URI_STR(uri1, "rsync://a.b.c/d/e.cer");
+	URI_STR(uri2, "rsync://a.b.c/d/e.cer");
+	URI_STR(uri3, "rsync://a.b.c/d/f.cer");
+
+	ck_assert_ptr_eq(uri1, uri2);
+	ck_assert_ptr_ne(uri1, uri3);
+	ck_assert_str_eq("rsync://a.b.c/d/e.cer", uri_get_global(uri1));
+	ck_assert_str_eq("repository/a.b.c/d/e.cer", uri_get_local(uri1));
+	ck_assert_uint_eq(2, HASH_COUNT(intern_table));
+
+	ck_assert(uri_equals(uri1, uri2));
+	ck_assert(!uri_equals(uri1, uri3));
+
+	uri_refput(uri1);
+	ck_assert_uint_eq(2, HASH_COUNT(intern_table));
+	ck_assert_str_eq("repository/a.b.c/d/e.cer", uri_get_local(uri2));
+	uri_refput(uri2);
+	ck_assert_uint_eq(1, HASH_COUNT(intern_table));
+	uri_refput(uri3);
+	ck_assert_uint_eq(0, HASH_COUNT(intern_table));
+}
+END_TEST
+
+START_TEST(uri_interned_mft)
+{
+	struct rpki_uri *mft, *file, *uri;
+	IA5String_t ia5;
+
+	URI_STR(mft, "rsync://a.b.c/d/e.mft");
+	URI_STR(uri, "rsync://a.b.c/d/f.crl");
+
+	ia5.buf = (uint8_t *) "f.crl";
+	ia5.size = strlen("f.crl");
+	ck_assert_int_eq(0, uri_create_mft(&file, mft, &ia5, false));
+
+	ck_assert_ptr_eq(uri, file);
+	ck_assert_str_eq("rsync://a.b.c/d/f.crl", uri_get_global(file));
+
+	uri_refget(file);
+	uri_refput(uri);
+	uri_refput(file);
+	ck_assert_str_eq("repository/a.b.c/d/f.crl", uri_get_local(file));
+	uri_refput(file);
+	uri_refput(mft);
+	ck_assert_uint_eq(0, HASH_COUNT(intern_table));
+}
+END_TEST
+
+START_TEST(uri_invalid)
+{
+	struct rpki_uri *uri;
+
+	ck_assert_int_eq(ENOTRSYNC, uri_create_rsync_str(&uri,
+	    "https://a.b.c/d", strlen("https://a.b.c/d")));
+	ck_assert_int_eq(ENOTSUPPORTED, uri_create_mixed_str(&uri,
+	    "ftp://a.b.c/d", strlen("ftp://a.b.c/d")));
+	ck_assert_uint_eq(0, HASH_COUNT(intern_table));
+}
+END_TEST
+
+Suite *uri_load_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, uri_interned);
+	tcase_add_test(core, uri_interned_mft);
+	tcase_add_test(core, uri_invalid);
+
+	suite = suite_create("uri");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = uri_load_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}